@@ -1,3 +1,8 @@
+newoption {
+    trigger     = "null-renderer",
+    description = "Build with the null render backend, run with -headless <frames> to check the frame loop without a GPU",
+}
+
 workspace "V3"
     configurations { "Debug", "Profile", "Release" }
     platforms { "x64" }
@@ -61,21 +66,22 @@ project "V3"
     }
 
 
-    postbuildcommands
-    {
-        "{COPY} contrib/SDL2/lib/%{cfg.platform}/SDL2.dll %{cfg.targetdir}",
-        "{COPY} contrib/d3dcompiler_47.dll %{cfg.targetdir}",
-    }
+    filter "system:windows"
+        postbuildcommands
+        {
+            "{COPY} contrib/SDL2/lib/%{cfg.platform}/SDL2.dll %{cfg.targetdir}",
+            "{COPY} contrib/d3dcompiler_47.dll %{cfg.targetdir}",
+        }
 
 
     filter "configurations:Debug"
-        defines { "_DEBUG" , "TRACY_ENABLE", "NOMINMAX"}
+        defines { "_DEBUG" , "TRACY_ENABLE", "NOMINMAX", "COUNT_OPERATOR_NEW=1" }
         editandcontinue "off"
         symbols  "Full"
         optimize "Off"
 
     filter "configurations:Profile"
-        defines { "NDEBUG" , "TRACY_ENABLE", "NOMINMAX"}
+        defines { "NDEBUG" , "TRACY_ENABLE", "NOMINMAX", "COUNT_OPERATOR_NEW=1" }
         editandcontinue "off"
         runtime "Release"
         symbols  "Full"
@@ -90,5 +96,26 @@ project "V3"
         --floatingpoint "fast"
         optimize "Speed"
 
+    filter "options:null-renderer"
+        kind "ConsoleApp"
+        defines { "RENDER_BACKEND=RENDER_BACKEND_NULL" }
+        removelinks { "d3d11.lib", "dxgi.lib", "dxguid.lib" }
+        removefiles { "contrib/ImGui/backends/imgui_impl_dx11.*" }
+
+    --Only the null backend builds on Linux: "premake5 gmake2 --null-renderer" with the system SDL2
+    filter "system:linux"
+        kind "ConsoleApp"
+        defines { "RENDER_BACKEND=RENDER_BACKEND_NULL" }
+        vectorextensions "AVX2"
+        removeflags { "MultiProcessorCompile" }
+        removelinks { "SDL2main", "d3d11.lib", "dxgi.lib", "dxguid.lib" }
+        removelibdirs { "contrib/SDL2/lib/%{cfg.platform}/" }
+        removeincludedirs { "contrib/SDL2/include" }
+        removefiles { "contrib/ImGui/backends/imgui_impl_dx11.*" }
+        buildoptions { "`sdl2-config --cflags`" }
+        links { "pthread", "dl" }
+        --Raised by gb_math.h under GCC and C++20
+        disablewarnings { "attributes", "volatile" }
+
     filter("files:**.hlsl")
         flags("ExcludeFromBuild")
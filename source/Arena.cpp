@@ -0,0 +1,122 @@
+#include "Arena.h"
+#include "Debug.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+//Replaces the global operator new so the steady state can be checked for heap use.
+//premake5.lua turns it on for Debug and Profile, Release keeps the CRT allocator
+#ifndef COUNT_OPERATOR_NEW
+#define COUNT_OPERATOR_NEW 0
+#endif
+
+#if COUNT_OPERATOR_NEW == 1
+static std::atomic<u64> s_operator_new_calls = 0;
+
+void* operator new(size_t bytes)
+{
+    s_operator_new_calls.fetch_add(1, std::memory_order_relaxed);
+    if (void* result = malloc(bytes ? bytes : 1))
+        return result;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+#endif
+
+struct FrameArenaBlock {
+    u8*    base     = nullptr;
+    size_t capacity = 0;
+    size_t used     = 0;
+    size_t bytes    = 0;                //used plus the heap allocations
+    std::vector<void*> heap;            //Freed at the next reset of this block
+};
+
+static FrameArenaBlock  s_blocks[2];
+static u32              s_block_index = 0;
+static FrameArenaStats  s_stats;
+static FrameArenaStats  s_last_stats;
+
+static constexpr size_t s_min_capacity = 4 * 1024 * 1024;
+
+void ResetFrameArena()
+{
+    const FrameArenaBlock& finished = s_blocks[s_block_index];
+    s_stats.bytes = finished.bytes;
+    s_stats.capacity = finished.capacity;
+#if COUNT_OPERATOR_NEW == 1
+    s_stats.operator_new_calls = s_operator_new_calls.exchange(0, std::memory_order_relaxed);
+#endif
+    s_last_stats = s_stats;
+    s_stats = {};
+
+    //Sized for the bigger of the two last frames so neither block keeps spilling
+    s_block_index ^= 1;
+    FrameArenaBlock& block = s_blocks[s_block_index];
+    for (void* p : block.heap)
+        free(p);
+    block.heap.clear();
+    const size_t required = Max(Max(block.bytes, finished.bytes), s_min_capacity);
+    if (block.capacity < required)
+    {
+        free(block.base);
+        const size_t capacity = Max(required, block.capacity * 2);
+        block.base = reinterpret_cast<u8*>(malloc(capacity));
+        block.capacity = block.base ? capacity : 0;
+        VALIDATE(block.base);
+    }
+    block.used = 0;
+    block.bytes = 0;
+}
+
+const FrameArenaStats& GetFrameArenaStats()
+{
+    return s_last_stats;
+}
+
+void* FrameAlloc(size_t bytes, size_t alignment)
+{
+    assert(alignment && (alignment & (alignment - 1)) == 0);
+    FrameArenaBlock& block = s_blocks[s_block_index];
+    s_stats.allocations++;
+    block.bytes += bytes + alignment - 1;
+
+    const uintptr_t base = reinterpret_cast<uintptr_t>(block.base);
+    const uintptr_t aligned = (base + block.used + alignment - 1) & ~uintptr_t(alignment - 1);
+    const size_t end = size_t(aligned - base) + bytes;
+    if (block.base && end <= block.capacity)
+    {
+        block.used = end;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    s_stats.heap_allocations++;
+    void* p = malloc(bytes + alignment - 1);
+    VALIDATE_V(p, nullptr);
+    block.heap.push_back(p);
+    return reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~uintptr_t(alignment - 1));
+}
+
+const char* FrameFormat(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    va_list measure;
+    va_copy(measure, args);
+    const i32 length = vsnprintf(nullptr, 0, fmt, measure);
+    va_end(measure);
+
+    char* result = nullptr;
+    if (length >= 0)
+    {
+        result = reinterpret_cast<char*>(FrameAlloc(size_t(length) + 1, 1));
+        vsnprintf(result, size_t(length) + 1, fmt, args);
+    }
+    va_end(args);
+    return result ? result : "";
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "Math.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//************
+//Frame Arena
+//************
+
+//Linear allocator for data that only lives for a frame. There are two blocks
+//that swap in ResetFrameArena, so anything allocated this frame stays valid
+//through the next one and is dropped the frame after. An allocation that does
+//not fit goes to the heap and the blocks grow to fit the whole frame at the
+//next reset, after a few frames nothing goes to the heap anymore.
+//Main thread only.
+
+struct FrameArenaStats {
+    u64    allocations          = 0;
+    u64    heap_allocations     = 0;    //Did not fit in the block
+    size_t bytes                = 0;    //Asked for, including the heap allocations
+    size_t capacity             = 0;
+    u64    operator_new_calls   = 0;    //Of the whole program, only counted when COUNT_OPERATOR_NEW is 1
+};
+
+//Call once at the start of every frame. Frees what was allocated two frames ago
+void ResetFrameArena();
+//Stats of the last finished frame
+const FrameArenaStats& GetFrameArenaStats();
+[[nodiscard]] void* FrameAlloc(size_t bytes, size_t alignment = alignof(std::max_align_t));
+//printf into the arena, valid until the end of the next frame
+[[nodiscard]] const char* FrameFormat(const char* fmt, ...);
+
+template <typename T>
+struct FrameAllocator {
+    using value_type = T;
+
+    FrameAllocator() = default;
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>&) {}
+
+    [[nodiscard]] T* allocate(size_t count)
+    {
+        return reinterpret_cast<T*>(FrameAlloc(count * sizeof(T), alignof(T)));
+    }
+    //The memory goes back when the block is reset
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const FrameAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const FrameAllocator<U>&) const { return false; }
+};
+
+//Must be emptied before the block they were grown in is reset, two frames later
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+using FrameString = std::basic_string<char, std::char_traits<char>, FrameAllocator<char>>;
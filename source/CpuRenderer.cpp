@@ -0,0 +1,474 @@
+#include "CpuRenderer.h"
+#include "Raycast.h"
+#include "Threading.h"
+#include "Timers.h"
+#include "Debug.h"
+#include "GpuSharedData.h"
+#include "Tracy.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cfloat>
+
+const char* renderScaleNames[+RenderScale::Count] = {
+    "Full",
+    "Half",
+    "Quarter",
+    "Checkerboard",
+};
+
+TraceLayout GetTraceLayout(RenderScale render_scale, const Vec2I& screen_size, u32 frame_index)
+{
+    TraceLayout r;
+    r.screen_size = screen_size;
+    r.frame_index = frame_index;
+    switch (render_scale)
+    {
+    case RenderScale::Half:         r.scale = 2; break;
+    case RenderScale::Quarter:      r.scale = 4; break;
+    case RenderScale::Checkerboard: r.checkerboard = true; break;
+    default: break;
+    }
+    if (r.checkerboard)
+        r.trace_size = { (screen_size.x + 1) / 2, screen_size.y };
+    else
+        r.trace_size = { (screen_size.x + r.scale - 1) / r.scale, (screen_size.y + r.scale - 1) / r.scale };
+    return r;
+}
+
+Vec2 TraceToScreenPixel(const TraceLayout& layout, const Vec2I& trace_pixel)
+{
+    if (layout.checkerboard)
+        return { float(trace_pixel.x * 2 + i32((u32(trace_pixel.y) + layout.frame_index) & 1)) + 0.5f, float(trace_pixel.y) + 0.5f };
+    return { (float(trace_pixel.x) + 0.5f) * layout.scale, (float(trace_pixel.y) + 0.5f) * layout.scale };
+}
+
+Ray PixelToRay(const Vec2& pixel, const Vec2I& screen_size, const CpuCamera& camera)
+{
+    const float x = (2.0f * pixel.x) / screen_size.x - 1.0f;
+    const float y = 1.0f - (2.0f * pixel.y) / screen_size.y;
+    Vec4 ray_view = camera.view_from_projection * Vec4({ x, y, 1.0f, 1.0f });
+    ray_view = { ray_view.x, ray_view.y, -1.0f, 0.0f };
+    const Vec3 ray_world = (camera.world_from_view * ray_view).xyz;
+    Ray ray = {
+        .origin = camera.position,
+        .direction = Normalize(ray_world),
+    };
+    return ray;
+}
+
+float GetConeSpread(const Vec2I& screen_size, const CpuCamera& camera, float lod_bias)
+{
+    const Vec2 center = { float(screen_size.x) * 0.5f, float(screen_size.y) * 0.5f };
+    const Ray a = PixelToRay(center, screen_size, camera);
+    const Ray b = PixelToRay({ center.x, center.y + 1.0f }, screen_size, camera);
+    return Length(b.direction - a.direction) * lod_bias;
+}
+
+//Full resolution unless the camera asks for the LOD trace
+static RaycastResult TracePrimaryRay(const Ray& ray, float cone_spread, const CpuScene& scene)
+{
+    if (cone_spread > 0.0f && scene.mips)
+        return RayVsVoxelCone(ray, cone_spread, *scene.mips);
+    return RayVsVoxel(ray, *scene.voxels);
+}
+
+//Same as GetAmbientOcclusion in Voxel.hlsl
+static float InterpolateFaceAO(u8 ao, Face face, const Vec3& local)
+{
+    const i32 axis = +face / 2;
+    const float u = Clamp(local.e[(axis + 1) % 3], 0.0f, 1.0f);
+    const float v = Clamp(local.e[(axis + 2) % 3], 0.0f, 1.0f);
+    const float bottom  = Lerp(float((ao >> 0) & 3), float((ao >> 2) & 3), u);
+    const float top     = Lerp(float((ao >> 4) & 3), float((ao >> 6) & 3), u);
+    return Lerp(bottom, top, v);
+}
+
+//Baked lighting of a hit, matches the irradiance cache path of Voxel.hlsl.
+//Without a cache only the sun and emission are added, the indirect light is traced
+static Vec3 ShadeHit(const RaycastResult& hit, const CpuScene& scene)
+{
+    const MaterialTable& materials = scene.voxels->material_table;
+    const Vec3 albedo = GetMaterialAlbedo(materials, hit.success);
+    const LightingEnvironment& env = *scene.environment;
+
+    const Vec3I voxel = ToVec3I(Floor(hit.p - hit.normal * 0.5f));
+    const Face face = FaceFromNormal(hit.normal);
+    const i32 face_index = GetFaceIndex(*scene.faces, voxel, face);
+
+    float visibility = 1.0f;
+    float ambient_factor = 1.0f;
+    Vec3 indirect = {};
+    if (face_index >= 0)
+    {
+        if (scene.sun && face_index < i32(scene.sun->visibility.size()))
+            visibility = scene.sun->visibility[face_index];
+        if (scene.face_ao && face_index < i32(scene.face_ao->size()))
+            ambient_factor = 1.0f - InterpolateFaceAO((*scene.face_ao)[face_index], face, hit.p - ToVec3(voxel)) * (0.75f / 3.0f);
+        if (scene.irradiance && face_index < i32(scene.irradiance->irradiance.size()))
+            indirect = scene.irradiance->irradiance[face_index].rgb * ambient_factor;
+    }
+    const float n_dot_l = Max(DotProduct(Normalize(env.sun_position - hit.p), hit.normal), 0.0f);
+    const Vec3 sun = env.sun_color * Lerp(env.shadow_amount * ambient_factor, n_dot_l, visibility);
+
+    return HadamardProduct(albedo, sun + indirect) + GetMaterialEmission(materials, hit.success);
+}
+
+static void WriteFeatures(DenoiseFeatures& features, size_t i, const RaycastResult& hit, const Vec3& origin, const CpuScene& scene)
+{
+    if (!hit.success)
+    {
+        features.normal_x[i] = features.normal_y[i] = features.normal_z[i] = 0.0f;
+        features.depth[i] = 0.0f;
+        features.albedo_r[i] = features.albedo_g[i] = features.albedo_b[i] = 0.0f;
+        return;
+    }
+    const Vec3 albedo = GetMaterialAlbedo(scene.voxels->material_table, hit.success);
+    features.normal_x[i] = hit.normal.x;
+    features.normal_y[i] = hit.normal.y;
+    features.normal_z[i] = hit.normal.z;
+    features.depth[i]    = Distance(origin, hit.p);
+    features.albedo_r[i] = albedo.r;
+    features.albedo_g[i] = albedo.g;
+    features.albedo_b[i] = albedo.b;
+}
+
+//Diffuse bounce off hit, the light it brings back is scaled by the albedo
+static SecondaryRay SpawnSecondaryRay(const RaycastResult& hit, const Vec3& throughput, u32 pixel, RandomState random, const CpuScene& scene)
+{
+    SecondaryRay r;
+    r.ray.origin = hit.p + hit.normal * 0.001f;
+    r.ray.direction = SampleHemisphere(hit.normal, random);
+    r.throughput = HadamardProduct(throughput, GetMaterialAlbedo(scene.voxels->material_table, hit.success));
+    r.pixel = pixel;
+    r.random = random;
+    return r;
+}
+
+u64 CpuTrace(DenoiseImage& color, DenoiseFeatures& features, const TraceLayout& layout, const CpuCamera& camera, const CpuScene& scene,
+             std::vector<SecondaryRay>* secondary)
+{
+    ZoneScopedN("CPU Trace");
+    color.Resize(layout.trace_size);
+    features.Resize(layout.trace_size);
+    //Only needed when there is no cache to read the indirect light from
+    if (scene.irradiance)
+        secondary = nullptr;
+    if (secondary)
+    {
+        secondary->clear();
+        secondary->resize(color.r.size());
+    }
+    //A traced pixel covers scale screen pixels
+    const float cone_spread = camera.cone_spread * layout.scale;
+    std::atomic<u64> rays = 0;
+    ParallelFor(u32(layout.trace_size.y), 4, [&](u32 begin, u32 end)
+    {
+        u64 rays_local = 0;
+        for (i32 y = i32(begin); y < i32(end); y++)
+            for (i32 x = 0; x < layout.trace_size.x; x++)
+            {
+                const size_t i = size_t(y) * layout.trace_size.x + x;
+                const Ray ray = PixelToRay(TraceToScreenPixel(layout, { x, y }), layout.screen_size, camera);
+                const RaycastResult hit = TracePrimaryRay(ray, cone_spread, scene);
+                rays_local++;
+                WriteFeatures(features, i, hit, ray.origin, scene);
+                const Vec3 c = hit.success ? ShadeHit(hit, scene) : scene.background;
+                if (secondary)
+                {
+                    //Throughput of 0 marks pixels without a bounce, removed below
+                    SecondaryRay& r = (*secondary)[i];
+                    r = {};
+                    if (hit.success)
+                    {
+                        RandomState random = { .state = (u32(i) + 1) * 0x9E3779B9u ^ (layout.frame_index + 1) * 0x85EBCA6Bu };
+                        if (random.state == 0)
+                            random.state = 1;
+                        r = SpawnSecondaryRay(hit, { 1.0f, 1.0f, 1.0f }, u32(i), random, scene);
+                    }
+                }
+                color.r[i] = c.r;
+                color.g[i] = c.g;
+                color.b[i] = c.b;
+            }
+        rays += rays_local;
+    });
+    if (secondary)
+    {
+        size_t count = 0;
+        for (const SecondaryRay& r : *secondary)
+            if (r.throughput.r > 0.0f || r.throughput.g > 0.0f || r.throughput.b > 0.0f)
+                (*secondary)[count++] = r;
+        secondary->resize(count);
+    }
+    return rays;
+}
+
+//Light a secondary ray brings back to its pixel, next is set when the path continues
+static Vec3 TraceSecondaryRay(const SecondaryRay& r, const CpuScene& scene, bool continue_path, SecondaryRay& next)
+{
+    next.throughput = {};
+    const RaycastResult hit = RayVsVoxel(r.ray, *scene.voxels);
+    if (!hit.success)
+        return HadamardProduct(r.throughput, scene.environment->sky_color);
+    if (continue_path)
+        next = SpawnSecondaryRay(hit, r.throughput, r.pixel, r.random, scene);
+    return HadamardProduct(r.throughput, ShadeHit(hit, scene));
+}
+
+static void AddToPixel(DenoiseImage& color, u32 pixel, const Vec3& c)
+{
+    color.r[pixel] += c.r;
+    color.g[pixel] += c.g;
+    color.b[pixel] += c.b;
+}
+
+u32 SecondaryRayBin(const SecondaryRay& r)
+{
+    const u32 octant = (r.ray.direction.x < 0.0f ? 1 : 0) | (r.ray.direction.y < 0.0f ? 2 : 0) | (r.ray.direction.z < 0.0f ? 4 : 0);
+    const i32 last = VOXEL_MAX_SIZE / SECONDARY_BRICK_SIZE - 1;
+    const i32 bx = Clamp(i32(floorf(r.ray.origin.x)) / SECONDARY_BRICK_SIZE, 0, last);
+    const i32 by = Clamp(i32(floorf(r.ray.origin.y)) / SECONDARY_BRICK_SIZE, 0, last);
+    const i32 bz = Clamp(i32(floorf(r.ray.origin.z)) / SECONDARY_BRICK_SIZE, 0, last);
+    const u32 brick = u32((bx * (last + 1) + by) * (last + 1) + bz);
+    return (octant * SECONDARY_BRICK_COUNT) + brick;
+}
+
+void BinSecondaryRays(std::vector<SecondaryRay>& out, const std::vector<SecondaryRay>& rays)
+{
+    ZoneScopedN("Bin Secondary Rays");
+    //Counting sort, rays keep their relative order inside a bin
+    static_assert(SECONDARY_BIN_COUNT <= 0x10000);
+    std::vector<u32> offsets(SECONDARY_BIN_COUNT + 1, 0);
+    for (const SecondaryRay& r : rays)
+        offsets[SecondaryRayBin(r) + 1]++;
+    for (u32 i = 0; i < SECONDARY_BIN_COUNT; i++)
+        offsets[i + 1] += offsets[i];
+    out.resize(rays.size());
+    for (const SecondaryRay& r : rays)
+        out[offsets[SecondaryRayBin(r)]++] = r;
+}
+
+u64 CountBinChanges(const std::vector<SecondaryRay>& rays)
+{
+    u64 changes = 0;
+    for (size_t i = 1; i < rays.size(); i++)
+        changes += SecondaryRayBin(rays[i]) != SecondaryRayBin(rays[i - 1]);
+    return changes;
+}
+
+u64 TraceSecondaryPaths(DenoiseImage& color, const std::vector<SecondaryRay>& rays, const CpuScene& scene, i32 bounces)
+{
+    ZoneScopedN("CPU Trace Secondary Paths");
+    std::atomic<u64> traced = 0;
+    ParallelFor(u32(rays.size()), 256, [&](u32 begin, u32 end)
+    {
+        u64 traced_local = 0;
+        for (u32 i = begin; i < end; i++)
+        {
+            SecondaryRay r = rays[i];
+            for (i32 bounce = 0; bounce < bounces; bounce++)
+            {
+                SecondaryRay next;
+                AddToPixel(color, r.pixel, TraceSecondaryRay(r, scene, bounce + 1 < bounces, next));
+                traced_local++;
+                if (next.throughput == Vec3({}))
+                    break;
+                r = next;
+            }
+        }
+        traced += traced_local;
+    });
+    return traced;
+}
+
+u64 TraceSecondaryWavefront(DenoiseImage& color, std::vector<SecondaryRay>& rays, std::vector<SecondaryRay>& scratch,
+                            const CpuScene& scene, i32 bounces)
+{
+    ZoneScopedN("CPU Trace Secondary Wavefront");
+    u64 traced = 0;
+    for (i32 bounce = 0; bounce < bounces && rays.size(); bounce++)
+    {
+        BinSecondaryRays(scratch, rays);
+        //Every pixel has at most one ray per bounce so the writes never overlap
+        const bool continue_path = bounce + 1 < bounces;
+        rays.resize(scratch.size());
+        ParallelFor(u32(scratch.size()), 256, [&](u32 begin, u32 end)
+        {
+            for (u32 i = begin; i < end; i++)
+                AddToPixel(color, scratch[i].pixel, TraceSecondaryRay(scratch[i], scene, continue_path, rays[i]));
+        });
+        traced += scratch.size();
+
+        size_t count = 0;
+        for (const SecondaryRay& r : rays)
+            if (r.throughput != Vec3({}))
+                rays[count++] = r;
+        rays.resize(count);
+    }
+    return traced;
+}
+
+u64 CpuTraceGuide(DenoiseFeatures& guide, const Vec2I& size, const CpuCamera& camera, const CpuScene& scene)
+{
+    ZoneScopedN("CPU Trace Guide");
+    guide.Resize(size);
+    ParallelFor(u32(size.y), 4, [&](u32 begin, u32 end)
+    {
+        for (i32 y = i32(begin); y < i32(end); y++)
+            for (i32 x = 0; x < size.x; x++)
+            {
+                const Ray ray = PixelToRay({ float(x) + 0.5f, float(y) + 0.5f }, size, camera);
+                WriteFeatures(guide, size_t(y) * size.x + x, TracePrimaryRay(ray, camera.cone_spread, scene), ray.origin, scene);
+            }
+    });
+    return u64(size.x) * u64(size.y);
+}
+
+struct UpsampleCandidate {
+    Vec2I p;        //Trace pixel
+    float weight;   //Spatial weight
+};
+
+//Same weights as Upsample.hlsl
+void UpsampleTrace(DenoiseImage& out, const DenoiseImage& trace, const DenoiseFeatures& trace_features,
+                   const DenoiseFeatures& guide, const TraceLayout& layout, const Vec3& background)
+{
+    ZoneScopedN("CPU Upsample");
+    const Vec2I size = guide.size;
+    out.Resize(size);
+    ParallelFor(u32(size.y), 8, [&](u32 begin, u32 end)
+    {
+        for (i32 y = i32(begin); y < i32(end); y++)
+            for (i32 x = 0; x < size.x; x++)
+            {
+                const size_t i = size_t(y) * size.x + x;
+                const float depth = guide.depth[i];
+                Vec3 result = background;
+                if (depth > 0.0f)
+                {
+                    UpsampleCandidate candidates[4];
+                    i32 candidate_count = 0;
+                    if (layout.checkerboard)
+                    {
+                        if (u32(x & 1) == ((u32(y) + layout.frame_index) & 1))
+                            candidates[candidate_count++] = { { x >> 1, y }, 1.0f };
+                        else
+                        {
+                            const Vec2I neighbours[4] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+                            for (const Vec2I& n : neighbours)
+                                if (n.x >= 0 && n.x < size.x && n.y >= 0 && n.y < size.y)
+                                    candidates[candidate_count++] = { { n.x >> 1, n.y }, 1.0f };
+                        }
+                    }
+                    else
+                    {
+                        const float fx = (float(x) + 0.5f) / layout.scale - 0.5f;
+                        const float fy = (float(y) + 0.5f) / layout.scale - 0.5f;
+                        const i32 bx = i32(floorf(fx));
+                        const i32 by = i32(floorf(fy));
+                        const float tx = fx - bx;
+                        const float ty = fy - by;
+                        for (i32 j = 0; j < 4; j++)
+                        {
+                            const i32 ox = j & 1;
+                            const i32 oy = j >> 1;
+                            const Vec2I p = { Clamp(bx + ox, 0, layout.trace_size.x - 1), Clamp(by + oy, 0, layout.trace_size.y - 1) };
+                            candidates[candidate_count++] = { p, (ox ? tx : 1.0f - tx) * (oy ? ty : 1.0f - ty) };
+                        }
+                    }
+
+                    const Vec3 normal = { guide.normal_x[i], guide.normal_y[i], guide.normal_z[i] };
+                    Vec3 sum = {};
+                    float sum_weight = 0.0f;
+                    float closest = FLT_MAX;
+                    Vec3 closest_color = background;
+                    for (i32 j = 0; j < candidate_count; j++)
+                    {
+                        const size_t k = size_t(candidates[j].p.y) * layout.trace_size.x + candidates[j].p.x;
+                        const float sample_depth = trace_features.depth[k];
+                        if (sample_depth <= 0.0f)
+                            continue;
+                        const Vec3 sample_color = { trace.r[k], trace.g[k], trace.b[k] };
+                        const Vec3 sample_normal = { trace_features.normal_x[k], trace_features.normal_y[k], trace_features.normal_z[k] };
+                        const float depth_difference = fabsf(sample_depth - depth);
+                        const float weight = candidates[j].weight *
+                            expf(-depth_difference / (float(UPSAMPLE_DEPTH_SIGMA) * depth)) *
+                            powf(Max(DotProduct(sample_normal, normal), 0.0f), float(UPSAMPLE_NORMAL_POWER));
+                        sum += sample_color * weight;
+                        sum_weight += weight;
+                        if (depth_difference < closest)
+                        {
+                            closest = depth_difference;
+                            closest_color = sample_color;
+                        }
+                    }
+                    //Nothing similar around, the closest surface is the best guess
+                    result = sum_weight > float(UPSAMPLE_MIN_WEIGHT) ? sum / sum_weight : closest_color;
+                }
+                out.r[i] = result.r;
+                out.g[i] = result.g;
+                out.b[i] = result.b;
+            }
+    });
+}
+
+void CpuRender(CpuRenderer& renderer, const Vec2I& size, const CpuCamera& camera, const CpuScene& scene)
+{
+    ZoneScopedN("CPU Render");
+    VALIDATE(scene.voxels && scene.faces && scene.environment);
+    const float start = GetTimer();
+    const TraceLayout layout = GetTraceLayout(renderer.render_scale, size, renderer.frame_index++);
+    renderer.shading_rays = CpuTrace(renderer.trace, renderer.trace_features, layout, camera, scene,
+                                     renderer.bounces > 0 ? &renderer.secondary_rays : nullptr);
+    renderer.secondary_rays_traced = 0;
+    renderer.secondary_bin_changes = 0;
+    renderer.secondary_milliseconds = 0.0f;
+    if (renderer.secondary_rays.size() && !scene.irradiance)
+    {
+        if (renderer.bin_secondary_rays)
+        {
+            BinSecondaryRays(renderer.secondary_binned, renderer.secondary_rays);
+            renderer.secondary_bin_changes = CountBinChanges(renderer.secondary_binned);
+        }
+        else
+            renderer.secondary_bin_changes = CountBinChanges(renderer.secondary_rays);
+
+        //Binning is part of the wavefront cost, it runs again inside TraceSecondaryWavefront
+        const float secondary_start = GetTimer();
+        if (renderer.bin_secondary_rays)
+            renderer.secondary_rays_traced = TraceSecondaryWavefront(renderer.trace, renderer.secondary_rays, renderer.secondary_binned, scene, renderer.bounces);
+        else
+            renderer.secondary_rays_traced = TraceSecondaryPaths(renderer.trace, renderer.secondary_rays, scene, renderer.bounces);
+        renderer.secondary_milliseconds = GetTimer() - secondary_start;
+        renderer.shading_rays += renderer.secondary_rays_traced;
+    }
+    const bool full_resolution = layout.scale == 1 && !layout.checkerboard;
+    if (full_resolution)
+    {
+        renderer.guide_rays = 0;
+        renderer.output = renderer.trace;
+    }
+    else
+    {
+        renderer.guide_rays = CpuTraceGuide(renderer.guide, size, camera, scene);
+        UpsampleTrace(renderer.output, renderer.trace, renderer.trace_features, renderer.guide, layout, scene.background);
+    }
+    renderer.denoise_milliseconds = 0.0f;
+    if (renderer.denoise && renderer.denoise_settings.iterations > 0)
+    {
+        const float denoise_start = GetTimer();
+        Denoise(renderer.output, full_resolution ? renderer.trace_features : renderer.guide, renderer.denoise_settings);
+        renderer.denoise_milliseconds = GetTimer() - denoise_start;
+    }
+    renderer.milliseconds = GetTimer() - start;
+}
+
+float ImageDifference(const DenoiseImage& a, const DenoiseImage& b)
+{
+    VALIDATE_V(a.size == b.size && a.r.size(), 0.0f);
+    double sum = 0.0;
+    for (size_t i = 0; i < a.r.size(); i++)
+        sum += fabsf(a.r[i] - b.r[i]) + fabsf(a.g[i] - b.g[i]) + fabsf(a.b[i] - b.b[i]);
+    return float(sum / (3.0 * a.r.size()));
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "Math.h"
+#include "Vox.h"
+#include "Denoise.h"
+#include "Lighting.h"
+#include "Raycast.h"
+
+#include <vector>
+
+//************
+//CPU Renderer
+//************
+
+//Reference version of the voxel tracer. The first hit is shaded with the baked
+//lighting only (sun visibility, irradiance cache and face AO) so every frame is
+//deterministic and the reduced resolution modes can be compared against full
+//resolution. The GPU path runs the same trace layouts and upsample weights.
+
+enum class RenderScale : i32 {
+    Full,
+    Half,
+    Quarter,
+    Checkerboard,   //Every other pixel, alternating every frame
+    Count,
+};
+ENUMOPS(RenderScale);
+extern const char* renderScaleNames[+RenderScale::Count];
+
+//Which screen pixels get a traced sample
+struct TraceLayout {
+    Vec2I screen_size   = {};
+    Vec2I trace_size    = {};
+    i32   scale         = 1;        //Screen pixels per traced pixel along each axis
+    bool  checkerboard  = false;
+    u32   frame_index   = 0;        //Picks the checkerboard half that gets traced
+};
+TraceLayout GetTraceLayout(RenderScale render_scale, const Vec2I& screen_size, u32 frame_index);
+//Center of the screen pixel traced for trace_pixel, same as TraceToScreenPixel in Voxel.hlsl
+Vec2 TraceToScreenPixel(const TraceLayout& layout, const Vec2I& trace_pixel);
+
+struct CpuCamera {
+    Vec3 position;
+    Mat4 view_from_projection;
+    Mat4 world_from_view;
+    float cone_spread = 0.0f;   //Screen pixel footprint per unit of distance for the LOD trace, 0 traces full resolution
+};
+
+struct CpuScene {
+    const VoxData*              voxels      = nullptr;
+    const VoxelFaceTable*       faces       = nullptr;
+    const SunVisibility*        sun         = nullptr;
+    const IrradianceCache*      irradiance  = nullptr;
+    const std::vector<u8>*      face_ao     = nullptr;
+    const LightingEnvironment*  environment = nullptr;
+    const std::vector<std::vector<u8>>* mips = nullptr;    //From BuildVoxelIndexMips, needed for the LOD trace
+    Vec3                        background  = {};
+};
+
+//Same as PixelToRay in Voxel.hlsl, pixel is measured from the top left
+Ray PixelToRay(const Vec2& pixel, const Vec2I& screen_size, const CpuCamera& camera);
+//Width of a screen pixel one unit in front of the camera scaled by lod_bias,
+//the cone_spread that lets LOD cells grow to lod_bias pixels
+float GetConeSpread(const Vec2I& screen_size, const CpuCamera& camera, float lod_bias);
+
+//One bounce of a path waiting to be traced
+struct SecondaryRay {
+    Ray         ray;
+    Vec3        throughput;     //Product of the albedos along the path so far
+    u32         pixel;          //Index into the traced image the light is added to
+    RandomState random;
+};
+
+//Secondary rays are sorted by direction octant and origin brick so rays traced
+//next to each other walk the same part of the volume
+#define SECONDARY_BRICK_SIZE 8
+#define SECONDARY_BRICK_COUNT ((VOXEL_MAX_SIZE / SECONDARY_BRICK_SIZE) * (VOXEL_MAX_SIZE / SECONDARY_BRICK_SIZE) * (VOXEL_MAX_SIZE / SECONDARY_BRICK_SIZE))
+#define SECONDARY_BIN_COUNT (8 * SECONDARY_BRICK_COUNT)
+u32  SecondaryRayBin(const SecondaryRay& r);
+void BinSecondaryRays(std::vector<SecondaryRay>& out, const std::vector<SecondaryRay>& rays);
+//Neighbouring rays in different bins, a stand in for cache misses since the
+//hardware counters are not available here
+u64  CountBinChanges(const std::vector<SecondaryRay>& rays);
+//Follows every path to the end before starting the next one
+u64  TraceSecondaryPaths(DenoiseImage& color, const std::vector<SecondaryRay>& rays, const CpuScene& scene, i32 bounces);
+//Traces one bounce of every path at a time, binned before each bounce.
+//rays is consumed, scratch holds the binned wavefront
+u64  TraceSecondaryWavefront(DenoiseImage& color, std::vector<SecondaryRay>& rays, std::vector<SecondaryRay>& scratch,
+                             const CpuScene& scene, i32 bounces);
+
+struct CpuRenderer {
+    RenderScale     render_scale = RenderScale::Half;
+    u32             frame_index  = 0;
+    i32             bounces      = 2;       //Diffuse bounces traced when the scene has no irradiance cache
+    bool            bin_secondary_rays = true;
+    bool            denoise = false;        //Filters output with the primary hit features, after the upsample like the GPU path
+    DenoiseSettings denoise_settings;
+    std::vector<SecondaryRay> secondary_rays;
+    std::vector<SecondaryRay> secondary_binned;
+    DenoiseImage    trace;              //trace_size
+    DenoiseFeatures trace_features;     //trace_size
+    DenoiseFeatures guide;              //Screen size, primary hits only
+    DenoiseImage    output;             //Screen size
+
+    //Stats of the last frame
+    u64             shading_rays = 0;   //Primary and secondary rays of the traced pixels
+    u64             guide_rays   = 0;
+    float           milliseconds = 0.0f;
+    u64             secondary_rays_traced   = 0;
+    u64             secondary_bin_changes   = 0;    //Of the first bounce, in the order it was traced
+    float           secondary_milliseconds  = 0.0f;
+    float           denoise_milliseconds    = 0.0f;
+};
+
+//Traces one shaded sample per pixel of layout, features.depth is 0 where nothing was hit.
+//When the scene has no irradiance cache the first bounce of every hit is written to secondary.
+//Returns the number of rays traced.
+u64 CpuTrace(DenoiseImage& color, DenoiseFeatures& features, const TraceLayout& layout, const CpuCamera& camera, const CpuScene& scene,
+             std::vector<SecondaryRay>* secondary = nullptr);
+//Normal and depth of the first hit for every screen pixel, the guide of UpsampleTrace
+u64 CpuTraceGuide(DenoiseFeatures& guide, const Vec2I& size, const CpuCamera& camera, const CpuScene& scene);
+//Joint bilateral upsample: every screen pixel blends the traced samples around it,
+//weighted by how close their depth and normal are to the guide
+void UpsampleTrace(DenoiseImage& out, const DenoiseImage& trace, const DenoiseFeatures& trace_features,
+                   const DenoiseFeatures& guide, const TraceLayout& layout, const Vec3& background);
+//Runs the passes above for renderer.render_scale, denoises when renderer.denoise is set and advances frame_index
+void CpuRender(CpuRenderer& renderer, const Vec2I& size, const CpuCamera& camera, const CpuScene& scene);
+//Mean absolute difference per channel, images must be the same size
+float ImageDifference(const DenoiseImage& a, const DenoiseImage& b);
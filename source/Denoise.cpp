@@ -0,0 +1,279 @@
+#include "Denoise.h"
+#include "Intrinsics.h"
+#include "Debug.h"
+#include "Tracy.hpp"
+
+#include <cmath>
+#include <cfloat>
+
+//B3 spline, the kernel is h[dx] * h[dy] for dx, dy in [-2, 2]
+static const float s_kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+static const float s_albedo_min = 0.001f;
+
+void DenoiseImage::Resize(const Vec2I& new_size)
+{
+    size = new_size;
+    const size_t count = size_t(size.x) * size_t(size.y);
+    r.resize(count);
+    g.resize(count);
+    b.resize(count);
+}
+
+void DenoiseFeatures::Resize(const Vec2I& new_size)
+{
+    size = new_size;
+    const size_t count = size_t(size.x) * size_t(size.y);
+    normal_x.resize(count);
+    normal_y.resize(count);
+    normal_z.resize(count);
+    depth.resize(count);
+    albedo_r.resize(count);
+    albedo_g.resize(count);
+    albedo_b.resize(count);
+}
+
+static float Luminance(float r, float g, float b)
+{
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+struct FilterConstants {
+    float inv_color;
+    float normal;
+    float inv_depth;
+    float inv_albedo;
+};
+
+static FilterConstants GetFilterConstants(const DenoiseSettings& settings, i32 step_width)
+{
+    FilterConstants r;
+    r.inv_color  = 1.0f / Max(settings.sigma_color, 0.0001f);
+    r.normal     = settings.sigma_normal;
+    r.inv_depth  = 1.0f / Max(settings.sigma_depth * float(step_width), 0.0001f);
+    r.inv_albedo = 1.0f / Max(settings.sigma_albedo, 0.0001f);
+    return r;
+}
+
+static void FilterPixel(DenoiseImage& out, const DenoiseImage& in, const DenoiseFeatures& f, const FilterConstants& c, i32 step_width, i32 x, i32 y)
+{
+    const i32 w = in.size.x;
+    const i32 h = in.size.y;
+    const i32 i = y * w + x;
+    const float depth_p = f.depth[i];
+    if (depth_p <= 0.0f)
+    {
+        out.r[i] = in.r[i];
+        out.g[i] = in.g[i];
+        out.b[i] = in.b[i];
+        return;
+    }
+    const float lum_p = Luminance(in.r[i], in.g[i], in.b[i]);
+    const float lum_scale = c.inv_color / (lum_p + 0.0001f);
+
+    float sum_r = 0.0f;
+    float sum_g = 0.0f;
+    float sum_b = 0.0f;
+    float sum_w = 0.0f;
+    for (i32 dy = -2; dy <= 2; dy++)
+    {
+        const i32 qy = y + dy * step_width;
+        if (qy < 0 || qy >= h)
+            continue;
+        for (i32 dx = -2; dx <= 2; dx++)
+        {
+            const i32 qx = x + dx * step_width;
+            if (qx < 0 || qx >= w)
+                continue;
+            const i32 q = qy * w + qx;
+            if (f.depth[q] <= 0.0f)
+                continue;
+
+            const float lum_q = Luminance(in.r[q], in.g[q], in.b[q]);
+            const float n_dot = f.normal_x[i] * f.normal_x[q] + f.normal_y[i] * f.normal_y[q] + f.normal_z[i] * f.normal_z[q];
+            const float albedo_diff = fabsf(f.albedo_r[i] - f.albedo_r[q]) + fabsf(f.albedo_g[i] - f.albedo_g[q]) + fabsf(f.albedo_b[i] - f.albedo_b[q]);
+            const float exponent = fabsf(lum_p - lum_q) * lum_scale +
+                                   (1.0f - n_dot) * c.normal +
+                                   fabsf(depth_p - f.depth[q]) * c.inv_depth +
+                                   albedo_diff * c.inv_albedo;
+            const float weight = s_kernel[dx + 2] * s_kernel[dy + 2] * expf(-exponent);
+            sum_r += in.r[q] * weight;
+            sum_g += in.g[q] * weight;
+            sum_b += in.b[q] * weight;
+            sum_w += weight;
+        }
+    }
+    //The center tap always has a weight of (3/8)^2 so sum_w can't be 0
+    out.r[i] = sum_r / sum_w;
+    out.g[i] = sum_g / sum_w;
+    out.b[i] = sum_b / sum_w;
+}
+
+//8 horizontally adjacent pixels, every tap has to be inside the row
+static void FilterPixels_256(DenoiseImage& out, const DenoiseImage& in, const DenoiseFeatures& f, const FilterConstants& c, i32 step_width, i32 x, i32 y)
+{
+    const i32 w = in.size.x;
+    const i32 h = in.size.y;
+    const i32 i = y * w + x;
+
+    const __m256 zero       = _mm256_setzero_ps();
+    const __m256 one        = _mm256_set1_ps(1.0f);
+    const __m256 inv_color  = _mm256_set1_ps(c.inv_color);
+    const __m256 normal_c   = _mm256_set1_ps(c.normal);
+    const __m256 inv_depth  = _mm256_set1_ps(c.inv_depth);
+    const __m256 inv_albedo = _mm256_set1_ps(c.inv_albedo);
+    const __m256 lum_r      = _mm256_set1_ps(0.2126f);
+    const __m256 lum_g      = _mm256_set1_ps(0.7152f);
+    const __m256 lum_b      = _mm256_set1_ps(0.0722f);
+
+    const __m256 p_r  = _mm256_loadu_ps(&in.r[i]);
+    const __m256 p_g  = _mm256_loadu_ps(&in.g[i]);
+    const __m256 p_b  = _mm256_loadu_ps(&in.b[i]);
+    const __m256 p_nx = _mm256_loadu_ps(&f.normal_x[i]);
+    const __m256 p_ny = _mm256_loadu_ps(&f.normal_y[i]);
+    const __m256 p_nz = _mm256_loadu_ps(&f.normal_z[i]);
+    const __m256 p_z  = _mm256_loadu_ps(&f.depth[i]);
+    const __m256 p_ar = _mm256_loadu_ps(&f.albedo_r[i]);
+    const __m256 p_ag = _mm256_loadu_ps(&f.albedo_g[i]);
+    const __m256 p_ab = _mm256_loadu_ps(&f.albedo_b[i]);
+    const __m256 p_lum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p_r, lum_r), _mm256_mul_ps(p_g, lum_g)), _mm256_mul_ps(p_b, lum_b));
+    const __m256 lum_scale = _mm256_div_ps(inv_color, _mm256_add_ps(p_lum, _mm256_set1_ps(0.0001f)));
+    const __m256 p_valid = _mm256_cmp_ps(p_z, zero, _CMP_GT_OQ);
+
+    __m256 sum_r = zero;
+    __m256 sum_g = zero;
+    __m256 sum_b = zero;
+    __m256 sum_w = zero;
+    for (i32 dy = -2; dy <= 2; dy++)
+    {
+        const i32 qy = y + dy * step_width;
+        if (qy < 0 || qy >= h)
+            continue;
+        for (i32 dx = -2; dx <= 2; dx++)
+        {
+            const i32 q = qy * w + x + dx * step_width;
+            const __m256 q_r  = _mm256_loadu_ps(&in.r[q]);
+            const __m256 q_g  = _mm256_loadu_ps(&in.g[q]);
+            const __m256 q_b  = _mm256_loadu_ps(&in.b[q]);
+            const __m256 q_z  = _mm256_loadu_ps(&f.depth[q]);
+
+            const __m256 q_lum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(q_r, lum_r), _mm256_mul_ps(q_g, lum_g)), _mm256_mul_ps(q_b, lum_b));
+            const __m256 n_dot = DotProduct_256(p_nx, p_ny, p_nz,
+                                                _mm256_loadu_ps(&f.normal_x[q]),
+                                                _mm256_loadu_ps(&f.normal_y[q]),
+                                                _mm256_loadu_ps(&f.normal_z[q]));
+            __m256 albedo_diff = Abs_256(_mm256_sub_ps(p_ar, _mm256_loadu_ps(&f.albedo_r[q])));
+            albedo_diff = _mm256_add_ps(albedo_diff, Abs_256(_mm256_sub_ps(p_ag, _mm256_loadu_ps(&f.albedo_g[q]))));
+            albedo_diff = _mm256_add_ps(albedo_diff, Abs_256(_mm256_sub_ps(p_ab, _mm256_loadu_ps(&f.albedo_b[q]))));
+
+            __m256 exponent = _mm256_mul_ps(Abs_256(_mm256_sub_ps(p_lum, q_lum)), lum_scale);
+            exponent = _mm256_add_ps(exponent, _mm256_mul_ps(_mm256_sub_ps(one, n_dot), normal_c));
+            exponent = _mm256_add_ps(exponent, _mm256_mul_ps(Abs_256(_mm256_sub_ps(p_z, q_z)), inv_depth));
+            exponent = _mm256_add_ps(exponent, _mm256_mul_ps(albedo_diff, inv_albedo));
+
+            __m256 weight = Exp_256(_mm256_sub_ps(zero, exponent));
+            weight = _mm256_mul_ps(weight, _mm256_set1_ps(s_kernel[dx + 2] * s_kernel[dy + 2]));
+            weight = _mm256_and_ps(weight, _mm256_cmp_ps(q_z, zero, _CMP_GT_OQ));
+
+            sum_r = _mm256_add_ps(sum_r, _mm256_mul_ps(q_r, weight));
+            sum_g = _mm256_add_ps(sum_g, _mm256_mul_ps(q_g, weight));
+            sum_b = _mm256_add_ps(sum_b, _mm256_mul_ps(q_b, weight));
+            sum_w = _mm256_add_ps(sum_w, weight);
+        }
+    }
+
+    //Pixels without a hit keep their color, max() keeps them from dividing by 0
+    const __m256 inv_w = _mm256_div_ps(one, _mm256_max_ps(sum_w, _mm256_set1_ps(FLT_MIN)));
+    _mm256_storeu_ps(&out.r[i], _mm256_blendv_ps(p_r, _mm256_mul_ps(sum_r, inv_w), p_valid));
+    _mm256_storeu_ps(&out.g[i], _mm256_blendv_ps(p_g, _mm256_mul_ps(sum_g, inv_w), p_valid));
+    _mm256_storeu_ps(&out.b[i], _mm256_blendv_ps(p_b, _mm256_mul_ps(sum_b, inv_w), p_valid));
+}
+
+void DenoiseIteration(DenoiseImage& out, const DenoiseImage& in, const DenoiseFeatures& features, const DenoiseSettings& settings, i32 step_width)
+{
+    ZoneScopedN("Denoise Iteration");
+    VALIDATE(in.size == features.size);
+    VALIDATE(step_width > 0);
+    if (out.size != in.size)
+        out.Resize(in.size);
+
+    const FilterConstants c = GetFilterConstants(settings, step_width);
+    const i32 w = in.size.x;
+    const i32 border = 2 * step_width;
+    //Columns where every horizontal tap of all 8 lanes is inside the image
+    const i32 simd_start = border;
+    const i32 simd_end   = w - border - 8;
+    for (i32 y = 0; y < in.size.y; y++)
+    {
+        i32 x = 0;
+        for (; x < simd_start && x < w; x++)
+            FilterPixel(out, in, features, c, step_width, x, y);
+        for (; x <= simd_end; x += 8)
+            FilterPixels_256(out, in, features, c, step_width, x, y);
+        for (; x < w; x++)
+            FilterPixel(out, in, features, c, step_width, x, y);
+    }
+}
+
+float DenoiseIterationSimdError(const DenoiseImage& in, const DenoiseFeatures& features, const DenoiseSettings& settings, i32 step_width)
+{
+    VALIDATE_V(in.size == features.size, FLT_MAX);
+    VALIDATE_V(step_width > 0, FLT_MAX);
+    DenoiseImage simd;
+    DenoiseIteration(simd, in, features, settings, step_width);
+
+    DenoiseImage scalar;
+    scalar.Resize(in.size);
+    const FilterConstants c = GetFilterConstants(settings, step_width);
+    for (i32 y = 0; y < in.size.y; y++)
+        for (i32 x = 0; x < in.size.x; x++)
+            FilterPixel(scalar, in, features, c, step_width, x, y);
+
+    //Dark pixels are compared in absolute terms
+    float error = 0.0f;
+    for (size_t i = 0; i < scalar.r.size(); i++)
+    {
+        error = Max(error, fabsf(simd.r[i] - scalar.r[i]) / Max(fabsf(scalar.r[i]), 0.01f));
+        error = Max(error, fabsf(simd.g[i] - scalar.g[i]) / Max(fabsf(scalar.g[i]), 0.01f));
+        error = Max(error, fabsf(simd.b[i] - scalar.b[i]) / Max(fabsf(scalar.b[i]), 0.01f));
+    }
+    return error;
+}
+
+void Denoise(DenoiseImage& image, const DenoiseFeatures& features, const DenoiseSettings& settings)
+{
+    ZoneScopedN("Denoise");
+    VALIDATE(image.size == features.size);
+    const size_t count = image.r.size();
+
+    //Demodulate
+    for (size_t i = 0; i < count; i++)
+    {
+        if (features.depth[i] <= 0.0f)
+            continue;
+        image.r[i] /= Max(features.albedo_r[i], s_albedo_min);
+        image.g[i] /= Max(features.albedo_g[i], s_albedo_min);
+        image.b[i] /= Max(features.albedo_b[i], s_albedo_min);
+    }
+
+    DenoiseImage temp;
+    temp.Resize(image.size);
+    DenoiseImage* src = &image;
+    DenoiseImage* dst = &temp;
+    for (i32 iteration = 0; iteration < settings.iterations; iteration++)
+    {
+        DenoiseIteration(*dst, *src, features, settings, 1 << iteration);
+        std::swap(src, dst);
+    }
+    if (src != &image)
+        std::swap(image, *src);
+
+    //Remodulate
+    for (size_t i = 0; i < count; i++)
+    {
+        if (features.depth[i] <= 0.0f)
+            continue;
+        image.r[i] *= Max(features.albedo_r[i], s_albedo_min);
+        image.g[i] *= Max(features.albedo_g[i], s_albedo_min);
+        image.b[i] *= Max(features.albedo_b[i], s_albedo_min);
+    }
+}
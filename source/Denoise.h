@@ -0,0 +1,51 @@
+#pragma once
+#include "Math.h"
+
+#include <vector>
+
+//************
+//Denoise
+//************
+
+//Edge-avoiding a-trous wavelet filter (SVGF without the variance guide).
+//Noise is filtered on the illumination (color / albedo) so texture detail survives,
+//the normal, depth and albedo feature buffers stop the kernel at geometric edges.
+//Denoise.hlsl runs the same weights on the GPU one iteration per pass.
+
+//All planes are stored as size.x * size.y floats, row major.
+struct DenoiseImage {
+    Vec2I size = {};
+    std::vector<float> r;
+    std::vector<float> g;
+    std::vector<float> b;
+
+    void Resize(const Vec2I& new_size);
+};
+
+struct DenoiseFeatures {
+    Vec2I size = {};
+    std::vector<float> normal_x;
+    std::vector<float> normal_y;
+    std::vector<float> normal_z;
+    std::vector<float> depth;       //Distance from the camera, 0 for pixels without a hit
+    std::vector<float> albedo_r;
+    std::vector<float> albedo_g;
+    std::vector<float> albedo_b;
+
+    void Resize(const Vec2I& new_size);
+};
+
+struct DenoiseSettings {
+    i32   iterations    = 5;        //Step width doubles every iteration: 1, 2, 4, 8, 16
+    float sigma_color   = 4.0f;     //Relative illumination difference allowed
+    float sigma_normal  = 32.0f;    //Falloff of (1 - dot(n_p, n_q))
+    float sigma_depth   = 1.0f;     //Voxels of depth difference per pixel of step width
+    float sigma_albedo  = 0.1f;     //Summed albedo difference
+};
+
+void Denoise(DenoiseImage& image, const DenoiseFeatures& features, const DenoiseSettings& settings);
+//Single filter pass without the (de/re)modulation, exposed for comparing against the GPU pass
+void DenoiseIteration(DenoiseImage& out, const DenoiseImage& in, const DenoiseFeatures& features, const DenoiseSettings& settings, i32 step_width);
+//Largest difference between DenoiseIteration and the same pass with the scalar filter only,
+//relative to the scalar result. The AVX path uses Exp_256 where the scalar one calls expf
+float DenoiseIterationSimdError(const DenoiseImage& in, const DenoiseFeatures& features, const DenoiseSettings& settings, i32 step_width);
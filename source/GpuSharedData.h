@@ -15,6 +15,11 @@
 #define SLOT_RANDOM_TEXTURE 7
 #define SLOT_RANDOM_TEXTURE_SAMPLER 7
 #define SLOT_VOXEL_MATERIALS 8
+#define SLOT_EMISSIVE_LIGHTS 9
+#define SLOT_VOXEL_FACES 10
+#define SLOT_IRRADIANCE_CACHE 11
+#define SLOT_SUN_VISIBILITY 12
+#define SLOT_VOXEL_FACE_AO 13
 //Cube Draw call
 #define SLOT_PRIMITIVE_TEXTURE 0
 #define SLOT_PRIMITIVE_TEXTURE_SAMPLER 0
@@ -23,6 +28,37 @@
 #define SLOT_PREVIOUS_TARGET_SAMPLER 0
 #define SLOT_PREVIOUS_DEPTH 1
 #define SLOT_PREVIOUS_DEPTH_SAMPLER 1
+//Denoise Draw Call
+#define SLOT_CB_DENOISE 1
+#define SLOT_DENOISE_INPUT 0
+#define SLOT_DENOISE_NORMAL_DEPTH 1
+#define SLOT_DENOISE_ALBEDO 2
+//Upsample Draw Call
+#define SLOT_TRACE_COLOR 0
+#define SLOT_TRACE_NORMAL_DEPTH 1
+#define SLOT_GUIDE_NORMAL_DEPTH 2
+//Temporal Draw Call
+#define SLOT_TEMPORAL_CURRENT 0
+#define SLOT_TEMPORAL_DEPTH 1
+#define SLOT_TEMPORAL_HISTORY 2
+#define SLOT_TEMPORAL_HISTORY_DEPTH 3
+
+//Edge length of the grid the voxel face table covers (VOXEL_MAX_SIZE)
+#define VOXEL_FACE_TABLE_SIZE 64
+
+#define MATERIAL_FLAG_EMISSIVE 0x1
+#define MATERIAL_FLAG_METAL 0x2
+
+#define DENOISE_FLAG_DEMODULATE 0x1
+#define DENOISE_FLAG_REMODULATE 0x2
+
+//Weights of the reduced resolution upsample, shared with UpsampleTrace in CpuRenderer.cpp
+#define UPSAMPLE_DEPTH_SIGMA 0.05   //Depth difference relative to the pixel depth
+#define UPSAMPLE_NORMAL_POWER 16.0
+#define UPSAMPLE_MIN_WEIGHT 0.0001
+
+//History taps further than this from the reprojected view depth, relative to it, are disoccluded
+#define TEMPORAL_DEPTH_TOLERANCE 0.03
 
 #ifdef __cplusplus
 
@@ -42,6 +78,8 @@
 #define STRUCT_PACK_END
 
 #define U32Pack uint
+#define u32   uint
+#define i32   int
 #define Vec2  float2
 #define Vec3  float3
 #define Vec4  float4
@@ -80,18 +118,60 @@ STRUCT_PREFIX CB_Common STRUCT_SUFFIX(SLOT_CB_COMMON) {
     Vec3I voxel_size;
     float total_time;
     Vec3 camera_position;
-    float _pad0;
+    float lod_cone_spread;          //Pixel footprint per unit of distance of primary rays, 0 traces them at full resolution
+    u32 emissive_light_count;
+    u32 max_bounces;
+    u32 russian_roulette_depth;     //Bounces that always continue before paths can be terminated
+    u32 temporal_max_history;       //Frames blended into the history, 0 when temporal accumulation is off
+    Vec3 sun_position;
+    u32 irradiance_cache_enabled;   //Indirect light is read from the per face cache instead of traced
+    u32 sun_visibility_enabled;     //Shadows come from the baked per face sun visibility instead of a shadow ray
+    u32 ambient_occlusion_enabled;  //Baked per face AO darkens the ambient and cached indirect light
+    u32 frame_index;
+    u32 temporal_history_valid;     //The history textures and previous_* matrices hold the last frame
+    Vec2I trace_size;               //Size of the traced image, smaller than screen_size for reduced resolution
+    i32 trace_scale;                //Screen pixels per traced pixel along each axis
+    u32 checkerboard_enabled;       //Every other pixel is traced, trace_scale is 1
+    //Camera of the last frame, the temporal pass reprojects into it
+    Mat4 previous_projection_from_view;
+    Mat4 previous_view_from_world;
+    Mat4 previous_view_from_projection;
 };
 
+//One a-trous iteration, sigmas match DenoiseSettings in Denoise.h
+STRUCT_PREFIX CB_Denoise STRUCT_SUFFIX(SLOT_CB_DENOISE) {
+    i32   step_width;
+    float sigma_color;
+    float sigma_normal;
+    float sigma_depth;
+    float sigma_albedo;
+    u32   denoise_flags;
+    float _denoise_pad0;
+    float _denoise_pad1;
+};
+
+//Shading inputs of a palette entry, packed from the MaterialTable in Vox.h
+STRUCT_PACK_START
+struct ShadingMaterial {
+    Vec3  albedo;       //Linear
+    float roughness;
+    Vec3  emission;     //albedo * emit * max(flux, 1), 0 when the material doesn't emit
+    u32   flags;        //MATERIAL_FLAG_*
+};
+STRUCT_PACK_END
+
+//Every emissive voxel with at least one uncovered face.
+//probability/alias make up the alias table used to pick a light in O(1),
+//weighted by the emitted power (luminance of the radiance * exposed area).
 STRUCT_PACK_START
-struct VoxMaterial {
-    float metalness;
-    float roughness;    //Surface Roughness:        Range from 0 to 100
-    float spec;         //Specular reflectivity:    Range from 0 to 100
-    float flux;         //Radiant flux:             Range from 1 to 5
-    float emit;
-    float ri;           //Refractive index:         Range from 1.00 to 3.00
-    float metal;        //metalness
-    U32Pack color;
+struct EmissiveLight {
+    Vec3I p;
+    u32   face_mask;    //bit per Face that is not blocked by a neighbour
+    Vec3  radiance;     //linear color * emit * flux
+    float area;         //exposed faces
+    float probability;  //chance to keep this entry when its column is picked
+    u32   alias;        //entry used otherwise
+    float pdf;          //chance this light gets picked: weight / total_weight
+    float _pad0;
 };
 STRUCT_PACK_END
@@ -1,4 +1,5 @@
 #pragma once
+#include <immintrin.h>
 
 
 union Vec2_256 {
@@ -94,7 +95,7 @@ SIMD_PREFIX Vec3_256 Normalize_256(const Vec3_256 b)
     r.z = _mm256_mul_ps(b.z, py);
     return r;
 }
-SIMD_PREFIX void Normalize_256(
+inline void Normalize_256(
                 __m256& out_x,
                 __m256& out_y,
                 __m256& out_z,
@@ -151,6 +152,29 @@ SIMD_PREFIX Vec3_256 Divide_256(const Vec3_256 a, const __m256 b)
     return r;
 }
 
+SIMD_PREFIX __m256 Abs_256(const __m256 a)
+{
+    const __m256 sign_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    return _mm256_and_ps(a, sign_mask);
+}
+
+//e^x for x <= 0 with ~1e-5 relative error, used for filter weights.
+//2^(x * log2(e)) split into the exponent bits and a polynomial for the fraction.
+SIMD_PREFIX __m256 Exp_256(const __m256 x)
+{
+    __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+    t = _mm256_max_ps(t, _mm256_set1_ps(-126.0f));
+    const __m256 ti = _mm256_floor_ps(t);
+    const __m256 f  = _mm256_sub_ps(t, ti);
+    __m256 p = _mm256_set1_ps(1.3697664e-2f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.1690358e-2f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.4163088e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.9296730e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+    const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(ti), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
 #if 0
 [[nodiscard]] inline Vec3_256 operator-(Vec3_256 a, Vec3_256 b) { return Subtract(a, b); }
 #endif
@@ -0,0 +1,362 @@
+#include "Lighting.h"
+#include "Raycast.h"
+#include "Threading.h"
+#include "Debug.h"
+#include "Tracy.hpp"
+
+#include <atomic>
+#include <cstring>
+
+static u8 GetVoxelIndex(const VoxelBlockData& voxels, const Vec3I& p)
+{
+    if (p.x >= 0 && p.x < VOXEL_MAX_SIZE &&
+        p.y >= 0 && p.y < VOXEL_MAX_SIZE &&
+        p.z >= 0 && p.z < VOXEL_MAX_SIZE)
+        return voxels.e[p.x][p.y][p.z];
+    return 0;
+}
+
+static float Luminance(const Vec3& c)
+{
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+//Vose's alias method: every column holds its own entry with "probability"
+//and falls back to "alias" otherwise so picking a light is one random number
+//for the column and one for the coin flip.
+static void BuildAliasTable(std::vector<EmissiveLight>& lights, const std::vector<float>& weights, float total_weight)
+{
+    const u32 count = u32(lights.size());
+    std::vector<float> scaled(count);
+    std::vector<u32> small;
+    std::vector<u32> large;
+    small.reserve(count);
+    large.reserve(count);
+    for (u32 i = 0; i < count; i++)
+    {
+        lights[i].pdf = weights[i] / total_weight;
+        scaled[i] = lights[i].pdf * count;
+        if (scaled[i] < 1.0f)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while (small.size() && large.size())
+    {
+        const u32 s = small.back();
+        small.pop_back();
+        const u32 l = large.back();
+
+        lights[s].probability = scaled[s];
+        lights[s].alias = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+        if (scaled[l] < 1.0f)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    //Whatever is left over is 1.0 within floating point error
+    for (u32 i : large)
+    {
+        lights[i].probability = 1.0f;
+        lights[i].alias = i;
+    }
+    for (u32 i : small)
+    {
+        lights[i].probability = 1.0f;
+        lights[i].alias = i;
+    }
+}
+
+float BuildEmissiveLights(std::vector<EmissiveLight>& out, const VoxData& voxels)
+{
+    ZoneScopedN("Build Emissive Lights");
+    out.clear();
+    VALIDATE_V(voxels.color_indices.size(), 0.0f);
+
+    std::vector<float> weights;
+    float total_weight = 0.0f;
+    const VoxelBlockData& block = voxels.color_indices[0];
+    for (i32 x = 0; x < VOXEL_MAX_SIZE; x++)
+        for (i32 y = 0; y < VOXEL_MAX_SIZE; y++)
+            for (i32 z = 0; z < VOXEL_MAX_SIZE; z++)
+            {
+                const u8 index = block.e[x][y][z];
+                if (!index)
+                    continue;
+                if (!(voxels.material_table.flags[index] & MATERIAL_FLAG_EMISSIVE))
+                    continue;
+
+                const Vec3I p = { x, y, z };
+                u32 face_mask = 0;
+                u32 face_count = 0;
+                for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+                {
+                    if (GetVoxelIndex(block, p + ToVec3I(faceNormals[face_i])) == 0)
+                    {
+                        face_mask |= 1 << face_i;
+                        face_count++;
+                    }
+                }
+                if (!face_mask)
+                    continue;
+
+                EmissiveLight light = {};
+                light.p = p;
+                light.face_mask = face_mask;
+                light.radiance = GetMaterialEmission(voxels.material_table, index);
+                light.area = float(face_count);
+
+                const float weight = Luminance(light.radiance) * light.area;
+                if (weight <= 0.0f)
+                    continue;
+                out.push_back(light);
+                weights.push_back(weight);
+                total_weight += weight;
+            }
+
+    if (out.size())
+        BuildAliasTable(out, weights, total_weight);
+    DEBUG_LOG("Emissive lights: %u\n", u32(out.size()));
+    return total_weight;
+}
+
+//************
+//Irradiance Cache
+//************
+
+LightingEnvironment::LightingEnvironment()
+{
+    sun_color = srgb_to_linear(Vec4({ 0.8f, 0.8f, 0.8f, 1.0f })).rgb;
+    sky_color = srgb_to_linear(Vec4({ 0.263f, 0.706f, 0.965f, 1.0f })).rgb * 0.5f;
+}
+
+void ResetIrradianceCache(IrradianceCache& cache, const VoxelFaceTable& table)
+{
+    cache.irradiance.clear();
+    cache.irradiance.resize(table.faces.size(), {});
+    cache.cursor = 0;
+}
+
+Face FaceFromNormal(const Vec3& n)
+{
+    if (n.x >  0.5f) return Face::Right;
+    if (n.x < -0.5f) return Face::Left;
+    if (n.y >  0.5f) return Face::Top;
+    if (n.y < -0.5f) return Face::Bot;
+    if (n.z >  0.5f) return Face::Back;
+    return Face::Front;
+}
+
+static bool IsSunVisible(const Vec3& p, const Vec3& n, const VoxData& voxels, const Vec3& sun_position)
+{
+    const Vec3 to_sun = sun_position - p;
+    const float sun_distance = Length(to_sun);
+    if (sun_distance <= 0.0f || DotProduct(to_sun, n) <= 0.0f)
+        return false;
+    Ray ray = {};
+    ray.direction = to_sun / sun_distance;
+    ray.origin = p + n * 0.001f;
+    const RaycastResult hit = RayVsVoxel(ray, voxels);
+    return !hit.success || Distance(ray.origin, hit.p) >= sun_distance;
+}
+
+//Same as the shader, shadowed surfaces still get shadow_amount
+static Vec3 SunLight(const Vec3& p, const Vec3& n, float visibility, const LightingEnvironment& env)
+{
+    const float n_dot_l = Max(DotProduct(Normalize(env.sun_position - p), n), 0.0f);
+    return env.sun_color * Lerp(env.shadow_amount, n_dot_l, visibility);
+}
+
+//Radiance leaving a surface towards the ray that hit it
+static Vec3 GatherRadiance(const RaycastResult& hit, const IrradianceCache& cache, const VoxelFaceTable& table,
+                           const VoxData& voxels, const LightingEnvironment& env, const SunVisibility* sun)
+{
+    if (!hit.success)
+        return env.sky_color;
+    const Vec3 albedo = GetMaterialAlbedo(voxels.material_table, hit.success);
+
+    const Vec3I voxel_p = ToVec3I(Floor(hit.p - hit.normal * 0.5f));
+    const i32 face_index = GetFaceIndex(table, voxel_p, FaceFromNormal(hit.normal));
+    float visibility;
+    if (sun && face_index >= 0 && face_index < i32(sun->visibility.size()))
+        visibility = sun->visibility[face_index];
+    else
+        visibility = IsSunVisible(hit.p, hit.normal, voxels, env.sun_position) ? 1.0f : 0.0f;
+    Vec3 incoming = SunLight(hit.p, hit.normal, visibility, env);
+    if (face_index >= 0)
+        incoming += cache.irradiance[face_index].rgb;
+
+    return HadamardProduct(albedo, incoming) + GetMaterialEmission(voxels.material_table, hit.success);
+}
+
+Vec3 SampleHemisphere(const Vec3& n, RandomState& random)
+{
+    const float r = sqrtf(NextRandomFloat(random));
+    const float phi = 2.0f * 3.14159265f * NextRandomFloat(random);
+    const Vec3 t0 = fabsf(n.x) > 0.5f ? Vec3({ 0.0f, 1.0f, 0.0f }) : Vec3({ 1.0f, 0.0f, 0.0f });
+    const Vec3 t1 = Normalize(CrossProduct(n, t0));
+    const Vec3 t2 = CrossProduct(n, t1);
+    return Normalize(t1 * (r * cosf(phi)) + t2 * (r * sinf(phi)) + n * sqrtf(Max(0.0f, 1.0f - r * r)));
+}
+
+u32 UpdateIrradianceCache(IrradianceCache& cache, const VoxelFaceTable& table, const VoxData& voxels, const LightingEnvironment& env,
+                          const SunVisibility* sun)
+{
+    ZoneScopedN("Update Irradiance Cache");
+    const u32 face_count = u32(table.faces.size());
+    if (face_count == 0 || cache.rays_per_face == 0)
+        return 0;
+    VALIDATE_V(cache.irradiance.size() == face_count, 0);
+
+    const u32 faces_to_update = Min(Max(cache.rays_per_frame / cache.rays_per_face, 1u), face_count);
+    for (u32 i = 0; i < faces_to_update; i++)
+    {
+        const u32 face_index = cache.cursor;
+        cache.cursor = (cache.cursor + 1) % face_count;
+
+        const u32 packed = table.faces[face_index];
+        const Vec3I p = { i32(packed & 0xFF), i32((packed >> 8) & 0xFF), i32((packed >> 16) & 0xFF) };
+        const u32 face = packed >> 24;
+        const Vec3 n = faceNormals[face];
+        const Vec3 t0 = fabsf(n.x) > 0.5f ? Vec3({ 0.0f, 1.0f, 0.0f }) : Vec3({ 1.0f, 0.0f, 0.0f });
+        const Vec3 t1 = CrossProduct(n, t0);
+        //Just outside the face so the ray starts in the empty neighbour
+        const Vec3 face_center = ToVec3(p) + 0.5f + n * 0.501f;
+
+        Vec3 sum = {};
+        for (u32 r = 0; r < cache.rays_per_face; r++)
+        {
+            Ray ray = {};
+            ray.origin = face_center + t0 * (NextRandomFloat(cache.random) - 0.5f) + t1 * (NextRandomFloat(cache.random) - 0.5f);
+            ray.direction = SampleHemisphere(n, cache.random);
+            sum += GatherRadiance(RayVsVoxel(ray, voxels), cache, table, voxels, env, sun);
+        }
+        const Vec3 estimate = sum / float(cache.rays_per_face);
+
+        Vec4& entry = cache.irradiance[face_index];
+        entry.a = Min(entry.a + 1.0f, float(Max(cache.max_history, 1u)));
+        entry.rgb = Lerp(entry.rgb, estimate, 1.0f / entry.a);
+    }
+    return faces_to_update;
+}
+
+
+//************
+//Sun Visibility
+//************
+
+static void MarkSunVisibilityRegions(SunVisibility& sun, const Vec3& min, const Vec3& max)
+{
+    if (max.x < 0.0f || max.y < 0.0f || max.z < 0.0f ||
+        min.x >= VOXEL_MAX_SIZE || min.y >= VOXEL_MAX_SIZE || min.z >= VOXEL_MAX_SIZE)
+        return;
+    const i32 last = SUN_VISIBILITY_REGION_COUNT - 1;
+    Vec3I region_min = ToVec3I(Floor(min / float(SUN_VISIBILITY_REGION_SIZE)));
+    Vec3I region_max = ToVec3I(Floor(max / float(SUN_VISIBILITY_REGION_SIZE)));
+    for (i32 i = 0; i < 3; i++)
+    {
+        region_min.e[i] = Clamp(region_min.e[i], 0, last);
+        region_max.e[i] = Clamp(region_max.e[i], 0, last);
+    }
+    for (i32 x = region_min.x; x <= region_max.x; x++)
+        for (i32 y = region_min.y; y <= region_max.y; y++)
+            for (i32 z = region_min.z; z <= region_max.z; z++)
+                sun.dirty_regions[x][y][z] = 1;
+}
+
+void ResetSunVisibility(SunVisibility& sun, const VoxelFaceTable& table)
+{
+    sun.visibility.clear();
+    sun.visibility.resize(table.faces.size(), 0.0f);
+    memset(sun.dirty_regions, 1, sizeof(sun.dirty_regions));
+}
+
+void InvalidateSunVisibility(SunVisibility& sun, const Vec3I& min, const Vec3I& max)
+{
+    //Faces of the neighbours change as well
+    const Vec3 box_min = ToVec3(min) - 1.0f;
+    const Vec3 box_max = ToVec3(max) + 2.0f;
+    const Vec3 center = (box_min + box_max) * 0.5f;
+    const Vec3 half_size = (box_max - box_min) * 0.5f;
+
+    Vec3 direction = center - sun.sun_position;
+    const float sun_distance = Length(direction);
+    if (sun_distance < 1.0f)
+    {
+        memset(sun.dirty_regions, 1, sizeof(sun.dirty_regions));
+        return;
+    }
+    direction = direction / sun_distance;
+
+    //Sweep the box away from the sun, growing it like the shadow of a point light
+    const float max_distance = VOXEL_MAX_SIZE * 1.75f;
+    for (float t = 0.0f; t <= max_distance; t += 1.0f)
+    {
+        const Vec3 p = center + direction * t;
+        const Vec3 extent = half_size * ((sun_distance + t) / sun_distance);
+        MarkSunVisibilityRegions(sun, p - extent, p + extent);
+    }
+}
+
+static float BakeFaceSunVisibility(u32 packed_face, const VoxData& voxels, const Vec3& sun_position, u32 samples_per_axis)
+{
+    const Vec3I p = { i32(packed_face & 0xFF), i32((packed_face >> 8) & 0xFF), i32((packed_face >> 16) & 0xFF) };
+    const Vec3 n = faceNormals[packed_face >> 24];
+    const Vec3 face_center = ToVec3(p) + 0.5f + n * 0.5f;
+    if (DotProduct(sun_position - face_center, n) <= 0.0f)
+        return 0.0f;
+
+    const Vec3 t0 = fabsf(n.x) > 0.5f ? Vec3({ 0.0f, 1.0f, 0.0f }) : Vec3({ 1.0f, 0.0f, 0.0f });
+    const Vec3 t1 = CrossProduct(n, t0);
+    u32 visible = 0;
+    for (u32 u = 0; u < samples_per_axis; u++)
+        for (u32 v = 0; v < samples_per_axis; v++)
+        {
+            const float fu = (float(u) + 0.5f) / float(samples_per_axis) - 0.5f;
+            const float fv = (float(v) + 0.5f) / float(samples_per_axis) - 0.5f;
+            if (IsSunVisible(face_center + t0 * fu + t1 * fv, n, voxels, sun_position))
+                visible++;
+        }
+    return float(visible) / float(samples_per_axis * samples_per_axis);
+}
+
+u32 UpdateSunVisibility(SunVisibility& sun, const VoxelFaceTable& table, const VoxData& voxels, const Vec3& sun_position)
+{
+    ZoneScopedN("Update Sun Visibility");
+    if (sun.sun_position != sun_position)
+    {
+        sun.sun_position = sun_position;
+        memset(sun.dirty_regions, 1, sizeof(sun.dirty_regions));
+    }
+    bool any_dirty = false;
+    const u8* dirty_regions = &sun.dirty_regions[0][0][0];
+    for (u32 i = 0; i < sizeof(sun.dirty_regions); i++)
+        any_dirty |= dirty_regions[i] != 0;
+    if (!any_dirty)
+        return 0;
+    sun.visibility.resize(table.faces.size(), 0.0f);
+
+    const u32 samples_per_axis = Max(sun.samples_per_axis, 1u);
+    std::atomic<u32> baked = 0;
+    ParallelFor(u32(table.faces.size()), 256, [&](u32 begin, u32 end)
+    {
+        u32 baked_local = 0;
+        for (u32 i = begin; i < end; i++)
+        {
+            const u32 packed = table.faces[i];
+            const u32 x = (packed & 0xFF) / SUN_VISIBILITY_REGION_SIZE;
+            const u32 y = ((packed >> 8) & 0xFF) / SUN_VISIBILITY_REGION_SIZE;
+            const u32 z = ((packed >> 16) & 0xFF) / SUN_VISIBILITY_REGION_SIZE;
+            if (!sun.dirty_regions[x][y][z])
+                continue;
+            sun.visibility[i] = BakeFaceSunVisibility(packed, voxels, sun_position, samples_per_axis);
+            baked_local++;
+        }
+        baked += baked_local;
+    });
+    memset(sun.dirty_regions, 0, sizeof(sun.dirty_regions));
+    return baked;
+}
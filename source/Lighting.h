@@ -0,0 +1,64 @@
+#pragma once
+#include "Math.h"
+#include "Vox.h"
+#include "GpuSharedData.h"
+
+#include <vector>
+
+//Gathers every emissive voxel that can be seen from at least one side and
+//builds the alias table the shader uses to pick one for next-event estimation.
+//Returns the total weight (0 when the scene has no lights).
+float BuildEmissiveLights(std::vector<EmissiveLight>& out, const VoxData& voxels);
+
+//Sun and sky, the same values Voxel.hlsl uses
+struct LightingEnvironment {
+    Vec3 sun_position   = { 0.0f, 50.0f, 50.0f };
+    Vec3 sun_color      = {};
+    Vec3 sky_color      = {};
+    float shadow_amount = 0.1f;     //Light that still reaches shadowed surfaces
+
+    LightingEnvironment();
+};
+
+//Face of a voxel an axis aligned hit normal points out of
+Face FaceFromNormal(const Vec3& n);
+//Cosine weighted direction around n
+Vec3 SampleHemisphere(const Vec3& n, RandomState& random);
+
+//Fraction of every face that the sun can see, baked so the tracer doesn't need
+//a shadow ray. Regions are rebaked when an edit or a sun move invalidates them.
+#define SUN_VISIBILITY_REGION_SIZE 8
+#define SUN_VISIBILITY_REGION_COUNT (VOXEL_MAX_SIZE / SUN_VISIBILITY_REGION_SIZE)
+struct SunVisibility {
+    std::vector<float> visibility;          //0: fully in shadow, 1: fully lit, per face index
+    u8   dirty_regions[SUN_VISIBILITY_REGION_COUNT][SUN_VISIBILITY_REGION_COUNT][SUN_VISIBILITY_REGION_COUNT] = {};
+    Vec3 sun_position = {};                 //Sun the current values were baked for
+    u32  samples_per_axis = 3;              //Shadow rays per face: samples_per_axis^2
+};
+void ResetSunVisibility(SunVisibility& sun, const VoxelFaceTable& table);
+//Marks the regions the edited box [min, max] is in and the ones its shadow can fall on
+void InvalidateSunVisibility(SunVisibility& sun, const Vec3I& min, const Vec3I& max);
+//Rebakes the dirty regions in parallel, everything when the sun moved.
+//Returns the number of faces that were baked.
+u32 UpdateSunVisibility(SunVisibility& sun, const VoxelFaceTable& table, const VoxData& voxels, const Vec3& sun_position);
+
+//Diffuse indirect light gathered on the CPU a few faces at a time, includes the
+//light of emissive voxels so the shader skips its light sampling when it is used.
+//Every ray that hits a face reuses the cached value of that face so the
+//cache converges to multiple bounces over a number of updates.
+struct IrradianceCache {
+    //rgb: average incoming radiance over the cosine weighted hemisphere (irradiance / pi),
+    //a:   number of updates blended in so far
+    std::vector<Vec4> irradiance;
+    u32 cursor          = 0;
+    u32 rays_per_face   = 16;
+    u32 rays_per_frame  = 16384;
+    u32 max_history     = 32;       //Caps the blend weight so the cache follows light changes
+    RandomState random;
+};
+void ResetIrradianceCache(IrradianceCache& cache, const VoxelFaceTable& table);
+//Refines the next faces round robin within cache.rays_per_frame rays.
+//Returns the number of faces that were updated.
+//Shadow rays are replaced by the baked values when sun is given.
+u32 UpdateIrradianceCache(IrradianceCache& cache, const VoxelFaceTable& table, const VoxData& voxels, const LightingEnvironment& env,
+                          const SunVisibility* sun = nullptr);
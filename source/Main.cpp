@@ -4,7 +4,6 @@
 
 #include "imgui.h"
 #include "ImGui/backends/imgui_impl_sdl2.h"
-#include "ImGui/backends/imgui_impl_dx11.h"
 #include "Tracy.hpp"
 #include "stb/stb_image.h"
 
@@ -16,23 +15,28 @@
 #include "WinInterop_File.h"
 #include "Vox.h"
 #include "Raycast.h"
-
+#include "Lighting.h"
+#include "CpuRenderer.h"
+#include "Wavefront.h"
+#include "Arena.h"
+#include "Threading.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <unordered_map>
 #include <vector>
 
-#define RASTERIZED_RENDERING 0
-
 template <typename T>
-void GenericImGuiTable(const std::string& title, const std::string& fmt, T* firstValue, i32 length = 3)
+void GenericImGuiTable(const char* title, const char* fmt, T* firstValue, i32 length = 3)
 {
     ImGui::TableNextRow();
     ImGui::TableSetColumnIndex(0);
-    ImGui::TextUnformatted(title.data());
+    ImGui::TextUnformatted(title);
     for (i32 column = 0; column < length; column++)
     {
         ImGui::TableSetColumnIndex(column + 1);
-        std::string string = ToString(fmt.c_str(), firstValue[column]);
-        ImGui::TextUnformatted(string.data());
+        ImGui::TextUnformatted(FrameFormat(fmt, firstValue[column]));
     }
 }
 
@@ -49,8 +53,238 @@ static void HelpMarker(const char* desc)
     }
 }
 
+//Structured buffers can't be empty, the shader never reads the placeholder
+//since the counts that index into it are 0
+template <typename T>
+static void UploadStructuredData(GpuBuffer* buffer, const std::vector<T>& data)
+{
+    if (data.size())
+        buffer->Upload(data);
+    else
+    {
+        T empty = {};
+        buffer->Upload(&empty, 1, sizeof(empty));
+    }
+}
+
+//Face AO is packed 4 faces to a u32
+static void UploadFaceAO(const std::vector<u8>& face_ao)
+{
+    if (face_ao.size())
+        g_renderer.structure_voxel_face_ao->Upload(face_ao.data(), face_ao.size() / sizeof(u32), sizeof(u32));
+    else
+    {
+        u32 empty = 0;
+        g_renderer.structure_voxel_face_ao->Upload(&empty, 1, sizeof(empty));
+    }
+}
+
+//Only the faces UpdateIrradianceCache just refined, the cursor wraps around
+static void UploadIrradianceRange(const IrradianceCache& cache, u32 first, u32 count)
+{
+    const u32 face_count = u32(cache.irradiance.size());
+    const u32 before_wrap = Min(count, face_count - first);
+    g_renderer.structure_irradiance_cache->UploadRange(&cache.irradiance[first], first, before_wrap);
+    if (before_wrap < count)
+        g_renderer.structure_irradiance_cache->UploadRange(&cache.irradiance[0], 0, count - before_wrap);
+}
+
+//Only the ranges of the chunks the last UpdateVoxelMesh remeshed, unless it had to move them.
+//Returns the bytes that were uploaded
+static u64 UploadVoxelMesh(const VoxelMeshLods& mesh)
+{
+    u64 r = 0;
+    for (i32 lod = 0; lod < VOXEL_MESH_LOD_COUNT; lod++)
+    {
+        const VoxelChunkedMesh& level = mesh.levels[lod];
+        GpuBuffer* vb = g_renderer.voxel_rast_vb[lod];
+        GpuBuffer* ib = g_renderer.voxel_rast_ib[lod];
+        if (level.vertices.empty())
+            continue;
+        if (level.relocated)
+        {
+            vb->Upload(level.vertices);
+            ib->Upload(level.indices);
+            r += level.vertices.size() * sizeof(Vertex_VoxelPacked) + level.indices.size() * sizeof(u32);
+            continue;
+        }
+        for (u32 i = 0; i < level.chunks_meshed; i++)
+        {
+            //The indices past the count were cleared to degenerate triangles too
+            const VoxelMeshChunk& chunk = level.chunks[level.remeshed[i]];
+            if (chunk.vertices.count)
+                vb->UploadRange(&level.vertices[chunk.vertices.first], chunk.vertices.first, chunk.vertices.count);
+            if (chunk.indices.capacity)
+                ib->UploadRange(&level.indices[chunk.indices.first], chunk.indices.first, chunk.indices.capacity);
+            r += u64(chunk.vertices.count) * sizeof(Vertex_VoxelPacked) + u64(chunk.indices.capacity) * sizeof(u32);
+        }
+    }
+    return r;
+}
+
+//Creates the voxel index texture the first time, updates every mip after that.
+//mips is kept for the CPU LOD trace
+static void UploadVoxelIndices(std::vector<std::vector<u8>>& mips, const VoxelBlockData& block)
+{
+    const i32 mip_levels = BuildVoxelIndexMips(mips, block);
+    if (!g_renderer.textures[Texture::Index_Voxel_Indices])
+    {
+        Texture::TextureParams voxel_indices_parameters = {
+            .size = { VOXEL_MAX_SIZE, VOXEL_MAX_SIZE, VOXEL_MAX_SIZE },
+            .format = Texture::Format_R8_UINT,
+            .mode = Texture::Address_Clamp,
+            .filter = Texture::Filter_Point,
+            .render_target = false,
+            .bytes_per_pixel = sizeof(block.e[0][0][0]),
+        };
+        CreateTexture(&g_renderer.textures[Texture::Index_Voxel_Indices], voxel_indices_parameters, mip_levels, mips[0].data());
+    }
+    for (i32 mip_level = 0; mip_level < mip_levels; mip_level++)
+    {
+        const i32 dim = VOXEL_MAX_SIZE >> mip_level;
+        const i32 width = dim * sizeof(block.e[0][0][0]);
+        UpdateTexture(&g_renderer.textures[Texture::Index_Voxel_Indices], mip_level, mips[mip_level].data(), width, width * dim);
+    }
+}
+
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+//************
+//Headless
+//************
+
+//"-headless <frames>" runs that many frames with a fixed time step and a camera that orbits on its
+//own, checks what the null backend recorded for every frame and exits with the number of failures.
+//The number of extra cubes changes every frame and repeats every HEADLESS_CYCLE frames, the voxels
+//are path traced and rasterized on alternating cycles. Once both were run no buffer may be created,
+//the upload ring has grown to fit the largest frame by then. The last frame of every cycle places
+//its cubes past the far plane so the culled lists end up empty
+#define HEADLESS_CYCLE 16
+struct HeadlessRun {
+    i32 frames  = 0;    //0 when running with a window
+    i32 frame   = 0;
+    u32 failures = 0;
+};
+
+static HeadlessRun ParseHeadlessRun(i32 argc, char* argv[])
+{
+    HeadlessRun r;
+    for (i32 i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], "-headless") == 0)
+            r.frames = Max(atoi(argv[i + 1]), 1);
+    return r;
+}
+
+static bool HeadlessFrameIsCulled(const HeadlessRun& run)
+{
+    return (run.frame % HEADLESS_CYCLE) == HEADLESS_CYCLE - 1;
+}
+
+static i32 HeadlessCubeCount(const HeadlessRun& run)
+{
+    return ((run.frame * 7) % HEADLESS_CYCLE) * 160;
+}
+
+//Same cubes for the same frame of every cycle, up to a few thousand
+static void AddHeadlessFrame(const HeadlessRun& run)
+{
+    g_renderer.raster_voxels = (run.frame / HEADLESS_CYCLE) & 1;
+    const i32 count = HeadlessCubeCount(run);
+    const float height = HeadlessFrameIsCulled(run) ? 5000.0f : 0.0f;
+    for (i32 i = 0; i < count; i++)
+    {
+        const Vec3 p = { float(i % 16), height + float((i / 16) % 16), float(i / 256) };
+        const Color color = (i % 3) ? Orange : transPurple;
+        AddCubeToRender(p, color, 0.25f, i & 1);
+    }
+}
+
+//The AVX denoise pass against the scalar one on a made up image: blocks of one normal, albedo
+//and depth with noisy illumination and a few pixels without a hit. Returns the failed step widths
+static u32 CheckHeadlessDenoise()
+{
+    const Vec2I size = { 128, 64 };
+    DenoiseImage image;
+    DenoiseFeatures features;
+    image.Resize(size);
+    features.Resize(size);
+    RandomState random;
+    for (i32 y = 0; y < size.y; y++)
+        for (i32 x = 0; x < size.x; x++)
+        {
+            const size_t i = size_t(y) * size.x + x;
+            const i32 block = (y / 8) * (size.x / 8) + x / 8;
+            const i32 axis = block % 3;
+            features.normal_x[i] = axis == 0 ? 1.0f : 0.0f;
+            features.normal_y[i] = axis == 1 ? 1.0f : 0.0f;
+            features.normal_z[i] = axis == 2 ? 1.0f : 0.0f;
+            features.depth[i] = (i % 37) ? 10.0f + float(block % 5) + 0.01f * float(x) : 0.0f;
+            features.albedo_r[i] = 0.2f + 0.1f * float(block % 7);
+            features.albedo_g[i] = 0.5f;
+            features.albedo_b[i] = 0.8f - 0.1f * float(block % 4);
+            image.r[i] = features.albedo_r[i] * 4.0f * NextRandomFloat(random);
+            image.g[i] = features.albedo_g[i] * 4.0f * NextRandomFloat(random);
+            image.b[i] = features.albedo_b[i] * 4.0f * NextRandomFloat(random);
+        }
+
+    const DenoiseSettings settings;
+    u32 failures = 0;
+    for (i32 i = 0; i < settings.iterations; i++)
+    {
+        const float error = DenoiseIterationSimdError(image, features, settings, 1 << i);
+        if (error > 0.001f)
+        {
+            printf("denoise step %d: AVX and scalar differ by %f\n", 1 << i, error);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static void CheckHeadlessFrame(HeadlessRun& run)
+{
+    const RenderRecord& record = GetRenderRecord();
+    const u32 draws = u32(record.counts[+RenderCommand::Draw] + record.counts[+RenderCommand::DrawInstanced] + record.counts[+RenderCommand::DrawIndexed]);
+    bool valid = true;
+    if (record.counts[+RenderCommand::Present] != 1)
+    {
+        printf("frame %d: %u presents\n", run.frame, u32(record.counts[+RenderCommand::Present]));
+        valid = false;
+    }
+    if (!draws)
+    {
+        printf("frame %d: nothing was drawn\n", run.frame);
+        valid = false;
+    }
+    if (HeadlessFrameIsCulled(run) && g_renderer.primitives_culled < u32(HeadlessCubeCount(run)))
+    {
+        printf("frame %d: %u of %d cubes culled\n", run.frame, g_renderer.primitives_culled, HeadlessCubeCount(run));
+        valid = false;
+    }
+    if (run.frame >= 2 * HEADLESS_CYCLE && record.counts[+RenderCommand::CreateBuffer])
+    {
+        printf("frame %d: %u buffers created\n", run.frame, u32(record.counts[+RenderCommand::CreateBuffer]));
+        valid = false;
+    }
+    run.failures += !valid;
+    run.frame++;
+    if (run.frame == run.frames)
+    {
+        printf("%d frames, %u failed, last frame: %zu commands, %u draws, %.1f KB uploaded\n", run.frames, run.failures,
+            record.commands.size(), draws, record.bytes[+RenderCommand::UploadBuffer] / 1024.0f);
+        g_running = false;
+    }
+}
+#endif
+
 int main(int argc, char* argv[])
 {
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+    HeadlessRun headless = ParseHeadlessRun(argc, argv);
+    if (headless.frames)
+        headless.failures += CheckHeadlessDenoise();
+    if (headless.frames)
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+#endif
     //Initilizers
     InitializeVideo();
 
@@ -77,83 +311,80 @@ int main(int argc, char* argv[])
 
 
     VoxData voxels;
+    std::vector<std::vector<u8>> voxel_mips;
+    std::vector<EmissiveLight> emissive_lights;
+    VoxelFaceTable voxel_faces;
+    IrradianceCache irradiance_cache;
+    SunVisibility sun_visibility;
+    LightingEnvironment lighting;
     LoadVoxFile(voxels, "assets/Test_01.vox");
     //LoadVoxFile(voxels, "assets/castle.vox");
-#if RASTERIZED_RENDERING == 1
-    std::vector<Vertex_Voxel> voxel_vertices;
-    u32 vox_mesh_index_count = CreateMeshFromVox(voxel_vertices, voxels);
-    if (voxel_vertices.size())
-        g_renderer.voxel_rast_vb->Upload(voxel_vertices.data(), voxel_vertices.size(), sizeof(voxel_vertices[0]));
-    assert(vox_mesh_index_count);
-#endif
+    std::vector<u8> voxel_face_ao;
+    //Reference renders of the current view, compared on request from the render settings
+    CpuRenderer cpu_renderer;
+    CpuRenderer cpu_reference;
+    float cpu_render_error = 0.0f;
+    WavefrontRenderer wavefront_renderer;
+    VoxelMesherStats mesher_stats[+VoxelMesher::Count] = {};
+    u64 voxel_mesh_upload_bytes = 0;    //Of the last edit
+    //Camera of the last frame for the temporal reprojection
+    Mat4 previous_projection_from_view = {};
+    Mat4 previous_view_from_world = {};
+    //The lighting the temporal history was accumulated under
+    Vec3 previous_sun_position = lighting.sun_position;
+    Mat4 previous_view_from_projection = {};
 
     {
-        Texture::TextureParams voxel_indices_parameters = {
-            .size = { VOXEL_MAX_SIZE, VOXEL_MAX_SIZE, VOXEL_MAX_SIZE },
-            .format = Texture::Format_R8_UINT,
-            .mode = Texture::Address_Clamp,
-            .filter = Texture::Filter_Point,
-            .render_target = false,
-            .bytes_per_pixel = sizeof(voxels.color_indices[0].e[0][0][0]),
-        };
-
-        i32 mip_levels = 1;
-        std::vector<u8*> mip_data;
-        mip_data.push_back((u8*)voxels.color_indices[0].e);
-        for (i32 mip_level = mip_levels; VOXEL_MAX_SIZE >> mip_level > 0; mip_level++)
-        {
-            mip_levels++;
-            const i32 read_dim = VOXEL_MAX_SIZE >> (mip_level - 1);
-            const i32 write_dim = VOXEL_MAX_SIZE >> mip_level;
-            const u8* ref = mip_data[mip_level - 1];
-            u8* data = new u8[write_dim * write_dim * write_dim];
-            for (i32 x = 0; x < write_dim; x++)
-            {
-                for (i32 y = 0; y < write_dim; y++)
-                {
-                    for (i32 z = 0; z < write_dim; z++)
-                    {
-                        const u32 x_base = u32(x) << 1;
-                        const u32 y_base = u32(y) << 1;
-                        const u32 z_base = u32(z) << 1;
-
-                        u8 r = ref[(read_dim * read_dim * x_base) + (read_dim * y_base) + z_base];
-                        r |= ref[(read_dim * read_dim * (x_base + 1)) + (read_dim * (y_base + 0)) + (z_base + 0)];
-                        r |= ref[(read_dim * read_dim * (x_base + 1)) + (read_dim * (y_base + 1)) + (z_base + 0)];
-                        r |= ref[(read_dim * read_dim * (x_base + 0)) + (read_dim * (y_base + 1)) + (z_base + 0)];
-                        r |= ref[(read_dim * read_dim * (x_base + 0)) + (read_dim * (y_base + 1)) + (z_base + 1)];
-                        r |= ref[(read_dim * read_dim * (x_base + 0)) + (read_dim * (y_base + 0)) + (z_base + 1)];
-                        r |= ref[(read_dim * read_dim * (x_base + 1)) + (read_dim * (y_base + 0)) + (z_base + 1)];
-                        r |= ref[(read_dim * read_dim * (x_base + 1)) + (read_dim * (y_base + 1)) + (z_base + 1)];
-
-                        data[(z)+(y * write_dim) + (x * write_dim * write_dim)] = r;
-                    }
-                }
-            }
-            mip_data.push_back(data);
-        }
-        CreateTexture(&g_renderer.textures[Texture::Index_Voxel_Indices], voxel_indices_parameters, mip_levels, (u8*)mip_data[0]);
-        for (int mip_level = 0; mip_level < mip_levels; mip_level++)
-        {
-            const i32 dim = VOXEL_MAX_SIZE >> mip_level;
-            const i32 width = dim * sizeof(VoxelBlockData::e[0][0][0]);
-            UpdateTexture(&g_renderer.textures[Texture::Index_Voxel_Indices], mip_level, mip_data[mip_level], width, width * dim);
-        }
-        for (i32 i = 1; i < mip_data.size(); i++)
-        {
-            delete mip_data[i];
-        }
+        UploadVoxelIndices(voxel_mips, voxels.color_indices[0]);
         CreateGpuBuffer(&g_renderer.structure_voxel_materials,"voxel_materials", false, GpuBuffer::Type::Structure);
-        g_renderer.structure_voxel_materials->Upload(voxels.materials, VOXEL_PALETTE_MAX, sizeof(voxels.materials[0]));
+        ShadingMaterial shading_materials[VOXEL_PALETTE_MAX];
+        PackShadingMaterials(shading_materials, voxels.material_table);
+        g_renderer.structure_voxel_materials->Upload(shading_materials, VOXEL_PALETTE_MAX, sizeof(shading_materials[0]));
+
+        BuildEmissiveLights(emissive_lights, voxels);
+        CreateGpuBuffer(&g_renderer.structure_emissive_lights, "emissive_lights", false, GpuBuffer::Type::Structure);
+        UploadStructuredData(g_renderer.structure_emissive_lights, emissive_lights);
+
+        BuildVoxelFaceTable(voxel_faces, voxels);
+        ResetIrradianceCache(irradiance_cache, voxel_faces);
+        CreateGpuBuffer(&g_renderer.structure_voxel_faces, "voxel_faces", false, GpuBuffer::Type::Structure);
+        g_renderer.structure_voxel_faces->Upload(voxel_faces.voxels);
+        CreateGpuBuffer(&g_renderer.structure_irradiance_cache, "irradiance_cache", false, GpuBuffer::Type::Structure);
+        UploadStructuredData(g_renderer.structure_irradiance_cache, irradiance_cache.irradiance);
+
+        ResetSunVisibility(sun_visibility, voxel_faces);
+        UpdateSunVisibility(sun_visibility, voxel_faces, voxels, lighting.sun_position);
+        CreateGpuBuffer(&g_renderer.structure_sun_visibility, "sun_visibility", false, GpuBuffer::Type::Structure);
+        UploadStructuredData(g_renderer.structure_sun_visibility, sun_visibility.visibility);
+
+        BakeFaceAO(voxel_face_ao, voxel_faces, voxels.color_indices[0]);
+        CreateGpuBuffer(&g_renderer.structure_voxel_face_ao, "voxel_face_ao", false, GpuBuffer::Type::Structure);
+        UploadFaceAO(voxel_face_ao);
     }
+    //Kept up to date so the raster path can be switched on at any time
+    VoxelMeshLods voxel_mesh;
+    ResetVoxelMesh(voxel_mesh);
+    UpdateVoxelMesh(voxel_mesh, voxels, voxel_faces, voxel_face_ao, voxel_mips);
+    voxel_mesh_upload_bytes = UploadVoxelMesh(voxel_mesh);
 
     while (g_running)
     {
         {
             ZoneScopedN("Frame Update:");
+            ResetFrameArena();
             totalTime = SDL_GetPerformanceCounter() / freq - startTime;
             float deltaTime = float(totalTime - previousTime);// / 10;
             previousTime = totalTime;
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+            //The same frames on every run
+            if (headless.frames)
+            {
+                deltaTime = 1.0f / 60.0f;
+                totalTime = headless.frame * double(deltaTime);
+                camera_yaw += tau / 240.0f;
+                camera_dis = 40.0f;
+            }
+#endif
             //TODO: Time stepping for simulation
             //if (deltaTime > (1.0f / 60.0f))
                 //deltaTime = (1.0f / 60.0f);
@@ -430,6 +661,10 @@ int main(int argc, char* argv[])
                 AddCubeToRender({ scale, 0, 0 }, Red,   { scale_double, scale_half,     scale_half   }, false);
                 AddCubeToRender({ 0, scale, 0 }, Green, { scale_half,   scale_double,   scale_half   }, false);
                 AddCubeToRender({ 0, 0, scale }, Blue,  { scale_half,   scale_half,     scale_double }, false);
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+                if (headless.frames)
+                    AddHeadlessFrame(headless);
+#endif
 
 #if 0
                 for (i32 x = -1; x < 2; x++)
@@ -458,9 +693,7 @@ int main(int argc, char* argv[])
                 float transformInformationWidth = 0.0f;
                 {
                     // Start the Dear ImGui frame
-                    ImGui_ImplDX11_NewFrame();
-                    ImGui_ImplSDL2_NewFrame(g_renderer.SDL_Context);
-                    ImGui::NewFrame();
+                    NewImGuiFrame();
 
                     const float PAD = 5.0f;
                     ImGuiIO& io = ImGui::GetIO();
@@ -503,14 +736,189 @@ int main(int argc, char* argv[])
 
                             ImGui::EndTable();
                         }
+                        const FrameArenaStats& arena = GetFrameArenaStats();
+                        ImGui::Text("Frame arena: %llu allocations, %.0f / %.0f KB", arena.allocations, arena.bytes / 1024.0f, arena.capacity / 1024.0f);
+                        ImGui::Text("Heap: %llu arena spills, %llu operator new", arena.heap_allocations, arena.operator_new_calls);
+                        ImGui::Text("Primitives: %u drawn, %u culled", g_renderer.primitives_drawn, g_renderer.primitives_culled);
+                        const UploadRingStats& upload_ring = GetUploadRingStats();
+                        ImGui::Text("Upload ring: %.0f / %.0f KB, %u grows, %u fence waits", upload_ring.bytes / 1024.0f, upload_ring.capacity / 1024.0f, upload_ring.grows, upload_ring.fence_waits);
+                        const RenderStateStats& state_binds = GetRenderStateStats();
+                        ImGui::Text("State binds: %llu submitted, %llu filtered", state_binds.submitted, state_binds.filtered);
+                    }
+                    ImGui::End();
+
+                    window_pos.x = work_pos.x + viewport->WorkSize.x - PAD;
+                    ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always, { 1.0f, 0.0f });
+                    ImGui::SetNextWindowBgAlpha(0.35f);
+                    if (ImGui::Begin("Render Settings", nullptr, windowFlags & ~ImGuiWindowFlags_NoNav))
+                    {
+                        ImGui::Checkbox("Rasterize Voxels", &g_renderer.raster_voxels);
+                        {
+                            const VoxelChunkedMesh& level = voxel_mesh.levels[0];
+                            ImGui::Text("Raster mesh: %u chunks remeshed, %.2fms, %.1f KB uploaded", level.chunks_meshed,
+                                level.milliseconds, voxel_mesh_upload_bytes / 1024.0f);
+                            ImGui::Text("Raster indices: %u drawn, %u culled by direction, %u at level 0", voxel_mesh.selected_indices,
+                                voxel_mesh.culled_indices, voxel_mesh.full_indices);
+                        }
+                        ImGui::SliderInt("Max Bounces",     &g_renderer.max_bounces,            1, 8);
+                        ImGui::SliderInt("Roulette Depth",  &g_renderer.russian_roulette_depth, 0, 8);
+                        const u32 cache_rays_min = 0;
+                        const u32 cache_rays_max = 65536;
+                        ImGui::Checkbox("Irradiance Cache", &g_renderer.irradiance_cache_enabled);
+                        ImGui::SliderScalar("Cache Rays",   ImGuiDataType_U32, &irradiance_cache.rays_per_frame, &cache_rays_min, &cache_rays_max);
+                        ImGui::DragFloat3("Sun Position",   lighting.sun_position.e, 0.5f);
+                        ImGui::Checkbox("Baked Sun Visibility", &g_renderer.sun_visibility_enabled);
+                        ImGui::Checkbox("Ambient Occlusion", &g_renderer.ambient_occlusion_enabled);
+                        ImGui::Checkbox("Temporal Accumulation", &g_renderer.temporal_enabled);
+                        ImGui::SliderInt("Max History",     &g_renderer.temporal_max_history,   1, 64);
+                        ImGui::Combo("Render Scale", reinterpret_cast<i32*>(&g_renderer.render_scale), renderScaleNames, +RenderScale::Count);
+                        ImGui::SliderFloat("LOD Bias",      &g_renderer.lod_bias,               0.0f, 4.0f);
+                        ImGui::SliderInt("CPU Bounces",     &cpu_renderer.bounces,              0, 4);
+                        ImGui::Checkbox("Bin Secondary Rays", &cpu_renderer.bin_secondary_rays);
+                        const CpuCamera cpu_camera = {
+                            .position = camera_pos_world,
+                            .view_from_projection = view_from_projection,
+                            .world_from_view = world_from_view,
+                            .cone_spread = GetConeSpread(g_renderer.size, { camera_pos_world, view_from_projection, world_from_view }, g_renderer.lod_bias),
+                        };
+                        const CpuScene cpu_scene = {
+                            .voxels = &voxels,
+                            .faces = &voxel_faces,
+                            .sun = g_renderer.sun_visibility_enabled ? &sun_visibility : nullptr,
+                            .irradiance = g_renderer.irradiance_cache_enabled ? &irradiance_cache : nullptr,
+                            .face_ao = g_renderer.ambient_occlusion_enabled ? &voxel_face_ao : nullptr,
+                            .environment = &lighting,
+                            .mips = &voxel_mips,
+                            .background = srgb_to_linear(backgroundColor).rgb,
+                        };
+                        if (ImGui::Button("Compare CPU Render"))
+                        {
+                            cpu_renderer.render_scale = g_renderer.render_scale;
+                            cpu_reference.render_scale = RenderScale::Full;
+                            cpu_reference.bounces = cpu_renderer.bounces;
+                            cpu_reference.bin_secondary_rays = cpu_renderer.bin_secondary_rays;
+                            cpu_renderer.denoise = cpu_reference.denoise = g_renderer.denoise_enabled;
+                            cpu_renderer.denoise_settings = cpu_reference.denoise_settings = g_renderer.denoise_settings;
+                            CpuRender(cpu_renderer, g_renderer.size, cpu_camera, cpu_scene);
+                            CpuRender(cpu_reference, g_renderer.size, cpu_camera, cpu_scene);
+                            cpu_render_error = ImageDifference(cpu_renderer.output, cpu_reference.output);
+                        }
+                        if (cpu_reference.shading_rays)
+                        {
+                            ImGui::Text("%s: %llu + %llu guide rays, %.1fms", renderScaleNames[+cpu_renderer.render_scale],
+                                cpu_renderer.shading_rays, cpu_renderer.guide_rays, cpu_renderer.milliseconds);
+                            ImGui::Text("Full: %llu rays, %.1fms, difference %.5f",
+                                cpu_reference.shading_rays, cpu_reference.milliseconds, cpu_render_error);
+                            if (cpu_reference.secondary_rays_traced)
+                            {
+                                ImGui::Text("Secondary: %.2f Mrays/s, %llu bin changes",
+                                    float(cpu_reference.secondary_rays_traced) / (Max(cpu_reference.secondary_milliseconds, 0.001f) * 1000.0f),
+                                    cpu_reference.secondary_bin_changes);
+                            }
+                            if (cpu_reference.denoise)
+                                ImGui::Text("Denoise: %.1fms, %.1fms full", cpu_renderer.denoise_milliseconds, cpu_reference.denoise_milliseconds);
+                        }
+                        if (ImGui::Button("Wavefront Render"))
+                        {
+                            wavefront_renderer.bounces = cpu_renderer.bounces;
+                            WavefrontRender(wavefront_renderer, g_renderer.size, cpu_camera, cpu_scene);
+                        }
+                        if (wavefront_renderer.accumulated_frames)
+                        {
+                            ImGui::Text("Wavefront: %u frames, %.1fms, %u instances culled", wavefront_renderer.accumulated_frames,
+                                wavefront_renderer.milliseconds, wavefront_renderer.instances_culled);
+                            ImGui::Text("    %u dispatches on %u pooled threads", wavefront_renderer.dispatches, GetWorkerThreadCount());
+                            for (i32 i = 0; i < +WavefrontStage::Count; i++)
+                                ImGui::Text("    %s: %llu, %.2fms", wavefrontStageNames[i], wavefront_renderer.stage_items[i], wavefront_renderer.stage_milliseconds[i]);
+                        }
+                        if (ImGui::Button("Compare Meshers"))
+                            CompareVoxelMeshers(mesher_stats, voxels, voxel_faces, voxel_face_ao);
+                        for (i32 i = 0; i < +VoxelMesher::Count; i++)
+                        {
+                            const VoxelMesherStats& mesher = mesher_stats[i];
+                            if (mesher.vertices)
+                                ImGui::Text("%s mesh: %u vertices, %u indices, %.0f KB, %.2fms", voxelMesherNames[i],
+                                    mesher.vertices, mesher.indices, mesher.bytes / 1024.0f, mesher.milliseconds);
+                        }
+                        DenoiseSettings& denoise = g_renderer.denoise_settings;
+                        ImGui::Checkbox("Denoise", &g_renderer.denoise_enabled);
+                        ImGui::SliderInt("Iterations",      &denoise.iterations,    1, 6);
+                        ImGui::SliderFloat("Sigma Color",   &denoise.sigma_color,   0.1f, 16.0f);
+                        ImGui::SliderFloat("Sigma Normal",  &denoise.sigma_normal,  1.0f, 128.0f);
+                        ImGui::SliderFloat("Sigma Depth",   &denoise.sigma_depth,   0.1f, 8.0f);
+                        ImGui::SliderFloat("Sigma Albedo",  &denoise.sigma_albedo,  0.01f, 1.0f);
                     }
                     ImGui::End();
                 }
             }
 
 
+            //Left click removes the voxel under the mouse, right click places one on the face that was hit
+            if (voxel_hit_result.success)
+            {
+                const Vec3I hit_voxel = ToVec3I(Floor(voxel_hit_result.p - voxel_hit_result.normal * 0.5f));
+                bool edited = false;
+                Vec3I edit_p = {};
+                if (playerInput.keyStates[SDL_BUTTON_LEFT].downThisFrame)
+                {
+                    edit_p = hit_voxel;
+                    edited = SetVoxel(voxels, edit_p, 0);
+                }
+                else if (playerInput.keyStates[SDL_BUTTON_RIGHT].downThisFrame)
+                {
+                    edit_p = hit_voxel + ToVec3I(voxel_hit_result.normal);
+                    edited = SetVoxel(voxels, edit_p, u8(voxel_hit_result.success));
+                }
+
+                if (edited)
+                {
+                    ZoneScopedN("Voxel Edit");
+                    //The history still shows the old voxels and their lighting
+                    g_renderer.temporal_history_valid = false;
+                    UploadVoxelIndices(voxel_mips, voxels.color_indices[0]);
+                    BuildEmissiveLights(emissive_lights, voxels);
+                    UploadStructuredData(g_renderer.structure_emissive_lights, emissive_lights);
+
+                    VoxelFaceTable new_voxel_faces;
+                    BuildVoxelFaceTable(new_voxel_faces, voxels);
+                    RemapFaceData(irradiance_cache.irradiance, voxel_faces, new_voxel_faces, Vec4({}));
+                    RemapFaceData(sun_visibility.visibility, voxel_faces, new_voxel_faces, 0.0f);
+                    RemapFaceData(voxel_face_ao, voxel_faces, new_voxel_faces, u8(0));
+                    irradiance_cache.cursor = 0;
+                    voxel_faces = std::move(new_voxel_faces);
+                    InvalidateSunVisibility(sun_visibility, edit_p, edit_p);
+                    UploadStructuredData(g_renderer.structure_voxel_faces, voxel_faces.voxels);
+                    UploadStructuredData(g_renderer.structure_irradiance_cache, irradiance_cache.irradiance);
+                    UpdateFaceAO(voxel_face_ao, voxel_faces, voxels.color_indices[0], edit_p, edit_p);
+                    UploadFaceAO(voxel_face_ao);
+                    InvalidateVoxelMesh(voxel_mesh, edit_p, edit_p);
+                    UpdateVoxelMesh(voxel_mesh, voxels, voxel_faces, voxel_face_ao, voxel_mips);
+                    voxel_mesh_upload_bytes = UploadVoxelMesh(voxel_mesh);
+                }
+            }
+
+            if (previous_sun_position != lighting.sun_position)
+            {
+                g_renderer.temporal_history_valid = false;
+                previous_sun_position = lighting.sun_position;
+            }
+            if (g_renderer.sun_visibility_enabled)
+            {
+                if (UpdateSunVisibility(sun_visibility, voxel_faces, voxels, lighting.sun_position))
+                    UploadStructuredData(g_renderer.structure_sun_visibility, sun_visibility.visibility);
+            }
+            if (g_renderer.irradiance_cache_enabled && irradiance_cache.irradiance.size())
+            {
+                const SunVisibility* baked_sun = g_renderer.sun_visibility_enabled ? &sun_visibility : nullptr;
+                const u32 first_face = irradiance_cache.cursor;
+                const u32 updated = UpdateIrradianceCache(irradiance_cache, voxel_faces, voxels, lighting, baked_sun);
+                if (updated)
+                    UploadIrradianceRange(irradiance_cache, first_face, updated);
+            }
+
             RenderUpdate(g_renderer.size, deltaTime);
 
+            const TraceLayout trace_layout = GetTraceLayout(g_renderer.render_scale, g_renderer.size, g_renderer.frame_index);
             CB_Common common = {
                 .projection_from_view = projection_from_view,
                 .view_from_world = view_from_world,
@@ -521,51 +929,59 @@ int main(int argc, char* argv[])
                 .voxel_size = voxels.size,
                 .total_time = float(totalTime),
                 .camera_position = camera_pos_world,
-                ._pad0 = 0.0f,
+                .lod_cone_spread = GetConeSpread(g_renderer.size, { camera_pos_world, view_from_projection, world_from_view }, g_renderer.lod_bias),
+                .emissive_light_count = u32(emissive_lights.size()),
+                .max_bounces = u32(g_renderer.max_bounces),
+                .russian_roulette_depth = u32(g_renderer.russian_roulette_depth),
+                .temporal_max_history = g_renderer.temporal_enabled ? u32(g_renderer.temporal_max_history) : 0,
+                .sun_position = lighting.sun_position,
+                .irradiance_cache_enabled = u32(g_renderer.irradiance_cache_enabled),
+                .sun_visibility_enabled = u32(g_renderer.sun_visibility_enabled),
+                .ambient_occlusion_enabled = u32(g_renderer.ambient_occlusion_enabled),
+                .frame_index = g_renderer.frame_index,
+                .temporal_history_valid = u32(g_renderer.temporal_history_valid),
+                .trace_size = trace_layout.trace_size,
+                .trace_scale = trace_layout.scale,
+                .checkerboard_enabled = u32(trace_layout.checkerboard),
+                .previous_projection_from_view = previous_projection_from_view,
+                .previous_view_from_world = previous_view_from_world,
+                .previous_view_from_projection = previous_view_from_projection,
             };
+            previous_projection_from_view   = projection_from_view;
+            previous_view_from_world        = view_from_world;
+            previous_view_from_projection   = view_from_projection;
             g_renderer.cb_common->Upload(&common, 1, sizeof(common));
             g_renderer.cb_common->Bind(SLOT_CB_COMMON, GpuBuffer::BindLocation::All);
 
-#if RASTERIZED_RENDERING == 0
-            //Pathtraced voxel rendering
+            if (g_renderer.raster_voxels)
             {
-                ZoneScopedN("Voxel Render");
-                DrawPathTracedVoxels();
+                ZoneScopedN("Voxel Raster");
+                SelectVoxelMeshLods(voxel_mesh, camera_pos_world, common.lod_cone_spread);
+                DrawRasterizedVoxels(voxel_mesh);
+                //Nothing was accumulated this frame
+                g_renderer.temporal_history_valid = false;
             }
-#else
-
-
-
-            //Rasterized voxel rendering
+            else
             {
-                //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                g_renderer.shaders[+Shader::Voxel_Rast]->UseShader();
-                g_renderer.voxel_rast_ib->Bind();
-                g_renderer.voxel_rast_vb->Bind();
-
-                glEnable(GL_DEPTH_TEST);
-                glDepthMask(GL_TRUE);
-
-                glEnableVertexArrayAttrib(g_renderer.vao, 0);
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex_Voxel), (void*)offsetof(Vertex_Voxel, p));
-                glEnableVertexArrayAttrib(g_renderer.vao, 1);
-                glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT,   sizeof(Vertex_Voxel), (void*)offsetof(Vertex_Voxel, rgba));
-                glEnableVertexArrayAttrib(g_renderer.vao, 2);
-                glVertexAttribIPointer(2, 1, GL_UNSIGNED_BYTE,  sizeof(Vertex_Voxel), (void*)offsetof(Vertex_Voxel, n));
-                glEnableVertexArrayAttrib(g_renderer.vao, 3);
-                glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE,  sizeof(Vertex_Voxel), (void*)offsetof(Vertex_Voxel, ao));
-
-                g_renderer.shaders[+Shader::Voxel_Rast]->UpdateUniformMat4("u_projection_from_view", 1, false, projection_from_view.e);
-                g_renderer.shaders[+Shader::Voxel_Rast]->UpdateUniformMat4("u_view_from_world",        1, false, view_from_world.e);
-
-                glDrawElements(GL_TRIANGLES, vox_mesh_index_count, GL_UNSIGNED_INT, 0);
+                //Pathtraced voxel rendering
+                {
+                    ZoneScopedN("Voxel Render");
+                    DrawPathTracedVoxels();
+                }
+                {
+                    ZoneScopedN("Voxel Temporal");
+                    AccumulatePathTracedVoxels();
+                }
+                {
+                    ZoneScopedN("Voxel Denoise");
+                    DenoisePathTracedVoxels();
+                }
             }
-#endif
 
             {
                 ZoneScopedN("Cube Render");
                 g_renderer.cb_common->Bind(SLOT_CB_COMMON, GpuBuffer::BindLocation::All);
-                RenderPrimitives();
+                RenderPrimitives(ComputeFrustum(projection_from_view * view_from_world));
             }
             {
                 ZoneScopedN("Final Draw");
@@ -576,8 +992,7 @@ int main(int argc, char* argv[])
                 ZoneScopedN("ImGui Render");
                 if (showIMGUI)
                 {
-                    ImGui::Render();
-                    ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
+                    RenderImGui();
                 }
             }
         }
@@ -585,16 +1000,23 @@ int main(int argc, char* argv[])
             ZoneScopedN("Frame End");
             RenderPresent();
         }
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+        if (headless.frames)
+            CheckHeadlessFrame(headless);
+#endif
         FrameMark;
     }
     // Cleanup
-    ImGui_ImplDX11_Shutdown();
-    ImGui_ImplSDL2_Shutdown();
+    ShutdownImGui();
     ImGui::DestroyContext();
 
     //SDL_GL_DeleteContext(g_renderer.GL_Context);
     SDL_DestroyWindow(g_renderer.SDL_Context);
     SDL_Quit();
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+    return i32(headless.failures);
+#else
     return 0;
+#endif
 
 }
@@ -1,4 +1,7 @@
 #include "Math.h"
+#include "Intrinsics.h"
+
+#include <bit>
 
 //uint32 PCG32_Random_R(uint64& state, uint64& inc)
 //{
@@ -164,40 +167,11 @@ float Bilinear(float p00, float p10, float p01, float p11, float x, float y)
 //    return ToChunk(ToGame(a));
 //}
 
-static void matd_mul(float out[4][4], float src1[4][4], float src2[4][4])
-{
-   int i,j,k;
-   for (j=0; j < 4; ++j)
-      for (i=0; i < 4; ++i) {
-         float t=0;
-         for (k=0; k < 4; ++k)
-            t += src1[k][i] * src2[j][k];
-         out[i][j] = t;
-      }
-}
-
+//Planes point inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0.
+//The depth range is [0, 1] like gb_mat4_perspective_directx_rh
 Frustum ComputeFrustum(const Mat4& in)
 {
     Frustum result = {};
-    Mat4 test1 = {};
-    test1.col[3] = {1, 20, 0, 1};
-    test1.col[0] = {3, 4, 0, 0};
-    test1.col[1] = {300, 0, 1, 30};
-    Mat4 test2 = {};
-    test2.col[3] = {20, 0.11f, 13, 0};
-    test2.col[0] = {3, 12, 0.12f, 0.3f};
-    test2.col[1] = {0, 1, 100, 18};
-
-    assert(false); //Is matd_mul() actually used?
-    float out[4][4];
-    float in1[4][4];
-    float in2[4][4];
-
-    memcpy(in1, test1.e, sizeof(in1));
-    memcpy(in2, test2.e, sizeof(in2));
-
-    matd_mul(out, in1, in2);
-    Mat4 testOut = test1 * test2;
     Mat4 mvProj = in;
     gb_mat4_transpose<float>(mvProj);
 
@@ -207,7 +181,7 @@ Frustum ComputeFrustum(const Mat4& in)
         (&result.e[1].x)[i] = mvProj.col[3].e[i] - mvProj.col[0].e[i];
         (&result.e[2].x)[i] = mvProj.col[3].e[i] + mvProj.col[1].e[i];
         (&result.e[3].x)[i] = mvProj.col[3].e[i] - mvProj.col[1].e[i];
-        (&result.e[4].x)[i] = mvProj.col[3].e[i] + mvProj.col[2].e[i];
+        (&result.e[4].x)[i] = mvProj.col[2].e[i];
         (&result.e[5].x)[i] = mvProj.col[3].e[i] - mvProj.col[2].e[i];
     }
     return result;
@@ -227,12 +201,58 @@ i32 TestPlane(const Plane *p, float x0, float y0, float z0, float x1, float y1,
 bool IsBoxInFrustum(const Frustum& f, float *bmin, float *bmax)
 {
    i32 i;
-   for (i=0; i < 5; ++i)
+   for (i=0; i < FRUSTUM_TESTED_PLANES; ++i)
       if (!TestPlane(&f.e[i], bmin[0], bmin[1], bmin[2], bmax[0], bmax[1], bmax[2]))
          return 0;
    return 1;
 }
 
+u32 CullBoxesToFrustum(u32* visible_indices, const Frustum& f, const AABBSoA& boxes)
+{
+    const float* mins[3] = { boxes.min_x, boxes.min_y, boxes.min_z };
+    const float* maxs[3] = { boxes.max_x, boxes.max_y, boxes.max_z };
+    //Only the corner furthest along the plane normal has to be tested
+    const float* corners[FRUSTUM_TESTED_PLANES][3] = {};
+    for (i32 plane = 0; plane < FRUSTUM_TESTED_PLANES; plane++)
+        for (i32 axis = 0; axis < 3; axis++)
+            corners[plane][axis] = (&f.e[plane].x)[axis] > 0 ? maxs[axis] : mins[axis];
+
+    u32 visible_count = 0;
+    u32 i = 0;
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= boxes.count; i += 8)
+    {
+        __m256 outside = zero;
+        for (i32 plane = 0; plane < FRUSTUM_TESTED_PLANES; plane++)
+        {
+            const Plane& p = f.e[plane];
+            const __m256 d = _mm256_add_ps(DotProduct_256(
+                _mm256_loadu_ps(corners[plane][0] + i), _mm256_loadu_ps(corners[plane][1] + i), _mm256_loadu_ps(corners[plane][2] + i),
+                _mm256_set1_ps(p.x), _mm256_set1_ps(p.y), _mm256_set1_ps(p.z)), _mm256_set1_ps(p.w));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, zero, _CMP_LT_OQ));
+        }
+        u32 visible_mask = ~u32(_mm256_movemask_ps(outside)) & 0xFF;
+        while (visible_mask)
+        {
+            const u32 bit = u32(std::countr_zero(visible_mask));
+            visible_indices[visible_count++] = i + bit;
+            visible_mask &= visible_mask - 1;
+        }
+    }
+    for (; i < boxes.count; i++)
+    {
+        bool inside = true;
+        for (i32 plane = 0; plane < FRUSTUM_TESTED_PLANES && inside; plane++)
+        {
+            const Plane& p = f.e[plane];
+            inside = corners[plane][0][i] * p.x + corners[plane][1][i] * p.y + corners[plane][2][i] * p.z + p.w >= 0;
+        }
+        if (inside)
+            visible_indices[visible_count++] = i;
+    }
+    return visible_count;
+}
+
 i32 ManhattanDistance(Vec3I a, Vec3I b)
 {
     return abs(a.x - b.x) + abs(a.y - b.y) + abs(a.z - b.z);
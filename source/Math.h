@@ -131,15 +131,12 @@ struct Vertex {
 };
 
 #pragma pack(push, 1)
-struct Vertex_Cube {
-    Color color;
+//One cube or tetrahedron, drawn instanced over a shared unit mesh
+struct Vertex_PrimitiveInstance {
     Vec3 p;
-    Vec2 uv;
-};
-struct Vertex_Tetra {
-    Color color;
-    Vec3 p;
-    Vec3 n;
+    Vec3 scale;
+    u32  color;     //ColorInt, R8G8B8A8_UNORM
+    u32  direction; //Tetrahedrons only, forward * 0.5 + 0.5 as R10G10B10A2_UNORM
 };
 #pragma pack(pop)
 
@@ -504,6 +501,33 @@ MATH_PREFIX Vec3 Lerp(const Vec3& a, const Vec3& b, const Vec3& t)
     return a + (b - a) * t;
 }
 
+MATH_PREFIX Vec3 Step(Vec3 a, float b)
+{
+    Vec3 r = {};
+    if (b > a.x)
+        r.x = 1;
+    if (b > a.y)
+        r.y = 1;
+    if (b > a.z)
+        r.z = 1;
+    return r;
+}
+
+// Converts a color from sRGB gamma to linear light gamma
+MATH_PREFIX Vec4 srgb_to_linear(Vec4 sRGB)
+{
+    Vec3 cutoff = Step(sRGB.rgb, 0.04045f);
+    // abs is here to silence compiler warning
+    Vec3 a = (Abs(sRGB.rgb) + 0.055f) / 1.055f;
+    Vec3 higher;
+    higher.x = powf(a.x, 2.4f);
+    higher.y = powf(a.y, 2.4f);
+    higher.z = powf(a.z, 2.4f);
+    Vec3 lower = sRGB.rgb / 12.92f;
+    Vec3 result = Lerp(higher, lower, cutoff);
+    return Vec4(result.r, result.g, result.b, sRGB.a);
+}
+
 MATH_PREFIX Vec3 Converge(const Vec3& value, const Vec3& target, float rate, float dt)
 {
     return Lerp(target, value, exp2(-rate * dt));
@@ -653,6 +677,25 @@ MATH_PREFIX float RandomFloat(const float min, const float max)
     return min + (max - min) * (rand() / float(RAND_MAX));
 }
 
+//xorshift32, cheap random numbers for CPU sampling where rand() would be shared between threads
+struct RandomState {
+    u32 state = 0x9E3779B9;
+};
+MATH_PREFIX u32 NextRandomU32(RandomState& r)
+{
+    u32 x = r.state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    r.state = x;
+    return x;
+}
+//[0, 1)
+MATH_PREFIX float NextRandomFloat(RandomState& r)
+{
+    return float(NextRandomU32(r) >> 8) * (1.0f / 16777216.0f);
+}
+
 //Multiplication of two vectors without adding each dimension to get the dot product
 MATH_PREFIX Vec3I HadamardProduct(const Vec3I& a, const Vec3I& b)
 {
@@ -892,6 +935,33 @@ const Vertex vertices_cube_full[] = {
       { { -0.5f, +0.5f, -0.5f }, { 1.0f, 1.0f }, {  0.0f,  0.0f, -1.0f } },
 };
 
+//Tip along +y, Tetra.hlsl turns it towards the direction of the instance
+#define TETRA_TIP   { +0.0f, +0.5f, +0.0f }
+#define TETRA_TOP   { +0.0f, -0.5f, +0.5f }
+#define TETRA_LEFT  { -0.5f, -0.5f, -0.5f }
+#define TETRA_RIGHT { +0.5f, -0.5f, -0.5f }
+const Vec3 tetrahedron_positions[] = {
+    TETRA_LEFT, //bottom
+    TETRA_RIGHT,
+    TETRA_TOP,
+
+    TETRA_LEFT, //z
+    TETRA_TOP,
+    TETRA_TIP,
+
+    TETRA_RIGHT,//x
+    TETRA_LEFT,
+    TETRA_TIP,
+
+    TETRA_TOP,  //xz
+    TETRA_RIGHT,
+    TETRA_TIP,
+};
+#undef TETRA_TIP
+#undef TETRA_TOP
+#undef TETRA_LEFT
+#undef TETRA_RIGHT
+
 const VertexFace smallCubeVertices[6] = {
     // +x
     VertexFace( {
@@ -938,9 +1008,8 @@ const VertexFace smallCubeVertices[6] = {
 };
 
 
-union Triangle {
-    struct { Vec3 p0, p1, p2; };
-    Vec3 e[3];
+struct Triangle {
+    Vec3 p0, p1, p2;
 
     Vec3 Normal() const
     {
@@ -954,8 +1023,24 @@ union Triangle {
     }
 };
 
+//Boxes split into one array per component, count boxes in each
+struct AABBSoA {
+    const float* min_x = nullptr;
+    const float* min_y = nullptr;
+    const float* min_z = nullptr;
+    const float* max_x = nullptr;
+    const float* max_y = nullptr;
+    const float* max_z = nullptr;
+    u32 count = 0;
+};
+
+//The far plane is left out, everything past it is far enough away to be cheap
+#define FRUSTUM_TESTED_PLANES 5
 Frustum ComputeFrustum(const Mat4& mvProj);
 bool IsBoxInFrustum(const Frustum& f, float* bmin, float* bmax);
+//Same test as IsBoxInFrustum for 8 boxes at a time. Writes the index of every box
+//that is at least partly inside to visible_indices in order, returns how many there are
+u32 CullBoxesToFrustum(u32* visible_indices, const Frustum& f, const AABBSoA& boxes);
 i32 ManhattanDistance(Vec3I a, Vec3I b);
 
 
@@ -2,6 +2,8 @@
 #include "Debug.h"
 #include "Vox.h"
 
+#include <cfloat>
+
 //Vec3I GetVoxelPosFromRayPos(Vec3& p, const Vec3& ray_direction)
 //{
 //#if 1
@@ -147,7 +149,7 @@ Vec3 ReflectRay(const Vec3& dir, const Vec3& normal)
     return result;
 }
 
-RaycastResult Linecast(const Ray& ray, VoxData voxels, float length, Vec3 normal)
+static RaycastResult LinecastBlock(const Ray& ray, const VoxelBlockData& block, const Vec3I& size, float length, Vec3 normal)
 {
     assert(length >= 0.0f);
     RaycastResult result = {};
@@ -164,10 +166,10 @@ RaycastResult Linecast(const Ray& ray, VoxData voxels, float length, Vec3 normal
 
     if (voxel_p.x < 0 || voxel_p.y < 0 || voxel_p.z < 0)
         return result;
-    if (voxel_p.x >= voxels.size.x || voxel_p.y >= voxels.size.y || voxel_p.z >= voxels.size.z)
+    if (voxel_p.x >= size.x || voxel_p.y >= size.y || voxel_p.z >= size.z)
         return result;
     result.normal = normal;
-    result.success = voxels.color_indices[0].e[voxel_p.x][voxel_p.y][voxel_p.z];
+    result.success = block.e[voxel_p.x][voxel_p.y][voxel_p.z];
 
     while (!result.success) 
     {
@@ -195,12 +197,11 @@ RaycastResult Linecast(const Ray& ray, VoxData voxels, float length, Vec3 normal
         }
 
         voxel_p = ToVec3I(Floor(p));
-        assert(voxels.color_indices.size() == 1);
         if (voxel_p.x < 0 || voxel_p.y < 0 || voxel_p.z < 0)
             return result;
-        if (voxel_p.x >= voxels.size.x || voxel_p.y >= voxels.size.y || voxel_p.z >= voxels.size.z)
+        if (voxel_p.x >= size.x || voxel_p.y >= size.y || voxel_p.z >= size.z)
             return result;
-        result.success = voxels.color_indices[0].e[voxel_p.x][voxel_p.y][voxel_p.z];
+        result.success = block.e[voxel_p.x][voxel_p.y][voxel_p.z];
     }
     
     u32 comp = (result.normal.x ? 0 : (result.normal.y ? 1 : 2));
@@ -212,8 +213,13 @@ RaycastResult Linecast(const Ray& ray, VoxData voxels, float length, Vec3 normal
     return result;
 }
 
+RaycastResult Linecast(const Ray& ray, const VoxData& voxels, float length, Vec3 normal)
+{
+    return LinecastBlock(ray, voxels.color_indices[0], voxels.size, length, normal);
+}
+
 //http://www.cs.yorku.ca/~amana/research/grid.pdf
-RaycastResult VoxelLinecast(const Ray& ray, VoxData voxels, float length)
+RaycastResult VoxelLinecast(const Ray& ray, const VoxData& voxels, float length)
 {
     assert(length >= 0.0f);
     RaycastResult result = {};
@@ -343,11 +349,11 @@ RaycastResult RayVsAABB(const Ray& ray, const AABB& box)
     return r;
 }
 
-RaycastResult RayVsVoxel(const Ray& ray, const VoxData& voxels)
+RaycastResult RayVsVoxelBlock(const Ray& ray, const VoxelBlockData& block, const Vec3I& size)
 {
     AABB aabb = {
         .min = {},
-        .max = ToVec3(voxels.size),
+        .max = ToVec3(size),
     };
     RaycastResult aabb_result = RayVsAABB(ray, aabb);
     RaycastResult linecast_result = {};
@@ -358,15 +364,119 @@ RaycastResult RayVsVoxel(const Ray& ray, const VoxData& voxels)
         clamped_ray.y = abs(aabb_result.p.y) <= 0.0001f ? 0.0f : aabb_result.p.y;
         clamped_ray.z = abs(aabb_result.p.z) <= 0.0001f ? 0.0f : aabb_result.p.z;
 
-        clamped_ray.x = abs(clamped_ray.x - voxels.size.x) <= 0.0001f ? voxels.size.x - 0.00001f : clamped_ray.x;
-        clamped_ray.y = abs(clamped_ray.y - voxels.size.y) <= 0.0001f ? voxels.size.y - 0.00001f : clamped_ray.y;
-        clamped_ray.z = abs(clamped_ray.z - voxels.size.z) <= 0.0001f ? voxels.size.z - 0.00001f : clamped_ray.z;
+        clamped_ray.x = abs(clamped_ray.x - size.x) <= 0.0001f ? size.x - 0.00001f : clamped_ray.x;
+        clamped_ray.y = abs(clamped_ray.y - size.y) <= 0.0001f ? size.y - 0.00001f : clamped_ray.y;
+        clamped_ray.z = abs(clamped_ray.z - size.z) <= 0.0001f ? size.z - 0.00001f : clamped_ray.z;
         Ray linecast_ray = { clamped_ray, ray.direction };
-        linecast_result = Linecast(linecast_ray, voxels, 1000.0f, aabb_result.normal);
+        linecast_result = LinecastBlock(linecast_ray, block, size, 1000.0f, aabb_result.normal);
     }
     return linecast_result;
 }
 
+RaycastResult RayVsVoxel(const Ray& ray, const VoxData& voxels)
+{
+    return RayVsVoxelBlock(ray, voxels.color_indices[0], voxels.size);
+}
+
+RaycastResult RayVsVoxelInstances(const Ray& ray, const VoxData& voxels, const std::vector<u32>* instance_indices)
+{
+    RaycastResult closest = {};
+    float closest_distance = FLT_MAX;
+    const u32 count = u32(instance_indices ? instance_indices->size() : voxels.instances.size());
+    for (u32 i = 0; i < count; i++)
+    {
+        const VoxInstance& instance = voxels.instances[instance_indices ? (*instance_indices)[i] : i];
+        //Rotations only swap and negate axes so the model space ray walks the same cells
+        const Ray local = {
+            .origin = InverseRotate(instance.rotation, ray.origin - instance.position) + instance.pivot,
+            .direction = InverseRotate(instance.rotation, ray.direction),
+        };
+        const Vec3I& size = instance.model < voxels.model_sizes.size() ? voxels.model_sizes[instance.model] : voxels.size;
+        RaycastResult hit = RayVsVoxelBlock(local, voxels.color_indices[instance.model], size);
+        if (!hit.success)
+            continue;
+        const float distance = Distance(local.origin, hit.p);
+        if (distance >= closest_distance)
+            continue;
+        closest_distance = distance;
+        closest = hit;
+        closest.p = Rotate(instance.rotation, hit.p - instance.pivot) + instance.position;
+        closest.normal = Rotate(instance.rotation, hit.normal);
+        closest.distance_mag = distance;
+    }
+    return closest;
+}
+
+static u8 GetMipIndex(const std::vector<std::vector<u8>>& mips, i32 level, const Vec3I& p)
+{
+    const i32 dim = VOXEL_MAX_SIZE >> level;
+    return mips[level][((p.x >> level) * dim + (p.y >> level)) * dim + (p.z >> level)];
+}
+
+RaycastResult RayVsVoxelCone(const Ray& ray, float cone_spread, const std::vector<std::vector<u8>>& mips, u32* steps)
+{
+    RaycastResult result = {};
+    VALIDATE_V(mips.size(), result);
+    const AABB aabb = {
+        .min = {},
+        .max = { float(VOXEL_MAX_SIZE), float(VOXEL_MAX_SIZE), float(VOXEL_MAX_SIZE) },
+    };
+    const RaycastResult entry = RayVsAABB(ray, aabb);
+    if (!entry.success)
+        return result;
+
+    const i32 top = i32(mips.size()) - 1;
+    float t = entry.distance_mag;
+    Vec3 normal = entry.normal;
+    u32 step_count = 0;
+    while (true)
+    {
+        step_count++;
+        //Nudged into the cell so points on a boundary don't pick the one behind them
+        const Vec3I v = ToVec3I(Floor(ray.origin + ray.direction * (t + 0.0005f)));
+        if (v.x < 0 || v.y < 0 || v.z < 0 || v.x >= VOXEL_MAX_SIZE || v.y >= VOXEL_MAX_SIZE || v.z >= VOXEL_MAX_SIZE)
+            break;
+
+        const float footprint = cone_spread * t;
+        i32 level = footprint > 1.0f ? Min(i32(log2f(footprint)), top) : 0;
+        const u8 index = GetMipIndex(mips, level, v);
+        if (index)
+        {
+            result.success = index;
+            result.p = ray.origin + ray.direction * t;
+            result.normal = normal;
+            result.distance_mag = t;
+            break;
+        }
+        while (level < top && GetMipIndex(mips, level + 1, v) == 0)
+            level++;
+
+        //Step to the exit of the empty cell
+        const i32 cell_size = 1 << level;
+        float t_exit = FLT_MAX;
+        i32 exit_axis = 0;
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            if (ray.direction.e[axis] == 0.0f)
+                continue;
+            const float cell_min = float((v.e[axis] >> level) << level);
+            const float boundary = ray.direction.e[axis] > 0.0f ? cell_min + cell_size : cell_min;
+            const float t_axis = (boundary - ray.origin.e[axis]) / ray.direction.e[axis];
+            if (t_axis < t_exit)
+            {
+                t_exit = t_axis;
+                exit_axis = axis;
+            }
+        }
+        t = Max(t_exit, t);
+        normal = {};
+        normal.e[exit_axis] = ray.direction.e[exit_axis] > 0.0f ? -1.0f : 1.0f;
+    }
+    if (steps)
+        *steps += step_count;
+    return result;
+}
+
 Ray MouseToRaycast(const Vec2I& pixel_pos, const Vec2I& screen_size, const Vec3& camera_pos, const Mat4& view_from_projection, const Mat4& world_from_view)
 {
     //To Normalized Device Coordinates
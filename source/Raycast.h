@@ -15,8 +15,18 @@ struct Ray {
 };
 
 Vec3 ReflectRay(const Vec3& dir, const Vec3& normal);
-RaycastResult Linecast(const Ray& ray, VoxData voxels, float length, Vec3 normal);
-RaycastResult VoxelLinecast(const Ray& ray, VoxData voxels, float length);
+RaycastResult Linecast(const Ray& ray, const VoxData& voxels, float length, Vec3 normal);
+RaycastResult VoxelLinecast(const Ray& ray, const VoxData& voxels, float length);
 [[nodiscard]] RaycastResult RayVsAABB(const Ray& ray, const AABB& box);
 [[nodiscard]] Ray MouseToRaycast(const Vec2I& pixel_pos, const Vec2I& screen_size, const Vec3& camera_pos, const Mat4& perspective, const Mat4& view);
 [[nodiscard]] RaycastResult RayVsVoxel(const Ray& ray, const VoxData& voxels);
+[[nodiscard]] RaycastResult RayVsVoxelBlock(const Ray& ray, const VoxelBlockData& block, const Vec3I& size);
+//Closest hit over voxels.instances, the ray is moved into the space of each model
+//so rotated copies trace the same block. instance_indices limits the search to the
+//listed instances, from CullVoxInstances for rays that start at the camera
+[[nodiscard]] RaycastResult RayVsVoxelInstances(const Ray& ray, const VoxData& voxels, const std::vector<u32>* instance_indices = nullptr);
+//Walks the mips from BuildVoxelIndexMips and stops at the first occupied cell that is
+//no smaller than the ray footprint (cone_spread * distance), the hit gets the color of
+//that cell. Empty space is skipped at the coarsest empty level.
+//steps is incremented once per cell visited.
+[[nodiscard]] RaycastResult RayVsVoxelCone(const Ray& ray, float cone_spread, const std::vector<std::vector<u8>>& mips, u32* steps = nullptr);
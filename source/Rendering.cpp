@@ -1,101 +1,48 @@
 #include "Rendering.h"
+#include "Rendering_Backend.h"
 #include "Debug.h"
 #include "WinInterop_File.h"
 #include "Vox.h"
+#include "Arena.h"
 #include "imgui.h"
-#include "ImGui/backends/imgui_impl_sdl2.h"
-#include "ImGui/backends/imgui_impl_dx11.h"
 #include "stb/stb_image.h"
 
 #include "SDL.h"
-#include "SDL_syswm.h"
 #include "Tracy.hpp"
 
-// DirectX
-#include <d3d11.h>
-#include <d3dcompiler.h>
-#include <dxgi.h>
-//#ifdef _MSC_VER
-//#pragma comment(lib, "d3dcompiler") // Automatically link with d3dcompiler.lib as we are using D3DCompile() below.
-//#endif
-
 Renderer g_renderer;
-
-struct SwapChain {
-    IDXGISwapChain*         handle              = nullptr;
-    ID3D11RenderTargetView* render_target_view  = nullptr;
-
-    Vec2I   size;
-    u32     refresh_rate;
-    u32     sample_count;
-    u32     sample_quality;
-};
-
-struct DX11Data {
-    ID3D11Device*           device;
-    ID3D11DeviceContext*    device_context;
-    IDXGIFactory*           factory;
-    SwapChain               swap_chain;
-    ID3D11BlendState*       blend_state;
-    ID3D11RasterizerState*  rasterizer_full;
-    ID3D11RasterizerState*  rasterizer_wireframe;
-    ID3D11RasterizerState*  rasterizer_voxel;
-    ID3D11DepthStencilState* depth_stencil_state_depth      = nullptr;
-    ID3D11DepthStencilState* depth_stencil_state_no_depth   = nullptr;
-
-    ID3D11RenderTargetView* hdr_rtv = nullptr;
-
-    HRESULT(*D3DCompileFunc)        (LPCVOID, SIZE_T, LPCSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
-    HRESULT(*D3DCompileFromFileFunc)(LPCWSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
+//Size of the swap chain and the screen sized targets
+static Vec2I s_backbuffer_size;
+
+const char* renderCommandNames[+RenderCommand::Count] = {
+    "Invalid",
+    "Create Texture",
+    "Update Texture",
+    "Create Buffer",
+    "Upload Buffer",
+    "Compile Shader",
+    "Bind Shader",
+    "Bind Vertex Buffers",
+    "Bind Constant Buffer",
+    "Bind Structure Buffer",
+    "Bind Rasterizer",
+    "Bind Viewport",
+    "Bind Sampler",
+    "Bind Texture",
+    "Bind Render Targets",
+    "Bind Depth State",
+    "Bind Blend State",
+    "Clear Render Target",
+    "Clear Depth",
+    "Copy Texture",
+    "Draw",
+    "Draw Instanced",
+    "Bind Index Buffer",
+    "Draw Indexed",
+    "Insert Fence",
+    "Wait For Fence",
+    "Present",
 };
-static DX11Data s_dx11 = {};
-
-template <typename T>
-void SafeRelease(T*& unknown)
-{
-    if (unknown)
-    {
-        unknown->Release();
-        unknown = nullptr;
-    }
-}
-
-extern "C" {
-#ifdef _MSC_VER
-    _declspec(dllexport) uint32_t NvOptimusEnablement = 0x00000001;
-    _declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 0x00000001;
-#else
-    __attribute__((dllexport)) uint32_t NvOptimusEnablement = 0x00000001;
-    __attribute__((dllexport)) int AmdPowerXpressRequestHighPerformance = 0x00000001;
-#endif
-}
-
-#if _DEBUG
-    
-    #ifndef HR
-        #define HR(x)                                       \
-        {                                                   \
-            HRESULT hresult = x;                            \
-            if(FAILED(hresult))                             \
-            {                                               \
-                assert(false);                              \
-            }                                               \
-        }
-    #endif
-
-    void ReportDX11References()
-    {
-        ID3D11Debug* debug_interface;
-        s_dx11.device->QueryInterface(__uuidof(ID3D11Debug), (void**)&debug_interface);
-        HR(debug_interface->ReportLiveDeviceObjects(D3D11_RLDO_DETAIL));
-    }
-#else
-    void ReportDX11References() {};
-    #ifndef HR
-    #define HR(x) x;
-    #endif
-#endif
-
 
 
 
@@ -105,47 +52,6 @@ extern "C" {
 //Texture
 //************
 
-struct DX11Texture : public Texture {
-    ID3D11SamplerState* m_sampler = nullptr;
-    ID3D11ShaderResourceView* m_view = nullptr;
-    union {
-        ID3D11Texture1D* m_texture1D;
-        ID3D11Texture2D* m_texture2D;
-        ID3D11Texture3D* m_texture3D;
-    };
-    DXGI_FORMAT m_format;
-
-    //Only used for depth and stencil textures
-    ID3D11DepthStencilView* m_depth_stencil_view = nullptr;
-};
-
-void DeleteTexture(Texture** texture)
-{
-    VALIDATE(texture);
-    VALIDATE(*texture != nullptr);
-    DX11Texture* tex = reinterpret_cast<DX11Texture*>(*texture);
-    switch (tex->m_dimension)
-    {
-    case Texture::Dimension_1D: SafeRelease(tex->m_texture1D); break;
-    case Texture::Dimension_2D: SafeRelease(tex->m_texture2D); break;
-    case Texture::Dimension_3D: SafeRelease(tex->m_texture3D); break;
-    }
-    if (tex->m_parameters.type == Texture::Type_Depth)
-    {
-        assert(tex->m_view == nullptr);
-        assert(tex->m_sampler == nullptr);
-        SafeRelease(tex->m_depth_stencil_view);
-    }
-    else
-    {
-        assert(tex->m_depth_stencil_view == nullptr);
-        SafeRelease(tex->m_sampler);
-        SafeRelease(tex->m_view);
-    }
-    delete tex;
-    *texture = nullptr;
-}
-
 bool CreateTexture(Texture** texture, void* data, Vec3I size, Texture::Format format, i32 bytes_per_pixel)
 {
     Texture::TextureParams tp = {};
@@ -170,476 +76,159 @@ bool CreateTexture(Texture** texture, const Texture::TextureParams& tp, const vo
     const u8* new_data[] = { (u8*)data };
     return CreateTexture(texture, tp, 1, (u8*)data);
 }
-bool CreateTexture(Texture** texture, const Texture::TextureParams& tp, u32 mip_levels, const u8* data)
-{
-    VALIDATE_V(texture, false);
-    VALIDATE_V(*texture == nullptr, false);
-    //VALIDATE_V(data, false);
 
-    DX11Texture* tex = new DX11Texture;
-    *texture = tex;
 
-    tex->m_parameters = tp;
-    tex->m_mip_levels = mip_levels;
-    assert(tex->m_parameters.size.x != -1 && tex->m_parameters.size.x != 0);
-    if (tex->m_parameters.size.z > 0)
-    {
-        tex->m_dimension = Texture::Dimension_3D;
-    }
-    else if (tex->m_parameters.size.y > 0)
-    {
-        tex->m_dimension = Texture::Dimension_2D;
-    }
-    else
-    {
-        tex->m_dimension = Texture::Dimension_1D;
-    }
-
-    switch (tp.format)
-    {
-    case Texture::Format_R11G11B10_FLOAT:       tex->m_format = DXGI_FORMAT_R11G11B10_FLOAT;    break;
-    case Texture::Format_D32_FLOAT:             tex->m_format = DXGI_FORMAT_D32_FLOAT;          break;
-    case Texture::Format_D16_UNORM:             tex->m_format = DXGI_FORMAT_D16_UNORM;          break;
-    case Texture::Format_R8G8B8A8_UNORM:        tex->m_format = DXGI_FORMAT_R8G8B8A8_UNORM;     break;
-    case Texture::Format_R8G8B8A8_UNORM_SRGB:   tex->m_format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;break;
-    case Texture::Format_R8G8B8A8_UINT:         tex->m_format = DXGI_FORMAT_R8G8B8A8_UINT;      break;
-    case Texture::Format_R8_UINT:               tex->m_format = DXGI_FORMAT_R8_UINT;            break;
-    default: FAIL;                              tex->m_format = DXGI_FORMAT_UNKNOWN;            break;
-    }
-
-    switch (tex->m_parameters.type)
-    {
-    case Texture::Type_Depth:
-    {
-        D3D11_TEXTURE2D_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        desc.Width = (u32)tex->m_parameters.size.x;
-        desc.Height = (u32)tex->m_parameters.size.y;
-        desc.MipLevels = desc.ArraySize = 1;
-        switch (tp.format)
-        {
-        case Texture::Format_D32_FLOAT:         desc.Format = DXGI_FORMAT_R32_TYPELESS;         break;
-        case Texture::Format_D16_UNORM:         desc.Format = DXGI_FORMAT_R16_TYPELESS;         break;
-        default: FAIL; break;
-        }
-        desc.SampleDesc.Count = 1;
-        desc.SampleDesc.Quality = 0;
-        desc.Usage = D3D11_USAGE_DEFAULT;
-        desc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
-        desc.CPUAccessFlags = 0;
-        desc.MiscFlags = 0;
 
-        HR(s_dx11.device->CreateTexture2D(&desc, NULL, &tex->m_texture2D));
-    }
-    {
 
-        D3D11_DEPTH_STENCIL_VIEW_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        desc.Format = tex->m_format;
-        desc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
-        desc.Texture2D.MipSlice = 0;
 
-        // Create the depth stencil view
-        HR(s_dx11.device->CreateDepthStencilView(
-            tex->m_texture2D,               // Depth stencil texture
-            &desc,                          // Depth stencil desc
-            &tex->m_depth_stencil_view));    // [out] Depth stencil view
-    }
-    DEBUG_LOG("Texture Created\n");
-    return true;
-    }
+//************
+//Buffer
+//************
 
+void FillIndexBuffer(GpuBuffer* ib, size_t count)
+{
+    if (ib->m_count > count)
+        return;
+    std::vector<u32> arr;
 
-    assert(tex->m_parameters.bytes_per_pixel);
+    //size_t amount = VOXEL_MAX_SIZE * VOXEL_MAX_SIZE * VOXEL_MAX_SIZE * 6 * 6;
+    size_t amount = 6 * count;
+    arr.reserve(amount);
+    i32 baseIndex = 0;
+    for (i32 i = 0; i < amount; i += 6)
 
-    //Create Texture
-    switch (tex->m_dimension)
-    {
-    case Texture::Dimension_1D:
     {
-        {
-            D3D11_TEXTURE1D_DESC desc;
-            ZeroMemory(&desc, sizeof(desc));
-            desc.Width = (u32)tex->m_parameters.size.x;
-            desc.MipLevels = desc.ArraySize = tex->m_mip_levels;
-            desc.Format = tex->m_format;
-            desc.Usage = D3D11_USAGE_DEFAULT;
-            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-            desc.CPUAccessFlags = 0;
-            desc.MiscFlags = 0;
-
-            assert(tex->m_mip_levels == 1);
-            D3D11_SUBRESOURCE_DATA sub_resource;
-            sub_resource.pSysMem = data;
-            sub_resource.SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
-            sub_resource.SysMemSlicePitch = 0;
-
-            HR(s_dx11.device->CreateTexture1D(&desc, data ? &sub_resource : nullptr, &tex->m_texture1D));
-        }
+        arr.push_back(baseIndex + 0);
+        arr.push_back(baseIndex + 1);
+        arr.push_back(baseIndex + 2);
+        arr.push_back(baseIndex + 1);
+        arr.push_back(baseIndex + 3);
+        arr.push_back(baseIndex + 2);
 
-        //Create View
-        {
-            D3D11_SHADER_RESOURCE_VIEW_DESC desc;
-            ZeroMemory(&desc, sizeof(desc));
-            desc.Format = tex->m_format;
-            desc.ViewDimension = D3D_SRV_DIMENSION_TEXTURE1D;
-            desc.Texture1D.MipLevels = 1;
-            desc.Texture1D.MostDetailedMip = 0;
-            HR(s_dx11.device->CreateShaderResourceView(tex->m_texture1D, &desc, &tex->m_view));
-        }
-        break;
+        baseIndex += 4; //Amount of vertices
     }
-    case Texture::Dimension_2D:
-    {
-        //Create Texture
-        {
-            D3D11_TEXTURE2D_DESC desc;
-            ZeroMemory(&desc, sizeof(desc));
-            desc.Width = (u32)tex->m_parameters.size.x;
-            desc.Height = (u32)tex->m_parameters.size.y;
-            desc.MipLevels = desc.ArraySize = tex->m_mip_levels;
-            desc.Format = tex->m_format;
-            desc.SampleDesc.Count = 1;
-            desc.SampleDesc.Quality = 0;
-            desc.Usage = D3D11_USAGE_DEFAULT;
-            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-            if (tp.render_target)
-                desc.BindFlags |= D3D11_BIND_RENDER_TARGET;
-            desc.CPUAccessFlags = 0;
-            desc.MiscFlags = 0;
-
-            assert(tex->m_mip_levels == 1);
-            D3D11_SUBRESOURCE_DATA sub_resource;
-            sub_resource.pSysMem = data;
-            sub_resource.SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
-            sub_resource.SysMemSlicePitch = 0;
-
-            HR(s_dx11.device->CreateTexture2D(&desc, data ? &sub_resource : nullptr, &tex->m_texture2D));
-        }
 
-        //Create View
-        {
-            D3D11_SHADER_RESOURCE_VIEW_DESC desc;
-            ZeroMemory(&desc, sizeof(desc));
-            desc.Format = tex->m_format;
-            desc.ViewDimension = D3D_SRV_DIMENSION_TEXTURE2D;
-            desc.Texture2D.MipLevels = 1;
-            desc.Texture2D.MostDetailedMip = 0;
-            HR(s_dx11.device->CreateShaderResourceView(tex->m_texture2D, &desc, &tex->m_view));
-        }
-        break;
-    }
-    case Texture::Dimension_3D:
-    {
-        //Create Texture
-        {
-            D3D11_TEXTURE3D_DESC desc;
-            ZeroMemory(&desc, sizeof(desc));
-            desc.Width = (u32)tex->m_parameters.size.x;
-            desc.Height = (u32)tex->m_parameters.size.y;
-            desc.Depth = (u32)tex->m_parameters.size.z;
-            desc.MipLevels = tex->m_mip_levels;
-            desc.Format = tex->m_format;
-            desc.Usage = D3D11_USAGE_DEFAULT;
-            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-            desc.CPUAccessFlags = 0;
-            desc.MiscFlags = 0;
+    ib->Upload(arr.data(), amount, sizeof(baseIndex));
+}
 
-#if 0
-            D3D11_SUBRESOURCE_DATA sub_resource;
-            sub_resource.pSysMem = data;
-            sub_resource.SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
-            sub_resource.SysMemSlicePitch = desc.Height * sub_resource.SysMemPitch;
-#else
-            D3D11_SUBRESOURCE_DATA sub_resource[MAX_MIPS] = {};
-            for (u32 i = 0; i < tex->m_mip_levels; i++)
-            {
-                sub_resource[i].pSysMem = nullptr;
-#if 0
-                sub_resource[i].SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
-                sub_resource[i].SysMemSlicePitch = desc.Height * sub_resource[i].SysMemPitch;
-#else
-                sub_resource[i].SysMemPitch = (desc.Width >> i) * tex->m_parameters.bytes_per_pixel;
-                sub_resource[i].SysMemSlicePitch = (desc.Height >> i) * sub_resource[i].SysMemPitch;
-#endif
-            }
-#endif
-                
+#define UPLOAD_RING_START_BYTES (64 * 1024)
+#define UPLOAD_RING_ALIGNMENT   16
 
-            HR(s_dx11.device->CreateTexture3D(&desc, nullptr, &tex->m_texture3D));
-        }
+struct UploadRingFrame {
+    u64 fence = 0;
+    u32 bytes = 0;
+};
 
-        //Create View
-        {
-            D3D11_SHADER_RESOURCE_VIEW_DESC desc;
-            ZeroMemory(&desc, sizeof(desc));
-            desc.Format = tex->m_format;
-            desc.ViewDimension = D3D_SRV_DIMENSION_TEXTURE3D;
-            desc.Texture3D.MipLevels = tex->m_mip_levels;
-            desc.Texture3D.MostDetailedMip = 0;
-            HR(s_dx11.device->CreateShaderResourceView(tex->m_texture3D, &desc, &tex->m_view));
-        }
-        break;
-    }
-    default:
-        FAIL;
-    }
+struct UploadRing {
+    GpuBuffer*      buffer      = nullptr;
+    u32             capacity    = 0;
+    u32             head        = 0;    //Next byte written
+    u32             used        = 0;    //Bytes behind the head the GPU may still read, this frame included
+    u32             frame_bytes = 0;
+    UploadRingFrame in_flight[FRAMES_IN_FLIGHT] = {};
+    u32             in_flight_first = 0;
+    u32             in_flight_count = 0;
+    UploadRingStats stats;
+};
+static UploadRing s_upload_ring;
 
-    //Create Sampler
-    {
-        D3D11_SAMPLER_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        switch (tp.filter)
-        {
-        case Texture::Filter_Point: desc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;   break;
-        case Texture::Filter_Aniso: desc.Filter = D3D11_FILTER_ANISOTROPIC;         break;
-        default: FAIL;              desc.Filter = D3D11_FILTER(0);
-        }
-        switch (tp.mode)
-        {
-        case Texture::Address_Wrap:         desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;         break;
-        case Texture::Address_Mirror:       desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_MIRROR;       break;
-        case Texture::Address_Clamp:        desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;        break;
-        case Texture::Address_Border:       desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;       break;
-        case Texture::Address_MirrorOnce:   desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_MIRROR_ONCE;  break;
-        default: FAIL;                      desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_MODE(0);      break;
-        }
-        desc.MipLODBias = 0;
-        desc.MaxAnisotropy = 16;
-        desc.ComparisonFunc = D3D11_COMPARISON_LESS;
-        desc.BorderColor[0] = desc.BorderColor[1] = desc.BorderColor[2] = desc.BorderColor[3] = 0.0f;
-        desc.MinLOD = 0;
-        desc.MaxLOD = 0;
-        HR(s_dx11.device->CreateSamplerState(&desc, &tex->m_sampler));
-    }
-    DEBUG_LOG("Texture Created\n");
-    return true;
+static void RetireUploadFrame()
+{
+    UploadRing& ring = s_upload_ring;
+    assert(ring.in_flight_count);
+    ring.used -= ring.in_flight[ring.in_flight_first].bytes;
+    ring.in_flight_first = (ring.in_flight_first + 1) % FRAMES_IN_FLIGHT;
+    ring.in_flight_count--;
 }
 
-bool UpdateTexture(Texture** texture, u32 mip_slice, void* data, u32 row_pitch_bytes, u32 depth_pitch_bytes)
+static void WaitForUploadFrame()
 {
-    VALIDATE_V(texture, false);
-    VALIDATE_V(*texture, false);
-    DX11Texture* t = reinterpret_cast<DX11Texture*>(*texture);
-    switch (t->m_dimension)
-    {
-    case Texture::Dimension_1D: FAIL; break;
-    case Texture::Dimension_2D: FAIL; break;
-    case Texture::Dimension_3D:
-        s_dx11.device_context->UpdateSubresource(
-            t->m_texture3D,                                         //[in]           ID3D11Resource  *pDstResource,
-            D3D11CalcSubresource(mip_slice, 0, t->m_mip_levels),    //[in]           UINT            DstSubresource,
-            NULL,                                                   //[in, optional] const D3D11_BOX *pDstBox,
-            data,                                                   //[in]           const void      *pSrcData,
-            row_pitch_bytes,                                        //[in]           UINT            SrcRowPitch,
-            depth_pitch_bytes                                       //[in]           UINT            SrcDepthPitch
-        );
-    break;
-    default: FAIL; break;
-    }
-
-    return true;
+    UploadRing& ring = s_upload_ring;
+    WaitForFence(ring.in_flight[ring.in_flight_first].fence);
+    RetireUploadFrame();
+    ring.stats.fence_waits++;
 }
 
-
-
-
-
-//************
-//Buffer
-//************
-
-struct DX11GpuBuffer : public GpuBuffer
+static bool AllocateUpload(u32 bytes, u32* offset)
 {
-    //D3D11_USAGE m_usage = D3D11_USAGE_DYNAMIC;
-    ID3D11Buffer* m_buffer = nullptr;
-    ID3D11ShaderResourceView* structure_resource_view = nullptr;
-    //D3D11_BIND_FLAG m_target = {};
-};
+    UploadRing& ring = s_upload_ring;
+    u32 start = (ring.head + UPLOAD_RING_ALIGNMENT - 1) & ~(UPLOAD_RING_ALIGNMENT - 1);
+    u32 skipped = start - ring.head;
+    if (u64(start) + bytes > ring.capacity)
+    {
+        //The end of the buffer is too small, wrap and leave it unused for this lap
+        skipped = ring.capacity - ring.head;
+        start = 0;
+    }
+    if (u64(ring.used) + skipped + bytes > ring.capacity)
+        return false;
+
+    ring.used += skipped + bytes;
+    ring.frame_bytes += skipped + bytes;
+    ring.head = start + bytes;
+    *offset = start;
+    return true;
+}
 
-//void GpuBuffer::UploadData(const void* data, u32 element_size, size_t count)
-//TODO: Clean this up with Type::Vertex = D3D11_BIND_VERTEX_BUFFER
-void GpuBuffer::Upload(const void* data, const size_t count, const u32 element_size, const bool is_byte_format)
+UploadRange UploadTransient(const void* data, size_t count, u32 element_size)
 {
-    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(this);
-    m_count = count;
-    SafeRelease(buf->m_buffer);
+    ZoneScopedN("Upload Transient");
+    UploadRing& ring = s_upload_ring;
+    assert(ring.buffer);
     assert(data);
-    assert(element_size);
-    assert(buf->m_type != GpuBuffer::Type::Invalid);
-    VALIDATE(count);
-    UINT total_bytes = UINT(element_size * count);
-    //assert(total_bytes / 16 == 0);
-    UINT buffer_type = 0;
-    UINT cpu_access_flags = 0;
-    UINT struct_byte_stride = 0;
-    UINT memory_pitch = 0;
-    UINT misc_flags = 0;
-    switch (buf->m_type)
-    {
-    case GpuBuffer::Type::Vertex:
-        buffer_type = D3D11_BIND_VERTEX_BUFFER;
-        break;
-    case GpuBuffer::Type::Index:
-        buffer_type = D3D11_BIND_INDEX_BUFFER;
-        break;
-    case GpuBuffer::Type::Constant:
-        buffer_type = D3D11_BIND_CONSTANT_BUFFER;
-        cpu_access_flags = D3D11_CPU_ACCESS_WRITE;
-        break;
-    case GpuBuffer::Type::Structure:
-        cpu_access_flags = D3D11_CPU_ACCESS_WRITE;
-        misc_flags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-        buffer_type = D3D11_BIND_SHADER_RESOURCE;
-        assert(!buf->m_is_dymamic);
-        struct_byte_stride = element_size;
-        break;
-    default:
-        FAIL;
-    }
+    const u32 bytes = u32(count * element_size);
+    VALIDATE_V(bytes, {});
 
-    if (!buf->m_buffer)
-    {
-        {
-            D3D11_BUFFER_DESC desc;
-            desc.ByteWidth = total_bytes;
-            desc.Usage = buf->m_is_dymamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_DEFAULT;
-            desc.BindFlags = buffer_type;
-            desc.CPUAccessFlags = buf->m_is_dymamic ? D3D11_CPU_ACCESS_WRITE | cpu_access_flags : cpu_access_flags;
-            desc.MiscFlags = misc_flags;
-            desc.StructureByteStride = struct_byte_stride;
-
-            D3D11_SUBRESOURCE_DATA dx11_data;
-            dx11_data.pSysMem = data;
-            dx11_data.SysMemPitch = memory_pitch;
-            dx11_data.SysMemSlicePitch = 0;
-
-            HR(s_dx11.device->CreateBuffer(
-                &desc,          //[in]            const D3D11_BUFFER_DESC * pDesc,
-                &dx11_data,     //[in, optional]  const D3D11_SUBRESOURCE_DATA * pInitialData,
-                &buf->m_buffer  //[out, optional] ID3D11Buffer * *ppBuffer
-            ));
-        }
-        DEBUG_LOG("Created and Uploaded data to gpu buffer: element: %i size: %i", element_size, count);
-
-        if (buf->m_type == GpuBuffer::Type::Structure)
-        {
-            D3D11_SHADER_RESOURCE_VIEW_DESC desc;
-            ZeroMemory(&desc, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
-            desc.Format = is_byte_format ? DXGI_FORMAT_R8_UINT : DXGI_FORMAT_UNKNOWN;
-            desc.ViewDimension = D3D_SRV_DIMENSION_BUFFER;
-            desc.Buffer.FirstElement = 0;
-            desc.Buffer.NumElements = (UINT)count;
-            HR(s_dx11.device->CreateShaderResourceView(
-                buf->m_buffer,                  //[in]            ID3D11Resource * pResource,
-                &desc,                          //[in, optional]  const D3D11_SHADER_RESOURCE_VIEW_DESC * pDesc,
-                &buf->structure_resource_view   //[out, optional] ID3D11ShaderResourceView * *ppSRView
-            ));
-        }
-
-        return;
-    }
+    while (ring.in_flight_count && IsFenceComplete(ring.in_flight[ring.in_flight_first].fence))
+        RetireUploadFrame();
 
-    if (buf->m_is_dymamic)
-    {
-        //map/unmap/memcopy
-        D3D11_MAPPED_SUBRESOURCE resource;
-        ZeroMemory(&resource, sizeof(D3D11_MAPPED_SUBRESOURCE));
-        HR(s_dx11.device_context->Map(
-            buf->m_buffer,          //[in]            ID3D11Resource * pResource,
-            0,                      //[in]            UINT                     Subresource,
-            D3D11_MAP_WRITE_DISCARD,//[in]            D3D11_MAP                MapType,
-            0,                      //[in]            UINT                     MapFlags,
-            &resource               //[out, optional] D3D11_MAPPED_SUBRESOURCE * pMappedResource
-        ));
-        memcpy(resource.pData, data, element_size * count);
-        s_dx11.device_context->Unmap(buf->m_buffer, 0);
-        DEBUG_LOG("Uploaded dynamic_buffer data to gpu buffer: element: %i size: %i", element_size, count);
-    }
-    else
-    {
-        s_dx11.device_context->UpdateSubresource(
-            buf->m_buffer,  //[in]           ID3D11Resource * pDstResource,
-            0,              //[in]           UINT            DstSubresource,
-            NULL,           //[in, optional] const D3D11_BOX * pDstBox,
-            data,           //[in]           const void* pSrcData,
-            total_bytes,    //[in]           UINT            SrcRowPitch,
-            0               //[in]           UINT            SrcDepthPitch
-        );
-        DEBUG_LOG("Uploaded default_buffer data to gpu buffer: element: %i size: %i", element_size, count);
-    }
-
-}
-
-void GpuBuffer::Bind(u32 slot, GpuBuffer::BindLocation binding)
-{
-    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(this);
-    switch (m_type)
+    u32 offset = 0;
+    while (!AllocateUpload(bytes, &offset))
     {
-    case GpuBuffer::Type::Constant:
-    {
-        switch (binding)
-        {
-        case GpuBuffer::BindLocation::Vertex:
-            s_dx11.device_context->VSSetConstantBuffers(slot, 1, &buf->m_buffer);
-            break;
-        case GpuBuffer::BindLocation::Pixel:
-            s_dx11.device_context->PSSetConstantBuffers(slot, 1, &buf->m_buffer);
-            break;
-        case GpuBuffer::BindLocation::All:
-            s_dx11.device_context->VSSetConstantBuffers(slot, 1, &buf->m_buffer);
-            s_dx11.device_context->PSSetConstantBuffers(slot, 1, &buf->m_buffer);
-            break;
-        default:
-            FAIL;
-            break;
-        }
-        break;
-    }
-    case GpuBuffer::Type::Structure:
-    {
-        switch (binding)
+        if (ring.in_flight_count)
         {
-        case GpuBuffer::BindLocation::Vertex:
-            s_dx11.device_context->VSSetShaderResources(slot, 1, &buf->structure_resource_view);
-            break;
-        case GpuBuffer::BindLocation::Pixel:
-            s_dx11.device_context->PSSetShaderResources(slot, 1, &buf->structure_resource_view);
-            break;
-        case GpuBuffer::BindLocation::All:
-            s_dx11.device_context->VSSetShaderResources(slot, 1, &buf->structure_resource_view);
-            s_dx11.device_context->PSSetShaderResources(slot, 1, &buf->structure_resource_view);
-            break;
-        default:
-            FAIL;
-            break;
+            WaitForUploadFrame();
+            continue;
         }
-        break;
-    }
-    default:
-        FAIL;
-    }
+        //Only this frame is in the buffer. What was drawn from the old buffer
+        //keeps it alive on the GPU, the new one starts empty
+        u32 capacity = Max(ring.capacity, u32(UPLOAD_RING_START_BYTES));
+        while (capacity < ring.frame_bytes + bytes + UPLOAD_RING_ALIGNMENT)
+            capacity *= 2;
+        if (capacity == ring.capacity)
+            capacity *= 2;
+        ring.buffer->Reserve(capacity);
+        ring.capacity = capacity;
+        ring.head = 0;
+        ring.used = 0;
+        ring.frame_bytes = 0;
+        ring.stats.capacity = capacity;
+        ring.stats.grows++;
+    }
+
+    ring.buffer->Write(data, offset, bytes);
+    return { ring.buffer, offset };
 }
 
-bool CreateGpuBuffer(GpuBuffer** buffer, const char* name, bool is_dynamic, GpuBuffer::Type type)
+const UploadRingStats& GetUploadRingStats()
 {
-    assert(buffer);
-    assert(*buffer == nullptr);
-    DX11GpuBuffer* buf = new DX11GpuBuffer;
-    buf->m_is_dymamic = is_dynamic;
-    buf->m_type = type;
-    strcpy(buf->m_name, name);
-    (*buffer) = reinterpret_cast<GpuBuffer*>(buf);
-    return true;
+    return s_upload_ring.stats;
 }
 
-void DeleteBuffer(GpuBuffer** buffer)
+//The GPU is done with this frame's uploads once it passed the fence
+static void EndUploadFrame()
 {
-    VALIDATE(buffer);
-    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(*buffer);
-    SafeRelease(buf->m_buffer);
-    delete buf;
-    DEBUG_LOG("GPU Buffer deleted %i, %i\n", m_target, m_handle);
+    UploadRing& ring = s_upload_ring;
+    ring.stats.bytes = ring.frame_bytes;
+    if (ring.frame_bytes == 0)
+        return;
+    if (ring.in_flight_count == FRAMES_IN_FLIGHT)
+        WaitForUploadFrame();
+    UploadRingFrame& frame = ring.in_flight[(ring.in_flight_first + ring.in_flight_count) % FRAMES_IN_FLIGHT];
+    frame.fence = InsertFence();
+    frame.bytes = ring.frame_bytes;
+    ring.in_flight_count++;
+    ring.frame_bytes = 0;
 }
 
 
@@ -650,285 +239,7 @@ void DeleteBuffer(GpuBuffer** buffer)
 //Shader
 //************
 
-struct DX11IncludeManager : ID3DInclude
-{
-    std::vector<std::string> m_included_shader_files;
-    File* file;
-
-    virtual HRESULT Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes) override
-    {
-        std::vector<std::string> filenames;
-        std::string filename = "source/";
-        ScanDirectoryForFileNames(filename, filenames);
-
-        for (size_t i = 0; i < filenames.size(); i++)
-        {
-            if (filenames[i].contains(pFileName))
-            {
-                filename += filenames[i];
-                break;
-            }
-        }
-        m_included_shader_files.push_back(filename);
-        file = new File(filename, File::Mode::Read, false);//Why doesnt this work if its not a pointer
-        file->GetText();
-        if (!file->m_textIsValid)
-        {
-            ppData = nullptr;
-            pBytes = nullptr;
-            return E_FAIL;
-        }
-        char* text = new char[file->m_dataString.size()];
-        memcpy(text, file->m_dataString.c_str(), file->m_dataString.size());
-
-        *ppData = text;
-        *pBytes = (UINT)file->m_dataString.size();
-        return S_OK;
-    }
-    virtual HRESULT Close(LPCVOID pData) override
-    {
-        delete file;
-        if (pData == nullptr)
-            return E_FAIL;
-        return S_OK;
-    }
-};
-
-
-struct DX11Shader : public Shader
-{
-    //D3D11_USAGE m_usage = D3D11_USAGE_DYNAMIC;
-    ID3D11Buffer* m_buffer = nullptr;
-    ID3D11ShaderResourceView* structure_resource_view = nullptr;
-    ID3D11InputLayout* m_vertex_input_layout = nullptr;
-    ID3D11VertexShader* m_vertex_shader = nullptr;
-    ID3D11PixelShader* m_pixel_shader = nullptr;
-    static const u32 m_vertex_component_max = 4;
-    D3D11_INPUT_ELEMENT_DESC m_local_layout[m_vertex_component_max] = {};
-
-    //D3D11_BIND_FLAG m_target = {};
-};
-
-bool CreateShader(Shader** s,
-    const std::string& vertexFileLocation,
-    const std::string& pixelFileLocation,
-    Shader::InputElementDesc* input_layout,
-    i32 layout_count)
-{
-    assert(s);
-    assert(*s == nullptr);
-    DX11Shader* shader = new DX11Shader;
-    (*s) = reinterpret_cast<DX11Shader*>(shader);
-
-    shader->m_vertexFile = vertexFileLocation;
-    shader->m_pixelFile = pixelFileLocation;
-
-    shader->m_vertex_component_count = layout_count;
-    for (u32 i = 0; i < shader->m_vertex_component_count; i++)
-    {
-        shader->m_local_layout[i] = {
-        .SemanticName = input_layout[i].SemanticName,
-        .SemanticIndex = 0,
-        .Format = DXGI_FORMAT(input_layout[i].Format),
-        .InputSlot = 0,
-        .AlignedByteOffset = input_layout[i].AlignedByteOffset,
-        .InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA,
-        .InstanceDataStepRate = 0,
-        };
-
-    }
-
-    shader->CheckForUpdate();
-    return true;
-}
-Shader::~Shader()
-{
-    DX11Shader* shader = reinterpret_cast<DX11Shader*>(this);
-    SafeRelease(shader->m_vertex_shader);
-    SafeRelease(shader->m_pixel_shader);
-    SafeRelease(shader->m_vertex_input_layout);
-    DEBUG_LOG("Shader Program Deleted\n");
-}
-bool Shader::CompileShader(std::string text, const std::string& file_name, Type shader_type)
-{
-    DX11Shader* shader = reinterpret_cast<DX11Shader*>(this);
-    bool failed = false;
-#if 1
-    D3D_SHADER_MACRO* shader_macros = nullptr;
-#else
-    D3D_SHADER_MACRO shader_macros[] = {
-        //{"RAY_TRACING", "1"},
-    };
-#endif
-
-    //WideCharToMultiByte
-    i32 char_count = MultiByteToWideChar(
-        CP_UTF8,                //[in]            UINT                              CodePage,
-        MB_ERR_INVALID_CHARS,   //[in]            DWORD                             dwFlags,
-        file_name.c_str(),      //[in]            _In_NLS_string_(cbMultiByte)LPCCH lpMultiByteStr,
-        -1,                     //[in]            int                               cbMultiByte,
-        nullptr,                //[out, optional] LPWSTR                            lpWideCharStr,
-        0                       //[in]            int                               cchWideChar
-    );
-    i32 wide_char_count = char_count;// = char_count / 2;
-    WCHAR* wide_char = new WCHAR[wide_char_count];
-    //memset(wide_char, '\0', wide_char_count);
-    i32 wide_char_actual = MultiByteToWideChar(
-        CP_UTF8,                //[in]            UINT                              CodePage,
-        MB_ERR_INVALID_CHARS,   //[in]            DWORD                             dwFlags,
-        file_name.c_str(),      //[in]            _In_NLS_string_(cbMultiByte)LPCCH lpMultiByteStr,
-        -1,                     //[in]            int                               cbMultiByte,
-        wide_char,              //[out, optional] LPWSTR                            lpWideCharStr,
-        wide_char_count         //[in]            int                               cchWideChar
-    );
-    assert(wide_char_actual > 0);
-    assert(wide_char_actual == wide_char_count);
-
-    std::string entry_point;
-    std::string target_version;
-    switch (shader_type)
-    {
-    case Type_Vertex:
-        entry_point = "Vertex_Main";
-        target_version = "vs_4_0";
-        break;
-    case Type_Pixel:
-        entry_point = "Pixel_Main";
-        target_version = "ps_4_0";
-        break;
-    default:
-        FAIL;
-    }
-
-    u32 flags1 = 0;
-    //flags1 |= D3DCOMPILE_WARNINGS_ARE_ERRORS;
-    flags1 |= D3DCOMPILE_PREFER_FLOW_CONTROL;
-#if _DEBUG
-    //;
-    flags1 |= D3DCOMPILE_DEBUG;
-#if 0
-    flags1 |= D3DCOMPILE_SKIP_OPTIMIZATION | D3DCOMPILE_OPTIMIZATION_LEVEL0;
-    //flags1 |= D3DCOMPILE_SKIP_VALIDATION; //dont do this
-#else
-    flags1 |= D3DCOMPILE_OPTIMIZATION_LEVEL3;
-#endif
-#endif
-
-    ID3DBlob* code;
-    ID3DBlob* errors;
-    DX11IncludeManager include_manager;
-    HRESULT compile_result = s_dx11.D3DCompileFromFileFunc(
-        wide_char,              //[in]            LPCWSTR                pFileName,
-        shader_macros,          //[in, optional]  const D3D_SHADER_MACRO *pDefines,
-        &include_manager,  //[in, optional]  ID3DInclude            *pInclude,
-        entry_point.c_str(),    //[in]            LPCSTR                 pEntrypoint,
-        target_version.c_str(), //[in]            LPCSTR                 pTarget,
-        flags1,                 //[in]            UINT                   Flags1,
-        0,                      //[in]            UINT                   Flags2,
-        &code,                  //[out]           ID3DBlob               **ppCode,
-        &errors                 //[out, optional] ID3DBlob               **ppErrorMsgs
-    );
-    delete wide_char;
-    failed = !code || !!errors || FAILED(compile_result);
-
-    if (!failed)
-    {
-        SafeRelease(errors);
-        switch (shader_type)
-        {
-        case Type_Vertex:
-            SafeRelease(shader->m_vertex_shader);
-            if (FAILED(s_dx11.device->CreateVertexShader(code->GetBufferPointer(), code->GetBufferSize(), nullptr, &shader->m_vertex_shader)))
-            {
-                FAIL;
-                SafeRelease(code);
-                SafeRelease(errors);
-                failed = true;
-            }
-            else
-            {
-                // Create the input layout
-                if (FAILED(s_dx11.device->CreateInputLayout(
-                    shader->m_local_layout,             //[in]            const D3D11_INPUT_ELEMENT_DESC *pInputElementDescs,
-                    shader->m_vertex_component_count,   //[in]            UINT                           NumElements,
-                    code->GetBufferPointer(),           //[in]            const void                     *pShaderBytecodeWithInputSignature,
-                    code->GetBufferSize(),              //[in]            SIZE_T                         BytecodeLength,
-                    &shader->m_vertex_input_layout      //[out, optional] ID3D11InputLayout              **ppInputLayout
-                )))
-                {
-                    FAIL;
-                    failed = true;
-                }
-                SafeRelease(code);
-            }
-            break;
-        case Type_Pixel:
-            SafeRelease(shader->m_pixel_shader);
-            if (FAILED(s_dx11.device->CreatePixelShader(code->GetBufferPointer(), code->GetBufferSize(), nullptr, &shader->m_pixel_shader)))
-            {
-                FAIL;
-                SafeRelease(code);
-                SafeRelease(errors);
-                failed = true;
-            }
-            break;
-        default:
-            FAIL;
-        }
-    }
-
-    for (i32 i = 0; i < include_manager.m_included_shader_files.size(); i++)
-    {
-        for (i32 i = 0; i < m_reference_file_names.size(); i++)
-        {
-            if (m_reference_file_names[i].find(include_manager.m_included_shader_files[i]) != std::string::npos)
-            {
-                goto postloops;
-            }
-        }
-        m_reference_file_names.push_back(include_manager.m_included_shader_files[i]);
-        m_reference_file_times.push_back(0);
-    }
-    postloops:
-
-    if (failed)
-    {
-        std::string info_string;
-        info_string.resize(errors->GetBufferSize());
-        memcpy(info_string.data(), errors->GetBufferPointer(), errors->GetBufferSize());
-        std::string error_title = file_name + " Compilation Error: ";
-        DebugPrint((error_title + info_string + "\n").c_str());
-
-        SDL_MessageBoxButtonData buttons[] = {
-            //{ /* .flags, .buttonid, .text */        0, 0, "Continue" },
-            { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 0, "Retry" },
-            { SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 1, "Continue" },
-        };
-
-        i32 buttonID = CreateMessageWindow(buttons, arrsize(buttons), MessageBoxType::Error, error_title.c_str(), info_string.c_str());
-        //if (buttons[buttonID].buttonid == 2)//NOTE: Stop button
-        //{
-        //    DebugPrint("stop hit");
-        //    g_running = false;
-        //    return false;
-        //}
-        //else
-        {
-            if (buttons[buttonID].buttonid == 0)//NOTE: Retry button
-            {
-                CheckForUpdate();
-            }
-            else if (buttons[buttonID].buttonid == 1)//NOTE: Continue button
-            {
-                return false;
-            }
-        }
-    }
-    DEBUG_LOG("Shader Vertex/Fragment Created\n");
-    return true;
-}
-
-void GetShaderReferenceFileTimes(std::vector<u64>& out, Shader* p)
+void GetShaderReferenceFileTimes(FrameVector<u64>& out, Shader* p)
 {
     out.resize(p->m_reference_file_times.size(), 0);
 
@@ -944,25 +255,19 @@ void GetShaderReferenceFileTimes(std::vector<u64>& out, Shader* p)
 
 void Shader::CheckForUpdate()
 {
-    std::string vertexText;
     u64 vertexFileTime;
-    std::string pixelText;
     u64 pixelFileTime;
-    std::vector<u64> referenced_file_times;
+    FrameVector<u64> referenced_file_times;
     {
 
         File vertexFile(m_vertexFile, File::Mode::Read, false);
         vertexFile.GetTime();
         VALIDATE(vertexFile.m_timeIsValid);
-        vertexFile.GetText();
-        vertexText = vertexFile.m_dataString;
         vertexFileTime = vertexFile.m_time;
 
         File pixelFile(m_pixelFile, File::Mode::Read, false);
         pixelFile.GetTime();
         VALIDATE(pixelFile.m_timeIsValid);
-        pixelFile.GetText();
-        pixelText = pixelFile.m_dataString;
         pixelFileTime = pixelFile.m_time;
 
         GetShaderReferenceFileTimes(referenced_file_times, this);
@@ -982,6 +287,19 @@ void Shader::CheckForUpdate()
         m_vertexLastWriteTime < vertexFileTime ||
         m_pixelLastWriteTime  < pixelFileTime)
     {
+        //The text is only read once a file changed, the checks above run several times a second
+        std::string vertexText;
+        std::string pixelText;
+        {
+            File vertexFile(m_vertexFile, File::Mode::Read, false);
+            vertexFile.GetText();
+            vertexText = vertexFile.m_dataString;
+
+            File pixelFile(m_pixelFile, File::Mode::Read, false);
+            pixelFile.GetText();
+            pixelText = pixelFile.m_dataString;
+        }
+
         //Compile shaders and link to program
         if (!CompileShader(vertexText, m_vertexFile, Type_Vertex) ||
             !CompileShader(pixelText, m_pixelFile, Type_Pixel))
@@ -1005,73 +323,147 @@ void Shader::CheckForUpdate()
 
 
 
+//************
+//State Cache
+//************
 
+#define SAMPLER_SLOT_COUNT 16
 
+//What the backend was last told to bind, Invalid when it is not known
+struct RenderState {
+    Shader::Index   shader      = Shader::Index_Invalid;
+    RasterizerState rasterizer  = RasterizerState::Invalid;
+    Vec2I           viewport    = {};
+    Texture::Index  samplers[SAMPLER_SLOT_COUNT] = {};
+    DepthState      depth       = DepthState::Invalid;
+    BlendState      blend       = BlendState::Invalid;
+};
+static RenderState      s_render_state;
+static RenderStateStats s_state_stats;
+static RenderStateStats s_state_stats_last_frame;
 
-
-
-
-
-
-
-void CreateRenderTargetView(ID3D11RenderTargetView** rtv, DXGI_FORMAT format, ID3D11Texture2D* texture)
+//Counts the bind, true when it has to reach the backend
+static bool SubmitState(RenderCommand type, bool changed)
 {
-    assert(rtv);
-    if (*rtv)
+    s_state_stats.submitted++;
+    s_state_stats.submitted_by_type[+type]++;
+    if (!changed)
     {
-        SafeRelease(*rtv);
-        *rtv = nullptr;
+        s_state_stats.filtered++;
+        s_state_stats.filtered_by_type[+type]++;
     }
+    return changed;
+}
 
-    D3D11_RENDER_TARGET_VIEW_DESC desc;
-    ZeroMemory(&desc, sizeof(desc));
-    desc.Format = format;
-    desc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-    desc.Texture2D.MipSlice = 0;
-
-    VERIFY(SUCCEEDED(s_dx11.device->CreateRenderTargetView(
-        texture,    //[in]            ID3D11Resource* pResource,
-        &desc,      //[in, optional]  const D3D11_RENDER_TARGET_VIEW_DESC* pDesc,
-        rtv         //[out, optional] ID3D11RenderTargetView** ppRTView
-    )));
+const RenderStateStats& GetRenderStateStats()
+{
+    return s_state_stats_last_frame;
 }
-void CreateRenderTargetView(ID3D11RenderTargetView** rtv, Texture::Index texture_index)
+
+void InvalidateStateCache()
 {
-    DX11Texture* t = reinterpret_cast<DX11Texture*>(g_renderer.textures[texture_index]);
-    CreateRenderTargetView(rtv, t->m_format, t->m_texture2D);
+    s_render_state = {};
 }
 
+void BindShader(Shader::Index shader)
+{
+    if (SubmitState(RenderCommand::BindShader, s_render_state.shader != shader))
+    {
+        s_render_state.shader = shader;
+        BackendBindShader(shader);
+    }
+}
 
-void FillIndexBuffer(GpuBuffer* ib, size_t count)
+void BindRasterizer(RasterizerState state)
 {
-    if (ib->m_count > count)
-        return;
-    std::vector<u32> arr;
+    if (SubmitState(RenderCommand::BindRasterizer, s_render_state.rasterizer != state))
+    {
+        s_render_state.rasterizer = state;
+        BackendBindRasterizer(state);
+    }
+}
 
-    //size_t amount = VOXEL_MAX_SIZE * VOXEL_MAX_SIZE * VOXEL_MAX_SIZE * 6 * 6;
-    size_t amount = 6 * count;
-    arr.reserve(amount);
-    i32 baseIndex = 0;
-    for (i32 i = 0; i < amount; i += 6)
+void BindViewport(const Vec2I& size)
+{
+    if (SubmitState(RenderCommand::BindViewport, s_render_state.viewport != size))
+    {
+        s_render_state.viewport = size;
+        BackendBindViewport(size);
+    }
+}
 
+void BindSampler(u32 slot, Texture::Index texture)
+{
+    VALIDATE(slot < SAMPLER_SLOT_COUNT);
+    if (SubmitState(RenderCommand::BindSampler, s_render_state.samplers[slot] != texture))
     {
-        arr.push_back(baseIndex + 0);
-        arr.push_back(baseIndex + 1);
-        arr.push_back(baseIndex + 2);
-        arr.push_back(baseIndex + 1);
-        arr.push_back(baseIndex + 3);
-        arr.push_back(baseIndex + 2);
+        s_render_state.samplers[slot] = texture;
+        BackendBindSampler(slot, texture);
+    }
+}
+
+void BindDepthState(DepthState state)
+{
+    if (SubmitState(RenderCommand::BindDepthState, s_render_state.depth != state))
+    {
+        s_render_state.depth = state;
+        BackendBindDepthState(state);
+    }
+}
 
-        baseIndex += 4; //Amount of vertices
+void BindBlendState(BlendState state)
+{
+    if (SubmitState(RenderCommand::BindBlendState, s_render_state.blend != state))
+    {
+        s_render_state.blend = state;
+        BackendBindBlendState(state);
     }
+}
 
-    ib->Upload(arr.data(), amount, sizeof(baseIndex));
+
+
+
+
+//************
+//Video
+//************
+
+//Recreates a screen sized texture at the new size, the contents are lost
+bool ResizeTexture(Texture::Index texture_index, const Vec2I& window_size)
+{
+    Texture** t = &g_renderer.textures[texture_index];
+    if (*t)
+    {
+        Texture::TextureParams tp = (*t)->m_parameters;
+        tp.size.xy = window_size;
+        assert(tp.size.z == 0);
+        DeleteTexture(t);
+        CreateTexture(t, tp, nullptr);
+        //The sampler bound for this index is gone
+        InvalidateStateCache();
+        return true;
+    }
+    return false;
 }
 
-typedef HRESULT(*D3DCompileFunc)        (LPCVOID, SIZE_T, LPCSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
-typedef HRESULT(*D3DCompileFromFileFunc)(LPCWSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
 
-void InitializeImGui()
+//Recreates everything that is as big as the screen, the contents are lost
+static void ResizeScreenTextures(const Vec2I& window_size)
+{
+    ResizeTexture(Texture::Index_Backbuffer_Depth,      window_size);
+    ResizeTexture(Texture::Index_Backbuffer_HDR,        window_size);
+    ResizeTexture(Texture::Index_Denoise_Normal_Depth,  window_size);
+    ResizeTexture(Texture::Index_Denoise_Albedo,        window_size);
+    ResizeTexture(Texture::Index_Denoise_Ping,          window_size);
+    ResizeTexture(Texture::Index_Denoise_Pong,          window_size);
+    ResizeTexture(Texture::Index_Temporal_History_Next, window_size);
+    ResizeTexture(Texture::Index_Temporal_History,      window_size);
+    ResizeTexture(Texture::Index_Temporal_Depth,        window_size);
+    //The history no longer lines up with the screen
+    g_renderer.temporal_history_valid = false;
+}
+
+static void InitializeImGui()
 {
     //___________
     //IMGUI SETUP
@@ -1089,8 +481,7 @@ void InitializeImGui()
     //ImGui::StyleColorsLight();
 
     // Setup Platform/Renderer backends
-    ImGui_ImplSDL2_InitForD3D(g_renderer.SDL_Context);
-    ImGui_ImplDX11_Init(s_dx11.device, s_dx11.device_context);
+    InitializeImGuiBackend();
 
     // Load Fonts
     // - If no fonts are loaded, dear imgui will use the default font. You can also load multiple fonts and use ImGui::PushFont()/PopFont() to select them.
@@ -1111,67 +502,9 @@ void InitializeImGui()
     SDL_ShowCursor(SDL_ENABLE);
 }
 
-void UpdateSwapchain(const Vec2I& window_size)
-{
-    SafeRelease(s_dx11.swap_chain.render_target_view);
-    HR(s_dx11.swap_chain.handle->ResizeBuffers(
-        0,                  //UINT        BufferCount, IS THIS RIGHT???
-        (UINT)window_size.x,//UINT        Width,
-        (UINT)window_size.y,//UINT        Height,
-        DXGI_FORMAT_UNKNOWN,//DXGI_FORMAT_R8G8B8A8_UNORM, //DXGI_FORMAT NewFormat,
-        0                   //UINT        SwapChainFlags
-    ));
-
-    DXGI_SWAP_CHAIN_DESC desc;
-    s_dx11.swap_chain.handle->GetDesc(&desc);
-    assert(desc.BufferDesc.Width == window_size.x);
-    assert(desc.BufferDesc.Height == window_size.y);
-    s_dx11.swap_chain.size.x = desc.BufferDesc.Width;
-    s_dx11.swap_chain.size.y = desc.BufferDesc.Height;
-    s_dx11.swap_chain.refresh_rate = desc.BufferDesc.RefreshRate.Numerator;
-    s_dx11.swap_chain.sample_count = desc.SampleDesc.Count;
-    s_dx11.swap_chain.sample_quality = desc.SampleDesc.Quality;
-
-
-    ID3D11Texture2D* backbuffer;
-    VERIFY(SUCCEEDED(s_dx11.swap_chain.handle->GetBuffer(0, IID_PPV_ARGS(&backbuffer))));
-    CreateRenderTargetView(&s_dx11.swap_chain.render_target_view, DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, backbuffer);
-
-    D3D11_TEXTURE2D_DESC backbuffer_desc = {};
-    backbuffer->GetDesc(&backbuffer_desc);
-    SafeRelease(backbuffer);
-    {
-        Texture** t = &g_renderer.textures[Texture::Index_Backbuffer_Depth];
-        if (*t)
-        {
-            Texture::TextureParams tp = (*t)->m_parameters;
-            tp.size.xy = window_size;
-            assert(tp.size.z == 0);
-            DeleteTexture(t);
-            CreateTexture(t, tp, nullptr);
-        }
-    }
-    {
-        Texture** t = &g_renderer.textures[Texture::Index_Backbuffer_HDR];
-        if (*t)
-        {
-            Texture::TextureParams tp = (*t)->m_parameters;
-            tp.size.xy = window_size;
-            assert(tp.size.z == 0);
-            DeleteTexture(t);
-            CreateTexture(t, tp, nullptr);
-            CreateRenderTargetView(&s_dx11.hdr_rtv, Texture::Index_Backbuffer_HDR);
-        }
-    }
-
-}
-
-//#pragma comment(lib, "dxgi.lib")
 void InitializeVideo()
 {
     SDL_SetHint(SDL_HINT_WINDOWS_DPI_AWARENESS, "permonitorv2");
-    //Is this needed?
-    SDL_SetHint(SDL_HINT_RENDER_DRIVER,         "direct3d11");
 
     SDL_Init(SDL_INIT_VIDEO);
     {
@@ -1193,143 +526,8 @@ void InitializeVideo()
 
     g_renderer.SDL_Context = SDL_CreateWindow("V3", g_renderer.pos.x, g_renderer.pos.y, g_renderer.size.x, g_renderer.size.y, windowFlags);
 
-    SDL_SysWMinfo wmInfo;
-    SDL_VERSION(&wmInfo.version);
-    SDL_GetWindowWMInfo(g_renderer.SDL_Context, &wmInfo);
-    HWND hwnd = wmInfo.info.win.window;
-
-
-    {
-#if 0
-        //Do we need to really do this?
-        {
-            IDXGIFactory* factory;
-            VERIFY(SUCCEEDED(CreateDXGIFactory(IID_PPV_ARGS(&factory))));
-            assert(factory);
-            IDXGIAdapter* aOutput;
-            for (UINT i = 0; factory->EnumAdapters(i, &aOutput) != DXGI_ERROR_NOT_FOUND; i++)
-            {
-                DXGI_ADAPTER_DESC desc;
-                HR(aOutput->GetDesc(&desc));
-                desc.Description;
-                UINT id = desc.VendorId;
-            }
-        }
-#endif
-
-
-
-        UINT flags = 0;
-//#if _DEBUG
-        flags |= D3D11_CREATE_DEVICE_DEBUG;
-//#endif
-
-        DXGI_RATIONAL refresh_rate;
-        refresh_rate.Numerator = g_renderer.refresh_rate;
-        refresh_rate.Denominator = 1;
-
-        DXGI_MODE_DESC dxgi_mode_desc;
-        {
-#if 0
-            dxgi_mode_desc.Width = g_renderer.size.x;
-            dxgi_mode_desc.Height = g_renderer.size.y;
-#else
-            dxgi_mode_desc.Width = 0;
-            dxgi_mode_desc.Height = 0;
-#endif
-            dxgi_mode_desc.RefreshRate = refresh_rate;
-            dxgi_mode_desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM; //DXGI_FORMAT_R32G32B32A32_FLOAT;
-            dxgi_mode_desc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
-            dxgi_mode_desc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
-        }
-
-        DXGI_SAMPLE_DESC dxgi_sample_desc;
-        {
-            //MSAA
-            dxgi_sample_desc.Count      = 1;
-            dxgi_sample_desc.Quality    = 0;
-        }
-
-        DXGI_SWAP_CHAIN_DESC swap_chain_desc;
-        swap_chain_desc.BufferDesc = dxgi_mode_desc;
-        swap_chain_desc.SampleDesc = dxgi_sample_desc;
-        swap_chain_desc.BufferUsage = DXGI_USAGE_BACK_BUFFER | DXGI_USAGE_RENDER_TARGET_OUTPUT;
-        swap_chain_desc.BufferCount = 2; //is this right?
-        swap_chain_desc.OutputWindow = hwnd;
-        swap_chain_desc.Windowed = TRUE;
-        swap_chain_desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL; //Does not work with MSAA
-        swap_chain_desc.Flags = 0; //do we need this?  DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING
-
-        const D3D_FEATURE_LEVEL feature_levels[]= { D3D_FEATURE_LEVEL_11_0 };
-        IDXGISwapChain*         swap_chain      = nullptr;
-        D3D_FEATURE_LEVEL       feature_level   = {};
-        ID3D11DeviceContext*    temp_context    = nullptr;
-
-        HR(D3D11CreateDeviceAndSwapChain(
-            nullptr,                    //[in, optional]  IDXGIAdapter               *pAdapter,
-            D3D_DRIVER_TYPE_HARDWARE,   //                D3D_DRIVER_TYPE            DriverType,
-            NULL,                       //                HMODULE                    Software,
-            flags,                      //                UINT                       Flags,
-            feature_levels,             //[in, optional]  const D3D_FEATURE_LEVEL    *pFeatureLevels,
-            arrsize(feature_levels),    //                UINT                       FeatureLevels,
-            D3D11_SDK_VERSION,          //                UINT                       SDKVersion,
-            &swap_chain_desc,           //[in, optional]  const DXGI_SWAP_CHAIN_DESC *pSwapChainDesc,
-            &swap_chain,                //[out, optional] IDXGISwapChain             **ppSwapChain,
-            &s_dx11.device,                    //[out, optional] ID3D11Device               **ppDevice,
-            &feature_level,             //[out, optional] D3D_FEATURE_LEVEL          *pFeatureLevel,
-            &temp_context               //[out, optional] ID3D11DeviceContext        **ppImmediateContext
-        ));
-        assert(s_dx11.device); //FATAL
-
-        VERIFY(SUCCEEDED(temp_context->QueryInterface(IID_PPV_ARGS(&s_dx11.device_context))));
-        temp_context->Release();
-
-        s_dx11.swap_chain.handle = swap_chain;
-        UpdateSwapchain(g_renderer.size);
-
-        // Get factory from device
-        IDXGIDevice*    pDXGIDevice  = nullptr;
-        IDXGIAdapter*   pDXGIAdapter = nullptr;
-        IDXGIFactory*   pFactory     = nullptr;
-
-        if (SUCCEEDED(s_dx11.device->QueryInterface(IID_PPV_ARGS(&pDXGIDevice))))
-            if (SUCCEEDED(pDXGIDevice->GetParent(IID_PPV_ARGS(&pDXGIAdapter))))
-                if (SUCCEEDED(pDXGIAdapter->GetParent(IID_PPV_ARGS(&pFactory))))
-                {
-                    s_dx11.factory         = pFactory;
-                }
-        if (pDXGIDevice) pDXGIDevice->Release();
-        if (pDXGIAdapter) pDXGIAdapter->Release();
-        s_dx11.device->AddRef();
-        s_dx11.device_context->AddRef();
-    }
-
-    {
-        HINSTANCE dll_instance = LoadLibrary("d3dcompiler_47.dll");
-        VALIDATE(dll_instance);
-        s_dx11.D3DCompileFunc          = (D3DCompileFunc)GetProcAddress(dll_instance, "D3DCompile");
-        s_dx11.D3DCompileFromFileFunc  = (D3DCompileFromFileFunc)GetProcAddress(dll_instance, "D3DCompileFromFile");
-    }
-
-#if 0 //Unsure if this is needed for creating window with SDL and D3D11
-    SDL_Renderer* renderer = nullptr;
-    for (i32 i = 0; i < SDL_GetNumRenderDrivers(); i++)
-    {
-        SDL_RendererInfo rendererInfo = {};
-        SDL_GetRenderDriverInfo(i, &rendererInfo);
-        if (rendererInfo.name == std::string("direct3d11"))
-        {
-            renderer = SDL_CreateRenderer(g_renderer.SDL_Context, i, 0);
-        }
-
-        break;
-    }
-#endif
-
-#if 0 //OpenGL code
-    /* This makes our buffer swap syncronized with the monitor's vertical refresh */
-    SDL_GL_SetSwapInterval(g_renderer.swapInterval);
-#endif
+    InitializeBackend();
+    s_backbuffer_size = g_renderer.size;
 
     //Create Textures:
     CreateTexture(&g_renderer.textures[Texture::Index_Minecraft], "assets/MinecraftSpriteSheet20120215Modified.png", Texture::Format_R8G8B8A8_UNORM_SRGB, Texture::Filter_Point);
@@ -1339,7 +537,7 @@ void InitializeVideo()
 
     {
         Texture::TextureParams tp = {
-            .size = ToVec3I(s_dx11.swap_chain.size, 0),
+            .size = ToVec3I(g_renderer.size, 0),
             .format = Texture::Format_D32_FLOAT,
             .mode = Texture::Address_Invalid,
             .filter = Texture::Filter_Invalid,
@@ -1348,10 +546,12 @@ void InitializeVideo()
             .bytes_per_pixel = 0,
         };
         CreateTexture(&g_renderer.textures[Texture::Index_Backbuffer_Depth], tp, nullptr);
+        //Depth of the last frame, copied at the end of the temporal pass
+        CreateTexture(&g_renderer.textures[Texture::Index_Temporal_Depth], tp, nullptr);
     }
     {
         Texture::TextureParams tp = {
-            .size   = ToVec3I(s_dx11.swap_chain.size, 0),
+            .size   = ToVec3I(g_renderer.size, 0),
             .format = Texture::Format_R11G11B10_FLOAT,
             .mode   = Texture::Address_Clamp,
             .filter = Texture::Filter_Aniso,
@@ -1360,6 +560,30 @@ void InitializeVideo()
             .bytes_per_pixel = 4,
         };
         CreateTexture(&g_renderer.textures[Texture::Index_Backbuffer_HDR], tp, nullptr);
+        //Same format as the HDR target so the result can be copied back
+        CreateTexture(&g_renderer.textures[Texture::Index_Denoise_Ping], tp, nullptr);
+        CreateTexture(&g_renderer.textures[Texture::Index_Denoise_Pong], tp, nullptr);
+    }
+    {
+        Texture::TextureParams tp = {
+            .size   = ToVec3I(g_renderer.size, 0),
+            .format = Texture::Format_R16G16B16A16_FLOAT,
+            .mode   = Texture::Address_Clamp,
+            .filter = Texture::Filter_Point,
+            .type   = Texture::Type_Texture,
+            .render_target = true,
+            .bytes_per_pixel = 8,
+        };
+        CreateTexture(&g_renderer.textures[Texture::Index_Denoise_Normal_Depth], tp, nullptr);
+        //Resized to the trace size by DrawPathTracedVoxels
+        CreateTexture(&g_renderer.textures[Texture::Index_Trace_Normal_Depth], tp, nullptr);
+        CreateTexture(&g_renderer.textures[Texture::Index_Trace_Color], tp, nullptr);
+        //rgb: accumulated color, a: number of frames accumulated
+        CreateTexture(&g_renderer.textures[Texture::Index_Temporal_History], tp, nullptr);
+        CreateTexture(&g_renderer.textures[Texture::Index_Temporal_History_Next], tp, nullptr);
+        tp.format = Texture::Format_R8G8B8A8_UNORM;
+        tp.bytes_per_pixel = 4;
+        CreateTexture(&g_renderer.textures[Texture::Index_Denoise_Albedo], tp, nullptr);
     }
 
     //Create Shaders:
@@ -1370,37 +594,53 @@ void InitializeVideo()
     //        { "NORMAL",     0, DXGI_FORMAT_R32G32B32_FLOAT,   0, (UINT)offsetof(Vertex, n),   D3D11_INPUT_PER_VERTEX_DATA, 0 }, };
     //    g_renderer.shaders[+Shader::Main] = new Shader("Source/Shaders/Main.vert", "Source/Shaders/Main.frag", layout, arrsize(layout));
     //}
-    //{
-    //    D3D11_INPUT_ELEMENT_DESC layout[] = {
-    //        { "POSITION",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, (UINT)offsetof(Vertex_Voxel, p),   D3D11_INPUT_PER_VERTEX_DATA, 0 },
-    //        { "COLOR",      0, DXGI_FORMAT_R32_UINT,        0, (UINT)offsetof(Vertex_Voxel, rgba),D3D11_INPUT_PER_VERTEX_DATA, 0 },
-    //        { "NORMAL",     0, DXGI_FORMAT_R8_UINT,         0, (UINT)offsetof(Vertex_Voxel, n),   D3D11_INPUT_PER_VERTEX_DATA, 0 },
-    //        { "AO",         0, DXGI_FORMAT_R8_UINT,         0, (UINT)offsetof(Vertex_Voxel, ao),  D3D11_INPUT_PER_VERTEX_DATA, 0 }, };
-    //    g_renderer.shaders[+Shader::Voxel_Rast] = new Shader("Source/Shaders/Voxel_Rast.vert", "Source/Shaders/Voxel_Rast.frag", layout, arrsize(layout));
-    //}
+    {
+        Shader::InputElementDesc layout[] = {
+            { "POSITION",   Shader::VertexFormat_R32_UINT,  offsetof(Vertex_VoxelPacked, position)      },
+            { "ATTRIBUTES", Shader::VertexFormat_R32_UINT,  offsetof(Vertex_VoxelPacked, attributes)    } };
+        VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Voxel_Rast], "Source/Shaders/Voxel_Rast.hlsl", layout, arrsize(layout)));
+    }
     {
         //D3D11_INPUT_ELEMENT_DESC layout[] = { { "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 } };
-        Shader::InputElementDesc layout[] = { { "POSITION", DXGI_FORMAT_R32G32_FLOAT, 0 } };
+        Shader::InputElementDesc layout[] = { { "POSITION", Shader::VertexFormat_R32G32_FLOAT, 0 } };
         VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Voxel],   "Source/Shaders/Voxel.hlsl",    layout, arrsize(layout)));
+        VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Voxel_Primary], "Source/Shaders/Voxel_Primary.hlsl", layout, arrsize(layout)));
     }
     {
         Shader::InputElementDesc layout[] = {
-            { "COLOR",      DXGI_FORMAT_R32G32B32A32_FLOAT, offsetof(Vertex_Cube, color)    },
-            { "POSITION",   DXGI_FORMAT_R32G32B32_FLOAT,    offsetof(Vertex_Cube, p)        },
-            { "TEXCOORD",   DXGI_FORMAT_R32G32_FLOAT,       offsetof(Vertex_Cube, uv)       } };
+            { "POSITION",           Shader::VertexFormat_R32G32B32_FLOAT,    offsetof(Vertex, p)                             },
+            { "TEXCOORD",           Shader::VertexFormat_R32G32_FLOAT,       offsetof(Vertex, uv)                            },
+            { "INSTANCE_POSITION",  Shader::VertexFormat_R32G32B32_FLOAT,    offsetof(Vertex_PrimitiveInstance, p),      1   },
+            { "INSTANCE_SCALE",     Shader::VertexFormat_R32G32B32_FLOAT,    offsetof(Vertex_PrimitiveInstance, scale),  1   },
+            { "INSTANCE_COLOR",     Shader::VertexFormat_R8G8B8A8_UNORM,     offsetof(Vertex_PrimitiveInstance, color),  1   } };
         VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Cube],    "Source/Shaders/Cube.hlsl",     layout, arrsize(layout)));
     }
     {
         Shader::InputElementDesc layout[] = {
-            { "COLOR",      DXGI_FORMAT_R32G32B32A32_FLOAT, offsetof(Vertex_Tetra, color)    },
-            { "POSITION",   DXGI_FORMAT_R32G32B32_FLOAT,    offsetof(Vertex_Tetra, p)        },
-            { "NORMAL",     DXGI_FORMAT_R32G32B32_FLOAT,    offsetof(Vertex_Tetra, n)        } };
+            { "POSITION",           Shader::VertexFormat_R32G32B32_FLOAT,    offsetof(Vertex, p)                                 },
+            { "NORMAL",             Shader::VertexFormat_R32G32B32_FLOAT,    offsetof(Vertex, n)                                 },
+            { "INSTANCE_POSITION",  Shader::VertexFormat_R32G32B32_FLOAT,    offsetof(Vertex_PrimitiveInstance, p),          1   },
+            { "INSTANCE_SCALE",     Shader::VertexFormat_R32G32B32_FLOAT,    offsetof(Vertex_PrimitiveInstance, scale),      1   },
+            { "INSTANCE_COLOR",     Shader::VertexFormat_R8G8B8A8_UNORM,     offsetof(Vertex_PrimitiveInstance, color),      1   },
+            { "INSTANCE_DIRECTION", Shader::VertexFormat_R10G10B10A2_UNORM,  offsetof(Vertex_PrimitiveInstance, direction),  1   } };
         VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Tetra],    "Source/Shaders/Tetra.hlsl",   layout, arrsize(layout)));
     }
     {
-        Shader::InputElementDesc layout[] = { { "POSITION", DXGI_FORMAT_R32G32_FLOAT, 0 } };
+        Shader::InputElementDesc layout[] = { { "POSITION", Shader::VertexFormat_R32G32_FLOAT, 0 } };
         VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Final_Draw],   "Source/Shaders/Final_Draw.hlsl",  layout, arrsize(layout)));
     }
+    {
+        Shader::InputElementDesc layout[] = { { "POSITION", Shader::VertexFormat_R32G32_FLOAT, 0 } };
+        VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Denoise],      "Source/Shaders/Denoise.hlsl",     layout, arrsize(layout)));
+    }
+    {
+        Shader::InputElementDesc layout[] = { { "POSITION", Shader::VertexFormat_R32G32_FLOAT, 0 } };
+        VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Upsample],     "Source/Shaders/Upsample.hlsl",    layout, arrsize(layout)));
+    }
+    {
+        Shader::InputElementDesc layout[] = { { "POSITION", Shader::VertexFormat_R32G32_FLOAT, 0 } };
+        VERIFY(CreateShader(&g_renderer.shaders[+Shader::Index_Temporal],     "Source/Shaders/Temporal.hlsl",    layout, arrsize(layout)));
+    }
     //{
     //    D3D11_INPUT_ELEMENT_DESC layout[] = {
     //        { "POSITION",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, (UINT)offsetof(Vertex_Cube, p),   D3D11_INPUT_PER_VERTEX_DATA, 0 },
@@ -1412,9 +652,40 @@ void InitializeVideo()
     CreateGpuBuffer(&g_renderer.quad_ib,        "Quad_IB",          true,   GpuBuffer::Type::Index);
     FillIndexBuffer(g_renderer.quad_ib, 6 * 4);
     CreateGpuBuffer(&g_renderer.tetra_vb,       "Tetra_VB",         false,  GpuBuffer::Type::Vertex);
-    //CreateGpuBuffer(&g_renderer.voxel_rast_vb,  "Voxel_Rast_VB",    true,   GpuBuffer::Type::Vertex);
+    {
+        Vertex vertices[arrsize(tetrahedron_positions)] = {};
+        for (i32 i = 0; i < arrsize(tetrahedron_positions); i += 3)
+        {
+            const Vec3* p = &tetrahedron_positions[i];
+            Vec3 normal = Normalize(CrossProduct(p[1] - p[0], p[2] - p[0]));
+            for (i32 j = 0; j < 3; j++)
+            {
+                vertices[i + j].p = p[j];
+                vertices[i + j].n = normal;
+            }
+        }
+        g_renderer.tetra_vb->Upload(vertices, arrsize(vertices), sizeof(vertices[0]));
+    }
+    CreateGpuBuffer(&s_upload_ring.buffer,      "Upload_Ring_VB",   true,   GpuBuffer::Type::Vertex);
+    s_upload_ring.buffer->Reserve(UPLOAD_RING_START_BYTES);
+    s_upload_ring.capacity = UPLOAD_RING_START_BYTES;
+    s_upload_ring.stats.capacity = UPLOAD_RING_START_BYTES;
+    for (i32 lod = 0; lod < VOXEL_MESH_LOD_COUNT; lod++)
+    {
+        CreateGpuBuffer(&g_renderer.voxel_rast_vb[lod], "Voxel_Rast_VB", false, GpuBuffer::Type::Vertex);
+        CreateGpuBuffer(&g_renderer.voxel_rast_ib[lod], "Voxel_Rast_IB", false, GpuBuffer::Type::Index);
+    }
     //CreateGpuBuffer(&g_renderer.box_vb,         "Box_VB",           false,  GpuBuffer::Type::Vertex);
     CreateGpuBuffer(&g_renderer.cube_vb,        "Cube_VB",          false,  GpuBuffer::Type::Vertex);
+    {
+        Vertex vertices[arrsize(vertices_cube_full)] = {};
+        for (i32 i = 0; i < arrsize(vertices_cube_full); i++)
+        {
+            vertices[i] = vertices_cube_full[i];
+            vertices[i].uv = uv_coordinates_full[i % arrsize(uv_coordinates_full)];
+        }
+        g_renderer.cube_vb->Upload(vertices, arrsize(vertices), sizeof(vertices[0]));
+    }
     {
         float p = 0.5f;
         Vertex vertices[] = {
@@ -1491,176 +762,37 @@ void InitializeVideo()
         g_renderer.voxel_vb->Upload(a, arrsize(a), sizeof(a[0]));
     }
     CreateGpuBuffer(&g_renderer.cb_common, "common_cb", true, GpuBuffer::Type::Constant);
-
-    //Create Blender State
-    {
-        D3D11_BLEND_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        desc.AlphaToCoverageEnable = false;
-        desc.IndependentBlendEnable = false;
-        desc.RenderTarget[0].BlendEnable = true;
-        desc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
-        desc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
-        desc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
-        desc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
-        desc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
-        desc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
-        desc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-        s_dx11.device->CreateBlendState(&desc, &s_dx11.blend_state);
-    }
-
-    // Create the rasterizer state
-    {
-        D3D11_RASTERIZER_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        desc.FillMode = D3D11_FILL_SOLID;
-        desc.CullMode = D3D11_CULL_BACK;
-        desc.FrontCounterClockwise = TRUE;
-        desc.DepthBias = 0;
-        desc.DepthBiasClamp = 0.0f;
-        desc.SlopeScaledDepthBias = 0.0f;
-        desc.DepthClipEnable = TRUE;
-        desc.ScissorEnable = FALSE;
-        desc.MultisampleEnable = TRUE;
-        desc.AntialiasedLineEnable = TRUE;
-        s_dx11.device->CreateRasterizerState(&desc, &s_dx11.rasterizer_full);
-    }
-    {
-        D3D11_RASTERIZER_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        desc.FillMode = D3D11_FILL_WIREFRAME;
-        desc.CullMode = D3D11_CULL_NONE;
-        desc.FrontCounterClockwise = TRUE;
-        desc.DepthBias = 0;
-        desc.DepthBiasClamp = 0.0f;
-        desc.SlopeScaledDepthBias = 0.0f;
-        desc.DepthClipEnable = TRUE;
-        desc.ScissorEnable = FALSE;
-        desc.MultisampleEnable = TRUE;
-        desc.AntialiasedLineEnable = TRUE;
-        s_dx11.device->CreateRasterizerState(&desc, &s_dx11.rasterizer_wireframe);
-    }
-    {
-        D3D11_RASTERIZER_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        desc.FillMode = D3D11_FILL_SOLID;
-        desc.CullMode = D3D11_CULL_NONE;
-        desc.FrontCounterClockwise = TRUE;
-        desc.DepthBias = 0;
-        desc.DepthBiasClamp = 0.0f;
-        desc.SlopeScaledDepthBias = 0.0f;
-        desc.DepthClipEnable = FALSE;
-        desc.ScissorEnable = FALSE;
-        desc.MultisampleEnable = FALSE;
-        desc.AntialiasedLineEnable = FALSE;
-        s_dx11.device->CreateRasterizerState(&desc, &s_dx11.rasterizer_voxel);
-    }
-    CreateRenderTargetView(&s_dx11.hdr_rtv, Texture::Index_Backbuffer_HDR);
-    {
-        D3D11_DEPTH_STENCIL_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        // Depth test parameters
-        desc.DepthEnable = true;
-        desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-        desc.DepthFunc = D3D11_COMPARISON_LESS;
-
-        // Stencil test parameters
-        desc.StencilEnable = false;
-        desc.StencilReadMask = 0xFF;
-        desc.StencilWriteMask = 0xFF;
-
-        // Stencil operations if pixel is front-facing
-        desc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-        desc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_INCR;
-        desc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-        desc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-
-        // Stencil operations if pixel is back-facing
-        desc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-        desc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_DECR;
-        desc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-        desc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-
-        // Create depth stencil state
-        HR(s_dx11.device->CreateDepthStencilState(&desc, &s_dx11.depth_stencil_state_depth));
-    }
-    {
-        D3D11_DEPTH_STENCIL_DESC desc;
-        ZeroMemory(&desc, sizeof(desc));
-        // Depth test parameters
-        desc.DepthEnable = false;
-        desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
-        desc.DepthFunc = D3D11_COMPARISON_LESS;
-
-        // Stencil test parameters
-        desc.StencilEnable = false;
-        desc.StencilReadMask = 0xFF;
-        desc.StencilWriteMask = 0xFF;
-
-        // Stencil operations if pixel is front-facing
-        desc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-        desc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_INCR;
-        desc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-        desc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-
-        // Stencil operations if pixel is back-facing
-        desc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
-        desc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_DECR;
-        desc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
-        desc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-
-        // Create depth stencil state
-        HR(s_dx11.device->CreateDepthStencilState(&desc, &s_dx11.depth_stencil_state_no_depth));
-    }
+    CreateGpuBuffer(&g_renderer.cb_denoise, "denoise_cb", true, GpuBuffer::Type::Constant);
 
     InitializeImGui();
 }
 
 
-
-Vec3 Step(Vec3 a, float b)
-{
-    Vec3 r = {};
-    if (b > a.x)
-        r.x = 1;
-    if (b > a.y)
-        r.y = 1;
-    if (b > a.z)
-        r.z = 1;
-    return r;
-}
-
-// Converts a color from sRGB gamma to linear light gamma
-Vec4 srgb_to_linear(Vec4 sRGB)
-{
-    Vec3 cutoff = Step(sRGB.rgb, 0.04045f);
-    // abs is here to silence compiler warning
-    Vec3 a = (Abs(sRGB.rgb) + 0.055f) / 1.055f;
-    Vec3 higher;
-    higher.x = powf(a.x, 2.4f);
-    higher.y = powf(a.y, 2.4f);
-    higher.z = powf(a.z, 2.4f);
-    Vec3 lower = sRGB.rgb / 12.92f;
-    Vec3 result = Lerp(higher, lower, cutoff);
-    return Vec4(result.r, result.g, result.b, sRGB.a);
-}
-
 double s_last_shader_update_time = 0;
 double s_incremental_time = 0;
 void RenderUpdate(Vec2I window_size, float deltaTime)
 {
     ZoneScopedN("Render Update");
+    //Shaders may be compiled again below and the resize creates new textures
+    InvalidateStateCache();
 
     //Vec2I window_size;
     //SDL_GetWindowSizeInPixels(g_renderer.SDL_Context, &window_size.x, &window_size.y);
-    if (s_dx11.swap_chain.size != window_size)
-        UpdateSwapchain(window_size);
+    if (s_backbuffer_size != window_size)
+    {
+        ResizeBackbuffer(window_size);
+        ResizeScreenTextures(window_size);
+        s_backbuffer_size = window_size;
+    }
 
     Vec4 background_color = srgb_to_linear(backgroundColor);
-    s_dx11.device_context->ClearRenderTargetView(s_dx11.swap_chain.render_target_view, background_color.e);
-    s_dx11.device_context->ClearRenderTargetView(s_dx11.hdr_rtv, background_color.e);
-    DX11Texture* depth = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Backbuffer_Depth]);
-    s_dx11.device_context->ClearDepthStencilView(depth->m_depth_stencil_view, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    ClearRenderTarget(Texture::Index_Swapchain, background_color);
+    ClearRenderTarget(Texture::Index_Backbuffer_HDR, background_color);
+    //Depth of 0 marks pixels the denoiser should leave alone
+    const Vec4 no_features = {};
+    ClearRenderTarget(Texture::Index_Denoise_Normal_Depth, no_features);
+    ClearRenderTarget(Texture::Index_Denoise_Albedo, no_features);
+    ClearDepth(Texture::Index_Backbuffer_Depth, 1.0f);
 
     if (s_last_shader_update_time + 0.1f <= s_incremental_time)
     {
@@ -1674,6 +806,14 @@ void RenderUpdate(Vec2I window_size, float deltaTime)
     s_incremental_time += deltaTime;
 }
 
+void RenderPresent()
+{
+    EndUploadFrame();
+    Present();
+    s_state_stats_last_frame = s_state_stats;
+    s_state_stats = {};
+}
+
 
 
 
@@ -1791,8 +931,8 @@ TextureCube::TextureCube(const char* fileLocation)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    FILE* file;
-    if (fopen_s(&file, fileLocation, "rb") != 0)
+    FILE* file = fopen(fileLocation, "rb");
+    if (file == nullptr)
     {
         assert(false);
         return;
@@ -1863,285 +1003,456 @@ void TextureCube::Bind()
 }
 #endif
 
-void RenderPresent()
-{
-    s_dx11.swap_chain.handle->Present(1, 0);
-}
-
 void DrawPathTracedVoxels()
 {
-    ID3D11DeviceContext* context = s_dx11.device_context;
-    DX11Shader* shader          = reinterpret_cast<DX11Shader*>(g_renderer.shaders[+Shader::Index_Voxel]);
-    DX11Texture* voxel_indices  = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Voxel_Indices]);
-    DX11Texture* voxel_indices_mip1 = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Voxel_Indices_mip1]);
-    DX11Texture* voxel_indices_mip2 = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Voxel_Indices_mip2]);
-    DX11Texture* voxel_indices_mip3 = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Voxel_Indices_mip3]);
-    DX11Texture* voxel_indices_mip4 = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Voxel_Indices_mip4]);
-    DX11Texture* voxel_indices_mip5 = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Voxel_Indices_mip5]);
-    DX11Texture* voxel_indices_mip6 = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Voxel_Indices_mip6]);
-    DX11Texture* random         = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Random]);
-    DX11GpuBuffer* vb           = reinterpret_cast<DX11GpuBuffer*>(g_renderer.voxel_vb);
-    DX11Texture* depth  = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Backbuffer_Depth]);
-    DX11Texture* target = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Backbuffer_HDR]);
+    GpuBuffer* vb = g_renderer.voxel_vb;
+    const u32 stride = sizeof(Vec2);
 
     //Bindings
     {
         g_renderer.structure_voxel_materials->Bind(SLOT_VOXEL_MATERIALS, GpuBuffer::BindLocation::Pixel);
+        g_renderer.structure_emissive_lights->Bind(SLOT_EMISSIVE_LIGHTS, GpuBuffer::BindLocation::Pixel);
+        g_renderer.structure_voxel_faces->Bind(SLOT_VOXEL_FACES, GpuBuffer::BindLocation::Pixel);
+        g_renderer.structure_irradiance_cache->Bind(SLOT_IRRADIANCE_CACHE, GpuBuffer::BindLocation::Pixel);
+        g_renderer.structure_sun_visibility->Bind(SLOT_SUN_VISIBILITY, GpuBuffer::BindLocation::Pixel);
+        g_renderer.structure_voxel_face_ao->Bind(SLOT_VOXEL_FACE_AO, GpuBuffer::BindLocation::Pixel);
     }
 
-    //Input Assembler
+    //Input Assembler and Shaders
     {
-        context->IASetInputLayout(shader->m_vertex_input_layout);
-        UINT strides[] = { sizeof(Vec2), };
-        UINT offsets[] = { 0, };
-        context->IASetVertexBuffers(0, 1, &vb->m_buffer, strides, offsets);
-        context->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        BindVertexBuffers(&vb, &stride, nullptr, 1);
+        BindShader(Shader::Index_Voxel);
     }
 
-    //Vertex Shader
+    //Rasterizer
     {
-        context->VSSetShader(shader->m_vertex_shader, NULL, 0);
+        BindRasterizer(RasterizerState::Voxel);
+        BindViewport(s_backbuffer_size);
     }
-    //Hull shader
+
+    //Pixel Shader
     {
-        context->HSSetShader(nullptr, nullptr, 0);
+        BindSampler(SLOT_VOXEL_INDICES_SAMPLER,  Texture::Index_Voxel_Indices);
+        BindSampler(SLOT_RANDOM_TEXTURE_SAMPLER, Texture::Index_Random);
+
+        BindTexture(SLOT_VOXEL_INDICES,   Texture::Index_Voxel_Indices);
+        //BindTexture(SLOT_VOXEL_INDICES_MIP1,  Texture::Index_Voxel_Indices_mip1);
+        //BindTexture(SLOT_VOXEL_INDICES_MIP2,  Texture::Index_Voxel_Indices_mip2);
+        //BindTexture(SLOT_VOXEL_INDICES_MIP3,  Texture::Index_Voxel_Indices_mip3);
+        //BindTexture(SLOT_VOXEL_INDICES_MIP4,  Texture::Index_Voxel_Indices_mip4);
+        //BindTexture(SLOT_VOXEL_INDICES_MIP5,  Texture::Index_Voxel_Indices_mip5);
+        //BindTexture(SLOT_VOXEL_INDICES_MIP6,  Texture::Index_Voxel_Indices_mip6);
+        BindTexture(SLOT_RANDOM_TEXTURE,  Texture::Index_Random);
     }
-    //Domain shader
+
+    const TraceLayout layout = GetTraceLayout(g_renderer.render_scale, s_backbuffer_size, g_renderer.frame_index++);
+    if (layout.scale == 1 && !layout.checkerboard)
     {
-        context->DSSetShader(nullptr, nullptr, 0);
+        //Output Merger
+        {
+            const Texture::Index targets[] = { Texture::Index_Backbuffer_HDR, Texture::Index_Denoise_Normal_Depth, Texture::Index_Denoise_Albedo };
+            BindDepthState(DepthState::Depth);
+            BindRenderTargets(targets, arrsize(targets), Texture::Index_Backbuffer_Depth);
+            //No blending, the feature buffers store depth in alpha
+            BindBlendState(BlendState::Opaque);
+        }
+
+        //Draw
+        {
+            Draw(u32(vb->m_count));
+        }
+        return;
     }
-    //Geometry shader
+
+    //Full resolution first hit: depth and the feature buffers the upsample and denoiser are guided by.
+    //The color target is left unbound so pixels without a traced neighbour keep the background
     {
-        context->GSSetShader(nullptr, nullptr, 0);
+        BindShader(Shader::Index_Voxel_Primary);
+        const Texture::Index targets[] = { Texture::Index_Invalid, Texture::Index_Denoise_Normal_Depth, Texture::Index_Denoise_Albedo };
+        BindDepthState(DepthState::Depth);
+        BindRenderTargets(targets, arrsize(targets), Texture::Index_Backbuffer_Depth);
+        BindBlendState(BlendState::Opaque);
+        Draw(u32(vb->m_count));
     }
 
-    //Rasterizer
+    //Lighting at the trace size, misses keep a depth of 0
     {
-        context->RSSetState(s_dx11.rasterizer_voxel);
-        D3D11_VIEWPORT view_port = {
-            .TopLeftX = 0.0f,
-            .TopLeftY = 0.0f,
-            .Width = (float)s_dx11.swap_chain.size.x,
-            .Height = (float)s_dx11.swap_chain.size.y,
-            .MinDepth = 0.0f,
-            .MaxDepth = 1.0f,
-        };
-        context->RSSetViewports(1, &view_port);
+        if (g_renderer.textures[Texture::Index_Trace_Color]->m_parameters.size.xy != layout.trace_size)
+        {
+            ResizeTexture(Texture::Index_Trace_Color,           layout.trace_size);
+            ResizeTexture(Texture::Index_Trace_Normal_Depth,    layout.trace_size);
+        }
+        const Vec4 no_trace = {};
+        ClearRenderTarget(Texture::Index_Trace_Color, no_trace);
+        ClearRenderTarget(Texture::Index_Trace_Normal_Depth, no_trace);
+
+        BindViewport(layout.trace_size);
+        BindShader(Shader::Index_Voxel);
+        const Texture::Index targets[] = { Texture::Index_Trace_Color, Texture::Index_Trace_Normal_Depth };
+        BindDepthState(DepthState::NoDepth);
+        BindRenderTargets(targets, arrsize(targets), Texture::Index_Invalid);
+        Draw(u32(vb->m_count));
     }
 
-    //Pixel Shader
+    UpsampleTracedVoxels();
+}
+
+//Joint bilateral upsample of the trace targets into the HDR target, guided by the full resolution first hit
+void UpsampleTracedVoxels()
+{
+    GpuBuffer* vb = g_renderer.voxel_vb;
+    const u32 stride = sizeof(Vec2);
+
+    //Input Assembler and Shaders
     {
-        context->PSSetShader(shader->m_pixel_shader, NULL, 0);
-        context->PSSetSamplers(SLOT_VOXEL_INDICES_SAMPLER,  1, &voxel_indices->m_sampler);
-        context->PSSetSamplers(SLOT_RANDOM_TEXTURE_SAMPLER, 1, &random->m_sampler);
+        BindVertexBuffers(&vb, &stride, nullptr, 1);
+        BindShader(Shader::Index_Upsample);
+    }
 
-        context->PSSetShaderResources(SLOT_VOXEL_INDICES,   1, &voxel_indices->m_view);
-        //context->PSSetShaderResources(SLOT_VOXEL_INDICES_MIP1,  1, &voxel_indices_mip1->m_view);
-        //context->PSSetShaderResources(SLOT_VOXEL_INDICES_MIP2,  1, &voxel_indices_mip2->m_view);
-        //context->PSSetShaderResources(SLOT_VOXEL_INDICES_MIP3,  1, &voxel_indices_mip3->m_view);
-        //context->PSSetShaderResources(SLOT_VOXEL_INDICES_MIP4,  1, &voxel_indices_mip4->m_view);
-        //context->PSSetShaderResources(SLOT_VOXEL_INDICES_MIP5,  1, &voxel_indices_mip5->m_view);
-        //context->PSSetShaderResources(SLOT_VOXEL_INDICES_MIP6,  1, &voxel_indices_mip6->m_view);
-        context->PSSetShaderResources(SLOT_RANDOM_TEXTURE,  1, &random->m_view);
+    //Rasterizer
+    {
+        BindRasterizer(RasterizerState::Voxel);
+        BindViewport(s_backbuffer_size);
     }
 
     //Output Merger
     {
-        context->OMSetDepthStencilState(s_dx11.depth_stencil_state_depth, 1);
-        context->OMSetRenderTargets(1, &s_dx11.hdr_rtv, depth->m_depth_stencil_view);
-        context->OMSetBlendState(s_dx11.blend_state, NULL, 0xffffffff);
+        BindDepthState(DepthState::NoDepth);
+        BindBlendState(BlendState::Opaque);
+        //Unbinds the trace and feature targets so they can be read
+        const Texture::Index target = Texture::Index_Backbuffer_HDR;
+        BindRenderTargets(&target, 1, Texture::Index_Invalid);
     }
 
-    //Compute shader
+    //Pixel Shader
     {
-        context->CSSetShader(nullptr, nullptr, 0);
+        BindTexture(SLOT_TRACE_COLOR,         Texture::Index_Trace_Color);
+        BindTexture(SLOT_TRACE_NORMAL_DEPTH,  Texture::Index_Trace_Normal_Depth);
+        BindTexture(SLOT_GUIDE_NORMAL_DEPTH,  Texture::Index_Denoise_Normal_Depth);
     }
 
     //Draw
     {
-        context->Draw((UINT)vb->m_count, 0);
+        Draw(u32(vb->m_count));
     }
+
+    BindTexture(SLOT_TRACE_COLOR,         Texture::Index_Invalid);
+    BindTexture(SLOT_TRACE_NORMAL_DEPTH,  Texture::Index_Invalid);
+    BindTexture(SLOT_GUIDE_NORMAL_DEPTH,  Texture::Index_Invalid);
+    BindRenderTargets(nullptr, 0, Texture::Index_Invalid);
 }
 
-void FinalDraw()
+void AccumulatePathTracedVoxels()
 {
-    ID3D11DeviceContext* context = s_dx11.device_context;
-    DX11Shader* shader          = reinterpret_cast<DX11Shader*>(g_renderer.shaders[+Shader::Index_Final_Draw]);
-    DX11GpuBuffer* vb           = reinterpret_cast<DX11GpuBuffer*>(g_renderer.voxel_vb);
-    DX11Texture* previous_target= reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Backbuffer_HDR]);
-    DX11Texture* previous_depth = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Backbuffer_Depth]);
+    if (!g_renderer.temporal_enabled)
+    {
+        g_renderer.temporal_history_valid = false;
+        return;
+    }
 
-    //Input Assembler
+    GpuBuffer* vb = g_renderer.voxel_vb;
+    const u32 stride = sizeof(Vec2);
+
+    //Input Assembler and Shaders
     {
-        context->IASetInputLayout(shader->m_vertex_input_layout);
-        UINT strides[] = { sizeof(Vec2), };
-        UINT offsets[] = { 0, };
-        context->IASetVertexBuffers(0, 1, &vb->m_buffer, strides, offsets);
-        context->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        BindVertexBuffers(&vb, &stride, nullptr, 1);
+        BindShader(Shader::Index_Temporal);
     }
 
-    //Vertex Shader
+    //Rasterizer
     {
-        context->VSSetShader(shader->m_vertex_shader, NULL, 0);
+        BindRasterizer(RasterizerState::Voxel);
+        BindViewport(s_backbuffer_size);
     }
-    //Hull shader
+
+    //Output Merger
     {
-        context->HSSetShader(nullptr, nullptr, 0);
+        BindDepthState(DepthState::NoDepth);
+        BindBlendState(BlendState::Opaque);
+        //Unbinds the HDR and depth targets so they can be read.
+        //Ping has the same format as the HDR target so the result can be copied back
+        const Texture::Index targets[] = { Texture::Index_Denoise_Ping, Texture::Index_Temporal_History_Next };
+        BindRenderTargets(targets, arrsize(targets), Texture::Index_Invalid);
     }
-    //Domain shader
+
+    //Pixel Shader
     {
-        context->DSSetShader(nullptr, nullptr, 0);
+        BindTexture(SLOT_TEMPORAL_CURRENT,        Texture::Index_Backbuffer_HDR);
+        BindTexture(SLOT_TEMPORAL_DEPTH,          Texture::Index_Backbuffer_Depth);
+        BindTexture(SLOT_TEMPORAL_HISTORY,        Texture::Index_Temporal_History);
+        BindTexture(SLOT_TEMPORAL_HISTORY_DEPTH,  Texture::Index_Temporal_Depth);
     }
-    //Geometry shader
+
+    //Draw
     {
-        context->GSSetShader(nullptr, nullptr, 0);
+        Draw(u32(vb->m_count));
     }
 
-    //Rasterizer
+    BindTexture(SLOT_TEMPORAL_CURRENT,        Texture::Index_Invalid);
+    BindTexture(SLOT_TEMPORAL_DEPTH,          Texture::Index_Invalid);
+    BindTexture(SLOT_TEMPORAL_HISTORY,        Texture::Index_Invalid);
+    BindTexture(SLOT_TEMPORAL_HISTORY_DEPTH,  Texture::Index_Invalid);
+    BindRenderTargets(nullptr, 0, Texture::Index_Invalid);
+
+    //This frame becomes the history of the next one
+    CopyTexture(Texture::Index_Backbuffer_HDR,      Texture::Index_Denoise_Ping);
+    CopyTexture(Texture::Index_Temporal_History,    Texture::Index_Temporal_History_Next);
+    CopyTexture(Texture::Index_Temporal_Depth,      Texture::Index_Backbuffer_Depth);
+    g_renderer.temporal_history_valid = true;
+}
+
+void DenoisePathTracedVoxels()
+{
+    const DenoiseSettings& settings = g_renderer.denoise_settings;
+    if (!g_renderer.denoise_enabled || settings.iterations <= 0)
+        return;
+
+    GpuBuffer* vb = g_renderer.voxel_vb;
+    const u32 stride = sizeof(Vec2);
+    const Texture::Index targets[2] = {
+        Texture::Index_Denoise_Ping,
+        Texture::Index_Denoise_Pong,
+    };
+
+    //Input Assembler and Shaders
     {
-        context->RSSetState(s_dx11.rasterizer_voxel);
-        D3D11_VIEWPORT view_port = {
-            .TopLeftX = 0.0f,
-            .TopLeftY = 0.0f,
-            .Width = (float)s_dx11.swap_chain.size.x,
-            .Height = (float)s_dx11.swap_chain.size.y,
-            .MinDepth = 0.0f,
-            .MaxDepth = 1.0f,
-        };
-        context->RSSetViewports(1, &view_port);
+        BindVertexBuffers(&vb, &stride, nullptr, 1);
+        BindShader(Shader::Index_Denoise);
     }
 
-    //NOTE(CSH): The output merger steps need to be done first for the final draw since 
-    //we are using the previously bound render target as the input to the this.
-    //Output Merger
+    //Rasterizer
     {
-        //context->OMSetDepthStencilState(s_dx11.swap_chain.depth_stencil_state, 1);
-        context->OMSetDepthStencilState(s_dx11.depth_stencil_state_no_depth, 1);
-        context->OMSetRenderTargets(1, &s_dx11.swap_chain.render_target_view, NULL);
-        context->OMSetBlendState(s_dx11.blend_state, NULL, 0xffffffff);
+        BindRasterizer(RasterizerState::Voxel);
+        BindViewport(s_backbuffer_size);
     }
 
-    //Pixel Shader
+    //Output Merger
     {
-        context->PSSetShader(shader->m_pixel_shader, NULL, 0);
-        context->PSSetSamplers(SLOT_PREVIOUS_TARGET_SAMPLER,1, &previous_target->m_sampler);
-        context->PSSetSamplers(SLOT_PREVIOUS_DEPTH_SAMPLER, 1, &previous_depth->m_sampler);
-        context->PSSetShaderResources(SLOT_PREVIOUS_TARGET, 1, &previous_target->m_view);
-        context->PSSetShaderResources(SLOT_PREVIOUS_DEPTH,  1, &previous_depth->m_view);
+        BindDepthState(DepthState::NoDepth);
+        BindBlendState(BlendState::Opaque);
+        //Unbinds the feature buffers as render targets so they can be read
+        BindRenderTargets(&targets[0], 1, Texture::Index_Invalid);
     }
 
-    //Compute shader
+    //Pixel Shader
     {
-        context->CSSetShader(nullptr, nullptr, 0);
+        BindTexture(SLOT_DENOISE_NORMAL_DEPTH,    Texture::Index_Denoise_Normal_Depth);
+        BindTexture(SLOT_DENOISE_ALBEDO,          Texture::Index_Denoise_Albedo);
     }
 
     //Draw
+    Texture::Index input = Texture::Index_Backbuffer_HDR;
+    i32 output_i = 0;
+    for (i32 iteration = 0; iteration < settings.iterations; iteration++)
+    {
+        output_i = iteration % 2;
+        u32 flags = 0;
+        if (iteration == 0)
+            flags |= DENOISE_FLAG_DEMODULATE;
+        if (iteration == settings.iterations - 1)
+            flags |= DENOISE_FLAG_REMODULATE;
+        CB_Denoise cb = {
+            .step_width = 1 << iteration,
+            .sigma_color = settings.sigma_color,
+            .sigma_normal = settings.sigma_normal,
+            .sigma_depth = settings.sigma_depth,
+            .sigma_albedo = settings.sigma_albedo,
+            .denoise_flags = flags,
+            ._denoise_pad0 = 0.0f,
+            ._denoise_pad1 = 0.0f,
+        };
+        g_renderer.cb_denoise->Upload(&cb, 1, sizeof(cb));
+        g_renderer.cb_denoise->Bind(SLOT_CB_DENOISE, GpuBuffer::BindLocation::Pixel);
+
+        //The previous output has to be unbound before it can be written to again
+        BindTexture(SLOT_DENOISE_INPUT, Texture::Index_Invalid);
+        BindRenderTargets(&targets[output_i], 1, Texture::Index_Invalid);
+        BindTexture(SLOT_DENOISE_INPUT, input);
+        Draw(u32(vb->m_count));
+        input = targets[output_i];
+    }
+    BindTexture(SLOT_DENOISE_INPUT,           Texture::Index_Invalid);
+    BindTexture(SLOT_DENOISE_NORMAL_DEPTH,    Texture::Index_Invalid);
+    BindTexture(SLOT_DENOISE_ALBEDO,          Texture::Index_Invalid);
+    BindRenderTargets(nullptr, 0, Texture::Index_Invalid);
+
+    //Primitives and the final draw keep using the HDR target
+    CopyTexture(Texture::Index_Backbuffer_HDR, targets[output_i]);
+}
+
+//Draws the runs of the ranges offsets[f]..offsets[f + 1] whose face f is in mask
+static void DrawVoxelChunkFaces(u32 first_index, const u32* offsets, u8 mask)
+{
+    u32 face_i = 0;
+    while (face_i < +Face::Count)
     {
-        context->Draw((UINT)vb->m_count, 0);
+        if (!(mask & (1 << face_i)))
+        {
+            face_i++;
+            continue;
+        }
+        const u32 begin = offsets[face_i];
+        while (face_i < +Face::Count && (mask & (1 << face_i)))
+            face_i++;
+        const u32 count = offsets[face_i] - begin;
+        if (count)
+            DrawIndexed(count, first_index + begin);
     }
 }
 
+void DrawRasterizedVoxels(const VoxelMeshLods& mesh)
+{
+    //Input Assembler and Shaders
+    {
+        BindShader(Shader::Index_Voxel_Rast);
+        g_renderer.structure_voxel_materials->Bind(SLOT_VOXEL_MATERIALS, GpuBuffer::BindLocation::Vertex);
+    }
 
+    //Rasterizer
+    {
+        BindRasterizer(RasterizerState::Full);
+        BindViewport(s_backbuffer_size);
+    }
 
+    //Output Merger
+    {
+        const Texture::Index target = Texture::Index_Backbuffer_HDR;
+        BindDepthState(DepthState::Depth);
+        BindRenderTargets(&target, 1, Texture::Index_Backbuffer_Depth);
+        BindBlendState(BlendState::Opaque);
+    }
 
-//**********************
-// Primitives Render
-//**********************
+    //Draw
+    {
+        const u32 stride = sizeof(Vertex_VoxelPacked);
+        for (i32 lod = 0; lod < VOXEL_MESH_LOD_COUNT; lod++)
+        {
+            const VoxelChunkedMesh& level = mesh.levels[lod];
+            if (level.indices.empty())
+                continue;
+            bool bound = false;
+            for (u32 i = 0; i < VOXEL_CHUNK_COUNT; i++)
+            {
+                if (mesh.chunk_lods[i] != lod)
+                    continue;
+                if (!bound)
+                {
+                    BindVertexBuffers(&g_renderer.voxel_rast_vb[lod], &stride, nullptr, 1);
+                    BindIndexBuffer(g_renderer.voxel_rast_ib[lod]);
+                    bound = true;
+                }
+                //Directions facing away from the camera are skipped, neighbouring ones go in one draw
+                const VoxelMeshChunk& chunk = level.chunks[i];
+                const u8 face_mask = mesh.chunk_faces[i];
+                DrawVoxelChunkFaces(chunk.indices.first, chunk.face_offsets, face_mask);
+                DrawVoxelChunkFaces(chunk.indices.first, chunk.skirt_offsets, face_mask & mesh.chunk_skirts[i]);
+            }
+        }
+    }
+}
 
-template<typename T>
-void RenderPrimitiveInternal(
-    std::vector<T>& verts_to_draw, 
-    ID3D11RasterizerState* rasterizer, 
-    Texture::Index texture_i,
-    Shader::Index shader_i,
-    GpuBuffer* vertex_buffer)
+void FinalDraw()
 {
-    if (verts_to_draw.size() == 0)
-        return;
-
-    ID3D11DeviceContext* context= s_dx11.device_context;
-    DX11Shader* shader      = reinterpret_cast<DX11Shader*>(g_renderer.shaders[+shader_i]);
-    DX11Texture* texture    = reinterpret_cast<DX11Texture*>(g_renderer.textures[+texture_i]);
-    DX11GpuBuffer* vb       = reinterpret_cast<DX11GpuBuffer*>(vertex_buffer);
-    DX11Texture* depth      = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Backbuffer_Depth]);
-    DX11Texture* target     = reinterpret_cast<DX11Texture*>(g_renderer.textures[Texture::Index_Backbuffer_HDR]);
+    GpuBuffer* vb = g_renderer.voxel_vb;
+    const u32 stride = sizeof(Vec2);
 
+    //Input Assembler and Shaders
     {
-        ZoneScopedN("Upload");
-        vb->Upload(verts_to_draw);
+        BindVertexBuffers(&vb, &stride, nullptr, 1);
+        BindShader(Shader::Index_Final_Draw);
     }
 
-    //Bindings
+    //Rasterizer
     {
+        BindRasterizer(RasterizerState::Voxel);
+        BindViewport(s_backbuffer_size);
     }
-    //Input Assembler
+
+    //NOTE(CSH): The output merger steps need to be done first for the final draw since
+    //we are using the previously bound render target as the input to the this.
+    //Output Merger
     {
-        context->IASetInputLayout(shader->m_vertex_input_layout);
-        UINT strides[] = { sizeof(T), };
-        UINT offsets[] = { 0, };
-        context->IASetVertexBuffers(0, 1, &vb->m_buffer, strides, offsets);
-        context->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        const Texture::Index target = Texture::Index_Swapchain;
+        BindDepthState(DepthState::NoDepth);
+        BindRenderTargets(&target, 1, Texture::Index_Invalid);
+        BindBlendState(BlendState::Alpha);
     }
 
-    //Vertex Shader
+    //Pixel Shader
     {
-        context->VSSetShader(shader->m_vertex_shader, NULL, 0);
+        BindSampler(SLOT_PREVIOUS_TARGET_SAMPLER,   Texture::Index_Backbuffer_HDR);
+        BindSampler(SLOT_PREVIOUS_DEPTH_SAMPLER,    Texture::Index_Backbuffer_Depth);
+        BindTexture(SLOT_PREVIOUS_TARGET,           Texture::Index_Backbuffer_HDR);
+        BindTexture(SLOT_PREVIOUS_DEPTH,            Texture::Index_Backbuffer_Depth);
     }
-    //Hull shader
+
+    //Draw
     {
-        context->HSSetShader(nullptr, nullptr, 0);
+        Draw(u32(vb->m_count));
     }
-    //Domain shader
+
+    //The depth buffer is bound for writing again next frame
+    BindTexture(SLOT_PREVIOUS_DEPTH, Texture::Index_Invalid);
+}
+
+
+
+
+//**********************
+// Primitives Render
+//**********************
+
+void RenderPrimitiveInternal(
+    FrameVector<Vertex_PrimitiveInstance>& instances_to_draw,
+    RasterizerState rasterizer,
+    Texture::Index texture_i,
+    Shader::Index shader_i,
+    GpuBuffer* mesh_buffer)
+{
+    if (instances_to_draw.size() == 0)
     {
-        context->DSSetShader(nullptr, nullptr, 0);
+        //Culled to nothing, the capacity still points into this frame's arena block
+        instances_to_draw = FrameVector<Vertex_PrimitiveInstance>();
+        return;
     }
-    //Geometry shader
+
+    const UploadRange instances = UploadTransient(instances_to_draw);
+
+    //Input Assembler and Shaders
     {
-        context->GSSetShader(nullptr, nullptr, 0);
+        GpuBuffer* buffers[] = { mesh_buffer, instances.buffer, };
+        const u32 strides[] = { sizeof(Vertex), sizeof(Vertex_PrimitiveInstance), };
+        const u32 offsets[] = { 0, instances.offset, };
+        BindVertexBuffers(buffers, strides, offsets, arrsize(buffers));
+        BindShader(shader_i);
     }
 
     //Rasterizer
     {
-        context->RSSetState(rasterizer);
-        D3D11_VIEWPORT view_port = {
-            .TopLeftX = 0.0f,
-            .TopLeftY = 0.0f,
-            .Width = (float)s_dx11.swap_chain.size.x,
-            .Height = (float)s_dx11.swap_chain.size.y,
-            .MinDepth = 0.0f,
-            .MaxDepth = 1.0f,
-        };
-        context->RSSetViewports(1, &view_port);
+        BindRasterizer(rasterizer);
+        BindViewport(s_backbuffer_size);
     }
 
     //Pixel Shader
     {
-        context->PSSetShader(shader->m_pixel_shader, NULL, 0);
-        context->PSSetSamplers(SLOT_PRIMITIVE_TEXTURE_SAMPLER,  1, &texture->m_sampler);
-        context->PSSetShaderResources(SLOT_PRIMITIVE_TEXTURE,   1, &texture->m_view);
+        BindSampler(SLOT_PRIMITIVE_TEXTURE_SAMPLER, texture_i);
+        BindTexture(SLOT_PRIMITIVE_TEXTURE,         texture_i);
     }
 
     //Output Merger
     {
-        context->OMSetDepthStencilState(s_dx11.depth_stencil_state_depth, 1);
-        context->OMSetRenderTargets(1, &s_dx11.hdr_rtv, depth->m_depth_stencil_view);
-        context->OMSetBlendState(s_dx11.blend_state, NULL, 0xffffffff);
-    }
-
-    //Compute shader
-    {
-        context->CSSetShader(nullptr, nullptr, 0);
+        const Texture::Index target = Texture::Index_Backbuffer_HDR;
+        BindDepthState(DepthState::Depth);
+        BindRenderTargets(&target, 1, Texture::Index_Backbuffer_Depth);
+        BindBlendState(BlendState::Alpha);
     }
 
     //Draw
     {
-        const size_t indices_per_face = 6;
-        const size_t faces_per_cube = 6;
-        const UINT total_indices_to_draw = UINT(verts_to_draw.size() * indices_per_face * faces_per_cube);
-        //context->DrawIndexed(UINT((verts_to_draw.size() / 24) * 36), 0, 0);
-        context->Draw(UINT(verts_to_draw.size()), 0);
+        DrawInstanced(u32(mesh_buffer->m_count), u32(instances_to_draw.size()));
     }
-    verts_to_draw.clear();
+    //Gives up the arena memory instead of keeping the capacity across the reset
+    instances_to_draw = FrameVector<Vertex_PrimitiveInstance>();
 }
 
 
@@ -2150,15 +1461,31 @@ void RenderPrimitiveInternal(
 //**********************
 // Add Cubes To Render
 //**********************
-std::vector<Vertex_Cube> s_cubesToDraw_transparent;
-std::vector<Vertex_Cube> s_cubesToDraw_opaque;
-std::vector<Vertex_Cube> s_cubesToDraw_wireframe;
+FrameVector<Vertex_PrimitiveInstance> s_cubesToDraw_transparent;
+FrameVector<Vertex_PrimitiveInstance> s_cubesToDraw_opaque;
+FrameVector<Vertex_PrimitiveInstance> s_cubesToDraw_wireframe;
+
+static u32 PackPrimitiveColor(const Color& color)
+{
+    ColorInt result;
+    for (i32 i = 0; i < 4; i++)
+        result.e[i] = u8(Clamp(color.e[i], 0.0f, 1.0f) * UCHAR_MAX + 0.5f);
+    return result.rgba;
+}
 
+//Same as R10G10B10A2_UNORM with the alpha bits left at 0
+static u32 PackPrimitiveDirection(const Vec3& dir)
+{
+    const u32 max = (1 << 10) - 1;
+    u32 result = 0;
+    for (i32 i = 0; i < 3; i++)
+        result |= u32(Clamp(dir.e[i] * 0.5f + 0.5f, 0.0f, 1.0f) * max + 0.5f) << (10 * i);
+    return result;
+}
 
 void AddCubeToRender(Vec3 p, Color color, Vec3  scale, bool wireframe)
 {
     assert(Abs(scale) == scale);
-    Vertex_Cube c;
 
     auto* list = &s_cubesToDraw_opaque;
     if (wireframe)
@@ -2170,14 +1497,11 @@ void AddCubeToRender(Vec3 p, Color color, Vec3  scale, bool wireframe)
         list = &s_cubesToDraw_transparent;
     }
 
-    for (i32 f = 0; f < +Face::Count; f++)
-        for (i32 v = 0; v < 6; v++)
-        {
-            c.p = p + HadamardProduct(vertices_cube_full[f * 6 + v].p, scale);
-            c.color = color;
-            c.uv = uv_coordinates_full[v];
-            list->push_back(c);
-        }
+    Vertex_PrimitiveInstance instance = {};
+    instance.p = p;
+    instance.scale = scale;
+    instance.color = PackPrimitiveColor(color);
+    list->push_back(instance);
 }
 
 
@@ -2190,35 +1514,9 @@ void AddCubeToRender(Vec3 p, Color color, Vec3  scale, bool wireframe)
 // Add Tetrahedron To Render
 //**********************
 
-#define TETRA_TIP   { +0.0f, +0.5f, +0.0f }
-#define TETRA_TOP   { +0.0f, -0.5f, +0.5f }
-#define TETRA_LEFT  { -0.5f, -0.5f, -0.5f }
-#define TETRA_RIGHT { +0.5f, -0.5f, -0.5f }
-const Vec3 tetrahedron_positions[] = {
-    TETRA_LEFT, //bottom
-    TETRA_RIGHT,
-    TETRA_TOP,
-
-    TETRA_LEFT, //z
-    TETRA_TOP,
-    TETRA_TIP,
-
-    TETRA_RIGHT,//x
-    TETRA_LEFT,
-    TETRA_TIP,
-
-    TETRA_TOP,  //xz
-    TETRA_RIGHT,
-    TETRA_TIP,
-};
-#undef TETRA_TIP
-#undef TETRA_TOP
-#undef TETRA_LEFT
-#undef TETRA_RIGHT
-
-std::vector<Vertex_Tetra> s_tetrasToDraw_transparent;
-std::vector<Vertex_Tetra> s_tetrasToDraw_opaque;
-std::vector<Vertex_Tetra> s_tetrasToDraw_wireframe;
+FrameVector<Vertex_PrimitiveInstance> s_tetrasToDraw_transparent;
+FrameVector<Vertex_PrimitiveInstance> s_tetrasToDraw_opaque;
+FrameVector<Vertex_PrimitiveInstance> s_tetrasToDraw_wireframe;
 
 void AddTetrahedronToRender(const Vec3 p, const Vec3 dir, Color color, Vec3  scale, bool wireframe)
 {
@@ -2236,38 +1534,78 @@ void AddTetrahedronToRender(const Vec3 p, const Vec3 dir, Color color, Vec3  sca
         list = &s_tetrasToDraw_transparent;
     }
 
-    Quat rotate_to_correct_forward = gb_quat_axis_angle({ -1, 0, 0 }, -tau / 4);
-    Quat rot = OrientationForDirectionAndUp(Normalize(dir), { 0, 1, 0 });
-    Vertex_Tetra v[3] = {};
-    for (i32 i = 0; i < arrsize(tetrahedron_positions); i+= 3)
+    //The rotation towards dir happens in Tetra.hlsl
+    Vertex_PrimitiveInstance instance = {};
+    instance.p = p;
+    instance.scale = scale;
+    instance.color = PackPrimitiveColor(color);
+    instance.direction = PackPrimitiveDirection(Normalize(dir));
+    list->push_back(instance);
+}
+
+//Drops the instances outside of frustum, keeps the order of the rest.
+//rotated instances are bounded by the box every rotation fits in
+static void CullPrimitives(FrameVector<Vertex_PrimitiveInstance>& instances, const Frustum& frustum, bool rotated)
+{
+    const u32 count = u32(instances.size());
+    if (count == 0)
+        return;
+
+    FrameVector<float> bounds[6];
+    for (FrameVector<float>& b : bounds)
+        b.resize(count);
+    for (u32 i = 0; i < count; i++)
     {
-        for (i32 j = 0; j < arrsize(v); j++)
-        {
-            Vec3 scaled = HadamardProduct(tetrahedron_positions[i + j], scale);
-            Vec3 forward_aligned = gb_quat_rotate_vec3(rotate_to_correct_forward, scaled);
-            Vec3 rotated = gb_quat_rotate_vec3(rot, forward_aligned);
-            v[j].p = p + rotated;
-        }
-        Vec3 normal = Normalize(CrossProduct(v[1].p - v[0].p, v[2].p - v[0].p));
-        for (i32 j = 0; j < arrsize(v); j++)
+        const Vertex_PrimitiveInstance& instance = instances[i];
+        const float radius = Length(instance.scale) * 0.5f;
+        const Vec3 half_extent = rotated ? Vec3({ radius, radius, radius }) : instance.scale * 0.5f;
+        for (i32 axis = 0; axis < 3; axis++)
         {
-            v[j].color = color;
-            v[j].n = normal;
-            list->push_back(v[j]);
+            bounds[axis][i]     = instance.p.e[axis] - half_extent.e[axis];
+            bounds[axis + 3][i] = instance.p.e[axis] + half_extent.e[axis];
         }
     }
+    const AABBSoA boxes = {
+        .min_x = bounds[0].data(),
+        .min_y = bounds[1].data(),
+        .min_z = bounds[2].data(),
+        .max_x = bounds[3].data(),
+        .max_y = bounds[4].data(),
+        .max_z = bounds[5].data(),
+        .count = count,
+    };
+    FrameVector<u32> visible(count);
+    const u32 visible_count = CullBoxesToFrustum(visible.data(), frustum, boxes);
+    //The indices are increasing so the instances can be moved down in place
+    for (u32 i = 0; i < visible_count; i++)
+        instances[i] = instances[visible[i]];
+    instances.resize(visible_count);
+
+    g_renderer.primitives_drawn  += visible_count;
+    g_renderer.primitives_culled += count - visible_count;
 }
 
-void RenderPrimitives()
+void RenderPrimitives(const Frustum& frustum)
 {
     ZoneScopedN("Render Primitives");
+    g_renderer.primitives_drawn = 0;
+    g_renderer.primitives_culled = 0;
+    {
+        ZoneScopedN("Cull");
+        CullPrimitives(s_tetrasToDraw_opaque,       frustum, true);
+        CullPrimitives(s_cubesToDraw_opaque,        frustum, false);
+        CullPrimitives(s_tetrasToDraw_transparent,  frustum, true);
+        CullPrimitives(s_cubesToDraw_transparent,   frustum, false);
+        CullPrimitives(s_tetrasToDraw_wireframe,    frustum, true);
+        CullPrimitives(s_cubesToDraw_wireframe,     frustum, false);
+    }
     g_renderer.cb_common->Bind(SLOT_CB_COMMON, GpuBuffer::BindLocation::All);
-    RenderPrimitiveInternal(s_tetrasToDraw_opaque,      s_dx11.rasterizer_full,     Texture::Index_Plain, Shader::Index_Tetra,   g_renderer.tetra_vb);
-    RenderPrimitiveInternal(s_cubesToDraw_opaque,       s_dx11.rasterizer_full,     Texture::Index_Plain, Shader::Index_Cube,    g_renderer.cube_vb);
-    RenderPrimitiveInternal(s_tetrasToDraw_transparent, s_dx11.rasterizer_full,     Texture::Index_Plain, Shader::Index_Tetra,   g_renderer.tetra_vb);
-    RenderPrimitiveInternal(s_cubesToDraw_transparent,  s_dx11.rasterizer_full,     Texture::Index_Plain, Shader::Index_Cube,    g_renderer.cube_vb);
-    RenderPrimitiveInternal(s_tetrasToDraw_wireframe,   s_dx11.rasterizer_wireframe,Texture::Index_Plain, Shader::Index_Tetra,   g_renderer.tetra_vb);
-    RenderPrimitiveInternal(s_cubesToDraw_wireframe,    s_dx11.rasterizer_wireframe,Texture::Index_Plain, Shader::Index_Cube,    g_renderer.cube_vb);
+    RenderPrimitiveInternal(s_tetrasToDraw_opaque,      RasterizerState::Full,      Texture::Index_Plain, Shader::Index_Tetra,   g_renderer.tetra_vb);
+    RenderPrimitiveInternal(s_cubesToDraw_opaque,       RasterizerState::Full,      Texture::Index_Plain, Shader::Index_Cube,    g_renderer.cube_vb);
+    RenderPrimitiveInternal(s_tetrasToDraw_transparent, RasterizerState::Full,      Texture::Index_Plain, Shader::Index_Tetra,   g_renderer.tetra_vb);
+    RenderPrimitiveInternal(s_cubesToDraw_transparent,  RasterizerState::Full,      Texture::Index_Plain, Shader::Index_Cube,    g_renderer.cube_vb);
+    RenderPrimitiveInternal(s_tetrasToDraw_wireframe,   RasterizerState::Wireframe, Texture::Index_Plain, Shader::Index_Tetra,   g_renderer.tetra_vb);
+    RenderPrimitiveInternal(s_cubesToDraw_wireframe,    RasterizerState::Wireframe, Texture::Index_Plain, Shader::Index_Cube,    g_renderer.cube_vb);
 }
 
 const SDL_MessageBoxColorScheme colorScheme = {
@@ -5,11 +5,25 @@
 //#include "Rendering_Texture.h"
 #include "Vox.h"
 #include "GpuSharedData.h"
+#include "Denoise.h"
+#include "CpuRenderer.h"
 
 #include <unordered_map>
 
 #define MAX_MIPS 10
 
+//Picked at compile time. The null backend sends nothing to a GPU, it records the
+//commands and byte counts of every frame so the frame loop runs without one
+#define RENDER_BACKEND_DX11 1
+#define RENDER_BACKEND_NULL 2
+#ifndef RENDER_BACKEND
+#ifdef _WIN32
+#define RENDER_BACKEND RENDER_BACKEND_DX11
+#else
+#define RENDER_BACKEND RENDER_BACKEND_NULL
+#endif
+#endif
+
 
 
 
@@ -32,6 +46,16 @@ struct Texture {
         Index_Random,
         Index_Backbuffer_Depth,
         Index_Backbuffer_HDR,
+        Index_Denoise_Normal_Depth,
+        Index_Denoise_Albedo,
+        Index_Denoise_Ping,
+        Index_Denoise_Pong,
+        Index_Trace_Color,
+        Index_Trace_Normal_Depth,
+        Index_Temporal_History,
+        Index_Temporal_History_Next,
+        Index_Temporal_Depth,
+        Index_Swapchain,    //Render target only, there is no Texture for it
         Index_Count,
     }; ENUMOPS(Index);
     enum Dimension : u32 {
@@ -59,6 +83,7 @@ struct Texture {
     enum Format : u32 {
         Format_Invalid,
         Format_R11G11B10_FLOAT,
+        Format_R16G16B16A16_FLOAT,
         Format_D32_FLOAT,
         Format_D16_UNORM,
         Format_R8G8B8A8_UNORM,
@@ -128,20 +153,54 @@ struct GpuBuffer
     Type m_type = GpuBuffer::Type::Invalid;
     char m_name[32];
     size_t m_count = 0;
+    size_t m_capacity = 0;      //Bytes, the buffer is only created again when an upload needs more
+    u32 m_element_size = 0;
 
     void Upload(const void* data, const size_t count, const u32 element_size, const bool is_byte_format = false);
-    template<typename T>
-    inline void Upload(const std::vector<T>& a)
+    template<typename T, typename Allocator>
+    inline void Upload(const std::vector<T, Allocator>& a)
     {
         assert(a.size());
         Upload(a.data(), a.size(), sizeof(T), false);
     }
+    //Replaces elements [first, first + count) of a buffer that is not dynamic and
+    //was last uploaded with the same element size, data points at element first
+    void UploadRange(const void* data, const size_t first, const size_t count);
     //Bind a Constant or Structure buffer
     void Bind(u32 slot, GpuBuffer::BindLocation binding);
+    //Dynamic Vertex buffers only. Creates the buffer with room for at least
+    //bytes, the contents are undefined afterwards
+    void Reserve(size_t bytes);
+    //Dynamic Vertex buffers only. The rest of the buffer is kept so the GPU must
+    //not be reading this range anymore, see UploadTransient
+    void Write(const void* data, u32 offset, u32 bytes);
 };
 bool CreateGpuBuffer(GpuBuffer** buffer, const char* name, bool is_dynamic, GpuBuffer::Type type);
 void DeleteBuffer(GpuBuffer** buffer);
 
+//Vertex data that is written and drawn in the same frame goes into one
+//persistent ring buffer. RenderPresent fences the frame, its range is only
+//written again once the GPU passed that fence. The buffer is created again,
+//twice the size, only when the data of the current frame alone fills it.
+struct UploadRange {
+    GpuBuffer* buffer = nullptr;
+    u32 offset = 0;     //Bytes, to bind the buffer at
+};
+struct UploadRingStats {
+    size_t  capacity    = 0;
+    size_t  bytes       = 0;    //Written last frame, including the alignment and the wrap
+    u32     grows       = 0;    //Since startup
+    u32     fence_waits = 0;    //Since startup, the GPU had not finished with the space that was needed
+};
+[[nodiscard]] UploadRange UploadTransient(const void* data, size_t count, u32 element_size);
+template<typename T, typename Allocator>
+[[nodiscard]] inline UploadRange UploadTransient(const std::vector<T, Allocator>& a)
+{
+    assert(a.size());
+    return UploadTransient(a.data(), a.size(), sizeof(T));
+}
+const UploadRingStats& GetUploadRingStats();
+
 
 
 
@@ -168,17 +227,33 @@ struct Shader
         Index_Cube,
         Index_Tetra,
         Index_Final_Draw,
+        Index_Denoise,
+        Index_Voxel_Primary,
+        Index_Upsample,
+        Index_Temporal,
         Index_Count,
     };
     ENUMOPS(Index);
 
+    enum VertexFormat : u32 {
+        VertexFormat_Invalid,
+        VertexFormat_R32G32_FLOAT,
+        VertexFormat_R32G32B32_FLOAT,
+        VertexFormat_R8G8B8A8_UNORM,
+        VertexFormat_R10G10B10A2_UNORM,
+        VertexFormat_R32_UINT,
+        VertexFormat_Count,
+    };
+    ENUMOPS(VertexFormat);
+
     struct InputElementDesc {
         const char* SemanticName;
-        u32 Format; //DXGI_FORMAT
+        VertexFormat Format;
         u32 AlignedByteOffset;
+        u32 InputSlot = 0;  //Slot 1 steps once per instance
     };
 
-    static const u32 m_vertex_component_max = 4;
+    static const u32 m_vertex_component_max = 8;
 
     ~Shader();
     void CheckForUpdate();
@@ -213,14 +288,21 @@ inline bool CreateShader(Shader** s, const std::string& shader_file_location, Sh
 struct Renderer {
     SDL_Window* SDL_Context     = nullptr;
     GpuBuffer* quad_ib          = nullptr;
-    GpuBuffer* voxel_rast_vb    = nullptr;
+    GpuBuffer* voxel_rast_vb[VOXEL_MESH_LOD_COUNT] = {};
+    GpuBuffer* voxel_rast_ib[VOXEL_MESH_LOD_COUNT] = {};
     GpuBuffer* voxel_vb         = nullptr;
     GpuBuffer* box_vb           = nullptr;//Does not need index buffer
-    GpuBuffer* cube_vb          = nullptr;
-    GpuBuffer* tetra_vb         = nullptr;
+    GpuBuffer* cube_vb          = nullptr;//Unit cube, drawn once per instance
+    GpuBuffer* tetra_vb         = nullptr;//Unit tetrahedron, drawn once per instance
     GpuBuffer* cb_common        = nullptr;
+    GpuBuffer* cb_denoise       = nullptr;
     GpuBuffer* structure_voxel_materials= nullptr;
     GpuBuffer* structure_voxel_indices  = nullptr;
+    GpuBuffer* structure_emissive_lights= nullptr;
+    GpuBuffer* structure_voxel_faces    = nullptr;
+    GpuBuffer* structure_irradiance_cache = nullptr;
+    GpuBuffer* structure_sun_visibility = nullptr;
+    GpuBuffer* structure_voxel_face_ao  = nullptr;
     //bool msaaEnabled = true;
     bool hasAttention;
     //i32 maxMSAASamples = 1;
@@ -232,6 +314,22 @@ struct Renderer {
     u32   refresh_rate;
     Shader*  shaders[+Shader::Index_Count] = {};
     Texture*        textures[Texture::Index_Count] = {};
+    i32             max_bounces = 4;
+    i32             russian_roulette_depth = 2;
+    bool            irradiance_cache_enabled = true;
+    bool            sun_visibility_enabled = true;
+    bool            ambient_occlusion_enabled = true;
+    bool            denoise_enabled = true;
+    RenderScale     render_scale = RenderScale::Full;
+    float           lod_bias = 0.0f;        //Primary rays stop at mip cells up to this many pixels wide, 0 turns the LOD trace off
+    u32             frame_index = 0;
+    bool            temporal_enabled = true;
+    i32             temporal_max_history = 16;
+    bool            temporal_history_valid = false;   //Cleared when the history can not be reprojected (resize) or is stale (voxel edit, sun moved)
+    DenoiseSettings denoise_settings;
+    u32             primitives_drawn = 0;   //Cubes and tetrahedrons of the last frame
+    u32             primitives_culled = 0;
+    bool            raster_voxels = false;  //Draws the packed voxel mesh instead of path tracing the voxels
 
     enum SwapInterval_ {
         SwapInterval_AdaptiveSync = -1,
@@ -246,11 +344,86 @@ void InitializeVideo();
 void RenderUpdate(Vec2I windowSize, float deltaTime);
 void RenderPresent();
 void DrawPathTracedVoxels();
+void UpsampleTracedVoxels();
+void AccumulatePathTracedVoxels();
+void DenoisePathTracedVoxels();
+//Every level of the mesh has to be uploaded to voxel_rast_vb and voxel_rast_ib,
+//draws each chunk at the level and with the directions SelectVoxelMeshLods picked
+void DrawRasterizedVoxels(const VoxelMeshLods& mesh);
         void AddCubeToRender(Vec3 p, Color color, Vec3  scale, bool wireframe);
 inline  void AddCubeToRender(Vec3 p, Color color, float scale, bool wireframe) { AddCubeToRender(p, color, { scale, scale, scale }, wireframe); }
 void AddTetrahedronToRender(const Vec3 p, const Vec3 dir, Color color, Vec3  scale, bool wireframe);
-void RenderPrimitives();
+//Cubes and tetrahedrons outside of frustum are dropped before the upload
+void RenderPrimitives(const Frustum& frustum);
 void FinalDraw();
+void NewImGuiFrame();
+void RenderImGui();
+void ShutdownImGui();
+
+
+//************
+//Render Record
+//************
+
+enum class RenderCommand : u32 {
+    Invalid,
+    CreateTexture,
+    UpdateTexture,
+    CreateBuffer,
+    UploadBuffer,
+    CompileShader,
+    BindShader,
+    BindVertexBuffers,
+    BindConstantBuffer,
+    BindStructureBuffer,
+    BindRasterizer,
+    BindViewport,
+    BindSampler,
+    BindTexture,
+    BindRenderTargets,
+    BindDepthState,
+    BindBlendState,
+    ClearRenderTarget,
+    ClearDepth,
+    CopyTexture,
+    Draw,
+    DrawInstanced,
+    BindIndexBuffer,
+    DrawIndexed,
+    InsertFence,
+    WaitForFence,
+    Present,
+    Count,
+};
+ENUMOPS(RenderCommand);
+extern const char* renderCommandNames[+RenderCommand::Count];
+
+//State binds the passes asked for last frame, and how many of them were
+//dropped because the same state was already bound
+struct RenderStateStats {
+    u64 submitted = 0;
+    u64 filtered  = 0;
+    u64 submitted_by_type[+RenderCommand::Count] = {};
+    u64 filtered_by_type[+RenderCommand::Count] = {};
+};
+const RenderStateStats& GetRenderStateStats();
+
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+struct RecordedCommand {
+    RenderCommand type = RenderCommand::Invalid;
+    u32 arg0 = 0;   //Slot, shader, texture, state or vertex count, depends on the type
+    u32 arg1 = 0;
+    u64 bytes = 0;  //Sent with the command
+};
+
+struct RenderRecord {
+    std::vector<RecordedCommand> commands;
+    u64 counts[+RenderCommand::Count] = {};
+    u64 bytes[+RenderCommand::Count] = {};
+};
+//Everything the null backend was asked to do between the last two RenderPresent calls
+const RenderRecord& GetRenderRecord();
+#endif
 
 
 enum class MessageBoxType {
@@ -0,0 +1,87 @@
+#pragma once
+#include "Rendering.h"
+
+//************
+//Backend
+//************
+
+//Implemented once per backend (Rendering_DX11.cpp, Rendering_Null.cpp). The
+//passes in Rendering.cpp only talk to the GPU through these and the Texture,
+//GpuBuffer and Shader functions of Rendering.h, so the same frame runs on both.
+
+enum class RasterizerState : u32 {
+    Invalid,
+    Full,
+    Wireframe,
+    Voxel,      //No culling or depth clip, the full screen triangle of the voxel passes
+    Count,
+};
+ENUMOPS(RasterizerState);
+
+enum class DepthState : u32 {
+    Invalid,
+    Depth,
+    NoDepth,
+    Count,
+};
+ENUMOPS(DepthState);
+
+enum class BlendState : u32 {
+    Invalid,
+    Opaque,
+    Alpha,
+    Count,
+};
+ENUMOPS(BlendState);
+
+//Device, swap chain and the fixed states above, the window already exists
+void InitializeBackend();
+void InitializeImGuiBackend();
+void ResizeBackbuffer(const Vec2I& size);
+void Present();
+
+//Frames the CPU may be ahead of the GPU before UploadTransient waits on a fence
+#define FRAMES_IN_FLIGHT 3
+
+//Fences complete in the order they were inserted, once the GPU finished
+//everything that was submitted before them
+u64  InsertFence();
+bool IsFenceComplete(u64 fence);
+void WaitForFence(u64 fence);
+
+//Render targets and shader resources are named by their texture index,
+//Texture::Index_Invalid unbinds and Texture::Index_Swapchain is the back buffer.
+//Everything is drawn as triangle lists and the hull, domain, geometry and
+//compute stages are never used.
+//Offsets are in bytes, nullptr binds every buffer from its start
+void BindVertexBuffers(GpuBuffer* const* buffers, const u32* strides, const u32* offsets, u32 count);
+void BindTexture(u32 slot, Texture::Index texture);
+void BindRenderTargets(const Texture::Index* targets, u32 count, Texture::Index depth);
+void ClearRenderTarget(Texture::Index target, const Vec4& color);
+void ClearDepth(Texture::Index depth, float value);
+void CopyTexture(Texture::Index destination, Texture::Index source);
+void Draw(u32 vertex_count);
+void DrawInstanced(u32 vertex_count, u32 instance_count);
+//Indices are u32 and count from the start of the bound vertex buffers
+void BindIndexBuffer(GpuBuffer* buffer);
+void DrawIndexed(u32 index_count, u32 first_index);
+
+//Go through the state cache in Rendering.cpp, a bind of what is already bound
+//never reaches the backend. Textures and render targets are not cached, D3D11
+//unbinds a texture from the inputs by itself when it is bound as an output.
+void BindShader(Shader::Index shader);  //Input layout and every shader stage
+void BindRasterizer(RasterizerState state);
+void BindViewport(const Vec2I& size);
+void BindSampler(u32 slot, Texture::Index texture);
+void BindDepthState(DepthState state);
+void BindBlendState(BlendState state);
+//Forgets what is bound, for when the objects behind an index were created again
+void InvalidateStateCache();
+
+//Implemented by the backend, only called by the state cache
+void BackendBindShader(Shader::Index shader);
+void BackendBindRasterizer(RasterizerState state);
+void BackendBindViewport(const Vec2I& size);
+void BackendBindSampler(u32 slot, Texture::Index texture);
+void BackendBindDepthState(DepthState state);
+void BackendBindBlendState(BlendState state);
@@ -0,0 +1,1580 @@
+#include "Rendering.h"
+#include "Rendering_Backend.h"
+#include "Debug.h"
+#include "WinInterop_File.h"
+#include "Vox.h"
+#include "imgui.h"
+#include "ImGui/backends/imgui_impl_sdl2.h"
+#include "ImGui/backends/imgui_impl_dx11.h"
+
+#include "SDL.h"
+#include "Tracy.hpp"
+
+#if RENDER_BACKEND == RENDER_BACKEND_DX11
+
+#include "SDL_syswm.h"
+
+// DirectX
+#include <d3d11.h>
+#include <d3dcompiler.h>
+#include <dxgi.h>
+//#ifdef _MSC_VER
+//#pragma comment(lib, "d3dcompiler") // Automatically link with d3dcompiler.lib as we are using D3DCompile() below.
+//#endif
+
+struct SwapChain {
+    IDXGISwapChain*         handle              = nullptr;
+    ID3D11RenderTargetView* render_target_view  = nullptr;
+
+    Vec2I   size;
+    u32     refresh_rate;
+    u32     sample_count;
+    u32     sample_quality;
+};
+
+struct DX11Data {
+    ID3D11Device*           device;
+    ID3D11DeviceContext*    device_context;
+    IDXGIFactory*           factory;
+    SwapChain               swap_chain;
+    ID3D11BlendState*       blend_state;
+    ID3D11RasterizerState*  rasterizer_full;
+    ID3D11RasterizerState*  rasterizer_wireframe;
+    ID3D11RasterizerState*  rasterizer_voxel;
+    ID3D11DepthStencilState* depth_stencil_state_depth      = nullptr;
+    ID3D11DepthStencilState* depth_stencil_state_no_depth   = nullptr;
+
+    HRESULT(*D3DCompileFunc)        (LPCVOID, SIZE_T, LPCSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
+    HRESULT(*D3DCompileFromFileFunc)(LPCWSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
+};
+static DX11Data s_dx11 = {};
+
+template <typename T>
+void SafeRelease(T*& unknown)
+{
+    if (unknown)
+    {
+        unknown->Release();
+        unknown = nullptr;
+    }
+}
+
+extern "C" {
+#ifdef _MSC_VER
+    _declspec(dllexport) uint32_t NvOptimusEnablement = 0x00000001;
+    _declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 0x00000001;
+#else
+    __attribute__((dllexport)) uint32_t NvOptimusEnablement = 0x00000001;
+    __attribute__((dllexport)) int AmdPowerXpressRequestHighPerformance = 0x00000001;
+#endif
+}
+
+#if _DEBUG
+    
+    #ifndef HR
+        #define HR(x)                                       \
+        {                                                   \
+            HRESULT hresult = x;                            \
+            if(FAILED(hresult))                             \
+            {                                               \
+                assert(false);                              \
+            }                                               \
+        }
+    #endif
+
+    void ReportDX11References()
+    {
+        ID3D11Debug* debug_interface;
+        s_dx11.device->QueryInterface(__uuidof(ID3D11Debug), (void**)&debug_interface);
+        HR(debug_interface->ReportLiveDeviceObjects(D3D11_RLDO_DETAIL));
+    }
+#else
+    void ReportDX11References() {};
+    #ifndef HR
+    #define HR(x) x;
+    #endif
+#endif
+
+
+
+
+
+
+//************
+//Texture
+//************
+
+void CreateRenderTargetView(ID3D11RenderTargetView** rtv, DXGI_FORMAT format, ID3D11Texture2D* texture)
+{
+    assert(rtv);
+    if (*rtv)
+    {
+        SafeRelease(*rtv);
+        *rtv = nullptr;
+    }
+
+    D3D11_RENDER_TARGET_VIEW_DESC desc;
+    ZeroMemory(&desc, sizeof(desc));
+    desc.Format = format;
+    desc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+    desc.Texture2D.MipSlice = 0;
+
+    VERIFY(SUCCEEDED(s_dx11.device->CreateRenderTargetView(
+        texture,    //[in]            ID3D11Resource* pResource,
+        &desc,      //[in, optional]  const D3D11_RENDER_TARGET_VIEW_DESC* pDesc,
+        rtv         //[out, optional] ID3D11RenderTargetView** ppRTView
+    )));
+}
+
+struct DX11Texture : public Texture {
+    ID3D11SamplerState* m_sampler = nullptr;
+    ID3D11ShaderResourceView* m_view = nullptr;
+    union {
+        ID3D11Texture1D* m_texture1D;
+        ID3D11Texture2D* m_texture2D;
+        ID3D11Texture3D* m_texture3D;
+    };
+    DXGI_FORMAT m_format;
+
+    //Only used for depth and stencil textures
+    ID3D11DepthStencilView* m_depth_stencil_view = nullptr;
+    //Only used for 2D render targets
+    ID3D11RenderTargetView* m_render_target_view = nullptr;
+};
+
+void DeleteTexture(Texture** texture)
+{
+    VALIDATE(texture);
+    VALIDATE(*texture != nullptr);
+    DX11Texture* tex = reinterpret_cast<DX11Texture*>(*texture);
+    switch (tex->m_dimension)
+    {
+    case Texture::Dimension_1D: SafeRelease(tex->m_texture1D); break;
+    case Texture::Dimension_2D: SafeRelease(tex->m_texture2D); break;
+    case Texture::Dimension_3D: SafeRelease(tex->m_texture3D); break;
+    }
+    if (tex->m_parameters.type == Texture::Type_Depth)
+    {
+        assert(tex->m_sampler == nullptr);
+        SafeRelease(tex->m_depth_stencil_view);
+        SafeRelease(tex->m_view);
+    }
+    else
+    {
+        assert(tex->m_depth_stencil_view == nullptr);
+        SafeRelease(tex->m_render_target_view);
+        SafeRelease(tex->m_sampler);
+        SafeRelease(tex->m_view);
+    }
+    delete tex;
+    *texture = nullptr;
+}
+
+
+bool CreateTexture(Texture** texture, const Texture::TextureParams& tp, u32 mip_levels, const u8* data)
+{
+    VALIDATE_V(texture, false);
+    VALIDATE_V(*texture == nullptr, false);
+    //VALIDATE_V(data, false);
+
+    DX11Texture* tex = new DX11Texture;
+    *texture = tex;
+
+    tex->m_parameters = tp;
+    tex->m_mip_levels = mip_levels;
+    assert(tex->m_parameters.size.x != -1 && tex->m_parameters.size.x != 0);
+    if (tex->m_parameters.size.z > 0)
+    {
+        tex->m_dimension = Texture::Dimension_3D;
+    }
+    else if (tex->m_parameters.size.y > 0)
+    {
+        tex->m_dimension = Texture::Dimension_2D;
+    }
+    else
+    {
+        tex->m_dimension = Texture::Dimension_1D;
+    }
+
+    switch (tp.format)
+    {
+    case Texture::Format_R11G11B10_FLOAT:       tex->m_format = DXGI_FORMAT_R11G11B10_FLOAT;    break;
+    case Texture::Format_R16G16B16A16_FLOAT:    tex->m_format = DXGI_FORMAT_R16G16B16A16_FLOAT; break;
+    case Texture::Format_D32_FLOAT:             tex->m_format = DXGI_FORMAT_D32_FLOAT;          break;
+    case Texture::Format_D16_UNORM:             tex->m_format = DXGI_FORMAT_D16_UNORM;          break;
+    case Texture::Format_R8G8B8A8_UNORM:        tex->m_format = DXGI_FORMAT_R8G8B8A8_UNORM;     break;
+    case Texture::Format_R8G8B8A8_UNORM_SRGB:   tex->m_format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;break;
+    case Texture::Format_R8G8B8A8_UINT:         tex->m_format = DXGI_FORMAT_R8G8B8A8_UINT;      break;
+    case Texture::Format_R8_UINT:               tex->m_format = DXGI_FORMAT_R8_UINT;            break;
+    default: FAIL;                              tex->m_format = DXGI_FORMAT_UNKNOWN;            break;
+    }
+
+    switch (tex->m_parameters.type)
+    {
+    case Texture::Type_Depth:
+    {
+        D3D11_TEXTURE2D_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        desc.Width = (u32)tex->m_parameters.size.x;
+        desc.Height = (u32)tex->m_parameters.size.y;
+        desc.MipLevels = desc.ArraySize = 1;
+        switch (tp.format)
+        {
+        case Texture::Format_D32_FLOAT:         desc.Format = DXGI_FORMAT_R32_TYPELESS;         break;
+        case Texture::Format_D16_UNORM:         desc.Format = DXGI_FORMAT_R16_TYPELESS;         break;
+        default: FAIL; break;
+        }
+        desc.SampleDesc.Count = 1;
+        desc.SampleDesc.Quality = 0;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+        desc.CPUAccessFlags = 0;
+        desc.MiscFlags = 0;
+
+        HR(s_dx11.device->CreateTexture2D(&desc, NULL, &tex->m_texture2D));
+    }
+    {
+
+        D3D11_DEPTH_STENCIL_VIEW_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        desc.Format = tex->m_format;
+        desc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+        desc.Texture2D.MipSlice = 0;
+
+        // Create the depth stencil view
+        HR(s_dx11.device->CreateDepthStencilView(
+            tex->m_texture2D,               // Depth stencil texture
+            &desc,                          // Depth stencil desc
+            &tex->m_depth_stencil_view));    // [out] Depth stencil view
+    }
+    {
+        //Depth read back as a single channel texture (temporal reprojection)
+        D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        switch (tp.format)
+        {
+        case Texture::Format_D32_FLOAT:         desc.Format = DXGI_FORMAT_R32_FLOAT;            break;
+        case Texture::Format_D16_UNORM:         desc.Format = DXGI_FORMAT_R16_UNORM;            break;
+        default: FAIL; break;
+        }
+        desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+        desc.Texture2D.MipLevels = 1;
+        desc.Texture2D.MostDetailedMip = 0;
+        HR(s_dx11.device->CreateShaderResourceView(tex->m_texture2D, &desc, &tex->m_view));
+    }
+    DEBUG_LOG("Texture Created\n");
+    return true;
+    }
+
+
+    assert(tex->m_parameters.bytes_per_pixel);
+
+    //Create Texture
+    switch (tex->m_dimension)
+    {
+    case Texture::Dimension_1D:
+    {
+        {
+            D3D11_TEXTURE1D_DESC desc;
+            ZeroMemory(&desc, sizeof(desc));
+            desc.Width = (u32)tex->m_parameters.size.x;
+            desc.MipLevels = desc.ArraySize = tex->m_mip_levels;
+            desc.Format = tex->m_format;
+            desc.Usage = D3D11_USAGE_DEFAULT;
+            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+            desc.CPUAccessFlags = 0;
+            desc.MiscFlags = 0;
+
+            assert(tex->m_mip_levels == 1);
+            D3D11_SUBRESOURCE_DATA sub_resource;
+            sub_resource.pSysMem = data;
+            sub_resource.SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
+            sub_resource.SysMemSlicePitch = 0;
+
+            HR(s_dx11.device->CreateTexture1D(&desc, data ? &sub_resource : nullptr, &tex->m_texture1D));
+        }
+
+        //Create View
+        {
+            D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+            ZeroMemory(&desc, sizeof(desc));
+            desc.Format = tex->m_format;
+            desc.ViewDimension = D3D_SRV_DIMENSION_TEXTURE1D;
+            desc.Texture1D.MipLevels = 1;
+            desc.Texture1D.MostDetailedMip = 0;
+            HR(s_dx11.device->CreateShaderResourceView(tex->m_texture1D, &desc, &tex->m_view));
+        }
+        break;
+    }
+    case Texture::Dimension_2D:
+    {
+        //Create Texture
+        {
+            D3D11_TEXTURE2D_DESC desc;
+            ZeroMemory(&desc, sizeof(desc));
+            desc.Width = (u32)tex->m_parameters.size.x;
+            desc.Height = (u32)tex->m_parameters.size.y;
+            desc.MipLevels = desc.ArraySize = tex->m_mip_levels;
+            desc.Format = tex->m_format;
+            desc.SampleDesc.Count = 1;
+            desc.SampleDesc.Quality = 0;
+            desc.Usage = D3D11_USAGE_DEFAULT;
+            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+            if (tp.render_target)
+                desc.BindFlags |= D3D11_BIND_RENDER_TARGET;
+            desc.CPUAccessFlags = 0;
+            desc.MiscFlags = 0;
+
+            assert(tex->m_mip_levels == 1);
+            D3D11_SUBRESOURCE_DATA sub_resource;
+            sub_resource.pSysMem = data;
+            sub_resource.SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
+            sub_resource.SysMemSlicePitch = 0;
+
+            HR(s_dx11.device->CreateTexture2D(&desc, data ? &sub_resource : nullptr, &tex->m_texture2D));
+        }
+
+        //Create View
+        {
+            D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+            ZeroMemory(&desc, sizeof(desc));
+            desc.Format = tex->m_format;
+            desc.ViewDimension = D3D_SRV_DIMENSION_TEXTURE2D;
+            desc.Texture2D.MipLevels = 1;
+            desc.Texture2D.MostDetailedMip = 0;
+            HR(s_dx11.device->CreateShaderResourceView(tex->m_texture2D, &desc, &tex->m_view));
+        }
+        if (tp.render_target)
+            CreateRenderTargetView(&tex->m_render_target_view, tex->m_format, tex->m_texture2D);
+        break;
+    }
+    case Texture::Dimension_3D:
+    {
+        //Create Texture
+        {
+            D3D11_TEXTURE3D_DESC desc;
+            ZeroMemory(&desc, sizeof(desc));
+            desc.Width = (u32)tex->m_parameters.size.x;
+            desc.Height = (u32)tex->m_parameters.size.y;
+            desc.Depth = (u32)tex->m_parameters.size.z;
+            desc.MipLevels = tex->m_mip_levels;
+            desc.Format = tex->m_format;
+            desc.Usage = D3D11_USAGE_DEFAULT;
+            desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+            desc.CPUAccessFlags = 0;
+            desc.MiscFlags = 0;
+
+#if 0
+            D3D11_SUBRESOURCE_DATA sub_resource;
+            sub_resource.pSysMem = data;
+            sub_resource.SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
+            sub_resource.SysMemSlicePitch = desc.Height * sub_resource.SysMemPitch;
+#else
+            D3D11_SUBRESOURCE_DATA sub_resource[MAX_MIPS] = {};
+            for (u32 i = 0; i < tex->m_mip_levels; i++)
+            {
+                sub_resource[i].pSysMem = nullptr;
+#if 0
+                sub_resource[i].SysMemPitch = desc.Width * tex->m_parameters.bytes_per_pixel;
+                sub_resource[i].SysMemSlicePitch = desc.Height * sub_resource[i].SysMemPitch;
+#else
+                sub_resource[i].SysMemPitch = (desc.Width >> i) * tex->m_parameters.bytes_per_pixel;
+                sub_resource[i].SysMemSlicePitch = (desc.Height >> i) * sub_resource[i].SysMemPitch;
+#endif
+            }
+#endif
+                
+
+            HR(s_dx11.device->CreateTexture3D(&desc, nullptr, &tex->m_texture3D));
+        }
+
+        //Create View
+        {
+            D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+            ZeroMemory(&desc, sizeof(desc));
+            desc.Format = tex->m_format;
+            desc.ViewDimension = D3D_SRV_DIMENSION_TEXTURE3D;
+            desc.Texture3D.MipLevels = tex->m_mip_levels;
+            desc.Texture3D.MostDetailedMip = 0;
+            HR(s_dx11.device->CreateShaderResourceView(tex->m_texture3D, &desc, &tex->m_view));
+        }
+        break;
+    }
+    default:
+        FAIL;
+    }
+
+    //Create Sampler
+    {
+        D3D11_SAMPLER_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        switch (tp.filter)
+        {
+        case Texture::Filter_Point: desc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;   break;
+        case Texture::Filter_Aniso: desc.Filter = D3D11_FILTER_ANISOTROPIC;         break;
+        default: FAIL;              desc.Filter = D3D11_FILTER(0);
+        }
+        switch (tp.mode)
+        {
+        case Texture::Address_Wrap:         desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;         break;
+        case Texture::Address_Mirror:       desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_MIRROR;       break;
+        case Texture::Address_Clamp:        desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;        break;
+        case Texture::Address_Border:       desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;       break;
+        case Texture::Address_MirrorOnce:   desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_MIRROR_ONCE;  break;
+        default: FAIL;                      desc.AddressU = desc.AddressV = desc.AddressW = D3D11_TEXTURE_ADDRESS_MODE(0);      break;
+        }
+        desc.MipLODBias = 0;
+        desc.MaxAnisotropy = 16;
+        desc.ComparisonFunc = D3D11_COMPARISON_LESS;
+        desc.BorderColor[0] = desc.BorderColor[1] = desc.BorderColor[2] = desc.BorderColor[3] = 0.0f;
+        desc.MinLOD = 0;
+        desc.MaxLOD = 0;
+        HR(s_dx11.device->CreateSamplerState(&desc, &tex->m_sampler));
+    }
+    DEBUG_LOG("Texture Created\n");
+    return true;
+}
+
+bool UpdateTexture(Texture** texture, u32 mip_slice, void* data, u32 row_pitch_bytes, u32 depth_pitch_bytes)
+{
+    VALIDATE_V(texture, false);
+    VALIDATE_V(*texture, false);
+    DX11Texture* t = reinterpret_cast<DX11Texture*>(*texture);
+    switch (t->m_dimension)
+    {
+    case Texture::Dimension_1D: FAIL; break;
+    case Texture::Dimension_2D: FAIL; break;
+    case Texture::Dimension_3D:
+        s_dx11.device_context->UpdateSubresource(
+            t->m_texture3D,                                         //[in]           ID3D11Resource  *pDstResource,
+            D3D11CalcSubresource(mip_slice, 0, t->m_mip_levels),    //[in]           UINT            DstSubresource,
+            NULL,                                                   //[in, optional] const D3D11_BOX *pDstBox,
+            data,                                                   //[in]           const void      *pSrcData,
+            row_pitch_bytes,                                        //[in]           UINT            SrcRowPitch,
+            depth_pitch_bytes                                       //[in]           UINT            SrcDepthPitch
+        );
+    break;
+    default: FAIL; break;
+    }
+
+    return true;
+}
+
+
+
+
+
+//************
+//Buffer
+//************
+
+struct DX11GpuBuffer : public GpuBuffer
+{
+    //D3D11_USAGE m_usage = D3D11_USAGE_DYNAMIC;
+    ID3D11Buffer* m_buffer = nullptr;
+    ID3D11ShaderResourceView* structure_resource_view = nullptr;
+    //D3D11_BIND_FLAG m_target = {};
+};
+
+static void CreateStructureView(DX11GpuBuffer* buf, const size_t count, const bool is_byte_format)
+{
+    SafeRelease(buf->structure_resource_view);
+    D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+    ZeroMemory(&desc, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
+    desc.Format = is_byte_format ? DXGI_FORMAT_R8_UINT : DXGI_FORMAT_UNKNOWN;
+    desc.ViewDimension = D3D_SRV_DIMENSION_BUFFER;
+    desc.Buffer.FirstElement = 0;
+    desc.Buffer.NumElements = (UINT)count;
+    HR(s_dx11.device->CreateShaderResourceView(
+        buf->m_buffer,                  //[in]            ID3D11Resource * pResource,
+        &desc,                          //[in, optional]  const D3D11_SHADER_RESOURCE_VIEW_DESC * pDesc,
+        &buf->structure_resource_view   //[out, optional] ID3D11ShaderResourceView * *ppSRView
+    ));
+}
+
+//void GpuBuffer::UploadData(const void* data, u32 element_size, size_t count)
+//TODO: Clean this up with Type::Vertex = D3D11_BIND_VERTEX_BUFFER
+void GpuBuffer::Upload(const void* data, const size_t count, const u32 element_size, const bool is_byte_format)
+{
+    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(this);
+    assert(data);
+    assert(element_size);
+    assert(buf->m_type != GpuBuffer::Type::Invalid);
+    VALIDATE(count);
+    const size_t previous_count = m_count;
+    m_count = count;
+    UINT total_bytes = UINT(element_size * count);
+    //assert(total_bytes / 16 == 0);
+    UINT buffer_type = 0;
+    UINT cpu_access_flags = 0;
+    UINT struct_byte_stride = 0;
+    UINT memory_pitch = 0;
+    UINT misc_flags = 0;
+    switch (buf->m_type)
+    {
+    case GpuBuffer::Type::Vertex:
+        buffer_type = D3D11_BIND_VERTEX_BUFFER;
+        break;
+    case GpuBuffer::Type::Index:
+        buffer_type = D3D11_BIND_INDEX_BUFFER;
+        break;
+    case GpuBuffer::Type::Constant:
+        buffer_type = D3D11_BIND_CONSTANT_BUFFER;
+        cpu_access_flags = D3D11_CPU_ACCESS_WRITE;
+        break;
+    case GpuBuffer::Type::Structure:
+        cpu_access_flags = D3D11_CPU_ACCESS_WRITE;
+        misc_flags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+        buffer_type = D3D11_BIND_SHADER_RESOURCE;
+        assert(!buf->m_is_dymamic);
+        struct_byte_stride = element_size;
+        break;
+    default:
+        FAIL;
+    }
+
+    //The buffer is kept as long as the data fits, a structured buffer also
+    //needs the same stride
+    if (buf->m_buffer && (total_bytes > buf->m_capacity ||
+        (buf->m_type == GpuBuffer::Type::Structure && element_size != buf->m_element_size)))
+    {
+        SafeRelease(buf->m_buffer);
+        SafeRelease(buf->structure_resource_view);
+    }
+    buf->m_element_size = element_size;
+
+    if (!buf->m_buffer)
+    {
+        {
+            D3D11_BUFFER_DESC desc;
+            desc.ByteWidth = total_bytes;
+            desc.Usage = buf->m_is_dymamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_DEFAULT;
+            desc.BindFlags = buffer_type;
+            desc.CPUAccessFlags = buf->m_is_dymamic ? D3D11_CPU_ACCESS_WRITE | cpu_access_flags : cpu_access_flags;
+            desc.MiscFlags = misc_flags;
+            desc.StructureByteStride = struct_byte_stride;
+
+            D3D11_SUBRESOURCE_DATA dx11_data;
+            dx11_data.pSysMem = data;
+            dx11_data.SysMemPitch = memory_pitch;
+            dx11_data.SysMemSlicePitch = 0;
+
+            HR(s_dx11.device->CreateBuffer(
+                &desc,          //[in]            const D3D11_BUFFER_DESC * pDesc,
+                &dx11_data,     //[in, optional]  const D3D11_SUBRESOURCE_DATA * pInitialData,
+                &buf->m_buffer  //[out, optional] ID3D11Buffer * *ppBuffer
+            ));
+            buf->m_capacity = total_bytes;
+        }
+        DEBUG_LOG("Created and Uploaded data to gpu buffer: element: %i size: %i", element_size, count);
+
+        if (buf->m_type == GpuBuffer::Type::Structure)
+            CreateStructureView(buf, count, is_byte_format);
+
+        return;
+    }
+
+    if (buf->m_type == GpuBuffer::Type::Structure && count != previous_count)
+        CreateStructureView(buf, count, is_byte_format);
+
+    if (buf->m_is_dymamic)
+    {
+        //map/unmap/memcopy
+        D3D11_MAPPED_SUBRESOURCE resource;
+        ZeroMemory(&resource, sizeof(D3D11_MAPPED_SUBRESOURCE));
+        HR(s_dx11.device_context->Map(
+            buf->m_buffer,          //[in]            ID3D11Resource * pResource,
+            0,                      //[in]            UINT                     Subresource,
+            D3D11_MAP_WRITE_DISCARD,//[in]            D3D11_MAP                MapType,
+            0,                      //[in]            UINT                     MapFlags,
+            &resource               //[out, optional] D3D11_MAPPED_SUBRESOURCE * pMappedResource
+        ));
+        memcpy(resource.pData, data, element_size * count);
+        s_dx11.device_context->Unmap(buf->m_buffer, 0);
+        DEBUG_LOG("Uploaded dynamic_buffer data to gpu buffer: element: %i size: %i", element_size, count);
+    }
+    else
+    {
+        //Constant buffers can only be updated whole
+        assert(buf->m_type != GpuBuffer::Type::Constant || total_bytes == buf->m_capacity);
+        const D3D11_BOX box = {
+            .left = 0,
+            .top = 0,
+            .front = 0,
+            .right = total_bytes,
+            .bottom = 1,
+            .back = 1,
+        };
+        s_dx11.device_context->UpdateSubresource(
+            buf->m_buffer,  //[in]           ID3D11Resource * pDstResource,
+            0,              //[in]           UINT            DstSubresource,
+            buf->m_type == GpuBuffer::Type::Constant ? NULL : &box, //[in, optional] const D3D11_BOX * pDstBox,
+            data,           //[in]           const void* pSrcData,
+            total_bytes,    //[in]           UINT            SrcRowPitch,
+            0               //[in]           UINT            SrcDepthPitch
+        );
+        DEBUG_LOG("Uploaded default_buffer data to gpu buffer: element: %i size: %i", element_size, count);
+    }
+
+}
+
+void GpuBuffer::UploadRange(const void* data, const size_t first, const size_t count)
+{
+    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(this);
+    assert(data);
+    assert(!buf->m_is_dymamic);
+    assert(buf->m_type != GpuBuffer::Type::Constant);
+    VALIDATE(buf->m_buffer);
+    VALIDATE(count);
+    VALIDATE(first + count <= buf->m_count);
+
+    const D3D11_BOX box = {
+        .left = UINT(first * buf->m_element_size),
+        .top = 0,
+        .front = 0,
+        .right = UINT((first + count) * buf->m_element_size),
+        .bottom = 1,
+        .back = 1,
+    };
+    s_dx11.device_context->UpdateSubresource(buf->m_buffer, 0, &box, data, 0, 0);
+}
+
+void GpuBuffer::Reserve(size_t bytes)
+{
+    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(this);
+    assert(buf->m_type == GpuBuffer::Type::Vertex);
+    assert(buf->m_is_dymamic);
+    VALIDATE(bytes);
+    SafeRelease(buf->m_buffer);
+
+    D3D11_BUFFER_DESC desc = {
+        .ByteWidth = UINT(bytes),
+        .Usage = D3D11_USAGE_DYNAMIC,
+        .BindFlags = D3D11_BIND_VERTEX_BUFFER,
+        .CPUAccessFlags = D3D11_CPU_ACCESS_WRITE,
+    };
+    HR(s_dx11.device->CreateBuffer(&desc, nullptr, &buf->m_buffer));
+    buf->m_capacity = bytes;
+    buf->m_count = 0;
+}
+
+void GpuBuffer::Write(const void* data, u32 offset, u32 bytes)
+{
+    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(this);
+    assert(buf->m_type == GpuBuffer::Type::Vertex);
+    assert(buf->m_is_dymamic);
+    assert(data);
+    VALIDATE(u64(offset) + bytes <= buf->m_capacity);
+
+    //The caller made sure the GPU is done with the range, so nothing is renamed
+    D3D11_MAPPED_SUBRESOURCE resource = {};
+    HR(s_dx11.device_context->Map(buf->m_buffer, 0, D3D11_MAP_WRITE_NO_OVERWRITE, 0, &resource));
+    memcpy(reinterpret_cast<u8*>(resource.pData) + offset, data, bytes);
+    s_dx11.device_context->Unmap(buf->m_buffer, 0);
+}
+
+void GpuBuffer::Bind(u32 slot, GpuBuffer::BindLocation binding)
+{
+    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(this);
+    switch (m_type)
+    {
+    case GpuBuffer::Type::Constant:
+    {
+        switch (binding)
+        {
+        case GpuBuffer::BindLocation::Vertex:
+            s_dx11.device_context->VSSetConstantBuffers(slot, 1, &buf->m_buffer);
+            break;
+        case GpuBuffer::BindLocation::Pixel:
+            s_dx11.device_context->PSSetConstantBuffers(slot, 1, &buf->m_buffer);
+            break;
+        case GpuBuffer::BindLocation::All:
+            s_dx11.device_context->VSSetConstantBuffers(slot, 1, &buf->m_buffer);
+            s_dx11.device_context->PSSetConstantBuffers(slot, 1, &buf->m_buffer);
+            break;
+        default:
+            FAIL;
+            break;
+        }
+        break;
+    }
+    case GpuBuffer::Type::Structure:
+    {
+        switch (binding)
+        {
+        case GpuBuffer::BindLocation::Vertex:
+            s_dx11.device_context->VSSetShaderResources(slot, 1, &buf->structure_resource_view);
+            break;
+        case GpuBuffer::BindLocation::Pixel:
+            s_dx11.device_context->PSSetShaderResources(slot, 1, &buf->structure_resource_view);
+            break;
+        case GpuBuffer::BindLocation::All:
+            s_dx11.device_context->VSSetShaderResources(slot, 1, &buf->structure_resource_view);
+            s_dx11.device_context->PSSetShaderResources(slot, 1, &buf->structure_resource_view);
+            break;
+        default:
+            FAIL;
+            break;
+        }
+        break;
+    }
+    default:
+        FAIL;
+    }
+}
+
+bool CreateGpuBuffer(GpuBuffer** buffer, const char* name, bool is_dynamic, GpuBuffer::Type type)
+{
+    assert(buffer);
+    assert(*buffer == nullptr);
+    DX11GpuBuffer* buf = new DX11GpuBuffer;
+    buf->m_is_dymamic = is_dynamic;
+    buf->m_type = type;
+    strcpy(buf->m_name, name);
+    (*buffer) = reinterpret_cast<GpuBuffer*>(buf);
+    return true;
+}
+
+void DeleteBuffer(GpuBuffer** buffer)
+{
+    VALIDATE(buffer);
+    DX11GpuBuffer* buf = reinterpret_cast<DX11GpuBuffer*>(*buffer);
+    SafeRelease(buf->m_buffer);
+    SafeRelease(buf->structure_resource_view);
+    delete buf;
+    DEBUG_LOG("GPU Buffer deleted %i, %i\n", m_target, m_handle);
+}
+
+
+
+
+
+//************
+//Shader
+//************
+
+struct DX11IncludeManager : ID3DInclude
+{
+    std::vector<std::string> m_included_shader_files;
+    File* file;
+
+    virtual HRESULT Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes) override
+    {
+        std::vector<std::string> filenames;
+        std::string filename = "source/";
+        ScanDirectoryForFileNames(filename, filenames);
+
+        for (size_t i = 0; i < filenames.size(); i++)
+        {
+            if (filenames[i].contains(pFileName))
+            {
+                filename += filenames[i];
+                break;
+            }
+        }
+        m_included_shader_files.push_back(filename);
+        file = new File(filename, File::Mode::Read, false);//Why doesnt this work if its not a pointer
+        file->GetText();
+        if (!file->m_textIsValid)
+        {
+            ppData = nullptr;
+            pBytes = nullptr;
+            return E_FAIL;
+        }
+        char* text = new char[file->m_dataString.size()];
+        memcpy(text, file->m_dataString.c_str(), file->m_dataString.size());
+
+        *ppData = text;
+        *pBytes = (UINT)file->m_dataString.size();
+        return S_OK;
+    }
+    virtual HRESULT Close(LPCVOID pData) override
+    {
+        delete file;
+        if (pData == nullptr)
+            return E_FAIL;
+        return S_OK;
+    }
+};
+
+
+struct DX11Shader : public Shader
+{
+    //D3D11_USAGE m_usage = D3D11_USAGE_DYNAMIC;
+    ID3D11Buffer* m_buffer = nullptr;
+    ID3D11ShaderResourceView* structure_resource_view = nullptr;
+    ID3D11InputLayout* m_vertex_input_layout = nullptr;
+    ID3D11VertexShader* m_vertex_shader = nullptr;
+    ID3D11PixelShader* m_pixel_shader = nullptr;
+    D3D11_INPUT_ELEMENT_DESC m_local_layout[Shader::m_vertex_component_max] = {};
+
+    //D3D11_BIND_FLAG m_target = {};
+};
+
+static DXGI_FORMAT ToDXGIFormat(Shader::VertexFormat format)
+{
+    switch (format)
+    {
+    case Shader::VertexFormat_R32G32_FLOAT:         return DXGI_FORMAT_R32G32_FLOAT;
+    case Shader::VertexFormat_R32G32B32_FLOAT:      return DXGI_FORMAT_R32G32B32_FLOAT;
+    case Shader::VertexFormat_R8G8B8A8_UNORM:       return DXGI_FORMAT_R8G8B8A8_UNORM;
+    case Shader::VertexFormat_R10G10B10A2_UNORM:    return DXGI_FORMAT_R10G10B10A2_UNORM;
+    case Shader::VertexFormat_R32_UINT:             return DXGI_FORMAT_R32_UINT;
+    default: FAIL;                                  return DXGI_FORMAT_UNKNOWN;
+    }
+}
+
+bool CreateShader(Shader** s,
+    const std::string& vertexFileLocation,
+    const std::string& pixelFileLocation,
+    Shader::InputElementDesc* input_layout,
+    i32 layout_count)
+{
+    assert(s);
+    assert(*s == nullptr);
+    DX11Shader* shader = new DX11Shader;
+    (*s) = reinterpret_cast<DX11Shader*>(shader);
+
+    shader->m_vertexFile = vertexFileLocation;
+    shader->m_pixelFile = pixelFileLocation;
+
+    assert(layout_count <= Shader::m_vertex_component_max);
+    shader->m_vertex_component_count = layout_count;
+    for (u32 i = 0; i < shader->m_vertex_component_count; i++)
+    {
+        shader->m_local_layout[i] = {
+        .SemanticName = input_layout[i].SemanticName,
+        .SemanticIndex = 0,
+        .Format = ToDXGIFormat(input_layout[i].Format),
+        .InputSlot = input_layout[i].InputSlot,
+        .AlignedByteOffset = input_layout[i].AlignedByteOffset,
+        .InputSlotClass = input_layout[i].InputSlot ? D3D11_INPUT_PER_INSTANCE_DATA : D3D11_INPUT_PER_VERTEX_DATA,
+        .InstanceDataStepRate = input_layout[i].InputSlot ? 1u : 0u,
+        };
+
+    }
+
+    shader->CheckForUpdate();
+    return true;
+}
+Shader::~Shader()
+{
+    DX11Shader* shader = reinterpret_cast<DX11Shader*>(this);
+    SafeRelease(shader->m_vertex_shader);
+    SafeRelease(shader->m_pixel_shader);
+    SafeRelease(shader->m_vertex_input_layout);
+    DEBUG_LOG("Shader Program Deleted\n");
+}
+bool Shader::CompileShader(std::string text, const std::string& file_name, Type shader_type)
+{
+    DX11Shader* shader = reinterpret_cast<DX11Shader*>(this);
+    bool failed = false;
+#if 1
+    D3D_SHADER_MACRO* shader_macros = nullptr;
+#else
+    D3D_SHADER_MACRO shader_macros[] = {
+        //{"RAY_TRACING", "1"},
+    };
+#endif
+
+    //WideCharToMultiByte
+    i32 char_count = MultiByteToWideChar(
+        CP_UTF8,                //[in]            UINT                              CodePage,
+        MB_ERR_INVALID_CHARS,   //[in]            DWORD                             dwFlags,
+        file_name.c_str(),      //[in]            _In_NLS_string_(cbMultiByte)LPCCH lpMultiByteStr,
+        -1,                     //[in]            int                               cbMultiByte,
+        nullptr,                //[out, optional] LPWSTR                            lpWideCharStr,
+        0                       //[in]            int                               cchWideChar
+    );
+    i32 wide_char_count = char_count;// = char_count / 2;
+    WCHAR* wide_char = new WCHAR[wide_char_count];
+    //memset(wide_char, '\0', wide_char_count);
+    i32 wide_char_actual = MultiByteToWideChar(
+        CP_UTF8,                //[in]            UINT                              CodePage,
+        MB_ERR_INVALID_CHARS,   //[in]            DWORD                             dwFlags,
+        file_name.c_str(),      //[in]            _In_NLS_string_(cbMultiByte)LPCCH lpMultiByteStr,
+        -1,                     //[in]            int                               cbMultiByte,
+        wide_char,              //[out, optional] LPWSTR                            lpWideCharStr,
+        wide_char_count         //[in]            int                               cchWideChar
+    );
+    assert(wide_char_actual > 0);
+    assert(wide_char_actual == wide_char_count);
+
+    std::string entry_point;
+    std::string target_version;
+    switch (shader_type)
+    {
+    case Type_Vertex:
+        entry_point = "Vertex_Main";
+        target_version = "vs_4_0";
+        break;
+    case Type_Pixel:
+        entry_point = "Pixel_Main";
+        target_version = "ps_4_0";
+        break;
+    default:
+        FAIL;
+    }
+
+    u32 flags1 = 0;
+    //flags1 |= D3DCOMPILE_WARNINGS_ARE_ERRORS;
+    flags1 |= D3DCOMPILE_PREFER_FLOW_CONTROL;
+#if _DEBUG
+    //;
+    flags1 |= D3DCOMPILE_DEBUG;
+#if 0
+    flags1 |= D3DCOMPILE_SKIP_OPTIMIZATION | D3DCOMPILE_OPTIMIZATION_LEVEL0;
+    //flags1 |= D3DCOMPILE_SKIP_VALIDATION; //dont do this
+#else
+    flags1 |= D3DCOMPILE_OPTIMIZATION_LEVEL3;
+#endif
+#endif
+
+    ID3DBlob* code;
+    ID3DBlob* errors;
+    DX11IncludeManager include_manager;
+    HRESULT compile_result = s_dx11.D3DCompileFromFileFunc(
+        wide_char,              //[in]            LPCWSTR                pFileName,
+        shader_macros,          //[in, optional]  const D3D_SHADER_MACRO *pDefines,
+        &include_manager,  //[in, optional]  ID3DInclude            *pInclude,
+        entry_point.c_str(),    //[in]            LPCSTR                 pEntrypoint,
+        target_version.c_str(), //[in]            LPCSTR                 pTarget,
+        flags1,                 //[in]            UINT                   Flags1,
+        0,                      //[in]            UINT                   Flags2,
+        &code,                  //[out]           ID3DBlob               **ppCode,
+        &errors                 //[out, optional] ID3DBlob               **ppErrorMsgs
+    );
+    delete wide_char;
+    failed = !code || !!errors || FAILED(compile_result);
+
+    if (!failed)
+    {
+        SafeRelease(errors);
+        switch (shader_type)
+        {
+        case Type_Vertex:
+            SafeRelease(shader->m_vertex_shader);
+            if (FAILED(s_dx11.device->CreateVertexShader(code->GetBufferPointer(), code->GetBufferSize(), nullptr, &shader->m_vertex_shader)))
+            {
+                FAIL;
+                SafeRelease(code);
+                SafeRelease(errors);
+                failed = true;
+            }
+            else
+            {
+                // Create the input layout
+                if (FAILED(s_dx11.device->CreateInputLayout(
+                    shader->m_local_layout,             //[in]            const D3D11_INPUT_ELEMENT_DESC *pInputElementDescs,
+                    shader->m_vertex_component_count,   //[in]            UINT                           NumElements,
+                    code->GetBufferPointer(),           //[in]            const void                     *pShaderBytecodeWithInputSignature,
+                    code->GetBufferSize(),              //[in]            SIZE_T                         BytecodeLength,
+                    &shader->m_vertex_input_layout      //[out, optional] ID3D11InputLayout              **ppInputLayout
+                )))
+                {
+                    FAIL;
+                    failed = true;
+                }
+                SafeRelease(code);
+            }
+            break;
+        case Type_Pixel:
+            SafeRelease(shader->m_pixel_shader);
+            if (FAILED(s_dx11.device->CreatePixelShader(code->GetBufferPointer(), code->GetBufferSize(), nullptr, &shader->m_pixel_shader)))
+            {
+                FAIL;
+                SafeRelease(code);
+                SafeRelease(errors);
+                failed = true;
+            }
+            break;
+        default:
+            FAIL;
+        }
+    }
+
+    for (i32 i = 0; i < include_manager.m_included_shader_files.size(); i++)
+    {
+        for (i32 i = 0; i < m_reference_file_names.size(); i++)
+        {
+            if (m_reference_file_names[i].find(include_manager.m_included_shader_files[i]) != std::string::npos)
+            {
+                goto postloops;
+            }
+        }
+        m_reference_file_names.push_back(include_manager.m_included_shader_files[i]);
+        m_reference_file_times.push_back(0);
+    }
+    postloops:
+
+    if (failed)
+    {
+        std::string info_string;
+        info_string.resize(errors->GetBufferSize());
+        memcpy(info_string.data(), errors->GetBufferPointer(), errors->GetBufferSize());
+        std::string error_title = file_name + " Compilation Error: ";
+        DebugPrint((error_title + info_string + "\n").c_str());
+
+        SDL_MessageBoxButtonData buttons[] = {
+            //{ /* .flags, .buttonid, .text */        0, 0, "Continue" },
+            { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 0, "Retry" },
+            { SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 1, "Continue" },
+        };
+
+        i32 buttonID = CreateMessageWindow(buttons, arrsize(buttons), MessageBoxType::Error, error_title.c_str(), info_string.c_str());
+        //if (buttons[buttonID].buttonid == 2)//NOTE: Stop button
+        //{
+        //    DebugPrint("stop hit");
+        //    g_running = false;
+        //    return false;
+        //}
+        //else
+        {
+            if (buttons[buttonID].buttonid == 0)//NOTE: Retry button
+            {
+                CheckForUpdate();
+            }
+            else if (buttons[buttonID].buttonid == 1)//NOTE: Continue button
+            {
+                return false;
+            }
+        }
+    }
+    DEBUG_LOG("Shader Vertex/Fragment Created\n");
+    return true;
+}
+
+
+typedef HRESULT(*D3DCompileFunc)        (LPCVOID, SIZE_T, LPCSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
+typedef HRESULT(*D3DCompileFromFileFunc)(LPCWSTR, const D3D_SHADER_MACRO*, ID3DInclude*, LPCSTR, LPCSTR, UINT, UINT, ID3DBlob**, ID3DBlob**);
+
+void InitializeImGuiBackend()
+{
+    ImGui_ImplSDL2_InitForD3D(g_renderer.SDL_Context);
+    ImGui_ImplDX11_Init(s_dx11.device, s_dx11.device_context);
+}
+
+void NewImGuiFrame()
+{
+    ImGui_ImplDX11_NewFrame();
+    ImGui_ImplSDL2_NewFrame();
+    ImGui::NewFrame();
+}
+
+void RenderImGui()
+{
+    ImGui::Render();
+    ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
+}
+
+void ShutdownImGui()
+{
+    ImGui_ImplDX11_Shutdown();
+    ImGui_ImplSDL2_Shutdown();
+}
+
+void ResizeBackbuffer(const Vec2I& window_size)
+{
+    SafeRelease(s_dx11.swap_chain.render_target_view);
+    HR(s_dx11.swap_chain.handle->ResizeBuffers(
+        0,                  //UINT        BufferCount, IS THIS RIGHT???
+        (UINT)window_size.x,//UINT        Width,
+        (UINT)window_size.y,//UINT        Height,
+        DXGI_FORMAT_UNKNOWN,//DXGI_FORMAT_R8G8B8A8_UNORM, //DXGI_FORMAT NewFormat,
+        0                   //UINT        SwapChainFlags
+    ));
+
+    DXGI_SWAP_CHAIN_DESC desc;
+    s_dx11.swap_chain.handle->GetDesc(&desc);
+    assert(desc.BufferDesc.Width == window_size.x);
+    assert(desc.BufferDesc.Height == window_size.y);
+    s_dx11.swap_chain.size.x = desc.BufferDesc.Width;
+    s_dx11.swap_chain.size.y = desc.BufferDesc.Height;
+    s_dx11.swap_chain.refresh_rate = desc.BufferDesc.RefreshRate.Numerator;
+    s_dx11.swap_chain.sample_count = desc.SampleDesc.Count;
+    s_dx11.swap_chain.sample_quality = desc.SampleDesc.Quality;
+
+
+    ID3D11Texture2D* backbuffer;
+    VERIFY(SUCCEEDED(s_dx11.swap_chain.handle->GetBuffer(0, IID_PPV_ARGS(&backbuffer))));
+    CreateRenderTargetView(&s_dx11.swap_chain.render_target_view, DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, backbuffer);
+
+    SafeRelease(backbuffer);
+}
+
+//#pragma comment(lib, "dxgi.lib")
+void InitializeBackend()
+{
+    //Is this needed?
+    SDL_SetHint(SDL_HINT_RENDER_DRIVER,         "direct3d11");
+
+    SDL_SysWMinfo wmInfo;
+    SDL_VERSION(&wmInfo.version);
+    SDL_GetWindowWMInfo(g_renderer.SDL_Context, &wmInfo);
+    HWND hwnd = wmInfo.info.win.window;
+
+
+    {
+#if 0
+        //Do we need to really do this?
+        {
+            IDXGIFactory* factory;
+            VERIFY(SUCCEEDED(CreateDXGIFactory(IID_PPV_ARGS(&factory))));
+            assert(factory);
+            IDXGIAdapter* aOutput;
+            for (UINT i = 0; factory->EnumAdapters(i, &aOutput) != DXGI_ERROR_NOT_FOUND; i++)
+            {
+                DXGI_ADAPTER_DESC desc;
+                HR(aOutput->GetDesc(&desc));
+                desc.Description;
+                UINT id = desc.VendorId;
+            }
+        }
+#endif
+
+
+
+        UINT flags = 0;
+//#if _DEBUG
+        flags |= D3D11_CREATE_DEVICE_DEBUG;
+//#endif
+
+        DXGI_RATIONAL refresh_rate;
+        refresh_rate.Numerator = g_renderer.refresh_rate;
+        refresh_rate.Denominator = 1;
+
+        DXGI_MODE_DESC dxgi_mode_desc;
+        {
+#if 0
+            dxgi_mode_desc.Width = g_renderer.size.x;
+            dxgi_mode_desc.Height = g_renderer.size.y;
+#else
+            dxgi_mode_desc.Width = 0;
+            dxgi_mode_desc.Height = 0;
+#endif
+            dxgi_mode_desc.RefreshRate = refresh_rate;
+            dxgi_mode_desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM; //DXGI_FORMAT_R32G32B32A32_FLOAT;
+            dxgi_mode_desc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
+            dxgi_mode_desc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
+        }
+
+        DXGI_SAMPLE_DESC dxgi_sample_desc;
+        {
+            //MSAA
+            dxgi_sample_desc.Count      = 1;
+            dxgi_sample_desc.Quality    = 0;
+        }
+
+        DXGI_SWAP_CHAIN_DESC swap_chain_desc;
+        swap_chain_desc.BufferDesc = dxgi_mode_desc;
+        swap_chain_desc.SampleDesc = dxgi_sample_desc;
+        swap_chain_desc.BufferUsage = DXGI_USAGE_BACK_BUFFER | DXGI_USAGE_RENDER_TARGET_OUTPUT;
+        swap_chain_desc.BufferCount = 2; //is this right?
+        swap_chain_desc.OutputWindow = hwnd;
+        swap_chain_desc.Windowed = TRUE;
+        swap_chain_desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL; //Does not work with MSAA
+        swap_chain_desc.Flags = 0; //do we need this?  DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING
+
+        const D3D_FEATURE_LEVEL feature_levels[]= { D3D_FEATURE_LEVEL_11_0 };
+        IDXGISwapChain*         swap_chain      = nullptr;
+        D3D_FEATURE_LEVEL       feature_level   = {};
+        ID3D11DeviceContext*    temp_context    = nullptr;
+
+        HR(D3D11CreateDeviceAndSwapChain(
+            nullptr,                    //[in, optional]  IDXGIAdapter               *pAdapter,
+            D3D_DRIVER_TYPE_HARDWARE,   //                D3D_DRIVER_TYPE            DriverType,
+            NULL,                       //                HMODULE                    Software,
+            flags,                      //                UINT                       Flags,
+            feature_levels,             //[in, optional]  const D3D_FEATURE_LEVEL    *pFeatureLevels,
+            arrsize(feature_levels),    //                UINT                       FeatureLevels,
+            D3D11_SDK_VERSION,          //                UINT                       SDKVersion,
+            &swap_chain_desc,           //[in, optional]  const DXGI_SWAP_CHAIN_DESC *pSwapChainDesc,
+            &swap_chain,                //[out, optional] IDXGISwapChain             **ppSwapChain,
+            &s_dx11.device,                    //[out, optional] ID3D11Device               **ppDevice,
+            &feature_level,             //[out, optional] D3D_FEATURE_LEVEL          *pFeatureLevel,
+            &temp_context               //[out, optional] ID3D11DeviceContext        **ppImmediateContext
+        ));
+        assert(s_dx11.device); //FATAL
+
+        VERIFY(SUCCEEDED(temp_context->QueryInterface(IID_PPV_ARGS(&s_dx11.device_context))));
+        temp_context->Release();
+
+        s_dx11.swap_chain.handle = swap_chain;
+        ResizeBackbuffer(g_renderer.size);
+
+        // Get factory from device
+        IDXGIDevice*    pDXGIDevice  = nullptr;
+        IDXGIAdapter*   pDXGIAdapter = nullptr;
+        IDXGIFactory*   pFactory     = nullptr;
+
+        if (SUCCEEDED(s_dx11.device->QueryInterface(IID_PPV_ARGS(&pDXGIDevice))))
+            if (SUCCEEDED(pDXGIDevice->GetParent(IID_PPV_ARGS(&pDXGIAdapter))))
+                if (SUCCEEDED(pDXGIAdapter->GetParent(IID_PPV_ARGS(&pFactory))))
+                {
+                    s_dx11.factory         = pFactory;
+                }
+        if (pDXGIDevice) pDXGIDevice->Release();
+        if (pDXGIAdapter) pDXGIAdapter->Release();
+        s_dx11.device->AddRef();
+        s_dx11.device_context->AddRef();
+    }
+
+    {
+        HINSTANCE dll_instance = LoadLibrary("d3dcompiler_47.dll");
+        VALIDATE(dll_instance);
+        s_dx11.D3DCompileFunc          = (D3DCompileFunc)GetProcAddress(dll_instance, "D3DCompile");
+        s_dx11.D3DCompileFromFileFunc  = (D3DCompileFromFileFunc)GetProcAddress(dll_instance, "D3DCompileFromFile");
+    }
+
+#if 0 //Unsure if this is needed for creating window with SDL and D3D11
+    SDL_Renderer* renderer = nullptr;
+    for (i32 i = 0; i < SDL_GetNumRenderDrivers(); i++)
+    {
+        SDL_RendererInfo rendererInfo = {};
+        SDL_GetRenderDriverInfo(i, &rendererInfo);
+        if (rendererInfo.name == std::string("direct3d11"))
+        {
+            renderer = SDL_CreateRenderer(g_renderer.SDL_Context, i, 0);
+        }
+
+        break;
+    }
+#endif
+
+#if 0 //OpenGL code
+    /* This makes our buffer swap syncronized with the monitor's vertical refresh */
+    SDL_GL_SetSwapInterval(g_renderer.swapInterval);
+#endif
+
+    //Create Blender State
+    {
+        D3D11_BLEND_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        desc.AlphaToCoverageEnable = false;
+        desc.IndependentBlendEnable = false;
+        desc.RenderTarget[0].BlendEnable = true;
+        desc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
+        desc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+        desc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+        desc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+        desc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+        desc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+        desc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+        s_dx11.device->CreateBlendState(&desc, &s_dx11.blend_state);
+    }
+
+    // Create the rasterizer state
+    {
+        D3D11_RASTERIZER_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        desc.FillMode = D3D11_FILL_SOLID;
+        desc.CullMode = D3D11_CULL_BACK;
+        desc.FrontCounterClockwise = TRUE;
+        desc.DepthBias = 0;
+        desc.DepthBiasClamp = 0.0f;
+        desc.SlopeScaledDepthBias = 0.0f;
+        desc.DepthClipEnable = TRUE;
+        desc.ScissorEnable = FALSE;
+        desc.MultisampleEnable = TRUE;
+        desc.AntialiasedLineEnable = TRUE;
+        s_dx11.device->CreateRasterizerState(&desc, &s_dx11.rasterizer_full);
+    }
+    {
+        D3D11_RASTERIZER_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        desc.FillMode = D3D11_FILL_WIREFRAME;
+        desc.CullMode = D3D11_CULL_NONE;
+        desc.FrontCounterClockwise = TRUE;
+        desc.DepthBias = 0;
+        desc.DepthBiasClamp = 0.0f;
+        desc.SlopeScaledDepthBias = 0.0f;
+        desc.DepthClipEnable = TRUE;
+        desc.ScissorEnable = FALSE;
+        desc.MultisampleEnable = TRUE;
+        desc.AntialiasedLineEnable = TRUE;
+        s_dx11.device->CreateRasterizerState(&desc, &s_dx11.rasterizer_wireframe);
+    }
+    {
+        D3D11_RASTERIZER_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        desc.FillMode = D3D11_FILL_SOLID;
+        desc.CullMode = D3D11_CULL_NONE;
+        desc.FrontCounterClockwise = TRUE;
+        desc.DepthBias = 0;
+        desc.DepthBiasClamp = 0.0f;
+        desc.SlopeScaledDepthBias = 0.0f;
+        desc.DepthClipEnable = FALSE;
+        desc.ScissorEnable = FALSE;
+        desc.MultisampleEnable = FALSE;
+        desc.AntialiasedLineEnable = FALSE;
+        s_dx11.device->CreateRasterizerState(&desc, &s_dx11.rasterizer_voxel);
+    }
+    {
+        D3D11_DEPTH_STENCIL_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        // Depth test parameters
+        desc.DepthEnable = true;
+        desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+        desc.DepthFunc = D3D11_COMPARISON_LESS;
+
+        // Stencil test parameters
+        desc.StencilEnable = false;
+        desc.StencilReadMask = 0xFF;
+        desc.StencilWriteMask = 0xFF;
+
+        // Stencil operations if pixel is front-facing
+        desc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+        desc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_INCR;
+        desc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+        desc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+
+        // Stencil operations if pixel is back-facing
+        desc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+        desc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_DECR;
+        desc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+        desc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+
+        // Create depth stencil state
+        HR(s_dx11.device->CreateDepthStencilState(&desc, &s_dx11.depth_stencil_state_depth));
+    }
+    {
+        D3D11_DEPTH_STENCIL_DESC desc;
+        ZeroMemory(&desc, sizeof(desc));
+        // Depth test parameters
+        desc.DepthEnable = false;
+        desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+        desc.DepthFunc = D3D11_COMPARISON_LESS;
+
+        // Stencil test parameters
+        desc.StencilEnable = false;
+        desc.StencilReadMask = 0xFF;
+        desc.StencilWriteMask = 0xFF;
+
+        // Stencil operations if pixel is front-facing
+        desc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+        desc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_INCR;
+        desc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+        desc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+
+        // Stencil operations if pixel is back-facing
+        desc.BackFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+        desc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_DECR;
+        desc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+        desc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+
+        // Create depth stencil state
+        HR(s_dx11.device->CreateDepthStencilState(&desc, &s_dx11.depth_stencil_state_no_depth));
+    }
+}
+
+
+
+
+
+//************
+//Commands
+//************
+
+static DX11Texture* GetDX11Texture(Texture::Index texture)
+{
+    assert(texture != Texture::Index_Swapchain);
+    return reinterpret_cast<DX11Texture*>(g_renderer.textures[texture]);
+}
+
+void BackendBindShader(Shader::Index shader_i)
+{
+    ID3D11DeviceContext* context = s_dx11.device_context;
+    DX11Shader* shader = reinterpret_cast<DX11Shader*>(g_renderer.shaders[+shader_i]);
+    context->IASetInputLayout(shader->m_vertex_input_layout);
+    context->VSSetShader(shader->m_vertex_shader, NULL, 0);
+    context->HSSetShader(nullptr, nullptr, 0);
+    context->DSSetShader(nullptr, nullptr, 0);
+    context->GSSetShader(nullptr, nullptr, 0);
+    context->PSSetShader(shader->m_pixel_shader, NULL, 0);
+    context->CSSetShader(nullptr, nullptr, 0);
+}
+
+void BindVertexBuffers(GpuBuffer* const* buffers, const u32* strides, const u32* offsets, u32 count)
+{
+    ID3D11Buffer* dx11_buffers[2] = {};
+    UINT dx11_offsets[arrsize(dx11_buffers)] = {};
+    VALIDATE(count <= arrsize(dx11_buffers));
+    for (u32 i = 0; i < count; i++)
+    {
+        dx11_buffers[i] = reinterpret_cast<DX11GpuBuffer*>(buffers[i])->m_buffer;
+        if (offsets)
+            dx11_offsets[i] = offsets[i];
+    }
+    s_dx11.device_context->IASetVertexBuffers(0, count, dx11_buffers, strides, dx11_offsets);
+    s_dx11.device_context->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+void BackendBindRasterizer(RasterizerState state)
+{
+    ID3D11RasterizerState* rasterizer = nullptr;
+    switch (state)
+    {
+    case RasterizerState::Full:         rasterizer = s_dx11.rasterizer_full;        break;
+    case RasterizerState::Wireframe:    rasterizer = s_dx11.rasterizer_wireframe;   break;
+    case RasterizerState::Voxel:        rasterizer = s_dx11.rasterizer_voxel;       break;
+    default: FAIL;                                                                  break;
+    }
+    s_dx11.device_context->RSSetState(rasterizer);
+}
+
+void BackendBindViewport(const Vec2I& size)
+{
+    D3D11_VIEWPORT view_port = {
+        .TopLeftX = 0.0f,
+        .TopLeftY = 0.0f,
+        .Width = (float)size.x,
+        .Height = (float)size.y,
+        .MinDepth = 0.0f,
+        .MaxDepth = 1.0f,
+    };
+    s_dx11.device_context->RSSetViewports(1, &view_port);
+}
+
+void BackendBindSampler(u32 slot, Texture::Index texture)
+{
+    s_dx11.device_context->PSSetSamplers(slot, 1, &GetDX11Texture(texture)->m_sampler);
+}
+
+void BindTexture(u32 slot, Texture::Index texture)
+{
+    ID3D11ShaderResourceView* view = nullptr;
+    if (texture != Texture::Index_Invalid)
+        view = GetDX11Texture(texture)->m_view;
+    s_dx11.device_context->PSSetShaderResources(slot, 1, &view);
+}
+
+void BindRenderTargets(const Texture::Index* targets, u32 count, Texture::Index depth)
+{
+    ID3D11RenderTargetView* views[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT] = {};
+    VALIDATE(count <= arrsize(views));
+    for (u32 i = 0; i < count; i++)
+    {
+        if (targets[i] == Texture::Index_Swapchain)
+            views[i] = s_dx11.swap_chain.render_target_view;
+        else if (targets[i] != Texture::Index_Invalid)
+            views[i] = GetDX11Texture(targets[i])->m_render_target_view;
+    }
+    ID3D11DepthStencilView* depth_view = nullptr;
+    if (depth != Texture::Index_Invalid)
+        depth_view = GetDX11Texture(depth)->m_depth_stencil_view;
+    s_dx11.device_context->OMSetRenderTargets(count, count ? views : nullptr, depth_view);
+}
+
+void BackendBindDepthState(DepthState state)
+{
+    ID3D11DepthStencilState* depth_stencil = nullptr;
+    switch (state)
+    {
+    case DepthState::Depth:     depth_stencil = s_dx11.depth_stencil_state_depth;       break;
+    case DepthState::NoDepth:   depth_stencil = s_dx11.depth_stencil_state_no_depth;    break;
+    default: FAIL;                                                                      break;
+    }
+    s_dx11.device_context->OMSetDepthStencilState(depth_stencil, 1);
+}
+
+void BackendBindBlendState(BlendState state)
+{
+    ID3D11BlendState* blend = nullptr;
+    switch (state)
+    {
+    case BlendState::Opaque:    blend = nullptr;            break;
+    case BlendState::Alpha:     blend = s_dx11.blend_state; break;
+    default: FAIL;                                          break;
+    }
+    s_dx11.device_context->OMSetBlendState(blend, NULL, 0xffffffff);
+}
+
+void ClearRenderTarget(Texture::Index target, const Vec4& color)
+{
+    ID3D11RenderTargetView* view = target == Texture::Index_Swapchain ?
+        s_dx11.swap_chain.render_target_view : GetDX11Texture(target)->m_render_target_view;
+    s_dx11.device_context->ClearRenderTargetView(view, color.e);
+}
+
+void ClearDepth(Texture::Index depth, float value)
+{
+    s_dx11.device_context->ClearDepthStencilView(GetDX11Texture(depth)->m_depth_stencil_view, D3D11_CLEAR_DEPTH, value, 0);
+}
+
+void CopyTexture(Texture::Index destination, Texture::Index source)
+{
+    s_dx11.device_context->CopyResource(GetDX11Texture(destination)->m_texture2D, GetDX11Texture(source)->m_texture2D);
+}
+
+void Draw(u32 vertex_count)
+{
+    s_dx11.device_context->Draw(vertex_count, 0);
+}
+
+void DrawInstanced(u32 vertex_count, u32 instance_count)
+{
+    s_dx11.device_context->DrawInstanced(vertex_count, instance_count, 0, 0);
+}
+
+void BindIndexBuffer(GpuBuffer* buffer)
+{
+    assert(buffer->m_type == GpuBuffer::Type::Index);
+    s_dx11.device_context->IASetIndexBuffer(reinterpret_cast<DX11GpuBuffer*>(buffer)->m_buffer, DXGI_FORMAT_R32_UINT, 0);
+}
+
+void DrawIndexed(u32 index_count, u32 first_index)
+{
+    s_dx11.device_context->DrawIndexed(index_count, first_index, 0);
+}
+
+//An event query per fence, FRAMES_IN_FLIGHT fences are waited on before
+//their query is used again
+static ID3D11Query* s_fence_queries[FRAMES_IN_FLIGHT + 1] = {};
+static u64 s_fence_next = 1;
+static u64 s_fence_completed = 0;
+
+u64 InsertFence()
+{
+    const u64 fence = s_fence_next++;
+    ID3D11Query*& query = s_fence_queries[fence % arrsize(s_fence_queries)];
+    assert(fence - s_fence_completed <= arrsize(s_fence_queries));
+    if (!query)
+    {
+        D3D11_QUERY_DESC desc = {
+            .Query = D3D11_QUERY_EVENT,
+            .MiscFlags = 0,
+        };
+        HR(s_dx11.device->CreateQuery(&desc, &query));
+    }
+    s_dx11.device_context->End(query);
+    return fence;
+}
+
+bool IsFenceComplete(u64 fence)
+{
+    if (fence <= s_fence_completed)
+        return true;
+    ID3D11Query* query = s_fence_queries[fence % arrsize(s_fence_queries)];
+    if (s_dx11.device_context->GetData(query, nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+        return false;
+    s_fence_completed = fence;
+    return true;
+}
+
+void WaitForFence(u64 fence)
+{
+    ZoneScopedN("Wait For Fence");
+    if (fence <= s_fence_completed)
+        return;
+    ID3D11Query* query = s_fence_queries[fence % arrsize(s_fence_queries)];
+    while (s_dx11.device_context->GetData(query, nullptr, 0, 0) != S_OK)
+        SDL_Delay(0);
+    s_fence_completed = fence;
+}
+
+void Present()
+{
+    s_dx11.swap_chain.handle->Present(1, 0);
+}
+
+#endif
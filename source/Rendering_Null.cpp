@@ -0,0 +1,416 @@
+#include "Rendering.h"
+#include "Rendering_Backend.h"
+#include "Debug.h"
+#include "imgui.h"
+#include "ImGui/backends/imgui_impl_sdl2.h"
+
+#include "SDL.h"
+
+#if RENDER_BACKEND == RENDER_BACKEND_NULL
+
+//Nothing is sent to a GPU. Every call is appended to the record of the frame
+//that is being built and RenderPresent turns it into the record of the last
+//frame, so the frame loop can be run, profiled and compared without a device.
+
+static RenderRecord s_frame_record;
+static RenderRecord s_last_record;
+
+static void Record(RenderCommand type, u32 arg0 = 0, u32 arg1 = 0, u64 bytes = 0)
+{
+    s_frame_record.commands.push_back({ type, arg0, arg1, bytes });
+    s_frame_record.counts[+type]++;
+    s_frame_record.bytes[+type] += bytes;
+}
+
+const RenderRecord& GetRenderRecord()
+{
+    return s_last_record;
+}
+
+
+
+
+
+//************
+//Texture
+//************
+
+static u64 GetTextureBytes(const Texture::TextureParams& tp, u32 mip_levels)
+{
+    i32 bytes_per_pixel = tp.bytes_per_pixel;
+    if (tp.type == Texture::Type_Depth)
+        bytes_per_pixel = tp.format == Texture::Format_D16_UNORM ? 2 : 4;
+    u64 bytes = 0;
+    for (u32 mip = 0; mip < mip_levels; mip++)
+        bytes += u64(Max(tp.size.x >> mip, 1)) * Max(tp.size.y >> mip, 1) * Max(tp.size.z >> mip, 1) * bytes_per_pixel;
+    return bytes;
+}
+
+void DeleteTexture(Texture** texture)
+{
+    VALIDATE(texture);
+    VALIDATE(*texture != nullptr);
+    delete *texture;
+    *texture = nullptr;
+}
+
+bool CreateTexture(Texture** texture, const Texture::TextureParams& tp, u32 mip_levels, const u8* data)
+{
+    VALIDATE_V(texture, false);
+    VALIDATE_V(*texture == nullptr, false);
+
+    Texture* tex = new Texture;
+    *texture = tex;
+
+    tex->m_parameters = tp;
+    tex->m_mip_levels = mip_levels;
+    assert(tex->m_parameters.size.x != -1 && tex->m_parameters.size.x != 0);
+    if (tex->m_parameters.size.z > 0)
+    {
+        tex->m_dimension = Texture::Dimension_3D;
+    }
+    else if (tex->m_parameters.size.y > 0)
+    {
+        tex->m_dimension = Texture::Dimension_2D;
+    }
+    else
+    {
+        tex->m_dimension = Texture::Dimension_1D;
+    }
+
+    Record(RenderCommand::CreateTexture, tex->m_dimension, tp.render_target, data ? GetTextureBytes(tp, mip_levels) : 0);
+    return true;
+}
+
+bool UpdateTexture(Texture** texture, u32 mip_slice, void* data, u32 row_pitch_bytes, u32 depth_pitch_bytes)
+{
+    VALIDATE_V(texture, false);
+    VALIDATE_V(*texture, false);
+    Texture* t = *texture;
+    VALIDATE_V(t->m_dimension == Texture::Dimension_3D, false);
+    assert(data);
+
+    const u64 depth = Max(t->m_parameters.size.z >> mip_slice, 1);
+    Record(RenderCommand::UpdateTexture, t->m_dimension, mip_slice, depth_pitch_bytes * depth);
+    return true;
+}
+
+
+
+
+
+//************
+//Buffer
+//************
+
+void GpuBuffer::Upload(const void* data, const size_t count, const u32 element_size, const bool is_byte_format)
+{
+    assert(data);
+    assert(element_size);
+    assert(m_type != GpuBuffer::Type::Invalid);
+    VALIDATE(count);
+    m_count = count;
+    const size_t total_bytes = element_size * count;
+    //Same rules as the D3D11 backend for when the buffer is created again
+    if (m_capacity == 0 || total_bytes > m_capacity ||
+        (m_type == GpuBuffer::Type::Structure && element_size != m_element_size))
+    {
+        m_capacity = total_bytes;
+        Record(RenderCommand::CreateBuffer, u32(m_type), element_size, total_bytes);
+    }
+    else
+    {
+        Record(RenderCommand::UploadBuffer, u32(m_type), element_size, total_bytes);
+    }
+    m_element_size = element_size;
+}
+
+void GpuBuffer::UploadRange(const void* data, const size_t first, const size_t count)
+{
+    assert(data);
+    assert(!m_is_dymamic);
+    assert(m_type != GpuBuffer::Type::Constant);
+    VALIDATE(m_capacity);
+    VALIDATE(count);
+    VALIDATE(first + count <= m_count);
+    Record(RenderCommand::UploadBuffer, u32(m_type), m_element_size, u64(count) * m_element_size);
+}
+
+void GpuBuffer::Reserve(size_t bytes)
+{
+    assert(m_type == GpuBuffer::Type::Vertex);
+    assert(m_is_dymamic);
+    VALIDATE(bytes);
+    m_capacity = bytes;
+    m_count = 0;
+    Record(RenderCommand::CreateBuffer, u32(m_type), 0, 0);
+}
+
+void GpuBuffer::Write(const void* data, u32 offset, u32 bytes)
+{
+    assert(m_type == GpuBuffer::Type::Vertex);
+    assert(m_is_dymamic);
+    assert(data);
+    VALIDATE(u64(offset) + bytes <= m_capacity);
+    Record(RenderCommand::UploadBuffer, u32(m_type), offset, bytes);
+}
+
+void GpuBuffer::Bind(u32 slot, GpuBuffer::BindLocation binding)
+{
+    switch (m_type)
+    {
+    case GpuBuffer::Type::Constant:     Record(RenderCommand::BindConstantBuffer,   slot, u32(binding)); break;
+    case GpuBuffer::Type::Structure:    Record(RenderCommand::BindStructureBuffer,  slot, u32(binding)); break;
+    default: FAIL;
+    }
+}
+
+bool CreateGpuBuffer(GpuBuffer** buffer, const char* name, bool is_dynamic, GpuBuffer::Type type)
+{
+    assert(buffer);
+    assert(*buffer == nullptr);
+    GpuBuffer* buf = new GpuBuffer;
+    buf->m_is_dymamic = is_dynamic;
+    buf->m_type = type;
+    strcpy(buf->m_name, name);
+    (*buffer) = buf;
+    return true;
+}
+
+void DeleteBuffer(GpuBuffer** buffer)
+{
+    VALIDATE(buffer);
+    delete *buffer;
+    *buffer = nullptr;
+}
+
+
+
+
+
+//************
+//Shader
+//************
+
+bool CreateShader(Shader** s,
+    const std::string& vertexFileLocation,
+    const std::string& pixelFileLocation,
+    Shader::InputElementDesc* input_layout,
+    i32 layout_count)
+{
+    assert(s);
+    assert(*s == nullptr);
+    assert(u32(layout_count) <= Shader::m_vertex_component_max);
+    Shader* shader = new Shader;
+    (*s) = shader;
+
+    shader->m_vertexFile = vertexFileLocation;
+    shader->m_pixelFile = pixelFileLocation;
+    shader->m_vertex_component_count = layout_count;
+
+    shader->CheckForUpdate();
+    return true;
+}
+
+Shader::~Shader()
+{
+}
+
+bool Shader::CompileShader(std::string text, const std::string& file_name, Type shader_type)
+{
+    Record(RenderCommand::CompileShader, shader_type, 0, text.size());
+    return true;
+}
+
+
+
+
+
+//************
+//Video
+//************
+
+void InitializeBackend()
+{
+    //Nothing is drawn to the window, it only provides the events.
+    //Set SDL_VIDEODRIVER to offscreen or dummy when there is no display
+    SDL_HideWindow(g_renderer.SDL_Context);
+}
+
+void InitializeImGuiBackend()
+{
+    ImGui_ImplSDL2_InitForOther(g_renderer.SDL_Context);
+
+    //A renderer backend would upload the font atlas, NewFrame needs it built either way
+    u8* pixels = nullptr;
+    i32 width = 0;
+    i32 height = 0;
+    ImGui::GetIO().Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+    Record(RenderCommand::CreateTexture, Texture::Dimension_2D, 0, u64(width) * height * 4);
+}
+
+void NewImGuiFrame()
+{
+    ImGui_ImplSDL2_NewFrame();
+    ImGui::NewFrame();
+}
+
+void RenderImGui()
+{
+    ImGui::Render();
+    const ImDrawData* draw_data = ImGui::GetDrawData();
+    for (i32 i = 0; i < draw_data->CmdListsCount; i++)
+    {
+        const ImDrawList* list = draw_data->CmdLists[i];
+        const u64 bytes = u64(list->VtxBuffer.Size) * sizeof(ImDrawVert) + u64(list->IdxBuffer.Size) * sizeof(ImDrawIdx);
+        Record(RenderCommand::UploadBuffer, u32(GpuBuffer::Type::Vertex), 0, bytes);
+        for (const ImDrawCmd& cmd : list->CmdBuffer)
+            Record(RenderCommand::Draw, cmd.ElemCount);
+    }
+}
+
+void ShutdownImGui()
+{
+    ImGui_ImplSDL2_Shutdown();
+}
+
+void ResizeBackbuffer(const Vec2I& size)
+{
+}
+
+//The pretend GPU finishes a frame one Present after the CPU did, or right
+//away when it is waited on
+static u64 s_fence_next = 1;
+static u64 s_fence_completed = 0;
+static u64 s_fence_presented = 0;
+
+u64 InsertFence()
+{
+    const u64 fence = s_fence_next++;
+    Record(RenderCommand::InsertFence, u32(fence));
+    return fence;
+}
+
+bool IsFenceComplete(u64 fence)
+{
+    return fence <= s_fence_completed;
+}
+
+void WaitForFence(u64 fence)
+{
+    assert(fence < s_fence_next);
+    if (fence <= s_fence_completed)
+        return;
+    Record(RenderCommand::WaitForFence, u32(fence));
+    s_fence_completed = fence;
+}
+
+void Present()
+{
+    s_fence_completed = Max(s_fence_completed, s_fence_presented);
+    s_fence_presented = s_fence_next - 1;
+    Record(RenderCommand::Present);
+    std::swap(s_last_record, s_frame_record);
+    //Keeps the capacity of the command list
+    s_frame_record.commands.clear();
+    for (u32 i = 0; i < +RenderCommand::Count; i++)
+    {
+        s_frame_record.counts[i] = 0;
+        s_frame_record.bytes[i] = 0;
+    }
+}
+
+
+
+
+//************
+//Commands
+//************
+
+void BackendBindShader(Shader::Index shader)
+{
+    assert(g_renderer.shaders[+shader]);
+    Record(RenderCommand::BindShader, shader);
+}
+
+void BindVertexBuffers(GpuBuffer* const* buffers, const u32* strides, const u32* offsets, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+        assert(buffers[i] && buffers[i]->m_type == GpuBuffer::Type::Vertex);
+    Record(RenderCommand::BindVertexBuffers, count);
+}
+
+void BackendBindRasterizer(RasterizerState state)
+{
+    Record(RenderCommand::BindRasterizer, +state);
+}
+
+void BackendBindViewport(const Vec2I& size)
+{
+    Record(RenderCommand::BindViewport, u32(size.x), u32(size.y));
+}
+
+void BackendBindSampler(u32 slot, Texture::Index texture)
+{
+    assert(g_renderer.textures[texture]);
+    Record(RenderCommand::BindSampler, slot, texture);
+}
+
+void BindTexture(u32 slot, Texture::Index texture)
+{
+    assert(texture == Texture::Index_Invalid || g_renderer.textures[texture]);
+    Record(RenderCommand::BindTexture, slot, texture);
+}
+
+void BindRenderTargets(const Texture::Index* targets, u32 count, Texture::Index depth)
+{
+    Record(RenderCommand::BindRenderTargets, count, depth);
+}
+
+void BackendBindDepthState(DepthState state)
+{
+    Record(RenderCommand::BindDepthState, +state);
+}
+
+void BackendBindBlendState(BlendState state)
+{
+    Record(RenderCommand::BindBlendState, +state);
+}
+
+void ClearRenderTarget(Texture::Index target, const Vec4& color)
+{
+    Record(RenderCommand::ClearRenderTarget, target);
+}
+
+void ClearDepth(Texture::Index depth, float value)
+{
+    Record(RenderCommand::ClearDepth, depth);
+}
+
+void CopyTexture(Texture::Index destination, Texture::Index source)
+{
+    Record(RenderCommand::CopyTexture, destination, source);
+}
+
+void Draw(u32 vertex_count)
+{
+    Record(RenderCommand::Draw, vertex_count);
+}
+
+void DrawInstanced(u32 vertex_count, u32 instance_count)
+{
+    Record(RenderCommand::DrawInstanced, vertex_count, instance_count);
+}
+
+void BindIndexBuffer(GpuBuffer* buffer)
+{
+    assert(buffer && buffer->m_type == GpuBuffer::Type::Index);
+    Record(RenderCommand::BindIndexBuffer);
+}
+
+void DrawIndexed(u32 index_count, u32 first_index)
+{
+    Record(RenderCommand::DrawIndexed, index_count, first_index);
+}
+
+#endif
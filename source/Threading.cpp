@@ -0,0 +1,126 @@
+#include "Threading.h"
+#include "Tracy.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Lives on the stack of the ParallelFor that dispatched it
+struct ParallelJob {
+    const std::function<void(u32 begin, u32 end)>* func = nullptr;
+    u32 count       = 0;
+    u32 batch_size  = 0;
+    u32 batch_count = 0;
+    std::atomic<u32> next_batch = 0;
+};
+
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::mutex               mutex;
+    std::condition_variable  wake;
+    std::condition_variable  done;
+    ParallelJob*             job        = nullptr;
+    u64                      generation = 0;    //Bumped for every job so a worker takes each one once
+    u32                      busy       = 0;    //Workers inside job
+    bool                     quit       = false;
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+};
+static WorkerPool s_pool;
+static std::once_flag s_pool_started;
+//One job at a time
+static std::mutex s_dispatch_mutex;
+static thread_local bool t_in_parallel_for = false;
+
+static void RunBatches(ParallelJob& job)
+{
+    for (u32 batch = job.next_batch++; batch < job.batch_count; batch = job.next_batch++)
+    {
+        const u32 begin = batch * job.batch_size;
+        (*job.func)(begin, Min(begin + job.batch_size, job.count));
+    }
+}
+
+static void WorkerMain()
+{
+    t_in_parallel_for = true;
+    u64 generation = 0;
+    std::unique_lock<std::mutex> lock(s_pool.mutex);
+    for (;;)
+    {
+        s_pool.wake.wait(lock, [&]() { return s_pool.quit || s_pool.generation != generation; });
+        if (s_pool.quit)
+            return;
+        generation = s_pool.generation;
+        //The job can be over already when this worker wakes up late
+        ParallelJob* job = s_pool.job;
+        if (!job)
+            continue;
+
+        s_pool.busy++;
+        lock.unlock();
+        RunBatches(*job);
+        lock.lock();
+        if (--s_pool.busy == 0)
+            s_pool.done.notify_one();
+    }
+}
+
+static void StartWorkers()
+{
+    const u32 thread_count = Max(std::thread::hardware_concurrency(), 1u) - 1;
+    s_pool.threads.reserve(thread_count);
+    for (u32 i = 0; i < thread_count; i++)
+        s_pool.threads.emplace_back(WorkerMain);
+}
+
+u32 GetWorkerThreadCount()
+{
+    return u32(s_pool.threads.size());
+}
+
+void ParallelFor(u32 count, u32 batch_size, const std::function<void(u32 begin, u32 end)>& func)
+{
+    if (count == 0)
+        return;
+    ParallelJob job;
+    job.func = &func;
+    job.count = count;
+    job.batch_size = Max(batch_size, 1u);
+    job.batch_count = (count + job.batch_size - 1) / job.batch_size;
+
+    if (t_in_parallel_for || job.batch_count == 1)
+    {
+        RunBatches(job);
+        return;
+    }
+
+    std::lock_guard<std::mutex> dispatch(s_dispatch_mutex);
+    std::call_once(s_pool_started, StartWorkers);
+    {
+        std::lock_guard<std::mutex> lock(s_pool.mutex);
+        s_pool.job = &job;
+        s_pool.generation++;
+    }
+    s_pool.wake.notify_all();
+
+    t_in_parallel_for = true;
+    RunBatches(job);
+    t_in_parallel_for = false;
+
+    //Every batch is taken, wait for the workers still running theirs
+    std::unique_lock<std::mutex> lock(s_pool.mutex);
+    s_pool.done.wait(lock, []() { return s_pool.busy == 0; });
+    s_pool.job = nullptr;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "Math.h"
+
+#include <functional>
+
+//Splits [0, count) into batches of batch_size and runs them on every hardware
+//thread, the calling thread included. Returns once all batches are done.
+//func(begin, end) must be safe to call from several threads at once.
+//The worker threads are started by the first call and kept until exit, a call
+//from inside func runs all of its batches on the calling thread.
+void ParallelFor(u32 count, u32 batch_size, const std::function<void(u32 begin, u32 end)>& func);
+//Threads of the pool, the thread calling ParallelFor not included
+u32 GetWorkerThreadCount();
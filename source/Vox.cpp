@@ -3,9 +3,15 @@
 #include "Math.h"
 #include "Debug.h"
 #include "WinInterop_File.h"
+#include "Threading.h"
+#include "Timers.h"
+#include "Tracy.hpp"
 
 #include "SDL.h"
 
+#include <bit>
+#include <cfloat>
+#include <cstring>
 #include <unordered_map>
 
 typedef std::unordered_map<std::string, std::string> Dict;
@@ -113,9 +119,9 @@ struct LAYR {
     i32     reserved_id; //must be -1
 };
 struct TransformInfo {
-    i8 rotation;
-    Vec3I translation;
-    i32 frame_index;
+    i8 rotation = 4;        //Identity, see DecodeVoxelRotation
+    Vec3I translation = {};
+    i32 frame_index = 0;
 };
 struct nTRN { //transform node chunk
     Dict    node_attributes;
@@ -211,12 +217,14 @@ const u32 FCCIMAP = SDL_FOURCC('I', 'M', 'A', 'P');
 const u32 FCCRGBA = SDL_FOURCC('R', 'G', 'B', 'A');
 
 struct VoxChunkAttributes {
+    u32  type = 0;      //FCCnTRN, FCCnGRP or FCCnSHP
     nTRN transforms;
     nGRP group_node_chunk;
     nSHP shape_node_chunk;
 };
 struct Vox {
     Vec3I size;
+    std::vector<Vec3I>                          model_sizes;    //Game axes
     std::vector<VoxelBlockData>                 color_indices;
     std::unordered_map<i32, VoxChunkAttributes> vox_chunks;
     std::unordered_map<i32, MaterialProperties> materials;
@@ -225,6 +233,77 @@ struct Vox {
 };
 
 
+//Walks the scene graph from node, every shape node adds an instance per model it references
+static void AddInstances(std::vector<VoxInstance>& out, const Vox& vox, i32 node_id, const VoxelRotation& rotation, const Vec3& translation, i32 depth)
+{
+    const auto it = vox.vox_chunks.find(node_id);
+    if (it == vox.vox_chunks.end())
+        return;
+    VALIDATE(depth < 64);
+    const VoxChunkAttributes& node = it->second;
+    switch (node.type)
+    {
+    case FCCnTRN:
+    {
+        //Only the first frame of an animation is used
+        const TransformInfo t = node.transforms.frame_transforms.size() ? node.transforms.frame_transforms[0] : TransformInfo();
+        const VoxelRotation local = DecodeVoxelRotation(u8(t.rotation));
+        const Vec3 local_translation = { float(t.translation.x), float(t.translation.z), float(t.translation.y) };
+        AddInstances(out, vox, node.transforms.child_node, CombineRotations(rotation, local), Rotate(rotation, local_translation) + translation, depth + 1);
+        break;
+    }
+    case FCCnGRP:
+    {
+        for (i32 child : node.group_node_chunk.child_nodes)
+            AddInstances(out, vox, child, rotation, translation, depth + 1);
+        break;
+    }
+    case FCCnSHP:
+    {
+        for (const auto& model : node.shape_node_chunk.model_attributes)
+        {
+            if (model.first < 0 || model.first >= i32(vox.model_sizes.size()))
+                continue;
+            const Vec3I& size = vox.model_sizes[model.first];
+            VoxInstance instance;
+            instance.model = u32(model.first);
+            instance.rotation = rotation;
+            instance.pivot = { float(size.x / 2), float(size.y / 2), float(size.z / 2) };
+            instance.position = translation;
+            out.push_back(instance);
+        }
+        break;
+    }
+    default: break;
+    }
+}
+
+static void BuildInstances(std::vector<VoxInstance>& out, const Vox& vox)
+{
+    out.clear();
+    AddInstances(out, vox, 0, {}, {}, 0);
+    if (out.empty())
+    {
+        //Files without a scene graph hold a single model at the origin
+        out.push_back({});
+        return;
+    }
+    //Move the scene so it starts at 0 like a single model does
+    Vec3 scene_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    for (const VoxInstance& instance : out)
+    {
+        const Vec3 size = ToVec3(vox.model_sizes[instance.model]);
+        for (i32 corner = 0; corner < 8; corner++)
+        {
+            const Vec3 local = { corner & 1 ? size.x : 0.0f, corner & 2 ? size.y : 0.0f, corner & 4 ? size.z : 0.0f };
+            const Vec3 world = Rotate(instance.rotation, local - instance.pivot) + instance.position;
+            scene_min = { Min(scene_min.x, world.x), Min(scene_min.y, world.y), Min(scene_min.z, world.z) };
+        }
+    }
+    for (VoxInstance& instance : out)
+        instance.position -= scene_min;
+}
+
 bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
 {
     static_assert(sizeof(VoxChunk)          == 4);
@@ -278,6 +357,8 @@ bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
             VALIDATE_V(vox.size.x <= VOXEL_MAX_SIZE, false);
             VALIDATE_V(vox.size.y <= VOXEL_MAX_SIZE, false);
             VALIDATE_V(vox.size.z <= VOXEL_MAX_SIZE, false);
+            //XYZI below swaps y and z the same way
+            vox.model_sizes.push_back({ vox.size.x, vox.size.z, vox.size.y });
             break;
         }
         case FCCXYZI:
@@ -321,6 +402,7 @@ bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
                 GetValueFromDict(t.frame_index, d, "_f");
                 n.frame_transforms[i] = t;
             }
+            vox.vox_chunks[node_id].type = FCCnTRN;
             vox.vox_chunks[node_id].transforms = n;
             break;
         }
@@ -336,6 +418,7 @@ bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
                 n.child_nodes.push_back(GetDataAndIncrement<i32>(v));
                 //dont need this?
             }
+            vox.vox_chunks[node_id].type = FCCnGRP;
             vox.vox_chunks[node_id].group_node_chunk = n;
 
             break;
@@ -354,6 +437,7 @@ bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
                 ReadDictData(d, v);
                 n.model_attributes[child_id] = d;
             }
+            vox.vox_chunks[node_id].type = FCCnSHP;
             vox.vox_chunks[node_id].shape_node_chunk = n;
             break;
         }
@@ -427,7 +511,7 @@ bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
             break;
         }
         case FCCIMAP:
-        case -1:
+        case u32(-1):
         default:
         {
             std::string headerString = header.FCCAsString();
@@ -437,7 +521,10 @@ bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
     }
 
     out.color_indices = vox.color_indices;
-    out.size          = vox.size;
+    out.model_sizes   = vox.model_sizes;
+    VALIDATE_V(out.model_sizes.size() == out.color_indices.size(), false);
+    out.size          = out.model_sizes[0];
+    BuildInstances(out.instances, vox);
     //NOTE: Annoying but for magicka voxel this has to be done this way
     //Magicka Voxel's indices are as such:
     //Indicies: 0-255 where 0 is invalid
@@ -452,13 +539,13 @@ bool LoadVoxFile_MyImplimentation(VoxData& out, const std::string& filePath)
         out.materials[i].flux       = vox.materials[i].flux;
         out.materials[i].emit       = vox.materials[i].emit;
         out.materials[i].ri         = vox.materials[i].ri;
-        out.materials[i].metal      = vox.materials[i].metal;
         out.materials[i].color      = vox.color_palette[i - 1];
     }
     //for (i32 i = 0; i < VOXEL_PALETTE_MAX; i++)
     //{
     //    out.color_palette[i] = vox.color_palette[i];
     //}
+    CompileMaterials(out);
 
     if (v.i == v.max)
         return true;
@@ -708,6 +795,109 @@ bool LoadVoxFile(VoxData& out_voxels, const std::string& filePath)
 #endif
 }
 
+VoxelRotation DecodeVoxelRotation(u8 r)
+{
+    VoxelRotation result;
+    const u8 row0 = r & 3;
+    const u8 row1 = (r >> 2) & 3;
+    VALIDATE_V(row0 < 3 && row1 < 3 && row0 != row1, result);
+    const u8 magica_axis[3] = { row0, row1, u8(3 - row0 - row1) };
+    //Swaps y and z, its own inverse
+    const u8 swap[3] = { 0, 2, 1 };
+    for (i32 i = 0; i < 3; i++)
+    {
+        result.axis[i] = swap[magica_axis[swap[i]]];
+        result.sign[i] = (r >> (4 + swap[i])) & 1 ? -1 : 1;
+    }
+    return result;
+}
+
+VoxelRotation CombineRotations(const VoxelRotation& a, const VoxelRotation& b)
+{
+    VoxelRotation result;
+    for (i32 i = 0; i < 3; i++)
+    {
+        result.axis[i] = b.axis[a.axis[i]];
+        result.sign[i] = a.sign[i] * b.sign[a.axis[i]];
+    }
+    return result;
+}
+
+AABB GetVoxInstanceBounds(const VoxData& voxels, const VoxInstance& instance)
+{
+    //Rotations only swap and negate axes so two opposite corners stay opposite
+    const Vec3 size = ToVec3(instance.model < voxels.model_sizes.size() ? voxels.model_sizes[instance.model] : voxels.size);
+    const Vec3 a = Rotate(instance.rotation, -instance.pivot) + instance.position;
+    const Vec3 b = Rotate(instance.rotation, size - instance.pivot) + instance.position;
+    AABB result;
+    result.min = { Min(a.x, b.x), Min(a.y, b.y), Min(a.z, b.z) };
+    result.max = { Max(a.x, b.x), Max(a.y, b.y), Max(a.z, b.z) };
+    return result;
+}
+
+u32 CullVoxInstances(std::vector<u32>& visible, const VoxData& voxels, const Frustum& frustum)
+{
+    ZoneScopedN("Cull Vox Instances");
+    thread_local std::vector<float> bounds[6];
+    const u32 count = u32(voxels.instances.size());
+    for (std::vector<float>& b : bounds)
+        b.resize(count);
+    for (u32 i = 0; i < count; i++)
+    {
+        const AABB box = GetVoxInstanceBounds(voxels, voxels.instances[i]);
+        for (i32 axis = 0; axis < 3; axis++)
+        {
+            bounds[axis][i]     = box.min.e[axis];
+            bounds[axis + 3][i] = box.max.e[axis];
+        }
+    }
+    const AABBSoA boxes = {
+        .min_x = bounds[0].data(),
+        .min_y = bounds[1].data(),
+        .min_z = bounds[2].data(),
+        .max_x = bounds[3].data(),
+        .max_y = bounds[4].data(),
+        .max_z = bounds[5].data(),
+        .count = count,
+    };
+    visible.resize(count);
+    visible.resize(CullBoxesToFrustum(visible.data(), frustum, boxes));
+    return count - u32(visible.size());
+}
+
+void CompileMaterials(VoxData& voxels)
+{
+    MaterialTable& table = voxels.material_table;
+    for (i32 i = 0; i < VOXEL_PALETTE_MAX; i++)
+    {
+        const VoxMaterial& material = voxels.materials[i];
+        ColorInt ci;
+        ci.rgba = material.color.rgba;
+        const Vec3 albedo = srgb_to_linear(ToColor(ci)).rgb;
+        const Vec3 emission = material.emit > 0.0f ? albedo * (material.emit * Max(material.flux, 1.0f)) : Vec3({});
+        table.albedo_r[i]   = albedo.r;
+        table.albedo_g[i]   = albedo.g;
+        table.albedo_b[i]   = albedo.b;
+        table.roughness[i]  = material.roughness;
+        table.emission_r[i] = emission.r;
+        table.emission_g[i] = emission.g;
+        table.emission_b[i] = emission.b;
+        table.flags[i] = u8((material.emit > 0.0f ? MATERIAL_FLAG_EMISSIVE : 0) |
+                            (material.metalness > 0.0f ? MATERIAL_FLAG_METAL : 0));
+    }
+}
+
+void PackShadingMaterials(ShadingMaterial* out, const MaterialTable& table)
+{
+    for (u32 i = 0; i < VOXEL_PALETTE_MAX; i++)
+    {
+        out[i].albedo    = GetMaterialAlbedo(table, i);
+        out[i].roughness = table.roughness[i];
+        out[i].emission  = GetMaterialEmission(table, i);
+        out[i].flags     = table.flags[i];
+    }
+}
+
 u16 VoxelPositionToIndex(Vec3 p)
 {
     const u16 result = (i16(p.z) * 16 * 16) + (i16(p.y) * 16) + (i16(p.x));
@@ -723,85 +913,6 @@ Vec3I IndexToVoxelPosition(u16 i)
     return result;
 }
 
-union VertexBlockCheck {
-    struct { Vec3I e0, e1, e2, e3, e4, e5, e6, e7; };
-};
-
-static const VertexBlockCheck vertex_blocks_to_check[+Face::Count] = {
-    {//right +X
-        Vec3I({  0,  1,  0 }),//Vertex 0
-              {  0,  0,  1 },
-
-              {  0,  0,  1 }, //Vertex 1
-              {  0, -1,  0 },
-              {  0,  1,  0 }, //Vertex 2
-              {  0,  0, -1 },
-
-              {  0,  0, -1 }, //Vertex 3
-              {  0, -1,  0 },
-    },
-    {//left -X
-        Vec3I({  0,  1,  0 }),//Vertex 0
-              {  0,  0, -1 },
-
-              {  0,  0, -1 }, //Vertex 1
-              {  0, -1,  0 },
-              {  0,  1,  0 }, //Vertex 2
-              {  0,  0,  1 },
-
-              {  0,  0,  1 }, //Vertex 3
-              {  0, -1,  0 },
-    },
-    {//Top +Y
-        Vec3I({  1,  0,  0 }),//Vertex 0
-              {  0,  0,  1 },
-
-              {  1,  0,  0 }, //Vertex 1
-              {  0,  0, -1 },
-              { -1,  0,  0 }, //Vertex 2
-              {  0,  0,  1 },
-
-              { -1,  0,  0 }, //Vertex 3
-              {  0,  0, -1 },
-    },
-    {//Bot -Y
-        Vec3I({ -1,  0,  0 }),//Vertex 0
-              {  0,  0,  1 },
-
-              { -1,  0,  0 }, //Vertex 1
-              {  0,  0, -1 },
-              {  1,  0,  0 }, //Vertex 2
-              {  0,  0,  1 },
-
-              {  1,  0,  0 }, //Vertex 3
-              {  0,  0, -1 },
-    },
-    {//Front +Z
-        Vec3I({ -1,  0,  0 }),//Vertex 0
-              {  0,  1,  0 },
-
-              { -1,  0,  0 }, //Vertex 1
-              {  0, -1,  0 },
-              {  1,  0,  0 }, //Vertex 2
-              {  0,  1,  0 },
-
-              {  1,  0,  0 }, //Vertex 3
-              {  0, -1,  0 },
-    },
-    {//Front -Z
-        Vec3I({  1,  0,  0 }),//Vertex 0
-              {  0,  1,  0 },
-
-              {  1,  0,  0 }, //Vertex 1
-              {  0, -1,  0 },
-              { -1,  0,  0 }, //Vertex 2
-              {  0,  1,  0 },
-
-              { -1,  0,  0 }, //Vertex 3
-              {  0, -1,  0 },
-    },
-};
-
 u8 GetVoxel(const VoxelBlockData& voxels, const Vec3I& p)
 {
     if (p.x >= 0 && p.x < VOXEL_MAX_SIZE &&
@@ -811,7 +922,7 @@ u8 GetVoxel(const VoxelBlockData& voxels, const Vec3I& p)
     return 0;
 }
 
-u32 CreateMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_data)
+u32 CreateMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao)
 {
     u32 r = 0;
     VALIDATE_V(voxel_data.color_indices.size() == 1, r);
@@ -838,7 +949,8 @@ u32 CreateMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_
                         //The Y and Z should be flipped because of magica voxel's coordinate system
                         const u8 face_normal_voxel = GetVoxel(voxel_color_is, checking_block_pos);
                         bool block_normal_is_clear = face_normal_voxel == 0;
-                        if (block_normal_is_clear)
+                        const i32 face_index = GetFaceIndex(faces, this_voxel_pos, Face(face_i));
+                        if (block_normal_is_clear && face_index >= 0)
                         {
                             for (i32 i = 0; i < 4; i++)
                             {
@@ -847,19 +959,7 @@ u32 CreateMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_
                                 v.rgba = voxel_data.materials[this_voxel_i].color;
                                 v.n = face_i;
 
-                                Vec3I ap = *(&vertex_blocks_to_check[face_i].e0 + ((i * 2) + 0));
-                                Vec3I bp = *(&vertex_blocks_to_check[face_i].e0 + ((i * 2) + 1));
-                                Vec3I cp = ap + bp;
-                                const u8 ai = GetVoxel(voxel_color_is, checking_block_pos + ap);
-                                const u8 bi = GetVoxel(voxel_color_is, checking_block_pos + bp);
-                                const u8 ci = GetVoxel(voxel_color_is, checking_block_pos + cp);
-                                v.ao = 0;
-                                if (ai)
-                                    v.ao++;
-                                if (bi)
-                                    v.ao++;
-                                if (ci)
-                                    v.ao++;
+                                v.ao = GetFaceAOCorner(face_ao[face_index], Face(face_i), vertex_cube_indexed[face_i].e[i]);
                                 vertices.push_back(v);
                             }
                             r += 6;
@@ -870,3 +970,987 @@ u32 CreateMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_
 
     return r;
 }
+
+bool SetVoxel(VoxData& voxels, const Vec3I& p, u8 color_index)
+{
+    VALIDATE_V(voxels.color_indices.size(), false);
+    if (p.x < 0 || p.x >= VOXEL_MAX_SIZE ||
+        p.y < 0 || p.y >= VOXEL_MAX_SIZE ||
+        p.z < 0 || p.z >= VOXEL_MAX_SIZE)
+        return false;
+    voxels.color_indices[0].e[p.x][p.y][p.z] = color_index;
+    if (color_index)
+    {
+        voxels.size.x = Max(voxels.size.x, p.x + 1);
+        voxels.size.y = Max(voxels.size.y, p.y + 1);
+        voxels.size.z = Max(voxels.size.z, p.z + 1);
+        //The instances of model 0 are traced and culled with its size, the pivot
+        //stays so the voxels already there do not move
+        if (voxels.model_sizes.size())
+        {
+            Vec3I& model_size = voxels.model_sizes[0];
+            model_size.x = Max(model_size.x, p.x + 1);
+            model_size.y = Max(model_size.y, p.y + 1);
+            model_size.z = Max(model_size.z, p.z + 1);
+        }
+    }
+    return true;
+}
+
+i32 BuildVoxelIndexMips(std::vector<std::vector<u8>>& mips, const VoxelBlockData& block)
+{
+    mips.clear();
+    const u8* base = &block.e[0][0][0];
+    mips.emplace_back(base, base + sizeof(block.e));
+    for (i32 mip_level = 1; VOXEL_MAX_SIZE >> mip_level > 0; mip_level++)
+    {
+        const i32 read_dim = VOXEL_MAX_SIZE >> (mip_level - 1);
+        const i32 write_dim = VOXEL_MAX_SIZE >> mip_level;
+        const u8* ref = mips[mip_level - 1].data();
+        std::vector<u8> data(write_dim * write_dim * write_dim);
+        for (i32 x = 0; x < write_dim; x++)
+        {
+            for (i32 y = 0; y < write_dim; y++)
+            {
+                for (i32 z = 0; z < write_dim; z++)
+                {
+                    const i32 x_base = x << 1;
+                    const i32 y_base = y << 1;
+                    const i32 z_base = z << 1;
+
+                    //Most common non zero child, the first one wins a tie
+                    u8 children[8];
+                    for (i32 i = 0; i < 8; i++)
+                        children[i] = ref[(read_dim * read_dim * (x_base + (i & 1))) + (read_dim * (y_base + ((i >> 1) & 1))) + (z_base + (i >> 2))];
+                    u8 r = 0;
+                    i32 best_count = 0;
+                    for (i32 i = 0; i < 8; i++)
+                    {
+                        if (!children[i])
+                            continue;
+                        i32 count = 0;
+                        for (i32 j = i; j < 8; j++)
+                            count += children[j] == children[i];
+                        if (count > best_count)
+                        {
+                            best_count = count;
+                            r = children[i];
+                        }
+                    }
+
+                    data[(z)+(y * write_dim) + (x * write_dim * write_dim)] = r;
+                }
+            }
+        }
+        mips.push_back(std::move(data));
+    }
+    return i32(mips.size());
+}
+
+//************
+//Neighbourhoods
+//************
+
+//Bit (dv + 1) * 3 + (du + 1) of a neighbourhood is the voxel in front of the face
+//offset by du along the first tangent axis and dv along the second one.
+static u32 GetNeighbourhoodBit(i32 du, i32 dv)
+{
+    return 1 << ((dv + 1) * 3 + (du + 1));
+}
+
+struct FaceAOTable {
+    u8 e[512];
+
+    FaceAOTable()
+    {
+        for (u32 mask = 0; mask < arrsize(e); mask++)
+        {
+            u8 result = 0;
+            for (i32 v = 0; v < 2; v++)
+                for (i32 u = 0; u < 2; u++)
+                {
+                    const i32 du = u ? 1 : -1;
+                    const i32 dv = v ? 1 : -1;
+                    u8 count = 0;
+                    if (mask & GetNeighbourhoodBit(du, 0))
+                        count++;
+                    if (mask & GetNeighbourhoodBit(0, dv))
+                        count++;
+                    if (mask & GetNeighbourhoodBit(du, dv))
+                        count++;
+                    result |= u8(count << (2 * (u + 2 * v)));
+                }
+            e[mask] = result;
+        }
+    }
+};
+static const FaceAOTable s_face_ao_table;
+
+static void GetFaceTangents(Face face, i32& axis_u, i32& axis_v)
+{
+    const i32 axis = +face / 2;
+    axis_u = (axis + 1) % 3;
+    axis_v = (axis + 2) % 3;
+}
+
+//Bit (dx + 1) * 9 + (dy + 1) * 3 + (dz + 1) of a voxel neighbourhood is the voxel at p + (dx, dy, dz),
+//the 27 bits split into 3 planes of constant dx with 9 bits each
+static u32 GetVoxelNeighbourBit(const Vec3I& d)
+{
+    return 1 << ((d.x + 1) * 9 + (d.y + 1) * 3 + (d.z + 1));
+}
+
+//The AO of every face from a voxel neighbourhood, one table per plane so every table
+//has 512 entries and a lookup is an OR of the 3 planes
+struct NeighbourhoodTable {
+    u16 fronts[3][512][+Face::Count];   //The voxels in front of the face that are in the plane, as a FaceAOTable index
+
+    NeighbourhoodTable()
+    {
+        for (i32 plane = 0; plane < 3; plane++)
+            for (u32 bits = 0; bits < 512; bits++)
+            {
+                const u32 mask = bits << (9 * plane);
+                for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+                {
+                    i32 axis_u;
+                    i32 axis_v;
+                    GetFaceTangents(Face(face_i), axis_u, axis_v);
+                    const Vec3I front = ToVec3I(faceNormals[face_i]);
+                    u16 result = 0;
+                    for (i32 dv = -1; dv <= 1; dv++)
+                        for (i32 du = -1; du <= 1; du++)
+                        {
+                            Vec3I d = front;
+                            d.e[axis_u] += du;
+                            d.e[axis_v] += dv;
+                            if (mask & GetVoxelNeighbourBit(d))
+                                result |= GetNeighbourhoodBit(du, dv);
+                        }
+                    fronts[plane][bits][face_i] = result;
+                }
+            }
+    }
+};
+static const NeighbourhoodTable s_neighbourhood_table;
+
+//Bit z of row x * VOXEL_MAX_SIZE + y is set when the voxel (x, y, z) is solid
+static u64 GetOccupancyRow(const VoxelBlockData& block, i32 x, i32 y)
+{
+    u64 result = 0;
+    for (i32 z = 0; z < VOXEL_MAX_SIZE; z++)
+        result |= u64(block.e[x][y][z] != 0) << z;
+    return result;
+}
+
+//Only the rows of the voxels in [min, max] are filled, the rest stay clear
+static void BuildOccupancyRows(std::vector<u64>& rows, const VoxelBlockData& block, const Vec3I& min, const Vec3I& max)
+{
+    rows.assign(VOXEL_MAX_SIZE * VOXEL_MAX_SIZE, 0);
+    for (i32 x = Max(min.x, 0); x <= Min(max.x, VOXEL_MAX_SIZE - 1); x++)
+        for (i32 y = Max(min.y, 0); y <= Min(max.y, VOXEL_MAX_SIZE - 1); y++)
+            rows[x * VOXEL_MAX_SIZE + y] = GetOccupancyRow(block, x, y);
+}
+
+//The 3 voxels of a row around p.z come out of one shift, 9 rows make up the neighbourhood
+static u32 GetNeighbourhoodMask(const std::vector<u64>& rows, const Vec3I& p)
+{
+    u32 result = 0;
+    for (i32 dx = -1; dx <= 1; dx++)
+        for (i32 dy = -1; dy <= 1; dy++)
+        {
+            const i32 x = p.x + dx;
+            const i32 y = p.y + dy;
+            if (x < 0 || x >= VOXEL_MAX_SIZE || y < 0 || y >= VOXEL_MAX_SIZE)
+                continue;
+            const u64 row = rows[x * VOXEL_MAX_SIZE + y];
+            const u32 bits = u32(p.z ? row >> (p.z - 1) : row << 1) & 0x7;
+            result |= bits << ((dx + 1) * 9 + (dy + 1) * 3);
+        }
+    return result;
+}
+
+//Same result as ComputeFaceAO
+static u8 GetNeighbourhoodFaceAO(u32 neighbourhood, Face face)
+{
+    const NeighbourhoodTable& t = s_neighbourhood_table;
+    const u32 front = t.fronts[0][neighbourhood & 0x1FF][+face] | t.fronts[1][(neighbourhood >> 9) & 0x1FF][+face] | t.fronts[2][neighbourhood >> 18][+face];
+    return s_face_ao_table.e[front];
+}
+
+//************
+//Voxel Faces
+//************
+
+static_assert(VOXEL_FACE_TABLE_SIZE == VOXEL_MAX_SIZE, "Voxel.hlsl indexes the face table with VOXEL_FACE_TABLE_SIZE");
+
+static u32 GetFaceTableIndex(const Vec3I& p)
+{
+    return (p.x * VOXEL_MAX_SIZE + p.y) * VOXEL_MAX_SIZE + p.z;
+}
+
+void BuildVoxelFaceTable(VoxelFaceTable& out, const VoxData& voxels)
+{
+    ZoneScopedN("Build Voxel Face Table");
+    out.voxels.clear();
+    out.faces.clear();
+    out.voxels.resize(VOXEL_MAX_SIZE * VOXEL_MAX_SIZE * VOXEL_MAX_SIZE, 0);
+    VALIDATE(voxels.color_indices.size());
+
+    std::vector<u64> rows;
+    BuildOccupancyRows(rows, voxels.color_indices[0], {}, { VOXEL_MAX_SIZE - 1, VOXEL_MAX_SIZE - 1, VOXEL_MAX_SIZE - 1 });
+    for (i32 x = 0; x < VOXEL_MAX_SIZE; x++)
+        for (i32 y = 0; y < VOXEL_MAX_SIZE; y++)
+        {
+            //Open faces of the whole row, a face is open when the row next to it is clear at the same z
+            const u64 row = rows[x * VOXEL_MAX_SIZE + y];
+            u64 open[+Face::Count];
+            open[+Face::Right] = row & ~(x + 1 < VOXEL_MAX_SIZE ? rows[(x + 1) * VOXEL_MAX_SIZE + y] : 0);
+            open[+Face::Left]  = row & ~(x > 0 ? rows[(x - 1) * VOXEL_MAX_SIZE + y] : 0);
+            open[+Face::Top]   = row & ~(y + 1 < VOXEL_MAX_SIZE ? rows[x * VOXEL_MAX_SIZE + y + 1] : 0);
+            open[+Face::Bot]   = row & ~(y > 0 ? rows[x * VOXEL_MAX_SIZE + y - 1] : 0);
+            open[+Face::Back]  = row & ~(row >> 1);
+            open[+Face::Front] = row & ~(row << 1);
+            u64 any = 0;
+            for (u64 faces : open)
+                any |= faces;
+            for (; any; any &= any - 1)
+            {
+                const i32 z = std::countr_zero(any);
+                u32 face_mask = 0;
+                for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+                    face_mask |= u32((open[face_i] >> z) & 1) << face_i;
+                out.voxels[GetFaceTableIndex({ x, y, z })] = (u32(out.faces.size()) << 6) | face_mask;
+                for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+                    if (face_mask & (1 << face_i))
+                        out.faces.push_back(x | y << 8 | z << 16 | face_i << 24);
+            }
+        }
+    DEBUG_LOG("Voxel faces: %u\n", u32(out.faces.size()));
+}
+
+i32 GetFaceIndex(const VoxelFaceTable& table, const Vec3I& p, Face face)
+{
+    if (p.x < 0 || p.x >= VOXEL_MAX_SIZE ||
+        p.y < 0 || p.y >= VOXEL_MAX_SIZE ||
+        p.z < 0 || p.z >= VOXEL_MAX_SIZE || table.voxels.empty())
+        return -1;
+    const u32 entry = table.voxels[GetFaceTableIndex(p)];
+    const u32 face_mask = entry & 0x3F;
+    const u32 face_bit = 1 << +face;
+    if (!(face_mask & face_bit))
+        return -1;
+    return i32((entry >> 6) + std::popcount(face_mask & (face_bit - 1)));
+}
+
+//************
+//Ambient Occlusion
+//************
+
+u8 ComputeFaceAO(const VoxelBlockData& block, const Vec3I& p, Face face)
+{
+    i32 axis_u;
+    i32 axis_v;
+    GetFaceTangents(face, axis_u, axis_v);
+    const Vec3I front = p + ToVec3I(faceNormals[+face]);
+    u32 mask = 0;
+    for (i32 dv = -1; dv <= 1; dv++)
+        for (i32 du = -1; du <= 1; du++)
+        {
+            Vec3I n = front;
+            n.e[axis_u] += du;
+            n.e[axis_v] += dv;
+            if (GetVoxel(block, n))
+                mask |= GetNeighbourhoodBit(du, dv);
+        }
+    return s_face_ao_table.e[mask];
+}
+
+u8 GetFaceAOCorner(u8 face_ao, Face face, const Vec3& corner)
+{
+    i32 axis_u;
+    i32 axis_v;
+    GetFaceTangents(face, axis_u, axis_v);
+    const i32 u = corner.e[axis_u] > 0.5f ? 1 : 0;
+    const i32 v = corner.e[axis_v] > 0.5f ? 1 : 0;
+    return (face_ao >> (2 * (u + 2 * v))) & 0x3;
+}
+
+static void ResizeFaceAO(std::vector<u8>& ao, const VoxelFaceTable& table)
+{
+    //Padded to whole u32s for the gpu buffer
+    ao.resize((table.faces.size() + 3) & ~size_t(3), 0);
+}
+
+void BakeFaceAO(std::vector<u8>& ao, const VoxelFaceTable& table, const VoxelBlockData& block)
+{
+    ZoneScopedN("Bake Face AO");
+    ResizeFaceAO(ao, table);
+    std::vector<u64> rows;
+    BuildOccupancyRows(rows, block, {}, { VOXEL_MAX_SIZE - 1, VOXEL_MAX_SIZE - 1, VOXEL_MAX_SIZE - 1 });
+    ParallelFor(u32(table.faces.size()), 1024, [&](u32 begin, u32 end)
+    {
+        //The faces of a voxel are next to each other, its neighbourhood is only built once
+        u32 voxel = UINT32_MAX;
+        u32 neighbourhood = 0;
+        for (u32 i = begin; i < end; i++)
+        {
+            const u32 packed = table.faces[i];
+            if ((packed & 0xFFFFFF) != voxel)
+            {
+                voxel = packed & 0xFFFFFF;
+                neighbourhood = GetNeighbourhoodMask(rows, { i32(packed & 0xFF), i32((packed >> 8) & 0xFF), i32((packed >> 16) & 0xFF) });
+            }
+            ao[i] = GetNeighbourhoodFaceAO(neighbourhood, Face(packed >> 24));
+        }
+    });
+}
+
+void UpdateFaceAO(std::vector<u8>& ao, const VoxelFaceTable& table, const VoxelBlockData& block, const Vec3I& min, const Vec3I& max)
+{
+    ResizeFaceAO(ao, table);
+    //A face reads the 3x3 voxels in front of it so only faces of voxels next to the edit change
+    std::vector<u64> rows;
+    BuildOccupancyRows(rows, block, { min.x - 2, min.y - 2, min.z - 2 }, { max.x + 2, max.y + 2, max.z + 2 });
+    for (i32 x = min.x - 1; x <= max.x + 1; x++)
+        for (i32 y = min.y - 1; y <= max.y + 1; y++)
+            for (i32 z = min.z - 1; z <= max.z + 1; z++)
+            {
+                const Vec3I p = { x, y, z };
+                u32 neighbourhood = UINT32_MAX;
+                for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+                {
+                    const i32 face_index = GetFaceIndex(table, p, Face(face_i));
+                    if (face_index < 0)
+                        continue;
+                    if (neighbourhood == UINT32_MAX)
+                        neighbourhood = GetNeighbourhoodMask(rows, p);
+                    ao[face_index] = GetNeighbourhoodFaceAO(neighbourhood, Face(face_i));
+                }
+            }
+}
+
+//************
+//Greedy Mesher
+//************
+
+//Bits [begin, begin + count) of a row
+static u64 GetSpanMask(i32 begin, i32 count)
+{
+    return (count == 64 ? ~0ull : ((1ull << count) - 1)) << begin;
+}
+
+//Faces that are brighter or darker on one side can't share a quad,
+//the interpolation would stretch the gradient over the whole quad
+static bool IsUniformAO(u8 ao)
+{
+    return ao == (ao & 0x3) * 0x55;
+}
+
+//One merged rectangle of faces in the slice d along the normal axis of face
+struct GreedyQuad {
+    u8  d;
+    u8  u;
+    u8  v;
+    u8  width;      //Along u
+    u8  height;     //Along v
+    u8  face;
+    u16 key;        //Color index | ao << 8
+};
+
+//Grows every quad of the slice d along u first and then along v while the rows below match.
+//rows[v] bit u is a face at (min_u + u, min_v + v), keys[v][u] its color index | ao << 8
+static void MergeSliceQuads(std::vector<GreedyQuad>& quads, u64* rows, const u16 (*keys)[VOXEL_MAX_SIZE], i32 size,
+                            i32 d, u32 face_i, i32 min_u, i32 min_v)
+{
+    for (i32 v = 0; v < size; v++)
+    {
+        while (rows[v])
+        {
+            const i32 u = std::countr_zero(rows[v]);
+            const u16 key = keys[v][u];
+            i32 width = 1;
+            i32 height = 1;
+            if (IsUniformAO(u8(key >> 8)))
+            {
+                while (u + width < size && ((rows[v] >> (u + width)) & 1) && keys[v][u + width] == key)
+                    width++;
+                const u64 span = GetSpanMask(u, width);
+                while (v + height < size && (rows[v + height] & span) == span)
+                {
+                    bool match = true;
+                    for (i32 i = 0; i < width && match; i++)
+                        match = keys[v + height][u + i] == key;
+                    if (!match)
+                        break;
+                    rows[v + height] &= ~span;
+                    height++;
+                }
+            }
+            rows[v] &= ~GetSpanMask(u, width);
+
+            GreedyQuad quad;
+            quad.d      = u8(d);
+            quad.u      = u8(min_u + u);
+            quad.v      = u8(min_v + v);
+            quad.width  = u8(width);
+            quad.height = u8(height);
+            quad.face   = u8(face_i);
+            quad.key    = key;
+            quads.push_back(quad);
+        }
+    }
+}
+
+//Meshes the faces of the voxels in the box [min, min + size), quads don't cross the box.
+//The voxels around the box are read too, so the faces between two solid voxels on either
+//side of its border are left out. Without a face table there is no AO.
+static void BuildGreedyQuads(std::vector<GreedyQuad>& quads, const VoxelBlockData& block, const VoxelFaceTable* faces, const std::vector<u8>* face_ao,
+                             const Vec3I& min, i32 size)
+{
+    static_assert(VOXEL_MAX_SIZE == 64, "A row of voxels has to fit a u64");
+    assert(size > 0 && size <= VOXEL_MAX_SIZE);
+
+    //Occupancy of the columns along every axis that start in the box, bit n is the voxel at n.
+    //The voxels one past the box on the column are read too so the faces on its border are right.
+    thread_local std::vector<u64> columns;
+    columns.assign(3 * size * size, 0);
+    Vec3I lo;
+    Vec3I hi;
+    for (i32 i = 0; i < 3; i++)
+    {
+        lo.e[i] = Max(min.e[i] - 1, 0);
+        hi.e[i] = Min(min.e[i] + size + 1, VOXEL_MAX_SIZE);
+    }
+    for (i32 x = lo.x; x < hi.x; x++)
+        for (i32 y = lo.y; y < hi.y; y++)
+            for (i32 z = lo.z; z < hi.z; z++)
+            {
+                if (!block.e[x][y][z])
+                    continue;
+                const Vec3I p = { x, y, z };
+                for (i32 axis = 0; axis < 3; axis++)
+                {
+                    //Same u and v as GetFaceTangents
+                    const u32 u = u32(p.e[(axis + 1) % 3] - min.e[(axis + 1) % 3]);
+                    const u32 v = u32(p.e[(axis + 2) % 3] - min.e[(axis + 2) % 3]);
+                    if (u < u32(size) && v < u32(size))
+                        columns[(axis * size + v) * size + u] |= 1ull << p.e[axis];
+                }
+            }
+
+    u64 slices[VOXEL_MAX_SIZE][VOXEL_MAX_SIZE];     //[d - min][v - min], bit u - min: the face at d along the normal axis
+    u16 keys[VOXEL_MAX_SIZE][VOXEL_MAX_SIZE];       //[v - min][u - min] of one slice
+    for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+    {
+        const Face face = Face(face_i);
+        const i32 axis = face_i / 2;
+        const bool positive = (face_i & 1) == 0;
+        i32 axis_u;
+        i32 axis_v;
+        GetFaceTangents(face, axis_u, axis_v);
+        const i32 min_d = min.e[axis];
+        const i32 min_u = min.e[axis_u];
+        const i32 min_v = min.e[axis_v];
+
+        //A face is visible when the next voxel along the normal is clear,
+        //the voxels past the ends of the column shift in as clear
+        for (i32 d = 0; d < size; d++)
+            memset(slices[d], 0, size * sizeof(slices[d][0]));
+        const u64 box = GetSpanMask(min_d, size);
+        u64 layers = 0;
+        for (i32 v = 0; v < size; v++)
+            for (i32 u = 0; u < size; u++)
+            {
+                const u64 column = columns[(axis * size + v) * size + u];
+                u64 visible = (positive ? column & ~(column >> 1) : column & ~(column << 1)) & box;
+                layers |= visible;
+                for (; visible; visible &= visible - 1)
+                    slices[std::countr_zero(visible) - min_d][v] |= 1ull << u;
+            }
+
+        while (layers)
+        {
+            const i32 d = std::countr_zero(layers);
+            layers &= layers - 1;
+
+            u64* rows = slices[d - min_d];
+            for (i32 v = 0; v < size; v++)
+            {
+                for (u64 bits = rows[v]; bits; bits &= bits - 1)
+                {
+                    const i32 u = std::countr_zero(bits);
+                    Vec3I p;
+                    p.e[axis] = d;
+                    p.e[axis_u] = min_u + u;
+                    p.e[axis_v] = min_v + v;
+                    u8 ao = 0;
+                    if (faces)
+                    {
+                        const i32 face_index = GetFaceIndex(*faces, p, face);
+                        if (face_index < 0)
+                        {
+                            rows[v] &= ~(1ull << u);
+                            continue;
+                        }
+                        ao = (*face_ao)[face_index];
+                    }
+                    keys[v][u] = u16(block.e[p.x][p.y][p.z] | ao << 8);
+                }
+            }
+
+            MergeSliceQuads(quads, rows, keys, size, d, face_i, min_u, min_v);
+        }
+    }
+}
+
+//The faces BuildGreedyQuads leaves out on the sides of the box: the voxels on its border
+//that have a solid voxel on the other side. Together they close the box on every side.
+static void BuildSkirtQuads(std::vector<GreedyQuad>& quads, const VoxelBlockData& block, const Vec3I& min, i32 size)
+{
+    u64 rows[VOXEL_MAX_SIZE];
+    u16 keys[VOXEL_MAX_SIZE][VOXEL_MAX_SIZE];
+    for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+    {
+        const i32 axis = face_i / 2;
+        const bool positive = (face_i & 1) == 0;
+        const i32 d = positive ? min.e[axis] + size - 1 : min.e[axis];
+        const i32 outside = positive ? d + 1 : d - 1;
+        //Past the block everything is clear and BuildGreedyQuads kept the faces
+        if (outside < 0 || outside >= VOXEL_MAX_SIZE)
+            continue;
+        i32 axis_u;
+        i32 axis_v;
+        GetFaceTangents(Face(face_i), axis_u, axis_v);
+        for (i32 v = 0; v < size; v++)
+        {
+            rows[v] = 0;
+            for (i32 u = 0; u < size; u++)
+            {
+                Vec3I p;
+                p.e[axis]   = d;
+                p.e[axis_u] = min.e[axis_u] + u;
+                p.e[axis_v] = min.e[axis_v] + v;
+                Vec3I q = p;
+                q.e[axis]   = outside;
+                if (!block.e[p.x][p.y][p.z] || !block.e[q.x][q.y][q.z])
+                    continue;
+                rows[v] |= 1ull << u;
+                keys[v][u] = block.e[p.x][p.y][p.z];
+            }
+        }
+        MergeSliceQuads(quads, rows, keys, size, d, face_i, min.e[axis_u], min.e[axis_v]);
+    }
+}
+
+//Lattice position of vertex i of the quad, in the winding of vertex_cube_indexed
+static Vec3I GetGreedyQuadCorner(const GreedyQuad& quad, i32 i)
+{
+    const i32 axis = quad.face / 2;
+    i32 axis_u;
+    i32 axis_v;
+    GetFaceTangents(Face(quad.face), axis_u, axis_v);
+    const Vec3I corner = ToVec3I(vertex_cube_indexed[quad.face].e[i]);
+    Vec3I p;
+    p.e[axis]   = quad.d + corner.e[axis];
+    p.e[axis_u] = quad.u + corner.e[axis_u] * quad.width;
+    p.e[axis_v] = quad.v + corner.e[axis_v] * quad.height;
+    return p;
+}
+
+//Appends the quads of the box [min, min + size) as indexed packed vertices, positions are scaled
+//by 1 << shift. The quads come out one slice at a time so the last vertex written at every
+//lattice point of the current slice is all that needs to be checked for reuse.
+static void AppendPackedQuads(std::vector<Vertex_VoxelPacked>& vertices, std::vector<u32>& indices, const std::vector<GreedyQuad>& quads,
+                              const Vec3I& min, i32 size, i32 shift)
+{
+    const i32 lattice_size = size + 1;
+    thread_local std::vector<u32> lattice;
+    lattice.assign(lattice_size * lattice_size, UINT32_MAX);
+    u32 slice = UINT32_MAX;
+    vertices.reserve(vertices.size() + 2 * quads.size());
+    indices.reserve(indices.size() + 6 * quads.size());
+    for (const GreedyQuad& quad : quads)
+    {
+        if (slice != (u32(quad.face) << 8 | quad.d))
+        {
+            slice = u32(quad.face) << 8 | quad.d;
+            std::fill(lattice.begin(), lattice.end(), UINT32_MAX);
+        }
+        i32 axis_u;
+        i32 axis_v;
+        GetFaceTangents(Face(quad.face), axis_u, axis_v);
+        u32 quad_indices[4];
+        for (i32 i = 0; i < 4; i++)
+        {
+            const Vec3I p = GetGreedyQuadCorner(quad, i);
+            const u8 ao = GetFaceAOCorner(u8(quad.key >> 8), Face(quad.face), vertex_cube_indexed[quad.face].e[i]);
+            const Vec3I position = { p.x << shift, p.y << shift, p.z << shift };
+            const Vertex_VoxelPacked vertex = PackVoxelVertex(position, Face(quad.face), ao, u8(quad.key & 0xFF));
+            u32& last = lattice[(p.e[axis_v] - min.e[axis_v]) * lattice_size + (p.e[axis_u] - min.e[axis_u])];
+            if (last == UINT32_MAX || vertices[last].attributes != vertex.attributes)
+            {
+                last = u32(vertices.size());
+                vertices.push_back(vertex);
+            }
+            quad_indices[i] = last;
+        }
+        //Same triangles as the quad index buffer
+        indices.push_back(quad_indices[0]);
+        indices.push_back(quad_indices[1]);
+        indices.push_back(quad_indices[2]);
+        indices.push_back(quad_indices[1]);
+        indices.push_back(quad_indices[3]);
+        indices.push_back(quad_indices[2]);
+    }
+}
+
+u32 CreateGreedyMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao)
+{
+    ZoneScopedN("Greedy Mesh");
+    u32 r = 0;
+    VALIDATE_V(voxel_data.color_indices.size() == 1, r);
+
+    std::vector<GreedyQuad> quads;
+    BuildGreedyQuads(quads, voxel_data.color_indices[0], &faces, &face_ao, {}, VOXEL_MAX_SIZE);
+    vertices.reserve(vertices.size() + 4 * quads.size());
+    for (const GreedyQuad& quad : quads)
+    {
+        for (i32 i = 0; i < 4; i++)
+        {
+            Vertex_Voxel vertex;
+            vertex.p = ToVec3(GetGreedyQuadCorner(quad, i));
+            vertex.rgba = voxel_data.materials[quad.key & 0xFF].color;
+            vertex.n = quad.face;
+            vertex.ao = GetFaceAOCorner(u8(quad.key >> 8), Face(quad.face), vertex_cube_indexed[quad.face].e[i]);
+            vertices.push_back(vertex);
+        }
+        r += 6;
+    }
+    return r;
+}
+
+void CreatePackedMeshFromVox(std::vector<Vertex_VoxelPacked>& vertices, std::vector<u32>& indices, const VoxData& voxel_data,
+                             const VoxelFaceTable& faces, const std::vector<u8>& face_ao)
+{
+    ZoneScopedN("Packed Mesh");
+    VALIDATE(voxel_data.color_indices.size() == 1);
+
+    std::vector<GreedyQuad> quads;
+    BuildGreedyQuads(quads, voxel_data.color_indices[0], &faces, &face_ao, {}, VOXEL_MAX_SIZE);
+    AppendPackedQuads(vertices, indices, quads, {}, VOXEL_MAX_SIZE, 0);
+    DEBUG_LOG("Packed voxel mesh: %u quads, %u vertices, %u indices, %.1f bytes per face\n",
+              u32(quads.size()), u32(vertices.size()), u32(indices.size()),
+              faces.faces.size() ? float(vertices.size() * sizeof(Vertex_VoxelPacked) + indices.size() * sizeof(u32)) / float(faces.faces.size()) : 0.0f);
+}
+
+const char* voxelMesherNames[+VoxelMesher::Count] = {
+    "Naive",
+    "Greedy",
+    "Packed",
+};
+
+void CompareVoxelMeshers(VoxelMesherStats* out, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao)
+{
+    ZoneScopedN("Compare Meshers");
+    std::vector<Vertex_Voxel> vertices;
+    std::vector<Vertex_VoxelPacked> packed_vertices;
+    std::vector<u32> packed_indices;
+    for (i32 i = 0; i < +VoxelMesher::Count; i++)
+    {
+        vertices.clear();
+        const float start = GetTimer();
+        u32 indices = 0;
+        switch (VoxelMesher(i))
+        {
+        case VoxelMesher::Naive:    indices = CreateMeshFromVox(vertices, voxel_data, faces, face_ao);          break;
+        case VoxelMesher::Greedy:   indices = CreateGreedyMeshFromVox(vertices, voxel_data, faces, face_ao);    break;
+        case VoxelMesher::Packed:   CreatePackedMeshFromVox(packed_vertices, packed_indices, voxel_data, faces, face_ao); break;
+        default: FAIL;
+        }
+        out[i].milliseconds = GetTimer() - start;
+        if (VoxelMesher(i) == VoxelMesher::Packed)
+        {
+            out[i].vertices = u32(packed_vertices.size());
+            out[i].indices  = u32(packed_indices.size());
+            out[i].bytes    = u64(packed_vertices.size()) * sizeof(Vertex_VoxelPacked) + u64(packed_indices.size()) * sizeof(u32);
+            continue;
+        }
+        out[i].vertices     = u32(vertices.size());
+        out[i].indices      = indices;
+        //Drawn with the shared quad index buffer
+        out[i].bytes        = u64(vertices.size()) * sizeof(Vertex_Voxel) + u64(indices) * sizeof(u32);
+    }
+}
+
+//************
+//Chunked Mesh
+//************
+
+void ResetVoxelMesh(VoxelChunkedMesh& mesh)
+{
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    for (VoxelMeshChunk& chunk : mesh.chunks)
+    {
+        chunk.vertices = {};
+        chunk.indices = {};
+        chunk.dirty = true;
+    }
+}
+
+void InvalidateVoxelMesh(VoxelChunkedMesh& mesh, const Vec3I& min, const Vec3I& max)
+{
+    //The chunks next to the cell that changed read it for the faces on their border
+    const i32 cell = 1 << mesh.lod;
+    Vec3I lo;
+    Vec3I hi;
+    for (i32 i = 0; i < 3; i++)
+    {
+        lo.e[i] = Clamp((min.e[i] & ~(cell - 1)) - 1, 0, VOXEL_MAX_SIZE - 1) / VOXEL_CHUNK_SIZE;
+        hi.e[i] = Clamp((max.e[i] | (cell - 1)) + 1, 0, VOXEL_MAX_SIZE - 1) / VOXEL_CHUNK_SIZE;
+    }
+    for (i32 x = lo.x; x <= hi.x; x++)
+        for (i32 y = lo.y; y <= hi.y; y++)
+            for (i32 z = lo.z; z <= hi.z; z++)
+                mesh.chunks[(x * VOXEL_CHUNKS_PER_AXIS + y) * VOXEL_CHUNKS_PER_AXIS + z].dirty = true;
+}
+
+//Room to grow so small edits fit in place, a multiple of 6 so index ranges hold whole quads
+static u32 GetRangeCapacity(u32 count)
+{
+    return (count + count / 2 + 5) / 6 * 6;
+}
+
+//Copies the chunks that are not dirty into new buffers without the holes moved chunks left behind
+static void CompactVoxelMesh(VoxelChunkedMesh& mesh)
+{
+    std::vector<Vertex_VoxelPacked> vertices;
+    std::vector<u32> indices;
+    for (VoxelMeshChunk& chunk : mesh.chunks)
+    {
+        if (chunk.dirty)
+        {
+            chunk.vertices = {};
+            chunk.indices = {};
+            continue;
+        }
+        const u32 first_vertex = u32(vertices.size());
+        vertices.insert(vertices.end(), mesh.vertices.begin() + chunk.vertices.first, mesh.vertices.begin() + chunk.vertices.first + chunk.vertices.capacity);
+        for (u32 i = 0; i < chunk.indices.capacity; i++)
+        {
+            const u32 index = mesh.indices[chunk.indices.first + i];
+            indices.push_back(i < chunk.indices.count ? index - chunk.vertices.first + first_vertex : 0);
+        }
+        chunk.vertices.first = first_vertex;
+        chunk.indices.first = u32(indices.size()) - chunk.indices.capacity;
+    }
+    mesh.vertices.swap(vertices);
+    mesh.indices.swap(indices);
+}
+
+//block is the mip level mesh.lod of the voxels, faces and face_ao are only given for level 0
+static u32 RemeshDirtyChunks(VoxelChunkedMesh& mesh, const VoxelBlockData& block, const VoxelFaceTable* faces, const std::vector<u8>* face_ao)
+{
+    const float start = GetTimer();
+    u32* dirty = mesh.remeshed;
+    u32 dirty_count = 0;
+    for (u32 i = 0; i < VOXEL_CHUNK_COUNT; i++)
+        if (mesh.chunks[i].dirty)
+            dirty[dirty_count++] = i;
+    mesh.chunks_meshed = dirty_count;
+    mesh.relocated = false;
+    if (!dirty_count)
+    {
+        mesh.milliseconds = 0.0f;
+        return 0;
+    }
+
+    //Every thread meshes into its own scratch quads and the chunk's staging buffers
+    const i32 size = VOXEL_CHUNK_SIZE >> mesh.lod;
+    ParallelFor(dirty_count, 1, [&](u32 begin, u32 end)
+    {
+        thread_local std::vector<GreedyQuad> quads;
+        for (u32 i = begin; i < end; i++)
+        {
+            VoxelMeshChunk& chunk = mesh.chunks[dirty[i]];
+            const Vec3I voxel_origin = GetVoxelChunkOrigin(dirty[i]);
+            const Vec3I origin = { voxel_origin.x >> mesh.lod, voxel_origin.y >> mesh.lod, voxel_origin.z >> mesh.lod };
+            quads.clear();
+            chunk.staged_vertices.clear();
+            chunk.staged_indices.clear();
+            BuildGreedyQuads(quads, block, faces, face_ao, origin, size);
+            const size_t open_quads = quads.size();
+            //Level 0 is never coarser than its neighbours
+            if (mesh.lod)
+                BuildSkirtQuads(quads, block, origin, size);
+            AppendPackedQuads(chunk.staged_vertices, chunk.staged_indices, quads, origin, size, mesh.lod);
+            //Both builders go through the faces in order
+            memset(chunk.face_offsets, 0, sizeof(chunk.face_offsets));
+            memset(chunk.skirt_offsets, 0, sizeof(chunk.skirt_offsets));
+            for (size_t quad_i = 0; quad_i < quads.size(); quad_i++)
+            {
+                u32* offsets = quad_i < open_quads ? chunk.face_offsets : chunk.skirt_offsets;
+                offsets[quads[quad_i].face + 1] += 6;
+            }
+            for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+                chunk.face_offsets[face_i + 1] += chunk.face_offsets[face_i];
+            chunk.skirt_offsets[0] = chunk.face_offsets[+Face::Count];
+            for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+                chunk.skirt_offsets[face_i + 1] += chunk.skirt_offsets[face_i];
+        }
+    });
+    //Moved chunks leave holes behind, once they are half of the buffers copy the rest together
+    u32 used_vertices = 0;
+    for (const VoxelMeshChunk& chunk : mesh.chunks)
+        if (!chunk.dirty)
+            used_vertices += chunk.vertices.capacity;
+    if (mesh.vertices.size() > 2 * size_t(used_vertices) + 4096)
+    {
+        CompactVoxelMesh(mesh);
+        mesh.relocated = true;
+    }
+
+    for (u32 i = 0; i < dirty_count; i++)
+    {
+        VoxelMeshChunk& chunk = mesh.chunks[dirty[i]];
+        const u32 vertex_count = u32(chunk.staged_vertices.size());
+        const u32 index_count = u32(chunk.staged_indices.size());
+        if (vertex_count > chunk.vertices.capacity || index_count > chunk.indices.capacity)
+        {
+            //Degenerate triangles in the old range until it is compacted away
+            std::fill(mesh.indices.begin() + chunk.indices.first, mesh.indices.begin() + chunk.indices.first + chunk.indices.capacity, 0);
+            chunk.vertices.first    = u32(mesh.vertices.size());
+            chunk.vertices.capacity = GetRangeCapacity(vertex_count);
+            chunk.indices.first     = u32(mesh.indices.size());
+            chunk.indices.capacity  = GetRangeCapacity(index_count);
+            mesh.vertices.resize(mesh.vertices.size() + chunk.vertices.capacity);
+            mesh.indices.resize(mesh.indices.size() + chunk.indices.capacity);
+            mesh.relocated = true;
+        }
+        std::copy(chunk.staged_vertices.begin(), chunk.staged_vertices.end(), mesh.vertices.begin() + chunk.vertices.first);
+        for (u32 j = 0; j < index_count; j++)
+            mesh.indices[chunk.indices.first + j] = chunk.staged_indices[j] + chunk.vertices.first;
+        std::fill(mesh.indices.begin() + chunk.indices.first + index_count, mesh.indices.begin() + chunk.indices.first + chunk.indices.capacity, 0);
+        chunk.vertices.count = vertex_count;
+        chunk.indices.count = index_count;
+        chunk.dirty = false;
+    }
+
+    mesh.milliseconds = GetTimer() - start;
+    return dirty_count;
+}
+
+u32 UpdateVoxelMesh(VoxelChunkedMesh& mesh, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao)
+{
+    ZoneScopedN("Update Voxel Mesh");
+    VALIDATE_V(voxel_data.color_indices.size() == 1, 0);
+    VALIDATE_V(mesh.lod == 0, 0);
+    return RemeshDirtyChunks(mesh, voxel_data.color_indices[0], &faces, &face_ao);
+}
+
+//************
+//Mesh LODs
+//************
+
+void ResetVoxelMesh(VoxelMeshLods& lods)
+{
+    for (i32 lod = 0; lod < VOXEL_MESH_LOD_COUNT; lod++)
+    {
+        lods.levels[lod].lod = lod;
+        ResetVoxelMesh(lods.levels[lod]);
+    }
+    memset(lods.chunk_lods, 0, sizeof(lods.chunk_lods));
+}
+
+void InvalidateVoxelMesh(VoxelMeshLods& lods, const Vec3I& min, const Vec3I& max)
+{
+    for (VoxelChunkedMesh& level : lods.levels)
+        InvalidateVoxelMesh(level, min, max);
+}
+
+u32 UpdateVoxelMesh(VoxelMeshLods& lods, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao,
+                    const std::vector<std::vector<u8>>& mips)
+{
+    ZoneScopedN("Update Voxel Mesh LODs");
+    u32 r = UpdateVoxelMesh(lods.levels[0], voxel_data, faces, face_ao);
+    VALIDATE_V(mips.size() >= VOXEL_MESH_LOD_COUNT, r);
+
+    //The mesher reads a full block, the coarse level goes in its low corner
+    std::vector<VoxelBlockData> coarse;
+    for (i32 lod = 1; lod < VOXEL_MESH_LOD_COUNT; lod++)
+    {
+        VoxelChunkedMesh& level = lods.levels[lod];
+        bool dirty = false;
+        for (const VoxelMeshChunk& chunk : level.chunks)
+            dirty |= chunk.dirty;
+        if (!dirty)
+        {
+            level.chunks_meshed = 0;
+            level.relocated = false;
+            continue;
+        }
+        if (coarse.empty())
+            coarse.resize(1);
+        else
+            memset(coarse[0].e, 0, sizeof(coarse[0].e));
+        const i32 dim = VOXEL_MAX_SIZE >> lod;
+        const std::vector<u8>& mip = mips[lod];
+        for (i32 x = 0; x < dim; x++)
+            for (i32 y = 0; y < dim; y++)
+                memcpy(coarse[0].e[x][y], &mip[(x * dim + y) * dim], dim);
+        r += RemeshDirtyChunks(level, coarse[0], nullptr, nullptr);
+    }
+    return r;
+}
+
+u32 SelectVoxelMeshLods(VoxelMeshLods& lods, const Vec3& camera_position, float cone_spread)
+{
+    u32 r = 0;
+    lods.culled_indices = 0;
+    lods.full_indices = 0;
+    for (u32 i = 0; i < VOXEL_CHUNK_COUNT; i++)
+    {
+        //Closest point of the chunk
+        const Vec3I origin = GetVoxelChunkOrigin(i);
+        Vec3 closest;
+        for (i32 axis = 0; axis < 3; axis++)
+            closest.e[axis] = Clamp(camera_position.e[axis], float(origin.e[axis]), float(origin.e[axis] + VOXEL_CHUNK_SIZE));
+        const float pixel_size = Distance(camera_position, closest) * cone_spread;
+
+        //Coarsest level whose cells are still no bigger than a pixel
+        i32 lod = 0;
+        while (lod + 1 < VOXEL_MESH_LOD_COUNT && float(2 << lod) <= pixel_size)
+            lod++;
+        lods.chunk_lods[i] = u8(lod);
+    }
+    for (u32 i = 0; i < VOXEL_CHUNK_COUNT; i++)
+    {
+        const u8 lod = lods.chunk_lods[i];
+        u8 skirts = 0;
+        for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+        {
+            const i32 neighbour = GetVoxelChunkNeighbour(i, Face(face_i));
+            if (neighbour >= 0 && lods.chunk_lods[neighbour] < lod)
+                skirts |= 1 << face_i;
+        }
+        lods.chunk_skirts[i] = skirts;
+
+        const VoxelMeshChunk& chunk = lods.levels[lod].chunks[i];
+        const u8 face_mask = GetVoxelChunkFaceMask(i, camera_position);
+        lods.chunk_faces[i] = face_mask;
+        for (u32 face_i = 0; face_i < +Face::Count; face_i++)
+        {
+            u32 count = chunk.face_offsets[face_i + 1] - chunk.face_offsets[face_i];
+            if (skirts & (1 << face_i))
+                count += chunk.skirt_offsets[face_i + 1] - chunk.skirt_offsets[face_i];
+            if (face_mask & (1 << face_i))
+                r += count;
+            else
+                lods.culled_indices += count;
+        }
+        lods.full_indices += lods.levels[0].chunks[i].indices.count;
+    }
+    lods.selected_indices = r;
+    return r;
+}
@@ -41,27 +41,301 @@ struct Vertex_Voxel {
     //u8 _unused_1;
     //u8 _unused_2;
 };
-//struct VoxMaterial {
-//    float metalness;
-//    float roughness;    //Surface Roughness:        Range from 0 to 100
-//    float spec;         //Specular reflectivity:    Range from 0 to 100
-//    //float ior;      // ????
-//    //float att;      // ????
-//    float flux;     //Radiant flux:             Range from 1 to 5
-//    float emit;
-//    float ri;       //Refractive index:         Range from 1.00 to 3.00
-//    //float d;        // ????
-//    float metal;    //metalness
-//    //std::string plastic; //is this in use?
-//    U32Pack color;
-//};
+//8 byte version for the indexed raster mesh, decoded in Voxel_Rast.hlsl.
+//position: x, y and z of the lattice point, 10 bits each starting at bit 0
+//attributes: bits 0-2 normal (Face), 3-4 AO, 8-15 palette index
+struct Vertex_VoxelPacked {
+    u32 position;
+    u32 attributes;
+};
+//Material as it is stored in the .vox file, only read when the MaterialTable is compiled
+//and by the mesher for the vertex colors
+struct VoxMaterial {
+    float metalness;
+    float roughness;    //Surface Roughness:        Range from 0 to 100
+    float spec;         //Specular reflectivity:    Range from 0 to 100
+    float flux;         //Radiant flux:             Range from 1 to 5
+    float emit;
+    float ri;           //Refractive index:         Range from 1.00 to 3.00
+    U32Pack color;
+};
+//Per palette entry values the tracers read at every hit, colors are already linear
+//and the emission is premultiplied so shading doesn't touch VoxMaterial
+struct MaterialTable {
+    float albedo_r[VOXEL_PALETTE_MAX]   = {};
+    float albedo_g[VOXEL_PALETTE_MAX]   = {};
+    float albedo_b[VOXEL_PALETTE_MAX]   = {};
+    float roughness[VOXEL_PALETTE_MAX]  = {};
+    float emission_r[VOXEL_PALETTE_MAX] = {};
+    float emission_g[VOXEL_PALETTE_MAX] = {};
+    float emission_b[VOXEL_PALETTE_MAX] = {};
+    u8    flags[VOXEL_PALETTE_MAX]      = {};  //MATERIAL_FLAG_*
+};
+//MagicaVoxel's _r byte in game axes: one of the 24 rotations or their 24 mirrors.
+//Row i of the matrix has a single non zero entry, sign[i] in column axis[i].
+struct VoxelRotation {
+    u8 axis[3] = { 0, 1, 2 };
+    i8 sign[3] = { 1, 1, 1 };
+};
+//Placement of a model, every instance of a model traces the same VoxelBlockData.
+//world = rotation * (local - pivot) + position
+struct VoxInstance {
+    u32             model = 0;      //Index into VoxData::color_indices
+    VoxelRotation   rotation;
+    Vec3            pivot;          //Model space, size / 2 like MagicaVoxel
+    Vec3            position;       //World space
+};
 struct VoxData {
     VoxMaterial                 materials[VOXEL_PALETTE_MAX] = {};
+    MaterialTable               material_table;     //Compiled from materials by CompileMaterials
     //U32Pack                     color_palette[VOXEL_PALETTE_MAX];
     std::vector<VoxelBlockData> color_indices;
     Vec3I                       size;
+    std::vector<Vec3I>          model_sizes;        //One per color_indices entry
+    std::vector<VoxInstance>    instances;          //From the scene graph, moved so the scene starts at 0
 };
 #pragma pack(pop)
 
 bool LoadVoxFile(VoxData& out_voxels, const std::string& filePath);
-u32 CreateMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_data);
+//Bits 0-1: column of row 0, bits 2-3: column of row 1, bits 4-6: negative rows,
+//converted from MagicaVoxel's z up to the game's y up
+VoxelRotation DecodeVoxelRotation(u8 r);
+//a applied after b
+VoxelRotation CombineRotations(const VoxelRotation& a, const VoxelRotation& b);
+inline Vec3 Rotate(const VoxelRotation& r, const Vec3& v)
+{
+    return { r.sign[0] * v.e[r.axis[0]], r.sign[1] * v.e[r.axis[1]], r.sign[2] * v.e[r.axis[2]] };
+}
+//Transpose, rotations are orthogonal
+inline Vec3 InverseRotate(const VoxelRotation& r, const Vec3& v)
+{
+    Vec3 result;
+    for (i32 i = 0; i < 3; i++)
+        result.e[r.axis[i]] = r.sign[i] * v.e[i];
+    return result;
+}
+//World space box of the model the instance places
+AABB GetVoxInstanceBounds(const VoxData& voxels, const VoxInstance& instance);
+//visible gets the index of every instance that is at least partly inside frustum,
+//returns how many were culled
+u32 CullVoxInstances(std::vector<u32>& visible, const VoxData& voxels, const Frustum& frustum);
+//Rebuilds voxels.material_table, needed after materials changed
+void CompileMaterials(VoxData& voxels);
+//GPU copy of the table, out has VOXEL_PALETTE_MAX entries
+void PackShadingMaterials(ShadingMaterial* out, const MaterialTable& table);
+inline Vec3 GetMaterialAlbedo(const MaterialTable& table, u32 color_index)
+{
+    return { table.albedo_r[color_index], table.albedo_g[color_index], table.albedo_b[color_index] };
+}
+inline Vec3 GetMaterialEmission(const MaterialTable& table, u32 color_index)
+{
+    return { table.emission_r[color_index], table.emission_g[color_index], table.emission_b[color_index] };
+}
+//Edits model 0. Returns false when p is outside of the grid, grows size and
+//the size of model 0, and with it the bounds of its instances, to include p
+bool SetVoxel(VoxData& voxels, const Vec3I& p, u8 color_index);
+//Every mip level down to 1x1x1 with mips[0] a copy of the block, a texel is
+//the most common non zero index of the 8 texels below it so non zero still
+//means something is inside and the color is representative for LOD hits.
+//Returns the number of levels.
+i32 BuildVoxelIndexMips(std::vector<std::vector<u8>>& mips, const VoxelBlockData& block);
+
+//Every uncovered voxel face gets an index so per face data can live in flat
+//buffers that are shared with the shader.
+//voxels: one entry per cell of the VOXEL_MAX_SIZE^3 grid ((x * 64 + y) * 64 + z):
+//        (index of the first face << 6) | face_mask, 0 when no face is uncovered.
+//        Faces of a voxel are stored in Face order so the index of a face is the
+//        first index plus the set bits of face_mask below it.
+//faces:  x | y << 8 | z << 16 | face << 24, one per face index
+struct VoxelFaceTable {
+    std::vector<u32> voxels;
+    std::vector<u32> faces;
+};
+void BuildVoxelFaceTable(VoxelFaceTable& out, const VoxData& voxels);
+//Returns -1 when the face is covered or outside of the grid
+i32 GetFaceIndex(const VoxelFaceTable& table, const Vec3I& p, Face face);
+
+//Sort key of a packed face, faces are built in x, y, z, Face order
+inline u32 GetFaceSortKey(u32 packed_face)
+{
+    const u32 x = packed_face & 0xFF;
+    const u32 y = (packed_face >> 8) & 0xFF;
+    const u32 z = (packed_face >> 16) & 0xFF;
+    return (((x << 8 | y) << 8 | z) << 3) | (packed_face >> 24);
+}
+
+//Moves per face data from the faces of old_table to the faces of new_table after
+//an edit, faces that did not exist before get empty_value.
+template <typename T>
+void RemapFaceData(std::vector<T>& data, const VoxelFaceTable& old_table, const VoxelFaceTable& new_table, const T& empty_value)
+{
+    std::vector<T> result(new_table.faces.size(), empty_value);
+    size_t old_i = 0;
+    for (size_t new_i = 0; new_i < new_table.faces.size(); new_i++)
+    {
+        const u32 key = GetFaceSortKey(new_table.faces[new_i]);
+        while (old_i < old_table.faces.size() && GetFaceSortKey(old_table.faces[old_i]) < key)
+            old_i++;
+        if (old_i < old_table.faces.size() && old_i < data.size() && GetFaceSortKey(old_table.faces[old_i]) == key)
+            result[new_i] = data[old_i];
+    }
+    data.swap(result);
+}
+
+//Ambient occlusion of the 4 corners of a face packed in a u8, 2 bits each: how many of
+//the 3 voxels in front of the face that touch the corner are solid.
+//Corner (u, v) is at bit 2 * (u + 2 * v) with u along axis (face_axis + 1) % 3 and v along
+//(face_axis + 2) % 3, 1 being the positive side of the voxel.
+u8 ComputeFaceAO(const VoxelBlockData& block, const Vec3I& p, Face face);
+//corner: offset of the vertex from the voxel origin, 0 or 1 on every axis
+u8 GetFaceAOCorner(u8 face_ao, Face face, const Vec3& corner);
+//One u8 per face index of table, padded to a multiple of 4 so it can be uploaded as u32s
+void BakeFaceAO(std::vector<u8>& ao, const VoxelFaceTable& table, const VoxelBlockData& block);
+//Recomputes the faces that the voxels in [min, max] can touch, table has to be up to date
+void UpdateFaceAO(std::vector<u8>& ao, const VoxelFaceTable& table, const VoxelBlockData& block, const Vec3I& min, const Vec3I& max);
+//One quad per exposed face, returns the index count for the shared quad index buffer
+u32 CreateMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao);
+//Same surface with the faces of every slice merged into the largest quads that share a
+//color and a uniform AO. Rows of voxels are u64 masks so the exposed faces of a whole row
+//come from one shift and AND instead of six neighbour lookups per voxel.
+u32 CreateGreedyMeshFromVox(std::vector<Vertex_Voxel>& vertices, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao);
+//Greedy mesh with real indices, corners shared by quads of the same color and AO are written once
+void CreatePackedMeshFromVox(std::vector<Vertex_VoxelPacked>& vertices, std::vector<u32>& indices, const VoxData& voxel_data,
+                             const VoxelFaceTable& faces, const std::vector<u8>& face_ao);
+inline Vertex_VoxelPacked PackVoxelVertex(const Vec3I& p, Face face, u8 ao, u8 color_index)
+{
+    Vertex_VoxelPacked result;
+    result.position   = u32(p.x) | u32(p.y) << 10 | u32(p.z) << 20;
+    result.attributes = u32(+face) | u32(ao & 0x3) << 3 | u32(color_index) << 8;
+    return result;
+}
+
+enum class VoxelMesher : i32 {
+    Naive,      //CreateMeshFromVox
+    Greedy,     //CreateGreedyMeshFromVox
+    Packed,     //CreatePackedMeshFromVox, what the raster path draws
+    Count,
+};
+ENUMOPS(VoxelMesher);
+extern const char* voxelMesherNames[+VoxelMesher::Count];
+struct VoxelMesherStats {
+    u32   vertices = 0;
+    u32   indices = 0;
+    u64   bytes = 0;            //Vertices and the indices they are drawn with
+    float milliseconds = 0.0f;
+};
+//Meshes the whole model once with every mesher, out has +VoxelMesher::Count entries
+void CompareVoxelMeshers(VoxelMesherStats* out, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao);
+
+//Packed mesh split into VOXEL_CHUNK_SIZE^3 chunks that are meshed on their own, in parallel,
+//so an edit only remeshes the chunks around it. Every chunk owns a range of the shared
+//buffers with room to grow: a remeshed chunk is written over its old range when it fits
+//and moved to the end otherwise. Unused indices of a range are degenerate triangles so
+//the buffers can still be drawn with a single call.
+#define VOXEL_CHUNK_SIZE 16
+#define VOXEL_CHUNKS_PER_AXIS (VOXEL_MAX_SIZE / VOXEL_CHUNK_SIZE)
+#define VOXEL_CHUNK_COUNT (VOXEL_CHUNKS_PER_AXIS * VOXEL_CHUNKS_PER_AXIS * VOXEL_CHUNKS_PER_AXIS)
+struct VoxelMeshRange {
+    u32 first    = 0;
+    u32 count    = 0;
+    u32 capacity = 0;
+};
+struct VoxelMeshChunk {
+    VoxelMeshRange vertices;
+    VoxelMeshRange indices;
+    //The quads are sorted by Face, the ones of face f are at [face_offsets[f], face_offsets[f + 1])
+    //from indices.first so the directions facing away from the camera can be skipped
+    u32 face_offsets[+Face::Count + 1] = {};
+    //Levels above 0 only. Faces on the side f of the chunk that have a solid cell on the other
+    //side, sorted the same way after the other faces. Drawn on the sides next to finer chunks
+    u32 skirt_offsets[+Face::Count + 1] = {};
+    bool dirty = true;
+    //Output of the last remesh with chunk relative indices, kept to reuse the memory
+    std::vector<Vertex_VoxelPacked> staged_vertices;
+    std::vector<u32> staged_indices;
+};
+struct VoxelChunkedMesh {
+    i32 lod = 0;        //Mip level the chunks are meshed from
+    VoxelMeshChunk chunks[VOXEL_CHUNK_COUNT];
+    std::vector<Vertex_VoxelPacked> vertices;
+    std::vector<u32> indices;
+
+    //What the last update changed. When a chunk was moved or the buffers were compacted the
+    //buffers have to be uploaded whole, otherwise only the ranges of the remeshed chunks
+    bool  relocated = false;
+    u32   remeshed[VOXEL_CHUNK_COUNT] = {};
+    u32   chunks_meshed = 0;
+    float milliseconds  = 0.0f;
+};
+//Voxel position of the first voxel of the chunk
+inline Vec3I GetVoxelChunkOrigin(u32 chunk)
+{
+    const i32 z = chunk % VOXEL_CHUNKS_PER_AXIS;
+    const i32 y = (chunk / VOXEL_CHUNKS_PER_AXIS) % VOXEL_CHUNKS_PER_AXIS;
+    const i32 x = chunk / (VOXEL_CHUNKS_PER_AXIS * VOXEL_CHUNKS_PER_AXIS);
+    return { x * VOXEL_CHUNK_SIZE, y * VOXEL_CHUNK_SIZE, z * VOXEL_CHUNK_SIZE };
+}
+//Bit f is set when faces of direction f in the chunk can face the camera: the camera is on the
+//front side of at least one of their planes. The faces of the other directions are all back faces.
+inline u8 GetVoxelChunkFaceMask(u32 chunk, const Vec3& camera_position)
+{
+    const Vec3I origin = GetVoxelChunkOrigin(chunk);
+    u8 result = 0;
+    for (i32 axis = 0; axis < 3; axis++)
+    {
+        if (camera_position.e[axis] > float(origin.e[axis]))
+            result |= 1 << (2 * axis);
+        if (camera_position.e[axis] < float(origin.e[axis] + VOXEL_CHUNK_SIZE))
+            result |= 1 << (2 * axis + 1);
+    }
+    return result;
+}
+//Chunk on side face of chunk, -1 past the edge of the volume
+inline i32 GetVoxelChunkNeighbour(u32 chunk, Face face)
+{
+    const i32 axis = +face / 2;
+    const i32 step = (+face & 1) ? -1 : 1;
+    const i32 strides[3] = { VOXEL_CHUNKS_PER_AXIS * VOXEL_CHUNKS_PER_AXIS, VOXEL_CHUNKS_PER_AXIS, 1 };
+    const i32 coordinate = (i32(chunk) / strides[axis]) % VOXEL_CHUNKS_PER_AXIS + step;
+    if (coordinate < 0 || coordinate >= VOXEL_CHUNKS_PER_AXIS)
+        return -1;
+    return i32(chunk) + step * strides[axis];
+}
+//Empties the buffers and marks every chunk dirty
+void ResetVoxelMesh(VoxelChunkedMesh& mesh);
+//Marks the chunks the voxels in [min, max] and their neighbours are in, the faces
+//and the AO of the voxels next to an edit change too
+void InvalidateVoxelMesh(VoxelChunkedMesh& mesh, const Vec3I& min, const Vec3I& max);
+//Remeshes the dirty chunks, returns how many there were.
+//faces and face_ao have to be up to date.
+u32 UpdateVoxelMesh(VoxelChunkedMesh& mesh, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao);
+
+//Coarser versions of the chunked mesh meshed from the index mips, a cell of level n is
+//2^n voxels wide and has the representative color the mip picked. A coarse cell is solid
+//when any of its voxels is, so a coarse chunk covers everything the finer levels do. Faces
+//between two solid cells are left out on the chunk borders too, which leaves holes where a
+//coarse chunk meets a finer one that is clear in front of a face. The skirt of that side
+//fills them, faces it adds in front of solid fine voxels are hidden by those voxels and face
+//the other way than the fine faces on the same plane. There is no AO below level 0.
+#define VOXEL_MESH_LOD_COUNT 3
+struct VoxelMeshLods {
+    VoxelChunkedMesh levels[VOXEL_MESH_LOD_COUNT];
+    u8 chunk_lods[VOXEL_CHUNK_COUNT] = {};      //Level drawn for every chunk, from SelectVoxelMeshLods
+    u8 chunk_faces[VOXEL_CHUNK_COUNT] = {};     //Directions drawn for every chunk, from GetVoxelChunkFaceMask
+    u8 chunk_skirts[VOXEL_CHUNK_COUNT] = {};    //Bit f: the neighbour on side f is at a finer level
+
+    //Stats of the last selection
+    u32 selected_indices = 0;
+    u32 culled_indices   = 0;   //Of the selected levels, skipped because they face away
+    u32 full_indices     = 0;   //If every chunk was drawn at level 0
+};
+void ResetVoxelMesh(VoxelMeshLods& lods);
+void InvalidateVoxelMesh(VoxelMeshLods& lods, const Vec3I& min, const Vec3I& max);
+//mips from BuildVoxelIndexMips of the same voxels
+u32 UpdateVoxelMesh(VoxelMeshLods& lods, const VoxData& voxel_data, const VoxelFaceTable& faces, const std::vector<u8>& face_ao,
+                    const std::vector<std::vector<u8>>& mips);
+//Picks the coarsest level for every chunk whose cells still cover at most a pixel at the
+//closest point of the chunk, the skirts next to finer chunks and the directions that can
+//face the camera. cone_spread is the pixel footprint per unit of distance from GetConeSpread,
+//0 keeps everything at level 0. Returns the number of indices to draw.
+u32 SelectVoxelMeshLods(VoxelMeshLods& lods, const Vec3& camera_position, float cone_spread);
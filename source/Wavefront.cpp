@@ -0,0 +1,333 @@
+#include "Wavefront.h"
+#include "Raycast.h"
+#include "Lighting.h"
+#include "Threading.h"
+#include "Timers.h"
+#include "Debug.h"
+#include "Tracy.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+const char* wavefrontStageNames[+WavefrontStage::Count] = {
+    "Generate",
+    "Extend",
+    "Shade",
+    "Connect",
+    "Accumulate",
+};
+
+//Items per ParallelFor batch of the stages that trace rays
+#define WAVEFRONT_BATCH_SIZE 256
+
+void WavefrontRays::Reserve(u32 capacity)
+{
+    origin_x.resize(capacity);
+    origin_y.resize(capacity);
+    origin_z.resize(capacity);
+    direction_x.resize(capacity);
+    direction_y.resize(capacity);
+    direction_z.resize(capacity);
+    throughput_r.resize(capacity);
+    throughput_g.resize(capacity);
+    throughput_b.resize(capacity);
+    pixel.resize(capacity);
+    random.resize(capacity);
+}
+
+void WavefrontHits::Reserve(u32 capacity)
+{
+    color_index.resize(capacity);
+    p_x.resize(capacity);
+    p_y.resize(capacity);
+    p_z.resize(capacity);
+    face.resize(capacity);
+    distance.resize(capacity);
+}
+
+void WavefrontShadowRays::Reserve(u32 capacity)
+{
+    origin_x.resize(capacity);
+    origin_y.resize(capacity);
+    origin_z.resize(capacity);
+    direction_x.resize(capacity);
+    direction_y.resize(capacity);
+    direction_z.resize(capacity);
+    max_distance.resize(capacity);
+    light_r.resize(capacity);
+    light_g.resize(capacity);
+    light_b.resize(capacity);
+    pixel.resize(capacity);
+}
+
+//Models placed by the scene graph when the file has one, the single block otherwise.
+//instance_indices limits the search to the instances inside the view
+static RaycastResult TraceScene(const Ray& ray, const VoxData& voxels, const std::vector<u32>* instance_indices = nullptr)
+{
+    if (voxels.instances.size())
+        return RayVsVoxelInstances(ray, voxels, instance_indices);
+    return RayVsVoxel(ray, voxels);
+}
+
+//Instances a ray from the camera through the screen can hit
+static u32 CullInstancesToCamera(std::vector<u32>& visible, const VoxData& voxels, const CpuCamera& camera)
+{
+    const Mat4 projection_from_world = gb_mat4_inverse(camera.world_from_view * camera.view_from_projection);
+    Frustum frustum = ComputeFrustum(projection_from_world);
+    //The rays start at the camera and not at the near plane
+    Plane& near_plane = frustum.e[4];
+    near_plane.w = -(near_plane.x * camera.position.x + near_plane.y * camera.position.y + near_plane.z * camera.position.z);
+    return CullVoxInstances(visible, voxels, frustum);
+}
+
+static void AddRadiance(DenoiseImage& radiance, u32 pixel, const Vec3& c)
+{
+    radiance.r[pixel] += c.r;
+    radiance.g[pixel] += c.g;
+    radiance.b[pixel] += c.b;
+}
+
+static void PushRay(WavefrontRays& q, u32 i, const Vec3& origin, const Vec3& direction, const Vec3& throughput, u32 pixel, u32 random)
+{
+    q.origin_x[i] = origin.x;
+    q.origin_y[i] = origin.y;
+    q.origin_z[i] = origin.z;
+    q.direction_x[i] = direction.x;
+    q.direction_y[i] = direction.y;
+    q.direction_z[i] = direction.z;
+    q.throughput_r[i] = throughput.r;
+    q.throughput_g[i] = throughput.g;
+    q.throughput_b[i] = throughput.b;
+    q.pixel[i] = pixel;
+    q.random[i] = random;
+}
+
+//One primary ray per pixel, also clears the radiance of this frame
+static void GenerateStage(WavefrontRays& rays, DenoiseImage& radiance, const Vec2I& size, const CpuCamera& camera, u32 frame_index)
+{
+    ZoneScopedN("Wavefront Generate");
+    ParallelFor(u32(size.y), 4, [&](u32 begin, u32 end)
+    {
+        for (i32 y = i32(begin); y < i32(end); y++)
+            for (i32 x = 0; x < size.x; x++)
+            {
+                const u32 i = u32(y * size.x + x);
+                const Ray ray = PixelToRay({ float(x) + 0.5f, float(y) + 0.5f }, size, camera);
+                u32 random = (i + 1) * 0x9E3779B9u ^ (frame_index + 1) * 0x85EBCA6Bu;
+                if (random == 0)
+                    random = 1;
+                PushRay(rays, i, ray.origin, ray.direction, { 1.0f, 1.0f, 1.0f }, i, random);
+                radiance.r[i] = radiance.g[i] = radiance.b[i] = 0.0f;
+            }
+    });
+    rays.count = u32(size.x * size.y);
+}
+
+static void ExtendStage(WavefrontHits& hits, const WavefrontRays& rays, const VoxData& voxels, const std::vector<u32>* instance_indices)
+{
+    ZoneScopedN("Wavefront Extend");
+    ParallelFor(rays.count, WAVEFRONT_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; i++)
+        {
+            const Ray ray = {
+                .origin     = { rays.origin_x[i], rays.origin_y[i], rays.origin_z[i] },
+                .direction  = { rays.direction_x[i], rays.direction_y[i], rays.direction_z[i] },
+            };
+            const RaycastResult hit = TraceScene(ray, voxels, instance_indices);
+            hits.color_index[i] = hit.success;
+            if (!hit.success)
+                continue;
+            hits.p_x[i] = hit.p.x;
+            hits.p_y[i] = hit.p.y;
+            hits.p_z[i] = hit.p.z;
+            hits.face[i] = +FaceFromNormal(hit.normal);
+            hits.distance[i] = Distance(ray.origin, hit.p);
+        }
+    });
+}
+
+//Adds the emission and the ambient part of the sun, queues a shadow ray for the
+//rest of the sun light and a diffuse bounce when the path continues.
+//Every pixel has at most one ray in the queue so the radiance writes never overlap.
+static void ShadeStage(WavefrontRays& next, WavefrontShadowRays& shadow_rays, DenoiseImage& radiance, DenoiseFeatures& features,
+                       const WavefrontHits& hits, const WavefrontRays& rays, const CpuScene& scene, bool primary, bool continue_path)
+{
+    ZoneScopedN("Wavefront Shade");
+    const LightingEnvironment& env = *scene.environment;
+    std::atomic<u32> next_count = 0;
+    std::atomic<u32> shadow_count = 0;
+    ParallelFor(rays.count, WAVEFRONT_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; i++)
+        {
+            const u32 pixel = rays.pixel[i];
+            const Vec3 throughput = { rays.throughput_r[i], rays.throughput_g[i], rays.throughput_b[i] };
+            const u32 color_index = hits.color_index[i];
+            if (!color_index)
+            {
+                if (primary)
+                {
+                    features.normal_x[pixel] = features.normal_y[pixel] = features.normal_z[pixel] = 0.0f;
+                    features.depth[pixel] = 0.0f;
+                    features.albedo_r[pixel] = features.albedo_g[pixel] = features.albedo_b[pixel] = 0.0f;
+                }
+                AddRadiance(radiance, pixel, primary ? scene.background : HadamardProduct(throughput, env.sky_color));
+                continue;
+            }
+
+            const Vec3 p = { hits.p_x[i], hits.p_y[i], hits.p_z[i] };
+            const Vec3 n = faceNormals[hits.face[i]];
+            const Vec3 albedo = GetMaterialAlbedo(scene.voxels->material_table, color_index);
+            const Vec3 weight = HadamardProduct(throughput, albedo);
+            if (primary)
+            {
+                features.normal_x[pixel] = n.x;
+                features.normal_y[pixel] = n.y;
+                features.normal_z[pixel] = n.z;
+                features.depth[pixel]    = hits.distance[i];
+                features.albedo_r[pixel] = albedo.r;
+                features.albedo_g[pixel] = albedo.g;
+                features.albedo_b[pixel] = albedo.b;
+            }
+
+            const Vec3 emission = HadamardProduct(throughput, GetMaterialEmission(scene.voxels->material_table, color_index));
+            AddRadiance(radiance, pixel, HadamardProduct(weight, env.sun_color * env.shadow_amount) + emission);
+
+            //Same as IsSunVisible in Lighting.cpp, a lit surface gets n_dot_l instead of shadow_amount
+            const Vec3 to_sun = env.sun_position - p;
+            const float sun_distance = Length(to_sun);
+            const float n_dot_l = sun_distance > 0.0f ? DotProduct(to_sun, n) / sun_distance : 0.0f;
+            if (n_dot_l > 0.0f)
+            {
+                const u32 j = shadow_count.fetch_add(1, std::memory_order_relaxed);
+                const Vec3 origin = p + n * 0.001f;
+                const Vec3 light = HadamardProduct(weight, env.sun_color * (n_dot_l - env.shadow_amount));
+                shadow_rays.origin_x[j] = origin.x;
+                shadow_rays.origin_y[j] = origin.y;
+                shadow_rays.origin_z[j] = origin.z;
+                shadow_rays.direction_x[j] = to_sun.x / sun_distance;
+                shadow_rays.direction_y[j] = to_sun.y / sun_distance;
+                shadow_rays.direction_z[j] = to_sun.z / sun_distance;
+                shadow_rays.max_distance[j] = sun_distance;
+                shadow_rays.light_r[j] = light.r;
+                shadow_rays.light_g[j] = light.g;
+                shadow_rays.light_b[j] = light.b;
+                shadow_rays.pixel[j] = pixel;
+            }
+
+            if (continue_path)
+            {
+                RandomState random = { .state = rays.random[i] };
+                const Vec3 direction = SampleHemisphere(n, random);
+                const u32 j = next_count.fetch_add(1, std::memory_order_relaxed);
+                PushRay(next, j, p + n * 0.001f, direction, weight, pixel, random.state);
+            }
+        }
+    });
+    next.count = next_count;
+    shadow_rays.count = shadow_count;
+}
+
+static void ConnectStage(DenoiseImage& radiance, const WavefrontShadowRays& shadow_rays, const VoxData& voxels)
+{
+    ZoneScopedN("Wavefront Connect");
+    ParallelFor(shadow_rays.count, WAVEFRONT_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; i++)
+        {
+            const Ray ray = {
+                .origin     = { shadow_rays.origin_x[i], shadow_rays.origin_y[i], shadow_rays.origin_z[i] },
+                .direction  = { shadow_rays.direction_x[i], shadow_rays.direction_y[i], shadow_rays.direction_z[i] },
+            };
+            const RaycastResult hit = TraceScene(ray, voxels);
+            if (!hit.success || Distance(ray.origin, hit.p) >= shadow_rays.max_distance[i])
+                AddRadiance(radiance, shadow_rays.pixel[i], { shadow_rays.light_r[i], shadow_rays.light_g[i], shadow_rays.light_b[i] });
+        }
+    });
+}
+
+static void AccumulateStage(DenoiseImage& accumulated, const DenoiseImage& radiance, u32 frames)
+{
+    ZoneScopedN("Wavefront Accumulate");
+    const float weight = 1.0f / float(frames);
+    ParallelFor(u32(radiance.r.size()), 4096, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; i++)
+        {
+            accumulated.r[i] += (radiance.r[i] - accumulated.r[i]) * weight;
+            accumulated.g[i] += (radiance.g[i] - accumulated.g[i]) * weight;
+            accumulated.b[i] += (radiance.b[i] - accumulated.b[i]) * weight;
+        }
+    });
+}
+
+static void EndStage(WavefrontRenderer& renderer, WavefrontStage stage, float start, u64 items)
+{
+    renderer.stage_milliseconds[+stage] += GetTimer() - start;
+    renderer.stage_items[+stage] += items;
+    //Every stage is one ParallelFor, an empty queue returns before reaching the pool
+    if (items)
+        renderer.dispatches++;
+}
+
+void WavefrontRender(WavefrontRenderer& renderer, const Vec2I& size, const CpuCamera& camera, const CpuScene& scene)
+{
+    ZoneScopedN("Wavefront Render");
+    VALIDATE(scene.voxels && scene.environment);
+    const float start = GetTimer();
+    const u32 pixel_count = u32(size.x * size.y);
+    for (i32 i = 0; i < +WavefrontStage::Count; i++)
+    {
+        renderer.stage_milliseconds[i] = 0.0f;
+        renderer.stage_items[i] = 0;
+    }
+
+    if (renderer.accumulated.size != size || memcmp(&renderer.last_camera, &camera, sizeof(camera)) != 0)
+    {
+        renderer.accumulated.Resize(size);
+        renderer.accumulated_frames = 0;
+        renderer.last_camera = camera;
+    }
+    renderer.radiance.Resize(size);
+    renderer.features.Resize(size);
+    renderer.rays.Reserve(pixel_count);
+    renderer.next_rays.Reserve(pixel_count);
+    renderer.hits.Reserve(pixel_count);
+    renderer.shadow_rays.Reserve(pixel_count);
+
+    renderer.instances_culled = 0;
+    renderer.dispatches = 0;
+    if (scene.voxels->instances.size())
+        renderer.instances_culled = CullInstancesToCamera(renderer.visible_instances, *scene.voxels, camera);
+
+    float stage_start = GetTimer();
+    GenerateStage(renderer.rays, renderer.radiance, size, camera, renderer.frame_index++);
+    EndStage(renderer, WavefrontStage::Generate, stage_start, renderer.rays.count);
+
+    for (i32 bounce = 0; bounce <= renderer.bounces && renderer.rays.count; bounce++)
+    {
+        stage_start = GetTimer();
+        //Only the primary rays are limited to the instances in view
+        const bool primary_in_view = bounce == 0 && scene.voxels->instances.size();
+        ExtendStage(renderer.hits, renderer.rays, *scene.voxels, primary_in_view ? &renderer.visible_instances : nullptr);
+        EndStage(renderer, WavefrontStage::Extend, stage_start, renderer.rays.count);
+
+        stage_start = GetTimer();
+        ShadeStage(renderer.next_rays, renderer.shadow_rays, renderer.radiance, renderer.features,
+                   renderer.hits, renderer.rays, scene, bounce == 0, bounce < renderer.bounces);
+        EndStage(renderer, WavefrontStage::Shade, stage_start, renderer.rays.count);
+
+        stage_start = GetTimer();
+        ConnectStage(renderer.radiance, renderer.shadow_rays, *scene.voxels);
+        EndStage(renderer, WavefrontStage::Connect, stage_start, renderer.shadow_rays.count);
+
+        std::swap(renderer.rays, renderer.next_rays);
+    }
+
+    stage_start = GetTimer();
+    AccumulateStage(renderer.accumulated, renderer.radiance, ++renderer.accumulated_frames);
+    EndStage(renderer, WavefrontStage::Accumulate, stage_start, pixel_count);
+    renderer.milliseconds = GetTimer() - start;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "Math.h"
+#include "Denoise.h"
+#include "CpuRenderer.h"
+
+#include <vector>
+
+//*****************
+//Wavefront Tracer
+//*****************
+
+//Path tracer split into stages that each run over every live path before the
+//next one starts: generate, extend (closest hit), shade, connect (shadow rays)
+//and accumulate. The queues between the stages are SoA so every stage reads
+//only the arrays it needs, this is the layout a compute shader port would use.
+//The sun visibility is traced instead of baked and the indirect light comes
+//from the bounces, so the result converges to the path traced reference.
+//Nothing is baked per face so it traces the instances of VoxData directly.
+
+//Paths waiting for the extend stage
+struct WavefrontRays {
+    std::vector<float> origin_x, origin_y, origin_z;
+    std::vector<float> direction_x, direction_y, direction_z;
+    std::vector<float> throughput_r, throughput_g, throughput_b;
+    std::vector<u32>   pixel;
+    std::vector<u32>   random;
+    u32 count = 0;
+
+    void Reserve(u32 capacity);
+};
+
+//Closest hit of every ray in WavefrontRays, same index
+struct WavefrontHits {
+    std::vector<u32>   color_index;     //0 when nothing was hit
+    std::vector<float> p_x, p_y, p_z;
+    std::vector<u8>    face;
+    std::vector<float> distance;
+
+    void Reserve(u32 capacity);
+};
+
+//Sun light the shade stage found, added to the pixel when nothing is in the way
+struct WavefrontShadowRays {
+    std::vector<float> origin_x, origin_y, origin_z;
+    std::vector<float> direction_x, direction_y, direction_z;
+    std::vector<float> max_distance;
+    std::vector<float> light_r, light_g, light_b;
+    std::vector<u32>   pixel;
+    u32 count = 0;
+
+    void Reserve(u32 capacity);
+};
+
+enum class WavefrontStage : i32 {
+    Generate,
+    Extend,
+    Shade,
+    Connect,
+    Accumulate,
+    Count,
+};
+ENUMOPS(WavefrontStage);
+extern const char* wavefrontStageNames[+WavefrontStage::Count];
+
+struct WavefrontRenderer {
+    i32                 bounces = 2;    //Diffuse bounces after the primary hit
+    WavefrontRays       rays;
+    WavefrontRays       next_rays;
+    WavefrontHits       hits;
+    WavefrontShadowRays shadow_rays;
+    DenoiseImage        radiance;       //This frame
+    DenoiseFeatures     features;       //Primary hits of this frame
+    DenoiseImage        accumulated;    //Average of every frame since the camera last moved
+    u32                 accumulated_frames = 0;
+    u32                 frame_index = 0;
+    CpuCamera           last_camera = {};
+    std::vector<u32>    visible_instances;  //Of VoxData::instances, traced by the primary rays
+
+    //Stats of the last frame
+    float               stage_milliseconds[+WavefrontStage::Count] = {};
+    u64                 stage_items[+WavefrontStage::Count] = {};
+    float               milliseconds = 0.0f;
+    u32                 instances_culled = 0;
+    u32                 dispatches = 0;     //ParallelFor jobs, all on the persistent worker pool
+};
+
+//Traces one path per pixel and blends it into renderer.accumulated,
+//the accumulation restarts when the camera or the size changed
+void WavefrontRender(WavefrontRenderer& renderer, const Vec2I& size, const CpuCamera& camera, const CpuScene& scene);
@@ -2,12 +2,32 @@
 #include "Debug.h"
 #include "Math.h"
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <shlobj_core.h>
+#else
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <filesystem>
+#include <pthread.h>
+#include <sys/stat.h>
+#endif
 #include <string>
 #include <thread>
 
+std::string ToString(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    char buffer[4096];
+    i32 i = vsnprintf(buffer, arrsize(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+}
+
+#ifdef _WIN32
 bool CreateFolder(const std::string& folderLocation)
 {
     BOOL result = CreateDirectoryA(folderLocation.c_str(), NULL);
@@ -24,16 +44,6 @@ void DebugPrint(const char* fmt, ...)
     va_end(list);
 }
 
-std::string ToString(const char* fmt, ...)
-{
-    va_list args;
-    va_start(args, fmt);
-    char buffer[4096];
-    i32 i = vsnprintf(buffer, arrsize(buffer), fmt, args);
-    va_end(args);
-    return buffer;
-}
-
 void ScanDirectoryForFileNames(const std::string& dir, std::vector<std::string>& out)
 {
     out.clear();
@@ -113,3 +123,52 @@ void Sleep_Thread(int64_t milliseconds)
 {
     Sleep(1000);
 }
+#else
+//Same behaviour on the platforms without Windows.h, used by the null renderer build
+
+bool CreateFolder(const std::string& folderLocation)
+{
+    return mkdir(folderLocation.c_str(), 0755) == 0;
+}
+
+void DebugPrint(const char* fmt, ...)
+{
+    va_list list;
+    va_start(list, fmt);
+    vfprintf(stderr, fmt, list);
+    va_end(list);
+}
+
+void ScanDirectoryForFileNames(const std::string& dir, std::vector<std::string>& out)
+{
+    out.clear();
+
+    //Trailing wildcard of the Windows search pattern is not needed here
+    std::string d = dir;
+    while (d.size() && (d.back() == '*' || d.back() == '/'))
+        d.pop_back();
+    if (d.empty())
+        d = ".";
+
+    std::error_code error;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(d, error))
+    {
+        if (!entry.is_directory(error))
+            out.push_back(entry.path().filename().string());
+    }
+}
+
+void SetThreadName(std::thread::native_handle_type threadID, std::string name)
+{
+#ifdef __linux__
+    //Linux limits thread names to 15 characters
+    name.resize(Min(name.size(), size_t(15)));
+    pthread_setname_np(threadID, name.c_str());
+#endif
+}
+
+void Sleep_Thread(int64_t milliseconds)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+#endif
@@ -1,8 +1,13 @@
 #include "WinInterop_File.h"
 #include "WinInterop.h"
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <cstdio>
+#include <filesystem>
+#endif
 
 File::File() :
     m_handleIsValid     (0),
@@ -32,6 +37,15 @@ File::File(const std::string& filename, File::Mode fileMode, bool createIfNotFou
     Init(filename, fileMode, createIfNotFound);
 }
 
+File::~File()
+{
+    if (m_handleIsValid)
+    {
+        FileDestructor();
+    }
+}
+
+#ifdef _WIN32
 void File::GetHandle()
 {
     //MultiByteToWideChar(CP_UTF8, );
@@ -99,15 +113,6 @@ bool File::FileDestructor()
     return CloseHandle(m_handle);
 }
 
-File::~File()
-{
-    if (m_handleIsValid)
-    {
-        FileDestructor();
-    }
-}
-
-
 void File::GetText()
 {
     if (!m_handleIsValid)
@@ -209,3 +214,110 @@ bool File::Delete()
     }
     return false;
 }
+#else
+//The handle is a FILE*, m_time is the last write time in the clock units of std::filesystem
+
+void File::GetHandle()
+{
+    m_handle = fopen(m_filename.c_str(), m_accessType == 1 ? "wb" : "rb");
+}
+
+void File::Init(const std::string& filename, File::Mode fileMode, bool createIfNotFound)
+{
+    m_filename = std::string(filename);
+    m_accessType = (fileMode == File::Mode::Write);
+    m_shareType  = 0;
+    m_openType   = 0;
+
+    //Write truncates an existing file and only creates one when asked to, like TRUNCATE_EXISTING
+    std::error_code error;
+    const bool exists = std::filesystem::exists(m_filename, error);
+    m_handle = nullptr;
+    if (exists || fileMode == File::Mode::Read)
+        GetHandle();
+    if (createIfNotFound && m_handle == nullptr)
+        m_handle = fopen(m_filename.c_str(), fileMode == File::Mode::Read ? "w+b" : "wb");
+    m_handleIsValid = (m_handle != nullptr);
+    assert(m_handleIsValid);
+}
+
+bool File::FileDestructor()
+{
+    return fclose(reinterpret_cast<FILE*>(m_handle)) == 0;
+}
+
+void File::GetText()
+{
+    if (!m_handleIsValid)
+        return;
+
+    FILE* file = reinterpret_cast<FILE*>(m_handle);
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (file_size < 0)
+    {
+        assert(false);
+        return;
+    }
+    m_dataString.resize(size_t(file_size), 0);
+    m_textIsValid = fread(m_dataString.data(), 1, size_t(file_size), file) == size_t(file_size);
+    assert(m_textIsValid);
+}
+
+void File::GetData()
+{
+    if (!m_handleIsValid)
+        return;
+
+    FILE* file = reinterpret_cast<FILE*>(m_handle);
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    m_dataBinary.resize(Max(file_size, 0l), 0);
+    m_binaryDataIsValid = file_size >= 0 && fread(m_dataBinary.data(), 1, m_dataBinary.size(), file) == m_dataBinary.size();
+}
+
+bool File::Write(void* data, size_t sizeInBytes)
+{
+    return Write(const_cast<const void*>(data), sizeInBytes);
+}
+
+bool File::Write(const void* data, size_t sizeInBytes)
+{
+    return fwrite(data, 1, sizeInBytes, reinterpret_cast<FILE*>(m_handle)) == sizeInBytes;
+}
+
+bool File::Write(const std::string& text)
+{
+    return Write(text.c_str(), text.size());
+}
+
+void File::GetTime()
+{
+    std::error_code error;
+    const std::filesystem::file_time_type time = std::filesystem::last_write_time(m_filename, error);
+    if (error)
+    {
+        DebugPrint("last_write_time failed with %d\n", error.value());
+        m_timeIsValid = false;
+    }
+    else
+    {
+        m_time = u64(time.time_since_epoch().count());
+        m_timeIsValid = true;
+    }
+}
+
+bool File::Delete()
+{
+    if (m_handleIsValid)
+    {
+        FileDestructor();
+        bool result = std::remove(m_filename.c_str()) == 0;
+        m_handleIsValid = false;
+        return result;
+    }
+    return false;
+}
+#endif
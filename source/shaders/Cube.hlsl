@@ -11,16 +11,21 @@ struct VS_Output {
 };
 
 struct VS_Input {
-    float4 color    : COLOR;
     float3 pos      : POSITION;
     float2 uv       : TEXCOORD;
+
+    //Per instance
+    float3 instance_p       : INSTANCE_POSITION;
+    float3 instance_scale   : INSTANCE_SCALE;
+    float4 instance_color   : INSTANCE_COLOR;
 };
 
 VS_Output Vertex_Main(VS_Input input)
 {
     VS_Output output;
-    output.position = mul(projection_from_view, mul(view_from_world, float4(input.pos, 1.0)));
-    output.color = input.color;
+    float3 p = input.instance_p + input.pos * input.instance_scale;
+    output.position = mul(projection_from_view, mul(view_from_world, float4(p, 1.0)));
+    output.color = input.instance_color;
     output.uv = input.uv;
     return output;
 }
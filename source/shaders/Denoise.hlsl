@@ -0,0 +1,103 @@
+#include "GpuSharedData.h"
+
+//**************
+//VERTEX SHADER
+//**************
+
+struct VS_Output {
+    float4 position : SV_POSITION;
+};
+
+struct VS_Input {
+    float2 pos : POSITION;
+};
+
+VS_Output Vertex_Main(VS_Input input)
+{
+    VS_Output output;
+    output.position = float4(input.pos, 0, 1);
+    return output;
+}
+
+
+
+
+//**************
+//PIXEL SHADER
+//**************
+struct PS_Output {
+    float4 color : SV_Target;
+};
+
+//Output of the previous iteration or the path traced image on the first one
+Texture2D   denoise_input           TEXTURE_REGISTER(SLOT_DENOISE_INPUT);
+//xyz: world normal, w: distance from the camera (0 when nothing was hit)
+Texture2D   denoise_normal_depth    TEXTURE_REGISTER(SLOT_DENOISE_NORMAL_DEPTH);
+Texture2D   denoise_albedo          TEXTURE_REGISTER(SLOT_DENOISE_ALBEDO);
+
+static const float ALBEDO_MIN = 0.001;
+//B3 spline
+static const float atrous_kernel[5] = { 1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0 };
+
+float Luminance(float3 c)
+{
+    return dot(c, float3(0.2126, 0.7152, 0.0722));
+}
+
+float3 LoadIllumination(int2 p)
+{
+    float3 color = denoise_input.Load(int3(p, 0)).rgb;
+    if (denoise_flags & DENOISE_FLAG_DEMODULATE)
+        color = color / max(denoise_albedo.Load(int3(p, 0)).rgb, ALBEDO_MIN);
+    return color;
+}
+
+//Same weights as FilterPixel in Denoise.cpp
+PS_Output Pixel_Main(VS_Output input)
+{
+    PS_Output output;
+    const int2 p = int2(input.position.xy);
+    const float4 normal_depth_p = denoise_normal_depth.Load(int3(p, 0));
+    const float3 albedo_p = denoise_albedo.Load(int3(p, 0)).rgb;
+    const float3 illum_p = LoadIllumination(p);
+    output.color.a = 1;
+    if (normal_depth_p.w <= 0)
+    {
+        output.color.rgb = denoise_input.Load(int3(p, 0)).rgb;
+        return output;
+    }
+
+    const float lum_scale   = 1.0 / (max(sigma_color, 0.0001) * (Luminance(illum_p) + 0.0001));
+    const float inv_depth   = 1.0 / max(sigma_depth * float(step_width), 0.0001);
+    const float inv_albedo  = 1.0 / max(sigma_albedo, 0.0001);
+
+    float3 sum_color = 0;
+    float  sum_weight = 0;
+    for (int dy = -2; dy <= 2; dy++)
+    {
+        for (int dx = -2; dx <= 2; dx++)
+        {
+            const int2 q = p + int2(dx, dy) * step_width;
+            if (any(q < 0) || any(q >= screen_size))
+                continue;
+            const float4 normal_depth_q = denoise_normal_depth.Load(int3(q, 0));
+            if (normal_depth_q.w <= 0)
+                continue;
+            const float3 albedo_q = denoise_albedo.Load(int3(q, 0)).rgb;
+            const float3 illum_q = LoadIllumination(q);
+
+            const float3 albedo_diff = abs(albedo_p - albedo_q);
+            const float exponent = abs(Luminance(illum_p) - Luminance(illum_q)) * lum_scale +
+                                   (1.0 - dot(normal_depth_p.xyz, normal_depth_q.xyz)) * sigma_normal +
+                                   abs(normal_depth_p.w - normal_depth_q.w) * inv_depth +
+                                   (albedo_diff.r + albedo_diff.g + albedo_diff.b) * inv_albedo;
+            const float weight = atrous_kernel[dx + 2] * atrous_kernel[dy + 2] * exp(-exponent);
+            sum_color  += illum_q * weight;
+            sum_weight += weight;
+        }
+    }
+    output.color.rgb = sum_color / sum_weight;
+    if (denoise_flags & DENOISE_FLAG_REMODULATE)
+        output.color.rgb *= max(albedo_p, ALBEDO_MIN);
+    return output;
+}
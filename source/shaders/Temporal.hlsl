@@ -0,0 +1,110 @@
+#include "GpuSharedData.h"
+
+//**************
+//VERTEX SHADER
+//**************
+
+struct VS_Output {
+    float4 position : SV_POSITION;
+};
+
+struct VS_Input {
+    float2 pos : POSITION;
+};
+
+VS_Output Vertex_Main(VS_Input input)
+{
+    VS_Output output;
+    output.position = float4(input.pos, 0, 1);
+    return output;
+}
+
+
+
+
+//**************
+//PIXEL SHADER
+//**************
+struct PS_Output {
+    float4 color    : SV_Target0;
+    //rgb: accumulated color, a: number of frames accumulated
+    float4 history  : SV_Target1;
+};
+
+Texture2D           current_color   TEXTURE_REGISTER(SLOT_TEMPORAL_CURRENT);
+Texture2D<float>    current_depth   TEXTURE_REGISTER(SLOT_TEMPORAL_DEPTH);
+Texture2D           history_color   TEXTURE_REGISTER(SLOT_TEMPORAL_HISTORY);
+Texture2D<float>    history_depth   TEXTURE_REGISTER(SLOT_TEMPORAL_HISTORY_DEPTH);
+
+static const float HISTORY_MIN_WEIGHT = 0.01;
+
+//Pixel position and depth buffer value back to view space
+float3 DepthToView(float2 pixel, float depth, float4x4 from_projection)
+{
+    const float2 ndc = float2(pixel.x / screen_size.x * 2 - 1, 1 - pixel.y / screen_size.y * 2);
+    const float4 view = mul(from_projection, float4(ndc, depth, 1));
+    return view.xyz / view.w;
+}
+
+PS_Output Pixel_Main(VS_Output input)
+{
+    PS_Output output;
+    const int2 p = int2(input.position.xy);
+    const float3 color = current_color.Load(int3(p, 0)).rgb;
+    const float depth = current_depth.Load(int3(p, 0));
+    output.color = float4(color, 1);
+    output.history = float4(color, 1);
+    //Background, nothing to reproject
+    if (depth >= 1)
+    {
+        output.history = 0;
+        return output;
+    }
+    if (!temporal_history_valid || temporal_max_history <= 1)
+        return output;
+
+    //Where this surface was on the screen last frame
+    const float3 view_p = DepthToView(input.position.xy, depth, view_from_projection);
+    const float4 world_p = mul(world_from_view, float4(view_p, 1));
+    const float3 previous_view_p = mul(previous_view_from_world, world_p).xyz;
+    const float4 previous_clip = mul(previous_projection_from_view, float4(previous_view_p, 1));
+    if (previous_clip.w <= 0)
+        return output;
+    const float2 previous_ndc = previous_clip.xy / previous_clip.w;
+    const float2 previous_pixel = float2(previous_ndc.x * 0.5 + 0.5, 0.5 - previous_ndc.y * 0.5) * screen_size;
+
+    //Bilinear history, taps whose depth does not match the reprojected surface were
+    //covering something else last frame (disocclusion) and are dropped
+    const float2 f = previous_pixel - 0.5;
+    const int2 base = int2(floor(f));
+    const float2 t = f - base;
+    float4 history = 0;
+    float sum_weight = 0;
+    [unroll]
+    for (int i = 0; i < 4; i++)
+    {
+        const int2 o = int2(i & 1, i >> 1);
+        const int2 q = base + o;
+        if (any(q < 0) || any(q >= screen_size))
+            continue;
+        const float q_depth = history_depth.Load(int3(q, 0));
+        if (q_depth >= 1)
+            continue;
+        const float3 q_view = DepthToView(float2(q) + 0.5, q_depth, previous_view_from_projection);
+        if (abs(q_view.z - previous_view_p.z) > TEMPORAL_DEPTH_TOLERANCE * abs(previous_view_p.z))
+            continue;
+        const float weight = (o.x ? t.x : 1 - t.x) * (o.y ? t.y : 1 - t.y);
+        history += history_color.Load(int3(q, 0)) * weight;
+        sum_weight += weight;
+    }
+    if (sum_weight < HISTORY_MIN_WEIGHT)
+        return output;
+    history /= sum_weight;
+
+    //Running average that turns into an exponential one after temporal_max_history frames
+    const float count = min(history.a + 1, float(temporal_max_history));
+    const float3 result = lerp(history.rgb, color, 1.0 / count);
+    output.color = float4(result, 1);
+    output.history = float4(result, count);
+    return output;
+}
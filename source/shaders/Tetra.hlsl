@@ -11,17 +11,40 @@ struct VS_Output {
 };
 
 struct VS_Input {
-    float4 color    : COLOR;
     float3 p        : POSITION;
     float3 n        : NORMAL;
+
+    //Per instance
+    float3 instance_p           : INSTANCE_POSITION;
+    float3 instance_scale       : INSTANCE_SCALE;
+    float4 instance_color       : INSTANCE_COLOR;
+    float4 instance_direction   : INSTANCE_DIRECTION;
 };
 
+//Columns are right, up and forward, forward is the direction of the tetrahedron
+float3x3 GetTetraBasis(float3 forward)
+{
+    float3 up = abs(forward.y) > 0.95 ? float3(0, 0, 1) : float3(0, 1, 0);
+    float3 right = normalize(cross(forward, up));
+    up = cross(forward, right);
+    return transpose(float3x3(right, up, forward));
+}
+
 VS_Output Vertex_Main(VS_Input input)
 {
     VS_Output output;
-    output.color = input.color;
-    output.p = mul(projection_from_view, mul(view_from_world, float4(input.p, 1.0)));
-    output.n = float4(input.n, 0.0).xyz;
+    float3x3 basis = GetTetraBasis(normalize(input.instance_direction.xyz * 2.0 - 1.0));
+
+    //The mesh tip points along +y, rotate it onto +z before turning it towards the direction.
+    //The normal goes through the inverse transpose of the scale
+    float3 p = input.p * input.instance_scale;
+    float3 n = input.n / max(input.instance_scale, 0.0001);
+    p = mul(basis, float3(p.x, -p.z, p.y));
+    n = mul(basis, float3(n.x, -n.z, n.y));
+
+    output.color = input.instance_color;
+    output.p = mul(projection_from_view, mul(view_from_world, float4(input.instance_p + p, 1.0)));
+    output.n = normalize(n);
 
     return output;
 }
@@ -0,0 +1,117 @@
+#include "GpuSharedData.h"
+
+//**************
+//VERTEX SHADER
+//**************
+
+struct VS_Output {
+    float4 position : SV_POSITION;
+};
+
+struct VS_Input {
+    float2 pos : POSITION;
+};
+
+VS_Output Vertex_Main(VS_Input input)
+{
+    VS_Output output;
+    output.position = float4(input.pos, 0, 1);
+    return output;
+}
+
+
+
+
+//**************
+//PIXEL SHADER
+//**************
+struct PS_Output {
+    float4 color : SV_Target;
+};
+
+//Reduced resolution trace, xyz of the normal_depth: world normal, w: distance from the camera (0 when nothing was hit)
+Texture2D   trace_color             TEXTURE_REGISTER(SLOT_TRACE_COLOR);
+Texture2D   trace_normal_depth      TEXTURE_REGISTER(SLOT_TRACE_NORMAL_DEPTH);
+//Full resolution first hit written by Voxel_Primary.hlsl
+Texture2D   guide_normal_depth      TEXTURE_REGISTER(SLOT_GUIDE_NORMAL_DEPTH);
+
+static const float FLT_MAX = 3.402823466e+38F;
+
+//Same weights as UpsampleTrace in CpuRenderer.cpp
+PS_Output Pixel_Main(VS_Output input)
+{
+    PS_Output output;
+    const int2 p = int2(input.position.xy);
+    const float4 guide = guide_normal_depth.Load(int3(p, 0));
+    //The background is already in the target
+    if (guide.w <= 0)
+        discard;
+
+    int2  candidates[4];
+    float spatial[4];
+    int   candidate_count = 0;
+    if (checkerboard_enabled)
+    {
+        if (uint(p.x & 1) == ((uint(p.y) + frame_index) & 1))
+        {
+            candidates[0] = int2(p.x >> 1, p.y);
+            spatial[0] = 1;
+            candidate_count = 1;
+        }
+        else
+        {
+            const int2 neighbours[4] = { int2(p.x - 1, p.y), int2(p.x + 1, p.y), int2(p.x, p.y - 1), int2(p.x, p.y + 1) };
+            [unroll]
+            for (int i = 0; i < 4; i++)
+            {
+                if (any(neighbours[i] < 0) || any(neighbours[i] >= screen_size))
+                    continue;
+                candidates[candidate_count] = int2(neighbours[i].x >> 1, neighbours[i].y);
+                spatial[candidate_count] = 1;
+                candidate_count++;
+            }
+        }
+    }
+    else
+    {
+        const float2 f = (float2(p) + 0.5) / trace_scale - 0.5;
+        const int2 base = int2(floor(f));
+        const float2 t = f - base;
+        [unroll]
+        for (int i = 0; i < 4; i++)
+        {
+            const int2 o = int2(i & 1, i >> 1);
+            candidates[i] = clamp(base + o, 0, trace_size - 1);
+            spatial[i] = (o.x ? t.x : 1 - t.x) * (o.y ? t.y : 1 - t.y);
+        }
+        candidate_count = 4;
+    }
+
+    float3 sum = 0;
+    float  sum_weight = 0;
+    float  closest = FLT_MAX;
+    float3 closest_color = 0;
+    for (int i = 0; i < candidate_count; i++)
+    {
+        const float4 sample_normal_depth = trace_normal_depth.Load(int3(candidates[i], 0));
+        if (sample_normal_depth.w <= 0)
+            continue;
+        const float3 sample_color = trace_color.Load(int3(candidates[i], 0)).rgb;
+        const float depth_difference = abs(sample_normal_depth.w - guide.w);
+        const float weight = spatial[i] *
+            exp(-depth_difference / (UPSAMPLE_DEPTH_SIGMA * guide.w)) *
+            pow(max(dot(sample_normal_depth.xyz, guide.xyz), 0), UPSAMPLE_NORMAL_POWER);
+        sum += sample_color * weight;
+        sum_weight += weight;
+        if (depth_difference < closest)
+        {
+            closest = depth_difference;
+            closest_color = sample_color;
+        }
+    }
+    //Nothing similar around, the closest surface is the best guess
+    if (closest == FLT_MAX)
+        discard;
+    output.color = float4(sum_weight > UPSAMPLE_MIN_WEIGHT ? sum / sum_weight : closest_color, 1);
+    return output;
+}
@@ -33,7 +33,10 @@ VS_Output Vertex_Main(VS_Input input)
 //PIXEL SHADER
 //**************
 struct PS_Output {
-    float4 color : SV_Target;
+    float4 color : SV_Target0;
+    //Denoiser feature buffers, xyz: normal w: distance from the camera
+    float4 normal_depth : SV_Target1;
+    float4 albedo : SV_Target2;
     float depth : SV_Depth;
 };
 
@@ -60,7 +63,14 @@ sampler     random_texture_sampler  SAMPLER_REGISTER(SLOT_RANDOM_TEXTURE_SAMPLER
 //    float metal;        //metalness
 //    uint color;
 //};
-StructuredBuffer<VoxMaterial> materials TEXTURE_REGISTER(SLOT_VOXEL_MATERIALS);
+StructuredBuffer<ShadingMaterial> materials TEXTURE_REGISTER(SLOT_VOXEL_MATERIALS);
+StructuredBuffer<EmissiveLight> emissive_lights TEXTURE_REGISTER(SLOT_EMISSIVE_LIGHTS);
+//See VoxelFaceTable in Lighting.h
+StructuredBuffer<uint> voxel_faces TEXTURE_REGISTER(SLOT_VOXEL_FACES);
+StructuredBuffer<float4> irradiance_cache TEXTURE_REGISTER(SLOT_IRRADIANCE_CACHE);
+StructuredBuffer<float> sun_visibility TEXTURE_REGISTER(SLOT_SUN_VISIBILITY);
+//4 faces per uint, see ComputeFaceAO in Vox.h
+StructuredBuffer<uint> voxel_face_ao TEXTURE_REGISTER(SLOT_VOXEL_FACE_AO);
 
 static const float FLT_INF     = 1.#INF;
 static const float FLT_MAX     = 3.402823466e+38F;
@@ -69,6 +79,8 @@ static const float FLT_EPSILON = 1.192092896e-07;
 static const float pi = 3.14159;
 static const float tau = 2 * pi;
 static const int MAX_MIPS = 6;
+//Upper limit for max_bounces, also used to offset random texture lookups per bounce
+static const int MAX_BOUNCES = 8;
 
 // Converts a color from sRGB gamma to linear light gamma
 float4 srgb_to_linear(float4 sRGB)
@@ -115,21 +127,82 @@ uint GetIndexFromGameVoxelPosition(const int3 p, const uint mip)
     return voxel_index;
 }
 
+//Already linear, converted when the materials are compiled
 float4 GetColorFromIndex(uint i)
 {
-    uint pack = materials[i].color;
-    float4 vc;
-    vc.a = float((pack & 0xFF000000) >> 24) / 255;
-    vc.b = float((pack & 0x00FF0000) >> 16) / 255;
-    vc.g = float((pack & 0x0000FF00) >>  8) / 255;
-    vc.r = float((pack & 0x000000FF)      ) / 255;
-    return srgb_to_linear(vc);
+    return float4(materials[i].albedo, 1);
 }
 float GetRoughnessFromIndex(uint rough_i)
 {
     float roughness = materials[rough_i].roughness;
     return roughness;
 }
+float3 GetEmissionFromIndex(uint i)
+{
+    return materials[i].emission;
+}
+
+uint FaceFromNormal(float3 n)
+{
+    if (n.x >  0.5) return 0;
+    if (n.x < -0.5) return 1;
+    if (n.y >  0.5) return 2;
+    if (n.y < -0.5) return 3;
+    if (n.z >  0.5) return 4;
+    return 5;
+}
+//Index into the per face buffers of the face that was hit, -1 when it is covered.
+//Same lookup as GetFaceIndex in Lighting.cpp
+int GetFaceIndex(float3 hit_p, float3 hit_normal)
+{
+    const int3 p = int3(floor(hit_p - hit_normal * 0.5));
+    if (any(p < 0) || any(p >= VOXEL_FACE_TABLE_SIZE))
+        return -1;
+    const uint entry = voxel_faces[(p.x * VOXEL_FACE_TABLE_SIZE + p.y) * VOXEL_FACE_TABLE_SIZE + p.z];
+    const uint face_bit = 1u << FaceFromNormal(hit_normal);
+    const uint face_mask = entry & 0x3F;
+    if (!(face_mask & face_bit))
+        return -1;
+    return int((entry >> 6) + countbits(face_mask & (face_bit - 1)));
+}
+//Diffuse indirect light arriving at the face that was hit, multiply by the albedo.
+float3 GetCachedIrradiance(float3 hit_p, float3 hit_normal)
+{
+    const int face_index = GetFaceIndex(hit_p, hit_normal);
+    if (face_index < 0)
+        return 0;
+    return irradiance_cache[face_index].rgb;
+}
+//Corner AO of the face that was hit interpolated to hit_p, 0 is open and 3 fully occluded
+float GetAmbientOcclusion(float3 hit_p, float3 hit_normal)
+{
+    const int face_index = GetFaceIndex(hit_p, hit_normal);
+    if (face_index < 0)
+        return 0;
+    const uint ao = (voxel_face_ao[uint(face_index) >> 2] >> ((uint(face_index) & 3) * 8)) & 0xFF;
+    const uint axis = FaceFromNormal(hit_normal) / 2;
+    const float3 local = hit_p - floor(hit_p - hit_normal * 0.5);
+    const float u = saturate(local[(axis + 1) % 3]);
+    const float v = saturate(local[(axis + 2) % 3]);
+    const float bottom  = lerp(float((ao >> 0) & 3), float((ao >> 2) & 3), u);
+    const float top     = lerp(float((ao >> 4) & 3), float((ao >> 6) & 3), u);
+    return lerp(bottom, top, v);
+}
+//Multiplier for the ambient terms
+float GetAmbientFactor(float3 hit_p, float3 hit_normal)
+{
+    if (!ambient_occlusion_enabled)
+        return 1;
+    return 1.0 - GetAmbientOcclusion(hit_p, hit_normal) * (0.75 / 3.0);
+}
+//Baked fraction of the face the sun can see
+float GetSunVisibility(float3 hit_p, float3 hit_normal)
+{
+    const int face_index = GetFaceIndex(hit_p, hit_normal);
+    if (face_index < 0)
+        return 0;
+    return sun_visibility[face_index];
+}
 
 void PixelToRay(out float3 ray_origin, out float3 ray_direction, float2 pixel)
 {
@@ -153,6 +226,15 @@ void PixelToRay(out float3 ray_origin, out float3 ray_direction, float2 pixel)
     ray_direction   = ray_world_n;
 }
 
+//Center of the screen pixel traced by this trace target pixel, same as TraceToScreenPixel in CpuRenderer.cpp
+float2 TraceToScreenPixel(float2 trace_pixel)
+{
+    const int2 p = int2(trace_pixel);
+    if (checkerboard_enabled)
+        return float2(p.x * 2 + ((uint(p.y) + frame_index) & 1), p.y) + 0.5;
+    return (float2(p) + 0.5) * trace_scale;
+}
+
 int3 float3ToVoxelPosition(const float3 p)
 {
     return int3(floor(p));
@@ -507,6 +589,78 @@ int RayVsVoxel(out uint      raycast_color_index,
     return loop_count;
 }
 
+//Same as RayVsVoxelCone in Raycast.cpp: stops at the first occupied mip cell that is
+//no smaller than the ray footprint and skips empty space at the coarsest empty level
+int RayVsVoxel_Cone(out uint      raycast_color_index,
+                    out float3    raycast_p,
+                    out float     raycast_distance_mag,
+                    out float3    raycast_normal,
+                    const float3    ray_origin,
+                    const float3    ray_direction,
+                    const float     cone_spread)
+{
+    raycast_color_index = 0;
+    raycast_p = 0;
+    raycast_normal = 0;
+    raycast_distance_mag = 0;
+    uint    aabb_raycast_color_index = 0;
+    float3  aabb_raycast_p = 0;
+    float   aabb_raycast_distance_mag = 0;
+    float3  aabb_raycast_normal = 0;
+    RayVsAABB(  aabb_raycast_color_index,
+                aabb_raycast_p,
+                aabb_raycast_distance_mag,
+                aabb_raycast_normal,
+                ray_origin,
+                ray_direction,
+                0,
+                float3(VOXEL_FACE_TABLE_SIZE, VOXEL_FACE_TABLE_SIZE, VOXEL_FACE_TABLE_SIZE));
+    if (aabb_raycast_color_index == 0)
+        return 0;
+
+    float t = aabb_raycast_distance_mag;
+    float3 normal = aabb_raycast_normal;
+    int loop_count = 0;
+    while (true)
+    {
+        loop_count++;
+        const int3 voxel_p = int3(floor(ray_origin + ray_direction * (t + 0.0005)));
+        if (any(voxel_p < 0) || any(voxel_p >= VOXEL_FACE_TABLE_SIZE))
+            break;
+
+        const float footprint = cone_spread * t;
+        int mip_level = footprint > 1 ? min(int(log2(footprint)), MAX_MIPS) : 0;
+        const uint index = GetIndexFromGameVoxelPosition(voxel_p, mip_level);
+        if (index != 0)
+        {
+            raycast_color_index = index;
+            raycast_p = ray_origin + ray_direction * t;
+            raycast_normal = normal;
+            raycast_distance_mag = t;
+            break;
+        }
+        while (mip_level < MAX_MIPS && GetIndexFromGameVoxelPosition(voxel_p, mip_level + 1) == 0)
+            mip_level++;
+
+        //Step to the exit of the empty cell
+        const float cell_size = float(1 << mip_level);
+        const float3 cell_min = float3((voxel_p >> mip_level) << mip_level);
+        const float3 boundary = cell_min + (ray_direction > 0 ? cell_size : 0);
+        float3 t_axis = (boundary - ray_origin) / ray_direction;
+        t_axis = ray_direction == 0 ? FLT_MAX : t_axis;
+        const float t_exit = min(t_axis.x, min(t_axis.y, t_axis.z));
+        normal = 0;
+        if (t_exit == t_axis.x)
+            normal.x = ray_direction.x > 0 ? -1 : 1;
+        else if (t_exit == t_axis.y)
+            normal.y = ray_direction.y > 0 ? -1 : 1;
+        else
+            normal.z = ray_direction.z > 0 ? -1 : 1;
+        t = max(t_exit, t);
+    }
+    return loop_count;
+}
+
 uint PCG_Random(uint state)
 {
     return uint((state ^ (state >> 11)) >> (11 + (state >> 30)));
@@ -524,6 +678,9 @@ float3 Random_Texture(int depth, int sample_index, int2 pixel_position)
     float pixels_scaled = float(pixel_position.y * screen_size.x + pixel_position.x);
     uint i = uint(depth_scaled + index_scaled + pixels_scaled);
             /*(total_time * 10) + */
+    //New samples every frame while they are being accumulated, cycles so the index stays exact as a float
+    if (temporal_max_history > 1)
+        i += (frame_index % 64) * 7919;
     float2 p;
     float2 size = float2(random_texture_size.xy);
     float index = float(i);
@@ -537,6 +694,96 @@ float3 Random_Texture(int depth, int sample_index, int2 pixel_position)
     return color.rgb;
 }
 
+//Russian roulette: once a path is past russian_roulette_depth it survives with a
+//probability equal to its strongest throughput channel and is reweighted by 1/p,
+//so dim paths stop early without biasing the estimate.
+bool RussianRoulette(inout float3 throughput, int bounce, int sample_index, int2 pixel_position)
+{
+    if (bounce < int(russian_roulette_depth))
+        return true;
+    const float survive = clamp(max(throughput.r, max(throughput.g, throughput.b)), 0.05, 1.0);
+    const float random = Random_Texture(bounce + 2 * MAX_BOUNCES, sample_index, pixel_position).x;
+    if (random >= survive)
+        return false;
+    throughput /= survive;
+    return true;
+}
+
+//Next event estimation: picks one emissive voxel with the alias table,
+//a point on one of its uncovered faces and traces a shadow ray to it.
+//Returns the incoming radiance over pi, multiply by the albedo for the diffuse response.
+float3 SampleEmissiveLights(const float3 p, const float3 n, const float3 random)
+{
+    if (emissive_light_count == 0)
+        return 0;
+
+    const float3 normals[6] = {
+        float3(  1.0,  0.0,  0.0 ),
+        float3( -1.0,  0.0,  0.0 ),
+        float3(  0.0,  1.0,  0.0 ),
+        float3(  0.0, -1.0,  0.0 ),
+        float3(  0.0,  0.0,  1.0 ),
+        float3(  0.0,  0.0, -1.0 ),
+    };
+
+    //Alias table lookup
+    float column = random.x * float(emissive_light_count);
+    uint light_i = min(uint(column), emissive_light_count - 1);
+    if (frac(column) >= emissive_lights[light_i].probability)
+        light_i = emissive_lights[light_i].alias;
+    const EmissiveLight light = emissive_lights[light_i];
+
+    //Pick one of the uncovered faces, every face has an area of 1
+    uint face_count = countbits(light.face_mask);
+    uint face_n = min(uint(random.y * float(face_count)), face_count - 1);
+    uint face = 0;
+    for (uint f = 0; f < 6; f++)
+    {
+        if (light.face_mask & (1u << f))
+        {
+            if (face_n == 0)
+            {
+                face = f;
+                break;
+            }
+            face_n--;
+        }
+    }
+    const float3 light_n = normals[face];
+    const uint axis = face / 2;
+    const float3 t0 = axis == 0 ? float3(0, 1, 0) : float3(1, 0, 0);
+    const float3 t1 = axis == 2 ? float3(0, 1, 0) : float3(0, 0, 1);
+    const float2 uv = frac(random.yz * float2(float(face_count), 7.0)) - 0.5;
+    const float3 light_p = float3(light.p) + 0.5 + light_n * 0.5 + t0 * uv.x + t1 * uv.y;
+
+    float3 to_light = light_p - p;
+    const float dist_sq = dot(to_light, to_light);
+    to_light = to_light * rsqrt(dist_sq);
+    const float cos_surface = dot(n, to_light);
+    const float cos_light = dot(light_n, -to_light);
+    if (cos_surface <= 0 || cos_light <= 0)
+        return 0;
+
+    uint    shadow_color_index;
+    float3  shadow_p;
+    float   shadow_distance_mag;
+    float3  shadow_normal;
+    RayVsVoxel(shadow_color_index,
+            shadow_p,
+            shadow_distance_mag,
+            shadow_normal,
+            p + n * 0.001,
+            to_light);
+    if (shadow_color_index == 0)
+        return 0;
+    const int3 shadow_voxel = int3(floor(shadow_p - shadow_normal * 0.5));
+    if (any(shadow_voxel != light.p))
+        return 0;
+
+    //Clamp the distance so lights touching the surface don't blow up
+    return light.radiance * (cos_surface * cos_light * light.area / (max(dist_sq, 0.25) * light.pdf * pi));
+}
+
 //    float3 emittance;
 //    float3 inner;
 //    Ray next_ray;
@@ -631,10 +878,18 @@ PS_Output Pixel_Main(VS_Output input)
 {
     PS_Output output;
     output.color = 0;
+    output.normal_depth = 0;
+    output.albedo = 0;
     output.depth = 0;
     float3 ray_origin;
     float3 ray_direction;
-    PixelToRay(ray_origin, ray_direction, input.position.xy);
+#if VOXEL_PRIMARY_ONLY
+    //Full resolution guide of the upsample, see Voxel_Primary.hlsl
+    const float2 pixel = input.position.xy;
+#else
+    const float2 pixel = TraceToScreenPixel(input.position.xy);
+#endif
+    PixelToRay(ray_origin, ray_direction, pixel);
 
 #if RAY_METHOD == RAY_BASIC
 //use basic single ray hit
@@ -865,7 +1120,6 @@ struct PointColor {
 #elif RAY_METHOD == RAY_LIGHT_DIR_DOT
 
 #define ENABLE_SHADOWS 1
-#define RAY_BOUNCES 2
 #define RAY_SAMPLES 3
 
     //uint voxel_index = voxel_indices.Load(int4(0, 0, 0, 1));
@@ -874,8 +1128,8 @@ struct PointColor {
     //output.color = color_;
     //return output;
 
+    //sun_position comes from CB_Common, Lighting.h bakes the cache with the same sun and sky
     const float3 background_color   = srgb_to_linear(float4(0.263, 0.706, 0.965, 1)).rgb;
-    const float3 sun_position       = float3(0, 50, 50);
     const float3 sun_color          = srgb_to_linear(float4(0.8, 0.8, 0.8, 1)).rgb;
     const float3 ambient_color      = 0.1;
     const float  roughness          = 0.1;
@@ -886,7 +1140,8 @@ struct PointColor {
     output.color.a = 1;
     float4 bounce_color = output.color;
     float4 sample_color = output.color;
-    float bounce_color_strength = 1;
+    float3 throughput = 1;
+    const int max_depth = min(int(max_bounces), MAX_BOUNCES);
     float3 next_ray_origin = ray_origin;
     float3 next_ray_direction = ray_direction;
 
@@ -894,12 +1149,31 @@ struct PointColor {
     float3  start_hit_voxel_p;
     float   start_hit_voxel_distance_mag;
     float3  start_hit_voxel_normal;
-    RayVsVoxel(start_hit_voxel_color_index,
-            start_hit_voxel_p,
-            start_hit_voxel_distance_mag,
-            start_hit_voxel_normal,
-            next_ray_origin,
-            next_ray_direction);
+    //A traced pixel covers trace_scale screen pixels, the primary pass runs at screen resolution
+#if VOXEL_PRIMARY_ONLY
+    const float cone_spread = lod_cone_spread;
+#else
+    const float cone_spread = lod_cone_spread * trace_scale;
+#endif
+    if (cone_spread > 0)
+    {
+        RayVsVoxel_Cone(start_hit_voxel_color_index,
+                start_hit_voxel_p,
+                start_hit_voxel_distance_mag,
+                start_hit_voxel_normal,
+                next_ray_origin,
+                next_ray_direction,
+                cone_spread);
+    }
+    else
+    {
+        RayVsVoxel(start_hit_voxel_color_index,
+                start_hit_voxel_p,
+                start_hit_voxel_distance_mag,
+                start_hit_voxel_normal,
+                next_ray_origin,
+                next_ray_direction);
+    }
 //Show loop count
 #if 0
     int loop_count_first = RayVsVoxel(start_hit_voxel_color_index,
@@ -922,7 +1196,12 @@ struct PointColor {
     {
         float4 projected_p = mul(projection_from_view, mul(view_from_world, float4(start_hit_voxel_p, 1)));
         output.depth = projected_p.z / projected_p.w;
+        output.normal_depth = float4(start_hit_voxel_normal, distance(ray_origin, start_hit_voxel_p));
+        output.albedo = float4(GetColorFromIndex(start_hit_voxel_color_index).rgb, 1);
     }
+#if VOXEL_PRIMARY_ONLY
+    return output;
+#endif
 
 
 #if RAY_SAMPLES > 1
@@ -936,35 +1215,21 @@ struct PointColor {
         float   hit_voxel_distance_mag = start_hit_voxel_distance_mag;
         float3  hit_voxel_normal = start_hit_voxel_normal;
 
-#if RAY_BOUNCES > 1
-        for (int j = 0; j < RAY_BOUNCES; j++)
-#else
-            int j = 0;
-#endif
+        [loop]
+        for (int j = 0; j < max_depth; j++)
         {
             if (hit_voxel_color_index == 0)
             {
-                bounce_color.rgb += background_color * (bounce_color_strength * 0.5);
+                bounce_color.rgb += background_color * (throughput * 0.5);
                 break;
             }
-            //get color from ray from sun
-            sun_ray_direction = normalize(hit_voxel_p - sun_position);
-            uint    sun_hit_voxel_color_index;
-            float3  sun_hit_voxel_p;
-            float   sun_hit_voxel_distance_mag;
-            float3  sun_hit_voxel_normal;
-            RayVsVoxel(sun_hit_voxel_color_index,
-                sun_hit_voxel_p,
-                sun_hit_voxel_distance_mag,
-                sun_hit_voxel_normal,
-                sun_ray_origin,
-                sun_ray_direction);
-
-            float3 difference = abs(hit_voxel_p - sun_hit_voxel_p);
+            //Later bounces pick up emitters through the light sampling below
+            if (j == 0)
+                bounce_color.rgb += GetEmissionFromIndex(hit_voxel_color_index);
             float3 dir_to_sun = normalize(sun_position - hit_voxel_p);
 
 #if 1
-            float3 random_float3 = Random_Texture(j, i, input.position.xy);
+            float3 random_float3 = Random_Texture(j, i, pixel);
             if (dot(random_float3, hit_voxel_normal) < 0)
             {
                 random_float3 = -random_float3;
@@ -991,19 +1256,54 @@ struct PointColor {
 #endif
             float light_amount = dot(dir_to_sun, shifted_normal);
             light_amount = max(light_amount, 0);
+            const float ambient_factor = GetAmbientFactor(hit_voxel_p, hit_voxel_normal);
+            const float ambient_amount = 0.1 * ambient_factor;
 
 #if ENABLE_SHADOWS
-            if (difference.x > 0.001 &&
-                    difference.y > 0.001 &&
-                    difference.z > 0.001)
+            if (sun_visibility_enabled)
+            {
+                light_amount = lerp(ambient_amount, light_amount, GetSunVisibility(hit_voxel_p, hit_voxel_normal));
+            }
+            else
             {
-                light_amount = 0.1;
+                //get color from ray from sun
+                sun_ray_direction = normalize(hit_voxel_p - sun_position);
+                uint    sun_hit_voxel_color_index;
+                float3  sun_hit_voxel_p;
+                float   sun_hit_voxel_distance_mag;
+                float3  sun_hit_voxel_normal;
+                RayVsVoxel(sun_hit_voxel_color_index,
+                    sun_hit_voxel_p,
+                    sun_hit_voxel_distance_mag,
+                    sun_hit_voxel_normal,
+                    sun_ray_origin,
+                    sun_ray_direction);
+
+                float3 difference = abs(hit_voxel_p - sun_hit_voxel_p);
+                if (difference.x > 0.001 &&
+                        difference.y > 0.001 &&
+                        difference.z > 0.001)
+                {
+                    light_amount = ambient_amount;
+                }
             }
 #endif
 
             const float4 hit_color = GetColorFromIndex(hit_voxel_color_index);
-            bounce_color.rgb += hit_color.rgb * sun_color * light_amount * bounce_color_strength;
-            bounce_color_strength = bounce_color_strength * 0.25;
+            bounce_color.rgb += hit_color.rgb * sun_color * light_amount * throughput;
+            if (irradiance_cache_enabled)
+            {
+                //The cache already holds the emitters and all further bounces
+                bounce_color.rgb += hit_color.rgb * GetCachedIrradiance(hit_voxel_p, hit_voxel_normal) * (throughput * ambient_factor);
+                break;
+            }
+            const float3 light_random = Random_Texture(j + MAX_BOUNCES, i, pixel);
+            bounce_color.rgb += hit_color.rgb * SampleEmissiveLights(hit_voxel_p, hit_voxel_normal, light_random) * throughput;
+
+            //Everything further down the path is reflected off this surface
+            throughput *= hit_color.rgb;
+            if (j + 1 >= max_depth || !RussianRoulette(throughput, j, i, pixel))
+                break;
 
             next_ray_direction = reflect(next_ray_direction, shifted_normal);
             next_ray_origin      = hit_voxel_p + next_ray_direction * 0.00001;
@@ -1016,7 +1316,7 @@ struct PointColor {
         }
         sample_color.rgb += bounce_color.rgb;
         bounce_color.rgb = 0;
-        bounce_color_strength = 1;
+        throughput = 1;
         next_ray_origin = ray_origin;
         next_ray_direction = ray_direction;
     }
@@ -1026,65 +1326,50 @@ struct PointColor {
 #elif RAY_METHOD == RAY_PATH_TRACING
 
     const int samples   = 3;
-    const int max_depth = 3;
+    const int max_depth = min(int(max_bounces), MAX_BOUNCES);
 
     float4 _color = float4(0, 0, 0, 1);
-
-    float3  results_emittance[max_depth];
-    float3  results_inner[max_depth];
-    float3  results_next_ray_origin[max_depth];
-    float3  results_next_ray_direction[max_depth];
-    bool    results_valid[max_depth];
-
     for (int i = 0; i < samples; i++)
     {
+        float3 throughput = 1;
+        float3 path_origin = ray_origin;
+        float3 path_direction = ray_direction;
+        [loop]
         for (int j = 0; j < max_depth; j++)
         {
-            if (j == 0)
+            float3  emittance;
+            float3  inner;
+            float3  next_ray_origin;
+            float3  next_ray_direction;
+            bool    valid;
+            PathTracing(emittance,
+                        inner,
+                        next_ray_origin,
+                        next_ray_direction,
+                        valid,
+                        path_origin,
+                        path_direction,
+                        j,
+                        max_depth,
+                        i,
+                        pixel);
+
+            if (!valid)
             {
-                PathTracing(results_emittance[j],
-                            results_inner[j],
-                            results_next_ray_origin[j],
-                            results_next_ray_direction[j],
-                            results_valid[j],
-                            ray_origin,
-                            ray_direction,
-                            0,
-                            max_depth,
-                            i,
-                            input.position.xy);
-
-                if (!results_valid[j])
+                if (j == 0)
                     discard;
+                break;
             }
-            else
-            {
-                PathTracing(results_emittance[j],
-                            results_inner[j],
-                            results_next_ray_origin[j],
-                            results_next_ray_direction[j],
-                            results_valid[j],
-                            results_next_ray_origin[j - 1],
-                            results_next_ray_direction[j - 1],
-                            0,
-                            max_depth,
-                            i,
-                            input.position.xy);
-
-                if (!results_valid[j])
-                    break;
-            }
-        }
-
-        float3 temp_color = 0;
-        for (int j = max_depth - 1; j >= 0; j--)
-        {
-            temp_color = results_emitance[j]+ (results_inner[j] * temp_color);
+            _color.rgb += throughput * emittance;
+            throughput *= inner;
+            if (!RussianRoulette(throughput, j, i, pixel))
+                break;
+            path_origin = next_ray_origin;
+            path_direction = next_ray_direction;
         }
-        _color.rgb += temp_color;
     }
     _color.rgb /= samples;  // Average samples.
-    color = _color;
+    output.color = _color;
 
 
     //PathTracingResult r;
@@ -0,0 +1,4 @@
+//Full resolution first hit only: writes the depth and the normal_depth/albedo features
+//the upsample and the denoiser are guided by, the lighting is traced at trace_size by Voxel.hlsl
+#define VOXEL_PRIMARY_ONLY 1
+#include "Voxel.hlsl"
@@ -0,0 +1,75 @@
+#include "GpuSharedData.h"
+
+//**************
+//VERTEX SHADER
+//**************
+
+StructuredBuffer<ShadingMaterial> materials TEXTURE_REGISTER(SLOT_VOXEL_MATERIALS);
+
+static const float3 world_face_normals[6] = {
+    float3(  1.0,  0.0,  0.0 ),
+    float3( -1.0,  0.0,  0.0 ),
+    float3(  0.0,  1.0,  0.0 ),
+    float3(  0.0, -1.0,  0.0 ),
+    float3(  0.0,  0.0,  1.0 ),
+    float3(  0.0,  0.0, -1.0 ),
+};
+
+struct VS_Output {
+    float4 position : SV_POSITION;
+    float3 world_p  : POSITION;
+    float3 normal   : NORMAL;
+    float3 color    : COLOR;
+    float  ao       : AO;
+};
+
+//Vertex_VoxelPacked in Vox.h
+struct VS_Input {
+    uint position   : POSITION;     //x, y and z of the lattice point, 10 bits each
+    uint attributes : ATTRIBUTES;   //Bits 0-2 normal, 3-4 AO, 8-15 palette index
+};
+
+VS_Output Vertex_Main(VS_Input input)
+{
+    VS_Output output;
+    float3 p;
+    p.x = float((input.position      ) & 0x3FF);
+    p.y = float((input.position >> 10) & 0x3FF);
+    p.z = float((input.position >> 20) & 0x3FF);
+    const uint n           = (input.attributes     ) & 0x7;
+    const uint color_index = (input.attributes >> 8) & 0xFF;
+
+    output.position = mul(projection_from_view, mul(view_from_world, float4(p, 1.0)));
+    output.world_p = p;
+    output.normal = world_face_normals[n];
+    output.color = materials[color_index].albedo;
+    output.ao = float((input.attributes >> 3) & 0x3);
+    return output;
+}
+
+
+
+
+
+//**************
+//PIXEL SHADER
+//**************
+
+struct PS_Output {
+    float4 color : SV_Target;
+};
+
+PS_Output Pixel_Main(VS_Output input)
+{
+    PS_Output output;
+
+    //Corners touched by more solid voxels get darker
+    float ao = saturate(min(input.ao, 2.0) / 3.0);
+    ao = ao * ao * ao;
+    //No shadows or bounces, the sun only shapes the faces
+    const float sun = saturate(dot(input.normal, normalize(sun_position - input.world_p)));
+
+    output.color.rgb = max(1.0 - ao, 0.01) * (0.25 + 0.75 * sun) * input.color;
+    output.color.a = 1.0;
+    return output;
+}